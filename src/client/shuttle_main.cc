@@ -1,5 +1,7 @@
 #include <string>
 #include <vector>
+#include <set>
+#include <map>
 #include <algorithm>
 #include <boost/lexical_cast.hpp>
 #include <boost/algorithm/string.hpp>
@@ -33,6 +35,8 @@ std::vector<std::string> cmdenvs;
 
 bool display_all = false;
 bool immediate_return = false;
+bool prometheus = false;
+std::string metric_prefix;
 
 std::string job_name = "map_reduce_job";
 ::baidu::shuttle::sdk::JobPriority job_priority = \
@@ -74,6 +78,14 @@ int ignore_reduce_failures = 0;
 bool decompress_input = false;
 std::string combine = "";
 bool compress_output = false;
+int partition_total = 0;
+int64_t reduce_target_size = 0;
+bool reduce_associative = false;
+std::string key_comparator_options;
+bool hash_aggregation = false;
+bool shm_transport = false;
+std::string plugin;
+bool plugin_isolation = false;
 }
 
 const std::string error_message = "shuttle client - A fast computing framework base on Galaxy\n"
@@ -84,10 +96,14 @@ const std::string error_message = "shuttle client - A fast computing framework b
         "\tshuttle list\n"
         "\tshuttle status <jobid>\n"
         "\tshuttle monitor <jobid>\n"
+        "\tshuttle trace <jobid> > trace.json\tTimeline for chrome://tracing or Perfetto\n"
+        "\tshuttle metrics [<minion endpoint>]\n"
         "Options:\n"
         "\t-h  --help\t\t\tShow this information\n"
         "\t-a  --all\t\t\tConsider finished and dead jobs in status and list operation\n"
         "\t-i  --immediate\tStop monitoring the state of submitted job and return immediately\n"
+        "\t-prometheus\t\t\tPrint metrics in the text format of Prometheus\n"
+        "\t-prefix <name>\t\t\tOnly print metrics whose names start with it\n"
         "\t-input <file>\t\t\tSpecify the input file, using a hdfs path\n"
         "\t-output <path>\t\t\tSpecify the output path, which must be empty\n"
         "\t-file <file>[,...]\t\tSpecify the files needed by your program\n"
@@ -186,6 +202,9 @@ ParsePartitioner(const std::string& partitioner) {
     } else if (boost::iequals(partitioner, "inthash") ||
             boost::iequals(partitioner, "inthashpartitioner")) {
         return ::baidu::shuttle::sdk::kIntHash;
+    } else if (boost::iequals(partitioner, "range") ||
+            boost::iequals(partitioner, "rangepartitioner")) {
+        return ::baidu::shuttle::sdk::kRange;
     }
     return ::baidu::shuttle::sdk::kKeyFieldBased;
 }
@@ -318,6 +337,13 @@ static int ParseCommandLineFlags(int* argc, char***argv) {
             opt[i] = NULL;
             ++ ret;
             continue;
+        } else if (!strcmp(ctx, "prometheus")) {
+            config::prometheus = true;
+            opt[i] = NULL;
+            ++ ret;
+            continue;
+        } else if (!strcmp(ctx, "prefix")) {
+            config::metric_prefix = opt[++i];
         } else if (!strcmp(ctx, "help") || !strcmp(ctx, "h")) {
             fprintf(stderr, "%s\n", error_message.c_str());
             exit(0);
@@ -391,6 +417,81 @@ static inline int64_t ParseMemory(const std::string& memory) {
     return base;
 }
 
+// Option flags of a -k spec or global ones, e.g. "nr"
+static bool ParseKeyOrderFlags(const std::string& flags,
+                               ::baidu::shuttle::sdk::KeyFieldOrder* order) {
+    for (size_t i = 0; i < flags.size(); i++) {
+        switch (flags[i]) {
+        case 'n': order->numeric = true; break;
+        case 'r': order->reverse = true; break;
+        case 'f': order->ignore_case = true; break;
+        default: return false;
+        }
+    }
+    return true;
+}
+
+// Leading field number of a -k position, character offsets are not supported
+static bool ParseKeyPosition(const std::string& pos, int32_t* field,
+                             ::baidu::shuttle::sdk::KeyFieldOrder* order) {
+    size_t digits = pos.find_first_not_of("0123456789");
+    if (digits == 0) {
+        return false;
+    }
+    *field = boost::lexical_cast<int32_t>(pos.substr(0, digits));
+    return *field > 0 && (digits == std::string::npos ||
+                          ParseKeyOrderFlags(pos.substr(digits), order));
+}
+
+// Options of KeyFieldBasedComparator, e.g. "-k2,2nr -k1,1f"
+static bool ParseKeyComparatorOptions(const std::string& options,
+        std::vector< ::baidu::shuttle::sdk::KeyFieldOrder >* orders) {
+    std::vector<std::string> tokens;
+    boost::split(tokens, options, boost::is_any_of(" "), boost::token_compress_on);
+    ::baidu::shuttle::sdk::KeyFieldOrder global;
+    std::vector<bool> has_flags;
+    for (size_t i = 0; i < tokens.size(); i++) {
+        const std::string& token = tokens[i];
+        if (token.empty()) {
+            continue;
+        }
+        if (token.size() < 2 || token[0] != '-') {
+            return false;
+        }
+        if (token[1] != 'k') {
+            if (!ParseKeyOrderFlags(token.substr(1), &global)) {
+                return false;
+            }
+            continue;
+        }
+        ::baidu::shuttle::sdk::KeyFieldOrder order;
+        std::string spec = token.substr(2);
+        size_t comma = spec.find(',');
+        if (!ParseKeyPosition(spec.substr(0, comma), &order.field_begin, &order)) {
+            return false;
+        }
+        if (comma != std::string::npos &&
+                !ParseKeyPosition(spec.substr(comma + 1), &order.field_end, &order)) {
+            return false;
+        }
+        has_flags.push_back(order.numeric || order.reverse || order.ignore_case);
+        orders->push_back(order);
+    }
+    // Global flags apply to specs without their own, or the whole key
+    if (orders->empty() && (global.numeric || global.reverse || global.ignore_case)) {
+        orders->push_back(global);
+        return true;
+    }
+    for (size_t i = 0; i < orders->size(); i++) {
+        if (!has_flags[i]) {
+            (*orders)[i].numeric = global.numeric;
+            (*orders)[i].reverse = global.reverse;
+            (*orders)[i].ignore_case = global.ignore_case;
+        }
+    }
+    return true;
+}
+
 static void ParseJobConfig() {
     std::vector<std::string> opts;
     boost::split(opts, config::jobconf, boost::is_any_of(","));
@@ -471,6 +572,29 @@ static void ParseJobConfig() {
         } else if(boost::starts_with(*it, "mapred.output.compress=")) {
             config::compress_output = 
                ParseBooleanValue(it->substr(strlen("mapred.output.compress=")));
+        } else if(boost::starts_with(*it, "mapred.reduce.partitions=")) {
+            config::partition_total =
+               boost::lexical_cast<int>(it->substr(strlen("mapred.reduce.partitions=")));
+        } else if(boost::starts_with(*it, "mapred.reduce.target.size=")) {
+            config::reduce_target_size =
+               ParseMemory(it->substr(strlen("mapred.reduce.target.size=")));
+        } else if(boost::starts_with(*it, "mapred.reducer.associative=")) {
+            config::reduce_associative =
+               ParseBooleanValue(it->substr(strlen("mapred.reducer.associative=")));
+        } else if(boost::starts_with(*it, "mapred.text.key.comparator.options=")) {
+            config::key_comparator_options =
+               it->substr(strlen("mapred.text.key.comparator.options="));
+        } else if(boost::starts_with(*it, "mapred.reduce.hash.aggregation=")) {
+            config::hash_aggregation =
+               ParseBooleanValue(it->substr(strlen("mapred.reduce.hash.aggregation=")));
+        } else if(boost::starts_with(*it, "mapred.shm.transport=")) {
+            config::shm_transport =
+               ParseBooleanValue(it->substr(strlen("mapred.shm.transport=")));
+        } else if(boost::starts_with(*it, "mapred.native.plugin=")) {
+            config::plugin = it->substr(strlen("mapred.native.plugin="));
+        } else if(boost::starts_with(*it, "mapred.native.plugin.isolation=")) {
+            config::plugin_isolation =
+               ParseBooleanValue(it->substr(strlen("mapred.native.plugin.isolation=")));
         }
     }
 }
@@ -525,6 +649,37 @@ static inline std::string FormatCostTime(const uint32_t& time) {
     return ss.str();
 }
 
+static std::string FormatBytes(int64_t bytes) {
+    const char* units[] = {"B", "K", "M", "G", "T"};
+    double size = bytes;
+    size_t unit = 0;
+    while (size >= 1024 && unit + 1 < sizeof(units) / sizeof(units[0])) {
+        size /= 1024;
+        unit++;
+    }
+    char buf[32];
+    snprintf(buf, sizeof(buf), unit == 0 ? "%.0f%s" : "%.1f%s", size, units[unit]);
+    return buf;
+}
+
+static std::vector<std::string> UsageRow(const char* phase,
+                                         const ::baidu::shuttle::sdk::TaskUsage& usage) {
+    std::vector<std::string> row;
+    row.push_back(phase);
+    row.push_back(boost::lexical_cast<std::string>(usage.attempts));
+    int64_t cpu_ms = usage.user_time_ms + usage.sys_time_ms;
+    row.push_back(boost::lexical_cast<std::string>(
+            usage.attempts > 0 ? cpu_ms / usage.attempts / 1000 : 0) + "s");
+    row.push_back(FormatBytes(usage.max_rss_kb * 1024));
+    row.push_back(FormatBytes(usage.dfs_read_bytes) + "/" + FormatBytes(usage.dfs_write_bytes));
+    row.push_back(FormatBytes(usage.local_read_bytes) + "/"
+                  + FormatBytes(usage.local_write_bytes));
+    row.push_back(FormatBytes(usage.pipe_in_bytes) + "/" + FormatBytes(usage.pipe_out_bytes));
+    row.push_back(boost::lexical_cast<std::string>(usage.pipe_in_wait_ms / 1000) + "s/"
+                  + boost::lexical_cast<std::string>(usage.pipe_out_wait_ms / 1000) + "s");
+    return row;
+}
+
 static void PrintJobDetails(const ::baidu::shuttle::sdk::JobInstance& job) {
     printf("Job Name: %s\n", job.desc.name.c_str());
     printf("Job ID: %s\n", job.jobid.c_str());
@@ -555,6 +710,20 @@ static void PrintJobDetails(const ::baidu::shuttle::sdk::JobInstance& job) {
               boost::lexical_cast<std::string>(job.reduce_stat.killed).c_str(),
               boost::lexical_cast<std::string>(job.reduce_stat.completed).c_str());
     printf("%s\n", tp.ToString().c_str());
+    if (job.map_usage.attempts + job.reduce_usage.attempts == 0) {
+        return;
+    }
+    // Bytes are totals of the phase, r/w and in/out
+    ::baidu::shuttle::TPrinter usage_tp(8);
+    usage_tp.AddRow(8, "Usage", "attempts", "cpu/attempt", "max rss", "dfs r/w",
+                    "local r/w", "pipe in/out", "pipe wait");
+    if (job.map_usage.attempts > 0) {
+        usage_tp.AddRow(UsageRow("Map", job.map_usage));
+    }
+    if (job.reduce_usage.attempts > 0) {
+        usage_tp.AddRow(UsageRow("Reduce", job.reduce_usage));
+    }
+    printf("%s\n", usage_tp.ToString().c_str());
 }
 
 static void PrintJobPrediction(const ::baidu::shuttle::sdk::JobInstance& job,
@@ -652,6 +821,52 @@ static void PrintJobsInfo(std::vector< ::baidu::shuttle::sdk::JobInstance >& job
     printf("%s\n", tp.ToString().c_str());
 }
 
+typedef std::set< ::baidu::shuttle::sdk::TaskInstance, TaskComparator > TaskTable;
+
+static const int32_t sTaskPageSize = 5000;
+
+// Fetch tasks changed since the version page by page and merge them into the table,
+// which is refilled from scratch once the epoch of the job changes
+static bool SyncJobTasks(::baidu::shuttle::Shuttle* shuttle, bool display_all,
+                         ::baidu::shuttle::sdk::JobInstance& job,
+                         std::string& error_msg,
+                         std::map<std::string, int64_t>& counters,
+                         TaskTable& table, int64_t& version, int64_t& epoch) {
+    ::baidu::shuttle::sdk::TaskFilter filter;
+    filter.since_version = version;
+    filter.since_epoch = epoch;
+    filter.limit = sTaskPageSize;
+    int64_t latest = version;
+    int32_t next_offset = 0;
+    do {
+        std::vector< ::baidu::shuttle::sdk::TaskInstance > tasks;
+        int64_t page_version = 0;
+        int64_t page_epoch = 0;
+        filter.offset = next_offset;
+        bool ok = shuttle->ShowJob(config::params[0], filter, display_all, true, job, tasks,
+                                   error_msg, counters, next_offset, page_version, page_epoch);
+        if (!ok) {
+            return false;
+        }
+        if (filter.offset == 0) {
+            latest = page_version;
+            if (page_epoch != epoch) {
+                table.clear();
+                epoch = page_epoch;
+                filter.since_version = 0;
+                filter.since_epoch = epoch;
+            }
+        }
+        for (std::vector< ::baidu::shuttle::sdk::TaskInstance >::iterator it = tasks.begin();
+                it != tasks.end(); ++it) {
+            table.erase(*it);
+            table.insert(*it);
+        }
+    } while (next_offset >= 0);
+    version = latest;
+    return true;
+}
+
 static int MonitorJob() {
     std::string master_endpoint = GetMasterAddr();
     if (master_endpoint.empty()) {
@@ -672,15 +887,15 @@ static int MonitorJob() {
     if (!is_tty) {
         monitor_interval = 20;
     }
-    bool display_all_attemp = false;
     while (true) {
         ::baidu::shuttle::sdk::JobInstance job;
-        std::vector< ::baidu::shuttle::sdk::TaskInstance > tasks;
         const std::string timestamp = FromatLongTime(time(NULL));
         std::string error_msg;
         std::map<std::string, int64_t> counters;
-        bool ok = shuttle->ShowJob(config::params[0], job, tasks, 
-                                   true, display_all_attemp, error_msg, counters);
+        // Polls ask for the job only, tasks are fetched once they are shown
+        std::vector< ::baidu::shuttle::sdk::TaskInstance > tasks;
+        bool ok = shuttle->ShowJob(config::params[0], job, tasks, true, false,
+                                   error_msg, counters);
         if (!ok) {
             fprintf(stderr, "lost connection with master\n");
             if (error_tolerance-- <= 0) {
@@ -714,10 +929,6 @@ static int MonitorJob() {
             fflush(stdout);
             break;
         case ::baidu::shuttle::sdk::kCompleted:
-            if (!display_all_attemp) {
-                display_all_attemp = true;
-                break;
-            }
             if (is_tty) {
                 printf("\r%s", erase);
                 printf("\r[%s] job is running, map: %d/%d, %d running; reduce: %d/%d, %d running\n",
@@ -731,7 +942,16 @@ static int MonitorJob() {
                         job.reduce_stat.completed, job.reduce_stat.total, job.reduce_stat.running);
             }
             fflush(stdout);
-            PrintJobPrediction(job, tasks);
+            {
+                TaskTable table;
+                int64_t version = 0;
+                int64_t epoch = 0;
+                if (SyncJobTasks(shuttle, true, job, error_msg, counters,
+                                 table, version, epoch)) {
+                    tasks.assign(table.begin(), table.end());
+                    PrintJobPrediction(job, tasks);
+                }
+            }
             printf("[%s] job `%s' has completed\n", timestamp.c_str(), job.desc.name.c_str());
             return 0;
         case ::baidu::shuttle::sdk::kFailed:
@@ -793,6 +1013,18 @@ static int SubmitJob() {
         fprintf(stderr, "reduce flag is needed, use -reducer to specify\n");
         return -1;
     }
+    // Partition number is written as a 5-digit prefix of shuffle keys
+    if (config::partition_total != 0 && (config::partition_total < config::reduce_tasks
+                || config::partition_total > 99999)) {
+        fprintf(stderr, "mapred.reduce.partitions should be in [reduce tasks, 99999]\n");
+        return -1;
+    }
+    std::vector< ::baidu::shuttle::sdk::KeyFieldOrder > key_orders;
+    if (!ParseKeyComparatorOptions(config::key_comparator_options, &key_orders)) {
+        fprintf(stderr, "invalid mapred.text.key.comparator.options: %s\n",
+                config::key_comparator_options.c_str());
+        return -1;
+    }
 /*  if (config::input_host.empty() || config::input_port.empty() ||
             config::input_user.empty() || config::input_password.empty()) {
         fprintf(stderr, "input dfs info is needed, use --jobconf to specify\n");
@@ -851,6 +1083,14 @@ static int SubmitJob() {
     job_desc.decompress_input = config::decompress_input;
     job_desc.compress_output = config::compress_output;
     job_desc.cmdenvs = config::cmdenvs;
+    job_desc.partition_total = config::reduce_tasks == 0 ? 0 : config::partition_total;
+    job_desc.reduce_target_size = config::reduce_target_size;
+    job_desc.reduce_associative = config::reduce_associative;
+    job_desc.key_orders = key_orders;
+    job_desc.hash_aggregation = config::hash_aggregation;
+    job_desc.shm_transport = config::shm_transport;
+    job_desc.plugin = config::plugin;
+    job_desc.plugin_isolation = config::plugin_isolation;
 
     std::string jobid;
     bool ok = shuttle->SubmitJob(job_desc, jobid);
@@ -944,7 +1184,7 @@ static int ListJobs() {
     ::baidu::shuttle::Shuttle *shuttle = ::baidu::shuttle::Shuttle::Connect(master_endpoint);
 
     std::vector< ::baidu::shuttle::sdk::JobInstance > jobs;
-    bool ok = shuttle->ListJobs(jobs, config::display_all);
+    bool ok = shuttle->ListJobs(jobs, config::display_all, true);
     delete shuttle;
     done = true;
     if (!ok) {
@@ -971,6 +1211,56 @@ static void PrintJobCounters(const std::map<std::string, int64_t>& counters) {
     printf("%s\n", tp.ToString().c_str());
 }
 
+// Nearest-rank percentile of sorted values
+static int64_t Percentile(const std::vector<int64_t>& sorted, int percent) {
+    size_t rank = (sorted.size() * percent + 99) / 100;
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static void PrintPhaseTimes(const std::vector< ::baidu::shuttle::sdk::TaskInstance >& tasks) {
+    // Phase times in ms of completed attempts, by kind and phase
+    std::map<std::string, std::map<std::string, std::vector<int64_t> > > times;
+    for (std::vector< ::baidu::shuttle::sdk::TaskInstance >::const_iterator it = tasks.begin();
+            it != tasks.end(); ++it) {
+        if (it->state != ::baidu::shuttle::sdk::kTaskCompleted) {
+            continue;
+        }
+        const char* kind = it->type == ::baidu::shuttle::sdk::kReduce ? "Reduce" : "Map";
+        std::map<std::string, int64_t>::const_iterator jt;
+        for (jt = it->phase_ms.begin(); jt != it->phase_ms.end(); ++jt) {
+            times[kind][jt->first].push_back(jt->second);
+        }
+    }
+    if (times.empty()) {
+        return;
+    }
+    ::baidu::shuttle::TPrinter tp(7);
+    printf("\n");
+    tp.AddRow(7, "Phase(ms)", "tasks", "p50", "p90", "p99", "max", "total");
+    std::map<std::string, std::map<std::string, std::vector<int64_t> > >::iterator kt;
+    for (kt = times.begin(); kt != times.end(); ++kt) {
+        std::map<std::string, std::vector<int64_t> >::iterator pt;
+        for (pt = kt->second.begin(); pt != kt->second.end(); ++pt) {
+            std::vector<int64_t>& values = pt->second;
+            std::sort(values.begin(), values.end());
+            int64_t total = 0;
+            for (size_t i = 0; i < values.size(); i++) {
+                total += values[i];
+            }
+            std::vector<std::string> row;
+            row.push_back(kt->first + " " + pt->first);
+            row.push_back(boost::lexical_cast<std::string>(values.size()));
+            row.push_back(boost::lexical_cast<std::string>(Percentile(values, 50)));
+            row.push_back(boost::lexical_cast<std::string>(Percentile(values, 90)));
+            row.push_back(boost::lexical_cast<std::string>(Percentile(values, 99)));
+            row.push_back(boost::lexical_cast<std::string>(values.back()));
+            row.push_back(boost::lexical_cast<std::string>(total));
+            tp.AddRow(row);
+        }
+    }
+    printf("%s\n", tp.ToString().c_str());
+}
+
 static int ShowJob() {
     std::string master_endpoint = GetMasterAddr();
     if (master_endpoint.empty()) {
@@ -984,21 +1274,24 @@ static int ShowJob() {
     ::baidu::shuttle::Shuttle *shuttle = ::baidu::shuttle::Shuttle::Connect(master_endpoint);
 
     ::baidu::shuttle::sdk::JobInstance job;
-    std::vector< ::baidu::shuttle::sdk::TaskInstance > tasks;
+    TaskTable table;
+    int64_t version = 0;
+    int64_t epoch = 0;
     std::string error_msg;
     std::map<std::string, int64_t> counters;
-    bool ok = shuttle->ShowJob(config::params[0], job, tasks, 
-                               config::display_all, true, error_msg, counters);
+    bool ok = SyncJobTasks(shuttle, config::display_all, job, error_msg, counters,
+                           table, version, epoch);
     delete shuttle;
     done = true;
     if (!ok) {
         fprintf(stderr, "show job status failed\n");
         return 1;
     }
-    std::sort(tasks.begin(), tasks.end(), TaskComparator());
+    std::vector< ::baidu::shuttle::sdk::TaskInstance > tasks(table.begin(), table.end());
     PrintJobDetails(job);
     PrintJobPrediction(job, tasks);
     PrintJobCounters(counters);
+    PrintPhaseTimes(tasks);
     PrintTasksInfo(tasks);
     if (!error_msg.empty()) {
         printf("===== error message =====\n");
@@ -1008,6 +1301,114 @@ static int ShowJob() {
     return 0;
 }
 
+static std::string ToString(int64_t value) {
+    return boost::lexical_cast<std::string>(value);
+}
+
+static void PrintMetrics(const std::vector< ::baidu::shuttle::sdk::Metric >& metrics) {
+    ::baidu::shuttle::TPrinter tp(8);
+    tp.SetMaxColWidth(80);
+    tp.AddRow(8, "Metric", "value/count", "avg", "p50", "p90", "p99", "p999", "max");
+    for (size_t i = 0; i < metrics.size(); i++) {
+        const ::baidu::shuttle::sdk::Metric& metric = metrics[i];
+        std::vector<std::string> row;
+        row.push_back(metric.labels.empty() ? metric.name
+                      : metric.name + "{" + metric.labels + "}");
+        if (metric.type != ::baidu::shuttle::sdk::kHistogramMetric) {
+            row.push_back(ToString(metric.value));
+            row.resize(8);
+        } else {
+            row.push_back(ToString(metric.count));
+            row.push_back(ToString(metric.count > 0 ? metric.sum / metric.count : 0));
+            row.push_back(ToString(metric.p50));
+            row.push_back(ToString(metric.p90));
+            row.push_back(ToString(metric.p99));
+            row.push_back(ToString(metric.p999));
+            row.push_back(ToString(metric.max));
+        }
+        tp.AddRow(row);
+    }
+    printf("%s\n", tp.ToString().c_str());
+}
+
+// Histograms are written as summaries, of their percentiles
+static void PrintPrometheus(const std::vector< ::baidu::shuttle::sdk::Metric >& metrics) {
+    static const char* type_names[] = {"counter", "gauge", "summary"};
+    std::string last_name;
+    for (size_t i = 0; i < metrics.size(); i++) {
+        const ::baidu::shuttle::sdk::Metric& metric = metrics[i];
+        // Metrics come sorted by name, so series of a name are together
+        if (metric.name != last_name) {
+            printf("# HELP %s %s\n", metric.name.c_str(), metric.help.c_str());
+            printf("# TYPE %s %s\n", metric.name.c_str(), type_names[metric.type]);
+            last_name = metric.name;
+        }
+        const std::string labels = metric.labels.empty() ? "" : "{" + metric.labels + "}";
+        if (metric.type != ::baidu::shuttle::sdk::kHistogramMetric) {
+            printf("%s%s %ld\n", metric.name.c_str(), labels.c_str(), metric.value);
+            continue;
+        }
+        const std::string quantile = "{" + (metric.labels.empty() ? "" : metric.labels + ",")
+            + "quantile=\"";
+        printf("%s%s0.5\"} %ld\n", metric.name.c_str(), quantile.c_str(), metric.p50);
+        printf("%s%s0.9\"} %ld\n", metric.name.c_str(), quantile.c_str(), metric.p90);
+        printf("%s%s0.99\"} %ld\n", metric.name.c_str(), quantile.c_str(), metric.p99);
+        printf("%s%s0.999\"} %ld\n", metric.name.c_str(), quantile.c_str(), metric.p999);
+        printf("%s_sum%s %ld\n", metric.name.c_str(), labels.c_str(), metric.sum);
+        printf("%s_count%s %ld\n", metric.name.c_str(), labels.c_str(), metric.count);
+    }
+}
+
+static int ShowMetrics() {
+    std::string master_endpoint = GetMasterAddr();
+    if (master_endpoint.empty()) {
+        fprintf(stderr, "fail to get master endpoint\n");
+        return -1;
+    }
+    ::baidu::shuttle::Shuttle *shuttle = ::baidu::shuttle::Shuttle::Connect(master_endpoint);
+
+    // Of the minion given, of master otherwise
+    const std::string minion = config::params.empty() ? "" : config::params[0];
+    std::vector< ::baidu::shuttle::sdk::Metric > metrics;
+    bool ok = shuttle->GetMetrics(minion, config::metric_prefix, metrics);
+    delete shuttle;
+    done = true;
+    if (!ok) {
+        fprintf(stderr, "get metrics failed\n");
+        return 1;
+    }
+    if (config::prometheus) {
+        PrintPrometheus(metrics);
+    } else {
+        PrintMetrics(metrics);
+    }
+    return 0;
+}
+
+static int TraceJob() {
+    std::string master_endpoint = GetMasterAddr();
+    if (master_endpoint.empty()) {
+        fprintf(stderr, "fail to get master endpoint\n");
+        return -1;
+    }
+    if (config::params.empty()) {
+        fprintf(stderr, "job id is required\n");
+        return -1;
+    }
+    ::baidu::shuttle::Shuttle *shuttle = ::baidu::shuttle::Shuttle::Connect(master_endpoint);
+
+    std::string trace;
+    bool ok = shuttle->TraceJob(config::params[0], trace);
+    delete shuttle;
+    done = true;
+    if (!ok) {
+        fprintf(stderr, "trace job failed\n");
+        return 1;
+    }
+    fwrite(trace.data(), 1, trace.size(), stdout);
+    return 0;
+}
+
 void* LongPeriodWarning(void* /*args*/) {
     sleep(5);
     if (!done) {
@@ -1066,6 +1467,10 @@ int main(int argc, char* argv[]) {
         return ShowJob();
     } else if (!strcmp(argv[1], "monitor")) {
         return MonitorJob();
+    } else if (!strcmp(argv[1], "metrics")) {
+        return ShowMetrics();
+    } else if (!strcmp(argv[1], "trace")) {
+        return TraceJob();
     } else {
         fprintf(stderr, "unknown op: %s\n", argv[1]);
         fprintf(stderr, "  use -h/--help for more introduction\n");
@@ -0,0 +1,390 @@
+#include "benchmark.h"
+
+#include <math.h>
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <sstream>
+#include <gflags/gflags.h>
+
+DEFINE_string(benchmark_filter, ".", "regular expression of the benchmarks to run");
+DEFINE_double(benchmark_min_time, 0.5, "seconds each benchmark runs at least");
+DEFINE_int32(benchmark_repetitions, 1, "runs of each benchmark, their mean, median "
+             "and standard deviation are reported as well");
+DEFINE_string(benchmark_out, "", "file the results are written to as JSON");
+
+namespace baidu {
+namespace shuttle {
+namespace bench {
+
+const static int64_t sMaxIterations = 1000000000L;
+
+static int64_t NowNs(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000L + ts.tv_nsec;
+}
+
+State::State(int64_t max_iterations, const std::vector<int64_t>& args)
+    : iterations_(0), max_iterations_(max_iterations), args_(args),
+      running_(false), real_begin_(0), cpu_begin_(0), real_ns_(0), cpu_ns_(0),
+      bytes_(0), items_(0) {
+}
+
+void State::PauseTiming() {
+    if (!running_) {
+        return;
+    }
+    real_ns_ += NowNs(CLOCK_MONOTONIC) - real_begin_;
+    cpu_ns_ += NowNs(CLOCK_PROCESS_CPUTIME_ID) - cpu_begin_;
+    running_ = false;
+}
+
+void State::ResumeTiming() {
+    if (running_) {
+        return;
+    }
+    real_begin_ = NowNs(CLOCK_MONOTONIC);
+    cpu_begin_ = NowNs(CLOCK_PROCESS_CPUTIME_ID);
+    running_ = true;
+}
+
+Benchmark::Benchmark(const std::string& name, Function function)
+    : name_(name), function_(function) {
+}
+
+Benchmark* Benchmark::Arg(int64_t arg) {
+    args_.push_back(std::vector<int64_t>(1, arg));
+    return this;
+}
+
+Benchmark* Benchmark::ArgPair(int64_t first, int64_t second) {
+    std::vector<int64_t> args;
+    args.push_back(first);
+    args.push_back(second);
+    args_.push_back(args);
+    return this;
+}
+
+static void PowersOf8(int64_t low, int64_t high, std::vector<int64_t>* values) {
+    values->push_back(low);
+    for (int64_t i = 1; i < high; i *= 8) {
+        if (i > low) {
+            values->push_back(i);
+        }
+    }
+    if (high != low) {
+        values->push_back(high);
+    }
+}
+
+Benchmark* Benchmark::Range(int64_t low, int64_t high) {
+    std::vector<int64_t> values;
+    PowersOf8(low, high, &values);
+    for (size_t i = 0; i < values.size(); i++) {
+        Arg(values[i]);
+    }
+    return this;
+}
+
+Benchmark* Benchmark::RangePair(int64_t low1, int64_t high1, int64_t low2, int64_t high2) {
+    std::vector<int64_t> first;
+    std::vector<int64_t> second;
+    PowersOf8(low1, high1, &first);
+    PowersOf8(low2, high2, &second);
+    for (size_t i = 0; i < first.size(); i++) {
+        for (size_t j = 0; j < second.size(); j++) {
+            ArgPair(first[i], second[j]);
+        }
+    }
+    return this;
+}
+
+static std::vector<Benchmark*>* Registry() {
+    static std::vector<Benchmark*> benchmarks;
+    return &benchmarks;
+}
+
+Benchmark* RegisterBenchmark(const char* name, Function function) {
+    Benchmark* benchmark = new Benchmark(name, function);
+    Registry()->push_back(benchmark);
+    return benchmark;
+}
+
+TempDir::TempDir(const std::string& prefix) {
+    std::string pattern = "/tmp/" + prefix + "_XXXXXX";
+    std::vector<char> buf(pattern.begin(), pattern.end());
+    buf.push_back('\0');
+    if (mkdtemp(&buf[0]) != NULL) {
+        path_ = &buf[0];
+    }
+}
+
+TempDir::~TempDir() {
+    if (!path_.empty()) {
+        std::string cmd = "rm -rf " + path_;
+        system(cmd.c_str());
+    }
+}
+
+struct Run {
+    std::string name;
+    std::string run_name;
+    std::string aggregate;
+    int repetition;
+    int64_t iterations;
+    // Per iteration, in nanoseconds
+    double real_time;
+    double cpu_time;
+    // Zero if not set by the benchmark
+    double bytes_per_second;
+    double items_per_second;
+    std::string label;
+    std::string error;
+};
+
+static std::string RunName(const Benchmark* benchmark, const std::vector<int64_t>& args) {
+    std::stringstream ss;
+    ss << benchmark->Name();
+    for (size_t i = 0; i < args.size(); i++) {
+        ss << "/" << args[i];
+    }
+    return ss.str();
+}
+
+// Runs benchmark with more iterations each time, until it takes min_time
+static Run RunOnce(const Benchmark* benchmark, const std::vector<int64_t>& args) {
+    Run run;
+    run.name = RunName(benchmark, args);
+    run.run_name = run.name;
+    run.repetition = 0;
+    int64_t iterations = 1;
+    while (true) {
+        State state(iterations, args);
+        benchmark->GetFunction()(state);
+        double seconds = state.RealSeconds();
+        if (!state.error().empty() || seconds >= FLAGS_benchmark_min_time
+                || iterations >= sMaxIterations) {
+            run.iterations = state.iterations();
+            run.error = state.error();
+            run.label = state.label();
+            int64_t n = std::max(state.iterations(), 1L);
+            run.real_time = state.RealSeconds() * 1e9 / n;
+            run.cpu_time = state.CpuSeconds() * 1e9 / n;
+            run.bytes_per_second = seconds > 0 ? state.bytes() / seconds : 0;
+            run.items_per_second = seconds > 0 ? state.items() / seconds : 0;
+            return run;
+        }
+        // Aims a bit over min_time, as short runs are noisy
+        double multiplier = seconds > FLAGS_benchmark_min_time / 10 ?
+                            FLAGS_benchmark_min_time * 1.4 / seconds : 10;
+        iterations = std::min(std::max(static_cast<int64_t>(iterations * multiplier),
+                                       iterations + 1), sMaxIterations);
+    }
+}
+
+static Run Aggregate(const std::vector<Run>& runs, const std::string& aggregate) {
+    Run result = runs[0];
+    result.name = runs[0].run_name + "_" + aggregate;
+    result.aggregate = aggregate;
+    std::vector<double> fields[4];
+    for (size_t i = 0; i < runs.size(); i++) {
+        fields[0].push_back(runs[i].real_time);
+        fields[1].push_back(runs[i].cpu_time);
+        fields[2].push_back(runs[i].bytes_per_second);
+        fields[3].push_back(runs[i].items_per_second);
+    }
+    double values[4];
+    for (int f = 0; f < 4; f++) {
+        std::vector<double>& v = fields[f];
+        double mean = 0;
+        for (size_t i = 0; i < v.size(); i++) {
+            mean += v[i] / v.size();
+        }
+        if (aggregate == "mean") {
+            values[f] = mean;
+        } else if (aggregate == "median") {
+            std::sort(v.begin(), v.end());
+            values[f] = v.size() % 2 == 1 ? v[v.size() / 2]
+                        : (v[v.size() / 2 - 1] + v[v.size() / 2]) / 2;
+        } else {
+            double var = 0;
+            for (size_t i = 0; i < v.size(); i++) {
+                var += (v[i] - mean) * (v[i] - mean);
+            }
+            values[f] = sqrt(var / (v.size() - 1));
+        }
+    }
+    result.real_time = values[0];
+    result.cpu_time = values[1];
+    result.bytes_per_second = values[2];
+    result.items_per_second = values[3];
+    return result;
+}
+
+static std::string HumanRate(double rate, const char* unit) {
+    const char* prefixes[] = {"", "k", "M", "G", "T"};
+    int i = 0;
+    while (rate >= 1024 && i < 4) {
+        rate /= 1024;
+        i++;
+    }
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.2f%s%s/s", rate, prefixes[i], unit);
+    return buf;
+}
+
+static void PrintRun(const Run& run) {
+    if (!run.error.empty()) {
+        printf("%-56s ERROR: %s\n", run.name.c_str(), run.error.c_str());
+        return;
+    }
+    printf("%-56s %13.0f ns %13.0f ns %10ld", run.name.c_str(),
+           run.real_time, run.cpu_time, run.iterations);
+    if (run.bytes_per_second > 0) {
+        printf(" %12s", HumanRate(run.bytes_per_second, "B").c_str());
+    }
+    if (run.items_per_second > 0) {
+        printf(" %12s", HumanRate(run.items_per_second, "").c_str());
+    }
+    if (!run.label.empty()) {
+        printf(" %s", run.label.c_str());
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+static std::string JsonString(const std::string& s) {
+    std::string out = "\"";
+    for (size_t i = 0; i < s.size(); i++) {
+        unsigned char c = s[i];
+        if (c == '"' || c == '\\') {
+            out.push_back('\\');
+            out.push_back(c);
+        } else if (c < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out.append(buf);
+        } else {
+            out.push_back(c);
+        }
+    }
+    out.push_back('"');
+    return out;
+}
+
+static bool WriteJson(const std::string& path, const std::string& executable,
+                      const std::vector<Run>& runs) {
+    FILE* out = fopen(path.c_str(), "w");
+    if (out == NULL) {
+        fprintf(stderr, "fail to open %s\n", path.c_str());
+        return false;
+    }
+    char date[64];
+    time_t now = time(NULL);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", localtime(&now));
+    char host[256] = {'\0'};
+    gethostname(host, sizeof(host) - 1);
+    fprintf(out, "{\n  \"context\": {\n");
+    fprintf(out, "    \"date\": %s,\n", JsonString(date).c_str());
+    fprintf(out, "    \"host_name\": %s,\n", JsonString(host).c_str());
+    fprintf(out, "    \"executable\": %s,\n", JsonString(executable).c_str());
+    fprintf(out, "    \"num_cpus\": %ld,\n", sysconf(_SC_NPROCESSORS_ONLN));
+    fprintf(out, "    \"min_time\": %g\n", FLAGS_benchmark_min_time);
+    fprintf(out, "  },\n  \"benchmarks\": [");
+    for (size_t i = 0; i < runs.size(); i++) {
+        const Run& run = runs[i];
+        fprintf(out, "%s\n    {\n", i == 0 ? "" : ",");
+        fprintf(out, "      \"name\": %s,\n", JsonString(run.name).c_str());
+        fprintf(out, "      \"run_name\": %s,\n", JsonString(run.run_name).c_str());
+        if (run.aggregate.empty()) {
+            fprintf(out, "      \"run_type\": \"iteration\",\n");
+            fprintf(out, "      \"repetition_index\": %d,\n", run.repetition);
+        } else {
+            fprintf(out, "      \"run_type\": \"aggregate\",\n");
+            fprintf(out, "      \"aggregate_name\": %s,\n", JsonString(run.aggregate).c_str());
+        }
+        fprintf(out, "      \"repetitions\": %d,\n", FLAGS_benchmark_repetitions);
+        if (!run.error.empty()) {
+            fprintf(out, "      \"error_occurred\": true,\n");
+            fprintf(out, "      \"error_message\": %s,\n", JsonString(run.error).c_str());
+        }
+        fprintf(out, "      \"iterations\": %ld,\n", run.iterations);
+        fprintf(out, "      \"real_time\": %.6e,\n", run.real_time);
+        fprintf(out, "      \"cpu_time\": %.6e,\n", run.cpu_time);
+        if (run.bytes_per_second > 0) {
+            fprintf(out, "      \"bytes_per_second\": %.6e,\n", run.bytes_per_second);
+        }
+        if (run.items_per_second > 0) {
+            fprintf(out, "      \"items_per_second\": %.6e,\n", run.items_per_second);
+        }
+        if (!run.label.empty()) {
+            fprintf(out, "      \"label\": %s,\n", JsonString(run.label).c_str());
+        }
+        fprintf(out, "      \"time_unit\": \"ns\"\n    }");
+    }
+    fprintf(out, "\n  ]\n}\n");
+    return fclose(out) == 0;
+}
+
+static int RunBenchmarks(const std::string& executable) {
+    regex_t filter;
+    if (regcomp(&filter, FLAGS_benchmark_filter.c_str(), REG_EXTENDED | REG_NOSUB) != 0) {
+        fprintf(stderr, "invalid filter: %s\n", FLAGS_benchmark_filter.c_str());
+        return 1;
+    }
+    printf("%-56s %16s %16s %10s\n", "Benchmark", "Time", "CPU", "Iterations");
+    printf("%s\n", std::string(102, '-').c_str());
+    std::vector<Run> runs;
+    int errors = 0;
+    const int repetitions = std::max(FLAGS_benchmark_repetitions, 1);
+    const std::vector<Benchmark*>& benchmarks = *Registry();
+    for (size_t b = 0; b < benchmarks.size(); b++) {
+        std::vector<std::vector<int64_t> > arg_sets = benchmarks[b]->Args();
+        if (arg_sets.empty()) {
+            arg_sets.push_back(std::vector<int64_t>());
+        }
+        for (size_t a = 0; a < arg_sets.size(); a++) {
+            std::string name = RunName(benchmarks[b], arg_sets[a]);
+            if (regexec(&filter, name.c_str(), 0, NULL, 0) != 0) {
+                continue;
+            }
+            std::vector<Run> repeated;
+            for (int r = 0; r < repetitions; r++) {
+                Run run = RunOnce(benchmarks[b], arg_sets[a]);
+                run.repetition = r;
+                PrintRun(run);
+                if (!run.error.empty()) {
+                    errors++;
+                }
+                repeated.push_back(run);
+                runs.push_back(run);
+            }
+            if (repetitions > 1 && repeated[0].error.empty()) {
+                const char* aggregates[] = {"mean", "median", "stddev"};
+                for (int i = 0; i < 3; i++) {
+                    runs.push_back(Aggregate(repeated, aggregates[i]));
+                    PrintRun(runs.back());
+                }
+            }
+        }
+    }
+    regfree(&filter);
+    if (!FLAGS_benchmark_out.empty() && !WriteJson(FLAGS_benchmark_out, executable, runs)) {
+        return 1;
+    }
+    return errors == 0 ? 0 : 1;
+}
+
+} //namespace bench
+} //namespace shuttle
+} //namespace baidu
+
+int main(int argc, char* argv[]) {
+    google::ParseCommandLineFlags(&argc, &argv, true);
+    return baidu::shuttle::bench::RunBenchmarks(argv[0]);
+}
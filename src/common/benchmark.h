@@ -0,0 +1,140 @@
+#ifndef _BAIDU_SHUTTLE_COMMON_BENCHMARK_H_
+#define _BAIDU_SHUTTLE_COMMON_BENCHMARK_H_
+
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+#include "common/record_generator.h"
+
+// A small harness in the manner of Google Benchmark. Benchmarks registered
+// by BENCHMARK are run by shuttle_bench, each until it takes
+// --benchmark_min_time, and --benchmark_out writes the results as JSON in
+// the format of Google Benchmark, so its tools compare two runs
+namespace baidu {
+namespace shuttle {
+namespace bench {
+
+// Passed to a benchmark function, which runs the measured code in a loop
+// while KeepRunning returns true
+class State {
+public:
+    State(int64_t max_iterations, const std::vector<int64_t>& args);
+    bool KeepRunning() {
+        if (iterations_ < max_iterations_) {
+            if (iterations_++ == 0) {
+                ResumeTiming();
+            }
+            return true;
+        }
+        PauseTiming();
+        return false;
+    }
+    // Setup in the loop is left out between the two
+    void PauseTiming();
+    void ResumeTiming();
+    int64_t range(size_t i) const {
+        return args_[i];
+    }
+    int64_t iterations() const {
+        return iterations_;
+    }
+    void SetBytesProcessed(int64_t bytes) {
+        bytes_ = bytes;
+    }
+    void SetItemsProcessed(int64_t items) {
+        items_ = items;
+    }
+    void SetLabel(const std::string& label) {
+        label_ = label;
+    }
+    void SkipWithError(const std::string& error) {
+        error_ = error;
+        max_iterations_ = iterations_;
+    }
+
+    double RealSeconds() const {
+        return real_ns_ / 1e9;
+    }
+    double CpuSeconds() const {
+        return cpu_ns_ / 1e9;
+    }
+    int64_t bytes() const {
+        return bytes_;
+    }
+    int64_t items() const {
+        return items_;
+    }
+    const std::string& label() const {
+        return label_;
+    }
+    const std::string& error() const {
+        return error_;
+    }
+private:
+    int64_t iterations_;
+    int64_t max_iterations_;
+    std::vector<int64_t> args_;
+    bool running_;
+    int64_t real_begin_;
+    int64_t cpu_begin_;
+    int64_t real_ns_;
+    int64_t cpu_ns_;
+    int64_t bytes_;
+    int64_t items_;
+    std::string label_;
+    std::string error_;
+};
+
+typedef void (*Function)(State& state);
+
+class Benchmark {
+public:
+    Benchmark(const std::string& name, Function function);
+    Benchmark* Arg(int64_t arg);
+    Benchmark* ArgPair(int64_t first, int64_t second);
+    // Powers of 8 from low to high, both included
+    Benchmark* Range(int64_t low, int64_t high);
+    // Pairs of the powers of 8 in each range
+    Benchmark* RangePair(int64_t low1, int64_t high1, int64_t low2, int64_t high2);
+
+    const std::string& Name() const {
+        return name_;
+    }
+    Function GetFunction() const {
+        return function_;
+    }
+    const std::vector<std::vector<int64_t> >& Args() const {
+        return args_;
+    }
+private:
+    std::string name_;
+    Function function_;
+    std::vector<std::vector<int64_t> > args_;
+};
+
+Benchmark* RegisterBenchmark(const char* name, Function function);
+
+// Scratch directory under /tmp, removed with all in it
+class TempDir {
+public:
+    explicit TempDir(const std::string& prefix);
+    ~TempDir();
+    const std::string& Path() const {
+        return path_;
+    }
+private:
+    std::string path_;
+};
+
+} //namespace bench
+} //namespace shuttle
+} //namespace baidu
+
+#define BENCHMARK_CONCAT_(a, b) a##b
+#define BENCHMARK_CONCAT(a, b) BENCHMARK_CONCAT_(a, b)
+#define BENCHMARK(function) \
+    static ::baidu::shuttle::bench::Benchmark* BENCHMARK_CONCAT(s_benchmark_, __LINE__) \
+        __attribute__((unused)) = ::baidu::shuttle::bench::RegisterBenchmark(#function, function)
+
+#endif
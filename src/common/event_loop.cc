@@ -0,0 +1,72 @@
+#include "event_loop.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+namespace baidu {
+namespace shuttle {
+
+const static int sMaxEvents = 64;
+
+EventLoop::EventLoop() {
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+}
+
+EventLoop::~EventLoop() {
+    if (epoll_fd_ >= 0) {
+        close(epoll_fd_);
+    }
+}
+
+bool EventLoop::Add(int fd, uint32_t events, const Handler& handler) {
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.fd = fd;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        return false;
+    }
+    handlers_[fd] = handler;
+    return true;
+}
+
+bool EventLoop::Modify(int fd, uint32_t events) {
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.fd = fd;
+    return epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &ev) == 0;
+}
+
+void EventLoop::Remove(int fd) {
+    if (handlers_.erase(fd) > 0) {
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, NULL);
+    }
+}
+
+int EventLoop::Poll(int timeout_ms) {
+    struct epoll_event events[sMaxEvents];
+    int n = epoll_wait(epoll_fd_, events, sMaxEvents, timeout_ms);
+    if (n < 0) {
+        return errno == EINTR ? 0 : -1;
+    }
+    for (int i = 0; i < n; i++) {
+        int fd = events[i].data.fd;
+        // An earlier handler may have removed the descriptor
+        std::map<int, Handler>::iterator it = handlers_.find(fd);
+        if (it == handlers_.end()) {
+            continue;
+        }
+        Handler handler = it->second;
+        handler(events[i].events);
+    }
+    return n;
+}
+
+bool EventLoop::SetNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+} //namespace shuttle
+} //namespace baidu
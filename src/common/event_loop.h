@@ -0,0 +1,41 @@
+#ifndef _BAIDU_SHUTTLE_COMMON_EVENT_LOOP_H_
+#define _BAIDU_SHUTTLE_COMMON_EVENT_LOOP_H_
+
+#include <stdint.h>
+#include <map>
+#include <boost/function.hpp>
+
+namespace baidu {
+namespace shuttle {
+
+// Readiness of many non-blocking descriptors waited with one epoll, so a
+// single thread drives them all. Handlers run in the thread calling Poll,
+// which is the only thread allowed to change the descriptors watched.
+// Other threads signal the loop through descriptors such as eventfds
+class EventLoop {
+public:
+    typedef boost::function<void (uint32_t events)> Handler;
+    EventLoop();
+    ~EventLoop();
+    bool Ok() const {
+        return epoll_fd_ >= 0;
+    }
+    // Events are level triggered, EPOLLIN and EPOLLOUT. Errors and hang
+    // ups are reported whatever is asked for
+    bool Add(int fd, uint32_t events, const Handler& handler);
+    bool Modify(int fd, uint32_t events);
+    void Remove(int fd);
+    // Waits up to timeout_ms, -1 for ever, and runs handlers of ready
+    // descriptors. Returns the number of them, or -1 on errors
+    int Poll(int timeout_ms);
+
+    static bool SetNonBlocking(int fd);
+private:
+    int epoll_fd_;
+    std::map<int, Handler> handlers_;
+};
+
+} //namespace shuttle
+} //namespace baidu
+
+#endif
@@ -1,8 +1,16 @@
+#include <algorithm>
 #include <deque>
+#include <dirent.h>
+#include <errno.h>
+#include <ftw.h>
+#include <glob.h>
+#include <string.h>
 #include <fcntl.h> 
 #include <stdio.h> 
+#include <stdlib.h> 
 #include <sys/stat.h> 
 #include <sys/types.h> 
+#include <time.h>
 #include <unistd.h> 
 #include <boost/algorithm/string.hpp>
 
@@ -16,6 +24,171 @@ using baidu::common::WARNING;
 namespace baidu {
 namespace shuttle {
 
+static __thread DfsCounters* tls_counters = NULL;
+static DfsCounters s_process_counters;
+// Set in tools, which count all their threads
+static bool s_count_process = false;
+// Set in tools run with $shuttle_time_dfs_ops, which time their dfs calls
+static bool s_time_ops = false;
+static const char* s_op_names[kFsOpCount] = {
+    "open", "close", "read", "write", "seek", "stat",
+    "list", "exist", "rename", "remove", "mkdirs"
+};
+static FsOpStats s_op_stats[kFsOpCount];
+
+static void CountDfsIo(int64_t read, int64_t written) {
+    if (tls_counters != NULL) {
+        tls_counters->Add(read, written);
+    } else if (s_count_process) {
+        s_process_counters.Add(read, written);
+    }
+}
+
+void FileSystem::BindCounters(DfsCounters* counters) {
+    tls_counters = counters;
+}
+
+DfsCounters* FileSystem::BoundCounters() {
+    return tls_counters;
+}
+
+FsOpStats::FsOpStats() : calls(0), errors(0), bytes(0), total_us(0) {
+    memset(buckets, 0, sizeof(buckets));
+}
+
+void FsOpStats::Add(int64_t us, int64_t n_bytes, bool ok) {
+    int bucket = 0;
+    while (bucket < kBuckets - 1 && (1L << bucket) <= us) {
+        ++bucket;
+    }
+    __sync_fetch_and_add(&calls, 1);
+    __sync_fetch_and_add(&errors, ok ? 0 : 1);
+    __sync_fetch_and_add(&bytes, n_bytes);
+    __sync_fetch_and_add(&total_us, us);
+    __sync_fetch_and_add(&buckets[bucket], 1);
+}
+
+void FsOpStats::Merge(const FsOpStats& other) {
+    calls += other.calls;
+    errors += other.errors;
+    bytes += other.bytes;
+    total_us += other.total_us;
+    for (int i = 0; i < kBuckets; i++) {
+        buckets[i] += other.buckets[i];
+    }
+}
+
+int64_t FsOpStats::PercentileUs(double percent) const {
+    int64_t rank = static_cast<int64_t>(calls * percent / 100);
+    int64_t seen = 0;
+    for (int i = 0; i < kBuckets; i++) {
+        seen += buckets[i];
+        if (seen > rank) {
+            return 1L << i;
+        }
+    }
+    return calls > 0 ? 1L << (kBuckets - 1) : 0;
+}
+
+// A "bytes" line with the counters, and a line for each op timed
+static void AppendProcessCounters() {
+    const char* file = getenv("minion_dfs_stats_file");
+    if (file == NULL || *file == '\0') {
+        return;
+    }
+    char buf[64];
+    snprintf(buf, sizeof(buf), "bytes %lld %lld\n",
+             (long long)s_process_counters.read_bytes,
+             (long long)s_process_counters.write_bytes);
+    std::string lines = buf;
+    for (int op = 0; op < kFsOpCount; op++) {
+        const FsOpStats& stats = s_op_stats[op];
+        if (stats.calls == 0) {
+            continue;
+        }
+        snprintf(buf, sizeof(buf), "%s %lld %lld %lld %lld", s_op_names[op],
+                 (long long)stats.calls, (long long)stats.errors,
+                 (long long)stats.bytes, (long long)stats.total_us);
+        lines += buf;
+        for (int i = 0; i < FsOpStats::kBuckets; i++) {
+            snprintf(buf, sizeof(buf), " %lld", (long long)stats.buckets[i]);
+            lines += buf;
+        }
+        lines += "\n";
+    }
+    // In one write in append mode, tools exiting together do not mix
+    int fd = open(file, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd >= 0) {
+        ssize_t ret = write(fd, lines.data(), lines.size());
+        (void)ret;
+        close(fd);
+    }
+}
+
+void FileSystem::ReportCountersAtExit() {
+    const char* time_ops = getenv("shuttle_time_dfs_ops");
+    s_count_process = true;
+    s_time_ops = time_ops != NULL && *time_ops != '\0';
+    atexit(AppendProcessCounters);
+}
+
+bool FileSystem::LoadCounters(const std::string& file, DfsCounters* counters,
+                              std::vector<FsOpStats>* ops) {
+    FILE* fp = fopen(file.c_str(), "r");
+    if (fp == NULL) {
+        return false;
+    }
+    if (ops != NULL) {
+        ops->resize(kFsOpCount);
+    }
+    char name[32];
+    long long values[4 + FsOpStats::kBuckets];
+    while (fscanf(fp, "%31s", name) == 1) {
+        const bool bytes = strcmp(name, "bytes") == 0;
+        const int count = bytes ? 2 : 4 + FsOpStats::kBuckets;
+        int n = 0;
+        while (n < count && fscanf(fp, "%lld", &values[n]) == 1) {
+            ++n;
+        }
+        if (n < count) {
+            break;
+        }
+        if (bytes) {
+            if (counters != NULL) {
+                counters->Add(values[0], values[1]);
+            }
+            continue;
+        }
+        FsOpStats line;
+        line.calls = values[0];
+        line.errors = values[1];
+        line.bytes = values[2];
+        line.total_us = values[3];
+        for (int i = 0; i < FsOpStats::kBuckets; i++) {
+            line.buckets[i] = values[4 + i];
+        }
+        for (int op = 0; ops != NULL && op < kFsOpCount; op++) {
+            if (strcmp(name, s_op_names[op]) == 0) {
+                (*ops)[op].Merge(line);
+            }
+        }
+    }
+    fclose(fp);
+    return true;
+}
+
+bool FileSystem::OpStatsEnabled() {
+    return s_time_ops;
+}
+
+void FileSystem::GetOpStats(std::vector<FsOpStats>* stats) {
+    stats->assign(s_op_stats, s_op_stats + kFsOpCount);
+}
+
+const char* FileSystem::OpName(FsOp op) {
+    return op < kFsOpCount ? s_op_names[op] : "unknown";
+}
+
 class InfHdfs : public FileSystem {
 public:
     InfHdfs();
@@ -63,39 +236,136 @@ public:
     int64_t Tell();
     int64_t GetSize();
     bool Rename(const std::string& old_name, const std::string& new_name);
-    bool Remove(const std::string& /*path*/) {
-        //TODO, not implementation
-        return false;
+    // Directories are removed with all in them, as in hdfs
+    bool Remove(const std::string& path);
+    bool List(const std::string& dir, std::vector<FileInfo>* children);
+    bool Glob(const std::string& dir, std::vector<FileInfo>* children);
+    bool Mkdirs(const std::string& dir);
+    bool Exist(const std::string& path);
+private:
+    static bool Stat(const std::string& path, FileInfo* info);
+private:
+    int fd_;
+    std::string path_;
+};
+
+// Times a call, the elapsed time is added to the stats of op by Done
+class OpTimer {
+public:
+    explicit OpTimer(FsOp op) : op_(op) {
+        clock_gettime(CLOCK_MONOTONIC, &begin_);
     }
-    bool List(const std::string& /*dir*/, std::vector<FileInfo>* /*children*/) {
-        //TODO, not implementation
-        return false;
+    bool Done(bool ok, int64_t bytes) {
+        struct timespec end;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        int64_t us = (end.tv_sec - begin_.tv_sec) * 1000000L
+            + (end.tv_nsec - begin_.tv_nsec) / 1000;
+        s_op_stats[op_].Add(us, bytes, ok);
+        return ok;
     }
-    bool Glob(const std::string& /*dir*/, std::vector<FileInfo>* /*children*/) {
-        //TODO, not implementation
-        return false;
+private:
+    FsOp op_;
+    struct timespec begin_;
+};
+
+// Dfs with its calls timed, only made when op stats are enabled
+class TimedFs : public FileSystem {
+public:
+    explicit TimedFs(FileSystem* fs) : fs_(fs) { }
+    virtual ~TimedFs() {
+        delete fs_;
     }
-    bool Mkdirs(const std::string& /*dir*/) {
-        //TODO, not implementation
-        return false;
+    bool Open(const std::string& path, OpenMode mode) {
+        OpTimer timer(kFsOpen);
+        return timer.Done(fs_->Open(path, mode), 0);
     }
-    bool Exist(const std::string& /*path*/) {
-        //TODO, not implementation
-        return false;
+    bool Open(const std::string& path, Param& param, OpenMode mode) {
+        OpTimer timer(kFsOpen);
+        return timer.Done(fs_->Open(path, param, mode), 0);
+    }
+    bool Close() {
+        OpTimer timer(kFsClose);
+        return timer.Done(fs_->Close(), 0);
+    }
+    bool Seek(int64_t pos) {
+        OpTimer timer(kFsSeek);
+        return timer.Done(fs_->Seek(pos), 0);
+    }
+    int32_t Read(void* buf, size_t len) {
+        OpTimer timer(kFsRead);
+        int32_t ret = fs_->Read(buf, len);
+        timer.Done(ret >= 0, std::max(ret, 0));
+        return ret;
+    }
+    int32_t Write(void* buf, size_t len) {
+        OpTimer timer(kFsWrite);
+        int32_t ret = fs_->Write(buf, len);
+        timer.Done(ret >= 0, std::max(ret, 0));
+        return ret;
+    }
+    int64_t Tell() {
+        return fs_->Tell();
+    }
+    int64_t GetSize() {
+        OpTimer timer(kFsStat);
+        int64_t size = fs_->GetSize();
+        timer.Done(size >= 0, 0);
+        return size;
+    }
+    bool Rename(const std::string& old_name, const std::string& new_name) {
+        OpTimer timer(kFsRename);
+        return timer.Done(fs_->Rename(old_name, new_name), 0);
+    }
+    bool Remove(const std::string& path) {
+        OpTimer timer(kFsRemove);
+        return timer.Done(fs_->Remove(path), 0);
+    }
+    bool List(const std::string& dir, std::vector<FileInfo>* children) {
+        OpTimer timer(kFsList);
+        return timer.Done(fs_->List(dir, children), 0);
+    }
+    bool Glob(const std::string& dir, std::vector<FileInfo>* children) {
+        OpTimer timer(kFsList);
+        return timer.Done(fs_->Glob(dir, children), 0);
+    }
+    bool Mkdirs(const std::string& dir) {
+        OpTimer timer(kFsMkdirs);
+        return timer.Done(fs_->Mkdirs(dir), 0);
+    }
+    // Missing files are not errors, they are what lock files are polled for
+    bool Exist(const std::string& path) {
+        OpTimer timer(kFsExist);
+        bool exist = fs_->Exist(path);
+        timer.Done(true, 0);
+        return exist;
     }
 private:
-    int fd_;
-    std::string path_;
+    FileSystem* fs_;
 };
 
+static FileSystem* TimeOpsIfEnabled(FileSystem* fs) {
+    return FileSystem::OpStatsEnabled() ? new TimedFs(fs) : fs;
+}
+
+bool FileSystem::LocalDfs() {
+    static bool local = getenv("shuttle_local_dfs") != NULL;
+    return local;
+}
+
 FileSystem* FileSystem::CreateInfHdfs() {
-    return new InfHdfs();
+    if (LocalDfs()) {
+        return TimeOpsIfEnabled(new LocalFs());
+    }
+    return TimeOpsIfEnabled(new InfHdfs());
 }
 
 FileSystem* FileSystem::CreateInfHdfs(Param& param) {
+    if (LocalDfs()) {
+        return TimeOpsIfEnabled(new LocalFs());
+    }
     InfHdfs* fs = new InfHdfs();
     fs->Connect(param);
-    return fs;
+    return TimeOpsIfEnabled(fs);
 }
 
 FileSystem* FileSystem::CreateLocalFs() {
@@ -227,11 +497,18 @@ bool InfHdfs::Seek(int64_t pos) {
 int32_t InfHdfs::Read(void* buf, size_t len) {
     int32_t ret = hdfsRead(fs_, fd_, buf, len);
     // /LOG(INFO, "InfHdfs::Read, %d, %d", len ,ret);
+    if (ret > 0) {
+        CountDfsIo(ret, 0);
+    }
     return ret;
 }
 
 int32_t InfHdfs::Write(void* buf, size_t len) {
-    return hdfsWrite(fs_, fd_, buf, len);
+    int32_t ret = hdfsWrite(fs_, fd_, buf, len);
+    if (ret > 0) {
+        CountDfsIo(0, ret);
+    }
+    return ret;
 }
 
 int64_t InfHdfs::Tell() {
@@ -364,6 +641,11 @@ bool LocalFs::Open(const std::string& path,
             return false;
         }
     } else if (mode == kWriteFile) {
+        // Parents are made on the way like hdfs does
+        size_t slash = path.find_last_of('/');
+        if (slash != std::string::npos && slash > 0) {
+            Mkdirs(path.substr(0, slash));
+        }
         fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, acl);
         if (fd_ < 0) {
             LOG(WARNING, "open %s fail, %s", path.c_str(), strerror(errno));
@@ -413,6 +695,99 @@ bool LocalFs::Rename(const std::string& old_name, const std::string& new_name) {
     return ::rename(old_name.c_str(), new_name.c_str()) == 0;
 }
 
+static int RemoveEntry(const char* path, const struct stat* /*sb*/,
+                       int /*type*/, struct FTW* /*ftw*/) {
+    return ::remove(path);
+}
+
+bool LocalFs::Remove(const std::string& path) {
+    return nftw(path.c_str(), RemoveEntry, 16, FTW_DEPTH | FTW_PHYS) == 0;
+}
+
+bool LocalFs::Stat(const std::string& path, FileInfo* info) {
+    struct stat buf;
+    if (::stat(path.c_str(), &buf) != 0) {
+        return false;
+    }
+    info->kind = S_ISDIR(buf.st_mode) ? kObjectKindDirectory : kObjectKindFile;
+    info->name = path;
+    info->size = buf.st_size;
+    return true;
+}
+
+bool LocalFs::List(const std::string& dir, std::vector<FileInfo>* children) {
+    if (children == NULL) {
+        return false;
+    }
+    FileInfo info;
+    if (!Stat(dir, &info)) {
+        LOG(WARNING, "error in listing directory: %s", dir.c_str());
+        return false;
+    }
+    if (info.kind != kObjectKindDirectory) {
+        // Like hdfsListDirectory, a file lists itself
+        children->push_back(info);
+        return true;
+    }
+    DIR* dp = opendir(dir.c_str());
+    if (dp == NULL) {
+        LOG(WARNING, "error in listing directory: %s", dir.c_str());
+        return false;
+    }
+    std::vector<std::string> names;
+    struct dirent* entry = NULL;
+    while ((entry = readdir(dp)) != NULL) {
+        if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+            names.push_back(entry->d_name);
+        }
+    }
+    closedir(dp);
+    std::sort(names.begin(), names.end());
+    for (size_t i = 0; i < names.size(); i++) {
+        if (Stat(dir + "/" + names[i], &info)) {
+            children->push_back(info);
+        }
+    }
+    return true;
+}
+
+bool LocalFs::Glob(const std::string& dir, std::vector<FileInfo>* children) {
+    if (children == NULL) {
+        return false;
+    }
+    glob_t matches;
+    int ret = glob(dir.c_str(), 0, NULL, &matches);
+    if (ret != 0 && ret != GLOB_NOMATCH) {
+        LOG(WARNING, "error in globbing: %s", dir.c_str());
+        return false;
+    }
+    for (size_t i = 0; ret == 0 && i < matches.gl_pathc; i++) {
+        FileInfo info;
+        if (Stat(matches.gl_pathv[i], &info)) {
+            children->push_back(info);
+        }
+    }
+    globfree(&matches);
+    return true;
+}
+
+bool LocalFs::Mkdirs(const std::string& dir) {
+    for (size_t pos = dir.find('/', 1); ; pos = dir.find('/', pos + 1)) {
+        const std::string& parent = dir.substr(0, pos);
+        if (::mkdir(parent.c_str(), 0755) != 0 && errno != EEXIST) {
+            LOG(WARNING, "fail to make dir %s, %s", parent.c_str(), strerror(errno));
+            return false;
+        }
+        if (pos == std::string::npos) {
+            return true;
+        }
+    }
+}
+
+bool LocalFs::Exist(const std::string& path) {
+    return ::access(path.c_str(), F_OK) == 0;
+}
+
 InfSeqFile::InfSeqFile() : fs_(NULL), sf_(NULL) {
 
 }
@@ -463,6 +838,7 @@ bool InfSeqFile::ReadNextRecord(std::string* key, std::string* value, bool* eof)
     }
     key->assign(static_cast<const char*>(raw_key), key_len);
     value->assign(static_cast<const char*>(raw_value), value_len);
+    CountDfsIo(key_len + value_len, 0);
     return true;
 }
 
@@ -472,6 +848,7 @@ bool InfSeqFile::WriteNextRecord(const std::string& key, const std::string& valu
         LOG(WARNING, "fail to write next record: %s", path_.c_str());
         return false;
     }
+    CountDfsIo(0, key.size() + value.size());
     return true;
 }
 
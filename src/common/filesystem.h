@@ -27,9 +27,73 @@ struct FileInfo {
     }
 };
 
+// Bytes moved through dfs by the threads bound to them, which may be
+// several threads working for one task
+struct DfsCounters {
+    int64_t read_bytes;
+    int64_t write_bytes;
+    DfsCounters() : read_bytes(0), write_bytes(0) { }
+    void Add(int64_t read, int64_t written) {
+        __sync_fetch_and_add(&read_bytes, read);
+        __sync_fetch_and_add(&write_bytes, written);
+    }
+};
+
+// Calls of dfs timed by FileSystem when op stats are enabled
+enum FsOp {
+    kFsOpen = 0,
+    kFsClose,
+    kFsRead,
+    kFsWrite,
+    kFsSeek,
+    kFsStat,
+    kFsList,
+    kFsExist,
+    kFsRename,
+    kFsRemove,
+    kFsMkdirs,
+    kFsOpCount
+};
+
+// Calls of one op, latencies are counted in buckets of powers of 2
+// microseconds, bucket i holding those below 2^i
+struct FsOpStats {
+    static const int kBuckets = 32;
+    int64_t calls;
+    int64_t errors;
+    int64_t bytes;
+    int64_t total_us;
+    int64_t buckets[kBuckets];
+    FsOpStats();
+    void Add(int64_t us, int64_t bytes, bool ok);
+    void Merge(const FsOpStats& other);
+    // Upper bound of the bucket holding the percent-th latency
+    int64_t PercentileUs(double percent) const;
+};
+
 class FileSystem {
 public:
     typedef std::map<std::string, std::string> Param;
+    // Dfs files read and written by this thread are counted in counters
+    // from now on, NULL stops it
+    static void BindCounters(DfsCounters* counters);
+    static DfsCounters* BoundCounters();
+    // Tools run by a task count all their threads and append the counters
+    // on exit to the file named by $minion_dfs_stats_file, if any. Their
+    // dfs calls are timed and appended too only with $shuttle_time_dfs_ops
+    static void ReportCountersAtExit();
+    // Sums the lines the tools have appended, the op stats into ops if
+    // not NULL
+    static bool LoadCounters(const std::string& file, DfsCounters* counters,
+                             std::vector<FsOpStats>* ops = NULL);
+    // Dfs files are local ones in processes with $shuttle_local_dfs set,
+    // which the minions, tools and apps of a cluster on one host inherit
+    static bool LocalDfs();
+    // Whether dfs calls of all threads are timed, see ReportCountersAtExit
+    static bool OpStatsEnabled();
+    // Stats of this process so far, kFsOpCount of them
+    static void GetOpStats(std::vector<FsOpStats>* stats);
+    static const char* OpName(FsOp op);
     static FileSystem* CreateInfHdfs();
     static FileSystem* CreateInfHdfs(Param& param);
     static FileSystem* CreateLocalFs();
@@ -0,0 +1,305 @@
+#include "metrics.h"
+
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <map>
+#include <vector>
+#include "mutex.h"
+
+namespace baidu {
+namespace shuttle {
+
+const static int64_t sMaxValue = (1L << Histogram::kMaxValueBits) - 1;
+// In permille, as the fields of Metric
+const static int sPercentiles[] = {500, 900, 990, 999};
+
+static int s_next_shard = 0;
+
+// Threads take shards in turn the first time they write
+static int ThreadShard() {
+    static __thread int shard = -1;
+    if (shard < 0) {
+        shard = __sync_fetch_and_add(&s_next_shard, 1) % kMetricShards;
+    }
+    return shard;
+}
+
+Counter::Counter() {
+    memset(cells_, 0, sizeof(cells_));
+}
+
+void Counter::Add(int64_t n) {
+    __sync_fetch_and_add(&cells_[ThreadShard()].value, n);
+}
+
+int64_t Counter::Value() const {
+    int64_t value = 0;
+    for (int i = 0; i < kMetricShards; i++) {
+        value += cells_[i].value;
+    }
+    return value;
+}
+
+void Gauge::Set(int64_t value) {
+    value_ = value;
+}
+
+void Gauge::Add(int64_t n) {
+    __sync_fetch_and_add(&value_, n);
+}
+
+Histogram::Histogram() : shards_(new Shard[kMetricShards]) {
+    memset(shards_, 0, sizeof(Shard) * kMetricShards);
+}
+
+Histogram::~Histogram() {
+    delete[] shards_;
+}
+
+int Histogram::BucketOf(int64_t value) {
+    value = std::max(std::min(value, sMaxValue), 0L);
+    if (value < (1L << kSubBucketBits)) {
+        return static_cast<int>(value);
+    }
+    // Exponent of the highest bit, and the bits below it pick the bucket
+    const int exp = 63 - __builtin_clzll(value);
+    const int shift = exp - kSubBucketBits;
+    const int sub = static_cast<int>(value >> shift) & ((1 << kSubBucketBits) - 1);
+    return ((shift + 1) << kSubBucketBits) + sub;
+}
+
+int64_t Histogram::BucketBound(int bucket) {
+    if (bucket < (1 << kSubBucketBits)) {
+        return bucket;
+    }
+    const int shift = (bucket >> kSubBucketBits) - 1;
+    const int64_t sub = bucket & ((1 << kSubBucketBits) - 1);
+    const int64_t lower = ((1L << kSubBucketBits) + sub) << shift;
+    return lower + (1L << shift) - 1;
+}
+
+void Histogram::Add(int64_t value) {
+    value = std::max(std::min(value, sMaxValue), 0L);
+    Shard& shard = shards_[ThreadShard()];
+    __sync_fetch_and_add(&shard.count, 1);
+    __sync_fetch_and_add(&shard.sum, value);
+    __sync_fetch_and_add(&shard.buckets[BucketOf(value)], 1);
+    int64_t max = shard.max;
+    while (value > max) {
+        int64_t prev = __sync_val_compare_and_swap(&shard.max, max, value);
+        if (prev == max) {
+            break;
+        }
+        max = prev;
+    }
+}
+
+void Histogram::Fill(Metric* metric) const {
+    int64_t count = 0;
+    int64_t sum = 0;
+    int64_t max = 0;
+    std::vector<int64_t> buckets(kBuckets, 0);
+    for (int i = 0; i < kMetricShards; i++) {
+        const Shard& shard = shards_[i];
+        count += shard.count;
+        sum += shard.sum;
+        max = std::max(max, static_cast<int64_t>(shard.max));
+        for (int b = 0; b < kBuckets; b++) {
+            buckets[b] += shard.buckets[b];
+        }
+    }
+    metric->set_count(count);
+    metric->set_sum(sum);
+    metric->set_max(max);
+    // Buckets are read while being added to, so they may sum to more or
+    // less than count by a few
+    int64_t total = 0;
+    for (int b = 0; b < kBuckets; b++) {
+        total += buckets[b];
+    }
+    int64_t values[sizeof(sPercentiles) / sizeof(sPercentiles[0])];
+    int64_t seen = 0;
+    size_t p = 0;
+    for (int b = 0; b < kBuckets && p < sizeof(sPercentiles) / sizeof(sPercentiles[0]); b++) {
+        seen += buckets[b];
+        while (p < sizeof(sPercentiles) / sizeof(sPercentiles[0])
+                && seen > 0 && seen * 1000 >= total * sPercentiles[p]) {
+            values[p++] = std::min(BucketBound(b), max);
+        }
+    }
+    for (; p < sizeof(sPercentiles) / sizeof(sPercentiles[0]); p++) {
+        values[p] = max;
+    }
+    metric->set_p50(values[0]);
+    metric->set_p90(values[1]);
+    metric->set_p99(values[2]);
+    metric->set_p999(values[3]);
+}
+
+LatencyScope::LatencyScope(Histogram* histogram, Gauge* in_flight)
+    : histogram_(histogram), in_flight_(in_flight), begin_(Metrics::NowUs()) {
+    if (in_flight_ != NULL) {
+        in_flight_->Add(1);
+    }
+}
+
+LatencyScope::~LatencyScope() {
+    histogram_->Add(Metrics::NowUs() - begin_);
+    if (in_flight_ != NULL) {
+        in_flight_->Add(-1);
+    }
+}
+
+struct MetricEntry {
+    MetricType type;
+    std::string help;
+    void* metric;
+};
+
+struct MetricRegistry {
+    Mutex mu;
+    // By names with labels
+    std::map<std::string, MetricEntry> entries;
+    // Held while collectors run, so a removed one is no longer called
+    Mutex collect_mu;
+    std::map<int, Metrics::Collector> collectors;
+    int next_collector;
+    MetricRegistry() : next_collector(0) { }
+};
+
+// Never deleted, threads may still write while the process exits
+static MetricRegistry* GetRegistry() {
+    static MetricRegistry* registry = new MetricRegistry();
+    return registry;
+}
+
+template <class T>
+static T* GetMetric(const std::string& name, const std::string& help, MetricType type) {
+    MetricRegistry* registry = GetRegistry();
+    MutexLock lock(&registry->mu);
+    std::map<std::string, MetricEntry>::iterator it = registry->entries.find(name);
+    if (it != registry->entries.end()) {
+        // A name used for another type is a bug of the caller
+        assert(it->second.type == type);
+        return static_cast<T*>(it->second.metric);
+    }
+    MetricEntry& entry = registry->entries[name];
+    entry.type = type;
+    entry.help = help;
+    entry.metric = new T();
+    return static_cast<T*>(entry.metric);
+}
+
+// Splits "name{labels}" into the fields of metric
+static void SetName(const std::string& name, Metric* metric) {
+    size_t brace = name.find('{');
+    if (brace == std::string::npos || name[name.size() - 1] != '}') {
+        metric->set_name(name);
+        return;
+    }
+    metric->set_name(name.substr(0, brace));
+    metric->set_labels(name.substr(brace + 1, name.size() - brace - 2));
+}
+
+static bool MetricLess(const Metric& a, const Metric& b) {
+    if (a.name() != b.name()) {
+        return a.name() < b.name();
+    }
+    return a.labels() < b.labels();
+}
+
+Counter* Metrics::GetCounter(const std::string& name, const std::string& help) {
+    return GetMetric<Counter>(name, help, kCounterMetric);
+}
+
+Gauge* Metrics::GetGauge(const std::string& name, const std::string& help) {
+    return GetMetric<Gauge>(name, help, kGaugeMetric);
+}
+
+Histogram* Metrics::GetHistogram(const std::string& name, const std::string& help) {
+    return GetMetric<Histogram>(name, help, kHistogramMetric);
+}
+
+int Metrics::AddCollector(const Collector& collector) {
+    MetricRegistry* registry = GetRegistry();
+    MutexLock lock(&registry->mu);
+    int id = registry->next_collector++;
+    registry->collectors[id] = collector;
+    return id;
+}
+
+void Metrics::RemoveCollector(int id) {
+    MetricRegistry* registry = GetRegistry();
+    MutexLock collect_lock(&registry->collect_mu);
+    MutexLock lock(&registry->mu);
+    registry->collectors.erase(id);
+}
+
+void Metrics::AddValue(const std::string& name, const std::string& help,
+                       MetricType type, int64_t value, GetMetricsResponse* response) {
+    Metric* metric = response->add_metrics();
+    SetName(name, metric);
+    metric->set_help(help);
+    metric->set_type(type);
+    metric->set_value(value);
+}
+
+void Metrics::Collect(const std::string& prefix, GetMetricsResponse* response) {
+    MetricRegistry* registry = GetRegistry();
+    MutexLock collect_lock(&registry->collect_mu);
+    GetMetricsResponse all;
+    std::map<int, Collector> collectors;
+    {
+        MutexLock lock(&registry->mu);
+        std::map<std::string, MetricEntry>::iterator it;
+        for (it = registry->entries.begin(); it != registry->entries.end(); ++it) {
+            if (it->first.compare(0, prefix.size(), prefix) != 0) {
+                continue;
+            }
+            const MetricEntry& entry = it->second;
+            Metric* metric = all.add_metrics();
+            SetName(it->first, metric);
+            metric->set_help(entry.help);
+            metric->set_type(entry.type);
+            switch (entry.type) {
+            case kCounterMetric:
+                metric->set_value(static_cast<Counter*>(entry.metric)->Value());
+                break;
+            case kGaugeMetric:
+                metric->set_value(static_cast<Gauge*>(entry.metric)->Value());
+                break;
+            case kHistogramMetric:
+                static_cast<Histogram*>(entry.metric)->Fill(metric);
+                break;
+            }
+        }
+        collectors = registry->collectors;
+    }
+    // Out of the lock of metrics, collectors take locks of their own
+    std::map<int, Collector>::iterator ct;
+    for (ct = collectors.begin(); ct != collectors.end(); ++ct) {
+        GetMetricsResponse collected;
+        ct->second(&collected);
+        for (int i = 0; i < collected.metrics_size(); i++) {
+            if (collected.metrics(i).name().compare(0, prefix.size(), prefix) == 0) {
+                all.add_metrics()->CopyFrom(collected.metrics(i));
+            }
+        }
+    }
+    std::vector<Metric> sorted(all.metrics().begin(), all.metrics().end());
+    std::stable_sort(sorted.begin(), sorted.end(), MetricLess);
+    for (size_t i = 0; i < sorted.size(); i++) {
+        response->add_metrics()->CopyFrom(sorted[i]);
+    }
+}
+
+int64_t Metrics::NowUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+} //namespace shuttle
+} //namespace baidu
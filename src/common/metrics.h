@@ -0,0 +1,112 @@
+#ifndef _BAIDU_SHUTTLE_COMMON_METRICS_H_
+#define _BAIDU_SHUTTLE_COMMON_METRICS_H_
+
+#include <stdint.h>
+#include <string>
+#include <boost/function.hpp>
+#include "proto/shuttle.pb.h"
+
+namespace baidu {
+namespace shuttle {
+
+// Writers add to the shard of their thread, so threads busy on the same
+// metric do not bounce a cache line, and readers sum the shards
+const static int kMetricShards = 8;
+
+struct MetricCell {
+    volatile int64_t value;
+    char pad[64 - sizeof(int64_t)];
+};
+
+// Only goes up, e.g. the tasks finished
+class Counter {
+public:
+    Counter();
+    void Add(int64_t n);
+    void Inc() {
+        Add(1);
+    }
+    int64_t Value() const;
+private:
+    MetricCell cells_[kMetricShards];
+};
+
+// Goes up and down, e.g. the rpcs being served
+class Gauge {
+public:
+    Gauge() : value_(0) { }
+    void Set(int64_t value);
+    void Add(int64_t n);
+    int64_t Value() const {
+        return value_;
+    }
+private:
+    volatile int64_t value_;
+};
+
+// Distribution of values such as latencies. Buckets are log-linear as in
+// HdrHistogram, 16 in each power of 2, so a percentile is off by less
+// than 1/16 of it. Values are clamped to [0, 2^40)
+class Histogram {
+public:
+    const static int kSubBucketBits = 4;
+    const static int kMaxValueBits = 40;
+    const static int kBuckets = (kMaxValueBits - kSubBucketBits + 1) << kSubBucketBits;
+
+    Histogram();
+    ~Histogram();
+    void Add(int64_t value);
+    // Count, sum, max and percentiles of all shards
+    void Fill(Metric* metric) const;
+    static int BucketOf(int64_t value);
+    // The largest value falling into bucket
+    static int64_t BucketBound(int bucket);
+private:
+    struct Shard {
+        volatile int64_t count;
+        volatile int64_t sum;
+        volatile int64_t max;
+        volatile int64_t buckets[kBuckets];
+        char pad[64];
+    };
+    Shard* shards_;
+};
+
+// Adds the us from construction to destruction to histogram, and counts
+// itself in in_flight meanwhile unless it is NULL
+class LatencyScope {
+public:
+    explicit LatencyScope(Histogram* histogram, Gauge* in_flight = NULL);
+    ~LatencyScope();
+private:
+    Histogram* histogram_;
+    Gauge* in_flight_;
+    int64_t begin_;
+};
+
+// Process-wide registry read by the GetMetrics rpc of master and minion.
+// Names follow Prometheus and may carry labels, e.g.
+// shuttle_minion_tasks_total{state="failed"}, the same name gives the same
+// metric, which lives as long as the process, so callers keep pointers
+class Metrics {
+public:
+    typedef boost::function<void (GetMetricsResponse*)> Collector;
+
+    static Counter* GetCounter(const std::string& name, const std::string& help);
+    static Gauge* GetGauge(const std::string& name, const std::string& help);
+    static Histogram* GetHistogram(const std::string& name, const std::string& help);
+    // Collectors add values computed when read, e.g. the tasks of each job
+    static int AddCollector(const Collector& collector);
+    static void RemoveCollector(int id);
+    // Adds a value to the response of a collector
+    static void AddValue(const std::string& name, const std::string& help,
+                         MetricType type, int64_t value, GetMetricsResponse* response);
+    // Metrics with names starting with prefix, ordered by name
+    static void Collect(const std::string& prefix, GetMetricsResponse* response);
+    static int64_t NowUs();
+};
+
+} //namespace shuttle
+} //namespace baidu
+
+#endif
@@ -0,0 +1,104 @@
+#include <gtest/gtest.h>
+#include <pthread.h>
+#include <string>
+#include "metrics.h"
+
+using namespace baidu::shuttle;
+
+TEST(Histogram, Buckets) {
+    // Exact below 16, then 16 buckets in each power of 2
+    for (int64_t v = 0; v < 16; v++) {
+        EXPECT_EQ(Histogram::BucketOf(v), v);
+        EXPECT_EQ(Histogram::BucketBound(v), v);
+    }
+    EXPECT_EQ(Histogram::BucketOf(16), 16);
+    EXPECT_EQ(Histogram::BucketOf(32), 32);
+    EXPECT_EQ(Histogram::BucketOf(33), 32);
+    EXPECT_EQ(Histogram::BucketBound(32), 33);
+    EXPECT_EQ(Histogram::BucketOf(-1), 0);
+    EXPECT_EQ(Histogram::BucketOf(1L << 50), Histogram::kBuckets - 1);
+    // Every value falls into a bucket bounding it within 1/16
+    int last = 0;
+    for (int64_t v = 1; v < (1L << 30); v += v / 7 + 1) {
+        int bucket = Histogram::BucketOf(v);
+        EXPECT_GE(bucket, last);
+        EXPECT_GE(Histogram::BucketBound(bucket), v);
+        EXPECT_LE(Histogram::BucketBound(bucket) - v, v / 16);
+        last = bucket;
+    }
+}
+
+TEST(Histogram, Percentiles) {
+    Histogram histogram;
+    for (int64_t v = 1; v <= 1000; v++) {
+        histogram.Add(v);
+    }
+    Metric metric;
+    histogram.Fill(&metric);
+    EXPECT_EQ(metric.count(), 1000);
+    EXPECT_EQ(metric.sum(), 500500);
+    EXPECT_EQ(metric.max(), 1000);
+    EXPECT_GE(metric.p50(), 500);
+    EXPECT_LE(metric.p50(), 500 + 500 / 16);
+    EXPECT_GE(metric.p99(), 990);
+    EXPECT_LE(metric.p999(), 1000);
+}
+
+static void* AddMany(void* arg) {
+    Counter* counter = static_cast<Counter*>(arg);
+    for (int i = 0; i < 100000; i++) {
+        counter->Inc();
+    }
+    return NULL;
+}
+
+TEST(Counter, Threads) {
+    Counter counter;
+    pthread_t threads[4];
+    for (int i = 0; i < 4; i++) {
+        pthread_create(&threads[i], NULL, AddMany, &counter);
+    }
+    for (int i = 0; i < 4; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    EXPECT_EQ(counter.Value(), 400000);
+}
+
+static void CollectJobs(GetMetricsResponse* response) {
+    Metrics::AddValue("test_running_tasks{job=\"job_1\"}", "tasks", kGaugeMetric, 3, response);
+    Metrics::AddValue("other_metric", "", kGaugeMetric, 1, response);
+}
+
+TEST(Metrics, Collect) {
+    Counter* counter = Metrics::GetCounter("test_tasks_total{state=\"failed\"}", "tasks");
+    EXPECT_EQ(counter, Metrics::GetCounter("test_tasks_total{state=\"failed\"}", "tasks"));
+    counter->Add(2);
+    Metrics::GetGauge("test_slots", "slots")->Set(5);
+    Metrics::GetHistogram("test_latency_us", "latency")->Add(100);
+    int id = Metrics::AddCollector(CollectJobs);
+
+    GetMetricsResponse response;
+    Metrics::Collect("test_", &response);
+    ASSERT_EQ(response.metrics_size(), 4);
+    EXPECT_EQ(response.metrics(0).name(), "test_latency_us");
+    EXPECT_EQ(response.metrics(0).type(), kHistogramMetric);
+    EXPECT_EQ(response.metrics(0).count(), 1);
+    EXPECT_EQ(response.metrics(1).name(), "test_running_tasks");
+    EXPECT_EQ(response.metrics(1).labels(), "job=\"job_1\"");
+    EXPECT_EQ(response.metrics(1).value(), 3);
+    EXPECT_EQ(response.metrics(2).name(), "test_slots");
+    EXPECT_EQ(response.metrics(2).value(), 5);
+    EXPECT_EQ(response.metrics(3).name(), "test_tasks_total");
+    EXPECT_EQ(response.metrics(3).labels(), "state=\"failed\"");
+    EXPECT_EQ(response.metrics(3).value(), 2);
+
+    Metrics::RemoveCollector(id);
+    response.Clear();
+    Metrics::Collect("test_", &response);
+    EXPECT_EQ(response.metrics_size(), 3);
+}
+
+int main(int argc, char* argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,262 @@
+#include "nexus.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+#include "logging.h"
+
+using baidu::common::WARNING;
+
+namespace baidu {
+namespace shuttle {
+
+static const std::string sLocalScheme = "local:";
+
+class InsNexus : public Nexus {
+public:
+    class InsScanResult : public ScanResult {
+    public:
+        explicit InsScanResult(::galaxy::ins::sdk::ScanResult* result) : result_(result) { }
+        virtual ~InsScanResult() {
+            delete result_;
+        }
+        bool Done() {
+            return result_->Done();
+        }
+        void Next() {
+            result_->Next();
+        }
+        const std::string Key() {
+            return result_->Key();
+        }
+        const std::string Value() {
+            return result_->Value();
+        }
+    private:
+        ::galaxy::ins::sdk::ScanResult* result_;
+    };
+
+    explicit InsNexus(const std::string& servers) : ins_(servers) { }
+    bool Put(const std::string& key, const std::string& value,
+             ::galaxy::ins::sdk::SDKError* error) {
+        return ins_.Put(key, value, error);
+    }
+    bool Get(const std::string& key, std::string* value,
+             ::galaxy::ins::sdk::SDKError* error) {
+        return ins_.Get(key, value, error);
+    }
+    bool Delete(const std::string& key, ::galaxy::ins::sdk::SDKError* error) {
+        return ins_.Delete(key, error);
+    }
+    ScanResult* Scan(const std::string& start_key, const std::string& end_key) {
+        ::galaxy::ins::sdk::ScanResult* result = ins_.Scan(start_key, end_key);
+        return result == NULL ? NULL : new InsScanResult(result);
+    }
+    bool Watch(const std::string& key, ::galaxy::ins::sdk::WatchCallback callback,
+               void* context, ::galaxy::ins::sdk::SDKError* error) {
+        return ins_.Watch(key, callback, context, error);
+    }
+    bool Lock(const std::string& key, ::galaxy::ins::sdk::SDKError* error) {
+        return ins_.Lock(key, error);
+    }
+    std::string GetSessionID() {
+        return ins_.GetSessionID();
+    }
+    void RegisterSessionTimeout(void (*handler)(void*), void* context) {
+        ins_.RegisterSessionTimeout(handler, context);
+    }
+private:
+    ::galaxy::ins::sdk::InsSDK ins_;
+};
+
+// A file for each key, replaced by rename so that readers of other
+// processes never see it half written. There is only one session, and
+// locks are taken at once
+class LocalNexus : public Nexus {
+public:
+    typedef std::vector<std::pair<std::string, std::string> > Records;
+    class LocalScanResult : public ScanResult {
+    public:
+        explicit LocalScanResult(Records* records) : cur_(0) {
+            records_.swap(*records);
+        }
+        bool Done() {
+            return cur_ >= records_.size();
+        }
+        void Next() {
+            ++cur_;
+        }
+        const std::string Key() {
+            return records_[cur_].first;
+        }
+        const std::string Value() {
+            return records_[cur_].second;
+        }
+    private:
+        Records records_;
+        size_t cur_;
+    };
+
+    explicit LocalNexus(const std::string& dir) : dir_(dir) {
+        session_id_ = "local_" + boost::lexical_cast<std::string>(getpid())
+            + "_" + boost::lexical_cast<std::string>(time(NULL));
+        std::string cmd = "mkdir -p " + dir_;
+        if (system(cmd.c_str()) != 0) {
+            LOG(WARNING, "fail to create local nexus: %s", dir_.c_str());
+        }
+    }
+    bool Put(const std::string& key, const std::string& value,
+             ::galaxy::ins::sdk::SDKError* error) {
+        std::string tmp = dir_ + "/.put_XXXXXX";
+        int fd = mkstemp(&tmp[0]);
+        bool ok = fd >= 0;
+        size_t written = 0;
+        while (ok && written < value.size()) {
+            ssize_t ret = write(fd, value.data() + written, value.size() - written);
+            ok = ret > 0;
+            written += ok ? ret : 0;
+        }
+        if (fd >= 0) {
+            ok = (close(fd) == 0) && ok;
+            ok = ok && rename(tmp.c_str(), KeyPath(key).c_str()) == 0;
+            if (!ok) {
+                unlink(tmp.c_str());
+            }
+        }
+        if (!ok) {
+            LOG(WARNING, "fail to put %s: %s", key.c_str(), strerror(errno));
+        }
+        SetError(error, ok ? ::galaxy::ins::sdk::kOK : ::galaxy::ins::sdk::kClusterDown);
+        return ok;
+    }
+    bool Get(const std::string& key, std::string* value,
+             ::galaxy::ins::sdk::SDKError* error) {
+        if (!ReadFile(KeyPath(key), value)) {
+            SetError(error, ::galaxy::ins::sdk::kNoSuchKey);
+            return false;
+        }
+        SetError(error, ::galaxy::ins::sdk::kOK);
+        return true;
+    }
+    bool Delete(const std::string& key, ::galaxy::ins::sdk::SDKError* error) {
+        bool ok = unlink(KeyPath(key).c_str()) == 0 || errno == ENOENT;
+        SetError(error, ok ? ::galaxy::ins::sdk::kOK : ::galaxy::ins::sdk::kClusterDown);
+        return ok;
+    }
+    ScanResult* Scan(const std::string& start_key, const std::string& end_key) {
+        DIR* dir = opendir(dir_.c_str());
+        if (dir == NULL) {
+            return NULL;
+        }
+        Records records;
+        struct dirent* entry = NULL;
+        while ((entry = readdir(dir)) != NULL) {
+            if (entry->d_name[0] == '.') {
+                continue;
+            }
+            std::string key = Unescape(entry->d_name);
+            if (key < start_key || (!end_key.empty() && key >= end_key)) {
+                continue;
+            }
+            std::string value;
+            if (ReadFile(dir_ + "/" + entry->d_name, &value)) {
+                records.push_back(std::make_pair(key, value));
+            }
+        }
+        closedir(dir);
+        std::sort(records.begin(), records.end());
+        return new LocalScanResult(&records);
+    }
+    bool Watch(const std::string& /*key*/, ::galaxy::ins::sdk::WatchCallback /*callback*/,
+               void* /*context*/, ::galaxy::ins::sdk::SDKError* error) {
+        // Nothing else takes the lock
+        SetError(error, ::galaxy::ins::sdk::kOK);
+        return true;
+    }
+    bool Lock(const std::string& key, ::galaxy::ins::sdk::SDKError* error) {
+        return Put(key, session_id_, error);
+    }
+    std::string GetSessionID() {
+        return session_id_;
+    }
+    void RegisterSessionTimeout(void (* /*handler*/)(void*), void* /*context*/) {
+    }
+private:
+    static void SetError(::galaxy::ins::sdk::SDKError* error,
+                         ::galaxy::ins::sdk::SDKError value) {
+        if (error != NULL) {
+            *error = value;
+        }
+    }
+    static bool ReadFile(const std::string& path, std::string* value) {
+        FILE* fp = fopen(path.c_str(), "r");
+        if (fp == NULL) {
+            return false;
+        }
+        value->clear();
+        char buf[4096];
+        size_t len = 0;
+        while ((len = fread(buf, 1, sizeof(buf), fp)) > 0) {
+            value->append(buf, len);
+        }
+        bool ok = !ferror(fp);
+        fclose(fp);
+        return ok;
+    }
+    // Keys have slashes and any byte, names of files keep letters and digits
+    std::string KeyPath(const std::string& key) const {
+        std::string name;
+        for (size_t i = 0; i < key.size(); i++) {
+            unsigned char c = key[i];
+            if (isalnum(c) || c == '_' || c == '-') {
+                name.push_back(c);
+            } else {
+                char hex[4];
+                snprintf(hex, sizeof(hex), "%%%02X", c);
+                name.append(hex);
+            }
+        }
+        return dir_ + "/" + name;
+    }
+    static std::string Unescape(const std::string& name) {
+        std::string key;
+        for (size_t i = 0; i < name.size(); i++) {
+            if (name[i] == '%' && i + 2 < name.size()) {
+                key.push_back(static_cast<char>(strtol(name.substr(i + 1, 2).c_str(), NULL, 16)));
+                i += 2;
+            } else {
+                key.push_back(name[i]);
+            }
+        }
+        return key;
+    }
+private:
+    std::string dir_;
+    std::string session_id_;
+};
+
+bool Nexus::IsLocal(const std::string& servers) {
+    return boost::starts_with(servers, sLocalScheme);
+}
+
+Nexus* Nexus::Create(const std::string& servers) {
+    if (IsLocal(servers)) {
+        return new LocalNexus(servers.substr(sLocalScheme.size()));
+    }
+    return new InsNexus(servers);
+}
+
+}
+}
@@ -0,0 +1,47 @@
+#ifndef _BAIDU_SHUTTLE_COMMON_NEXUS_H_
+#define _BAIDU_SHUTTLE_COMMON_NEXUS_H_
+
+#include <string>
+#include "ins_sdk.h"
+
+namespace baidu {
+namespace shuttle {
+
+// Key-value store keeping the state of master, its lock and address. It is
+// iNexus in clusters, and a directory shared by the processes of a cluster
+// on one host, see mini/mini_cluster.cc
+class Nexus {
+public:
+    class ScanResult {
+    public:
+        virtual ~ScanResult() {}
+        virtual bool Done() = 0;
+        virtual void Next() = 0;
+        virtual const std::string Key() = 0;
+        virtual const std::string Value() = 0;
+    };
+    // Servers of iNexus, or local:<dir>
+    static Nexus* Create(const std::string& servers);
+    static bool IsLocal(const std::string& servers);
+    virtual ~Nexus() {}
+
+    // Errors are left out when error is NULL
+    virtual bool Put(const std::string& key, const std::string& value,
+                     ::galaxy::ins::sdk::SDKError* error) = 0;
+    virtual bool Get(const std::string& key, std::string* value,
+                     ::galaxy::ins::sdk::SDKError* error) = 0;
+    virtual bool Delete(const std::string& key, ::galaxy::ins::sdk::SDKError* error) = 0;
+    // Keys in [start_key, end_key), in order
+    virtual ScanResult* Scan(const std::string& start_key, const std::string& end_key) = 0;
+    virtual bool Watch(const std::string& key, ::galaxy::ins::sdk::WatchCallback callback,
+                       void* context, ::galaxy::ins::sdk::SDKError* error) = 0;
+    // Blocks until the lock is held by this session
+    virtual bool Lock(const std::string& key, ::galaxy::ins::sdk::SDKError* error) = 0;
+    virtual std::string GetSessionID() = 0;
+    virtual void RegisterSessionTimeout(void (*handler)(void*), void* context) = 0;
+};
+
+}
+}
+
+#endif
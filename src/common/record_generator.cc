@@ -0,0 +1,75 @@
+#include "record_generator.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+
+namespace baidu {
+namespace shuttle {
+
+RecordGenerator::RecordGenerator(int key_size, int value_size, int distinct_keys,
+                                 double skew, uint32_t seed)
+    : key_size_(key_size), value_size_(value_size), seed_(seed == 0 ? 1 : seed),
+      distinct_keys_(std::max(distinct_keys, 1)) {
+    if (skew <= 0) {
+        return;
+    }
+    cdf_.resize(distinct_keys_);
+    double sum = 0;
+    for (int i = 0; i < distinct_keys_; i++) {
+        sum += 1.0 / pow(i + 1, skew);
+        cdf_[i] = sum;
+    }
+    for (int i = 0; i < distinct_keys_; i++) {
+        cdf_[i] /= sum;
+    }
+}
+
+uint32_t RecordGenerator::Random() {
+    // xorshift32, the same records for the same seed on all hosts
+    seed_ ^= seed_ << 13;
+    seed_ ^= seed_ >> 17;
+    seed_ ^= seed_ << 5;
+    return seed_;
+}
+
+void RecordGenerator::FormatKey(int rank, std::string* key) {
+    char digits[32];
+    int len = snprintf(digits, sizeof(digits), "%d", rank);
+    key->assign(std::max(key_size_ - len, 0), '0');
+    key->append(digits, len);
+}
+
+void RecordGenerator::Next(std::string* key, std::string* value) {
+    int rank = 0;
+    if (cdf_.empty()) {
+        rank = Random() % distinct_keys_;
+    } else {
+        double p = Random() / 4294967296.0;
+        rank = std::lower_bound(cdf_.begin(), cdf_.end(), p) - cdf_.begin();
+        rank = std::min(rank, distinct_keys_ - 1);
+    }
+    FormatKey(rank, key);
+    value->resize(value_size_);
+    for (int i = 0; i < value_size_; i++) {
+        (*value)[i] = 'a' + Random() % 26;
+    }
+}
+
+void RecordGenerator::NextLine(std::string* line) {
+    std::string value;
+    Next(line, &value);
+    line->push_back('\t');
+    line->append(value);
+}
+
+void RecordGenerator::Sorted(int n, std::vector<std::pair<std::string, std::string> >* records) {
+    records->resize(n);
+    for (int i = 0; i < n; i++) {
+        Next(&(*records)[i].first, &(*records)[i].second);
+    }
+    std::sort(records->begin(), records->end());
+}
+
+} //namespace shuttle
+} //namespace baidu
@@ -0,0 +1,39 @@
+#ifndef _BAIDU_SHUTTLE_COMMON_RECORD_GENERATOR_H_
+#define _BAIDU_SHUTTLE_COMMON_RECORD_GENERATOR_H_
+
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace baidu {
+namespace shuttle {
+
+// Records with keys drawn from distinct_keys ones. Ranks of keys follow a
+// Zipf distribution of skew, 0 for a uniform one, and key 0 is the most
+// frequent. Keys are padded to key_size, values are random printable bytes
+class RecordGenerator {
+public:
+    RecordGenerator(int key_size, int value_size, int distinct_keys,
+                    double skew, uint32_t seed);
+    void Next(std::string* key, std::string* value);
+    // A line of key, a tab and value, as streaming apps write
+    void NextLine(std::string* line);
+    // n records ordered by key, as sorted files hold them
+    void Sorted(int n, std::vector<std::pair<std::string, std::string> >* records);
+private:
+    uint32_t Random();
+    void FormatKey(int rank, std::string* key);
+private:
+    int key_size_;
+    int value_size_;
+    uint32_t seed_;
+    // Cumulative probability of each rank, empty if uniform
+    std::vector<double> cdf_;
+    int distinct_keys_;
+};
+
+} //namespace shuttle
+} //namespace baidu
+
+#endif
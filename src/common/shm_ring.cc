@@ -0,0 +1,339 @@
+#include "shm_ring.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+namespace baidu {
+namespace shuttle {
+
+const static uint32_t sShmRingMagic = 0x53485247;
+const static uint32_t sShmRingVersion = 1;
+const static long sWaitTimeoutMs = 100;
+
+// Lives in the first page of the object. Fields of the writer and of
+// the reader are kept on separate cache lines
+struct ShmRingHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t capacity;
+    char pad0[48];
+    // Bytes ever committed, only moved by the writer
+    volatile uint64_t head;
+    volatile int32_t data_seq;
+    volatile int32_t reader_waiting;
+    volatile int32_t writer_closed;
+    volatile int32_t writer_pid;
+    char pad1[40];
+    // Bytes ever consumed, only moved by the reader
+    volatile uint64_t tail;
+    volatile int32_t space_seq;
+    volatile int32_t writer_waiting;
+    volatile int32_t reader_closed;
+    volatile int32_t reader_pid;
+    char pad2[40];
+};
+
+static size_t PageSize() {
+    static size_t page_size = sysconf(_SC_PAGESIZE);
+    return page_size;
+}
+
+static size_t HeaderSize() {
+    size_t page_size = PageSize();
+    return (sizeof(ShmRingHeader) + page_size - 1) / page_size * page_size;
+}
+
+ShmRing::ShmRing(const std::string& name, Role role, bool owner)
+    : name_(name), role_(role), owner_(owner), header_(NULL),
+      data_(NULL), capacity_(0), map_size_(0) {
+}
+
+ShmRing::~ShmRing() {
+    if (header_ != NULL) {
+        munmap(header_, map_size_);
+    }
+    Unlink();
+}
+
+void ShmRing::Unlink() {
+    if (owner_) {
+        shm_unlink(name_.c_str());
+        owner_ = false;
+    }
+}
+
+bool ShmRing::Map(int fd, size_t capacity) {
+    size_t header_size = HeaderSize();
+    map_size_ = header_size + capacity * 2;
+    // Reserves the address range first, then maps the data area into
+    // both halves of it
+    void* base = mmap(NULL, map_size_, PROT_NONE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+        return false;
+    }
+    char* addr = static_cast<char*>(base);
+    if (mmap(addr, header_size + capacity, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED
+        || mmap(addr + header_size + capacity, capacity, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_FIXED, fd, header_size) == MAP_FAILED) {
+        munmap(base, map_size_);
+        return false;
+    }
+    header_ = reinterpret_cast<ShmRingHeader*>(addr);
+    data_ = addr + header_size;
+    capacity_ = capacity;
+    return true;
+}
+
+ShmRing* ShmRing::Create(const std::string& name, size_t capacity, Role role) {
+    size_t page_size = PageSize();
+    capacity = (capacity + page_size - 1) / page_size * page_size;
+    if (capacity == 0) {
+        capacity = page_size;
+    }
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd == -1 && errno == EEXIST) {
+        // Left over by a process which has been killed
+        shm_unlink(name.c_str());
+        fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    }
+    if (fd == -1) {
+        return NULL;
+    }
+    ShmRing* ring = new ShmRing(name, role, true);
+    bool ok = ftruncate(fd, HeaderSize() + capacity) == 0
+        && ring->Map(fd, capacity);
+    close(fd);
+    if (!ok) {
+        delete ring;
+        return NULL;
+    }
+    ShmRingHeader* header = ring->header_;
+    memset(header, 0, sizeof(ShmRingHeader));
+    header->capacity = capacity;
+    header->version = sShmRingVersion;
+    if (role == kReader) {
+        header->reader_pid = getpid();
+    } else {
+        header->writer_pid = getpid();
+    }
+    __sync_synchronize();
+    header->magic = sShmRingMagic;
+    return ring;
+}
+
+ShmRing* ShmRing::Attach(const std::string& name, Role role) {
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd == -1) {
+        return NULL;
+    }
+    struct stat st;
+    size_t header_size = HeaderSize();
+    if (fstat(fd, &st) != 0 || st.st_size <= (off_t)header_size) {
+        close(fd);
+        return NULL;
+    }
+    ShmRing* ring = new ShmRing(name, role, false);
+    bool ok = ring->Map(fd, st.st_size - header_size);
+    close(fd);
+    if (!ok || ring->header_->magic != sShmRingMagic
+            || ring->header_->version != sShmRingVersion
+            || ring->header_->capacity != ring->capacity_) {
+        delete ring;
+        return NULL;
+    }
+    // The process that really reads or writes takes over the side, so
+    // it is the one watched by the peer
+    if (role == kReader) {
+        ring->header_->reader_pid = getpid();
+    } else {
+        ring->header_->writer_pid = getpid();
+    }
+    __sync_synchronize();
+    return ring;
+}
+
+bool ShmRing::PeerGone(int32_t pid) const {
+    return pid > 0 && kill(pid, 0) == -1 && errno == ESRCH;
+}
+
+bool ShmRing::Wait(volatile int32_t* seq, int32_t expected) {
+    struct timespec timeout;
+    timeout.tv_sec = 0;
+    timeout.tv_nsec = sWaitTimeoutMs * 1000000;
+    syscall(SYS_futex, seq, FUTEX_WAIT, expected, &timeout, NULL, 0);
+    if (!give_up_.empty() && give_up_()) {
+        return false;
+    }
+    int32_t peer = role_ == kReader ? header_->writer_pid : header_->reader_pid;
+    return !PeerGone(peer);
+}
+
+void ShmRing::Wake(volatile int32_t* seq, volatile int32_t* waiting) {
+    __sync_synchronize();
+    if (*waiting) {
+        *waiting = 0;
+        __sync_fetch_and_add(seq, 1);
+        syscall(SYS_futex, seq, FUTEX_WAKE, 1, NULL, NULL, 0);
+    }
+}
+
+char* ShmRing::Reserve(size_t len) {
+    if (len > capacity_) {
+        return NULL;
+    }
+    uint64_t head = header_->head;
+    while (!header_->reader_closed) {
+        int32_t seq = header_->space_seq;
+        __sync_synchronize();
+        if (capacity_ - (head - header_->tail) >= len) {
+            return data_ + head % capacity_;
+        }
+        header_->writer_waiting = 1;
+        __sync_synchronize();
+        if (capacity_ - (head - header_->tail) >= len || header_->reader_closed) {
+            continue;
+        }
+        if (!Wait(&header_->space_seq, seq)) {
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+void ShmRing::Commit(size_t len) {
+    // Data must land before the position that publishes it
+    __sync_synchronize();
+    header_->head = header_->head + len;
+    Wake(&header_->data_seq, &header_->reader_waiting);
+}
+
+bool ShmRing::Write(const char* data, size_t len) {
+    // Large writes go in pieces, so the reader starts before the end
+    size_t piece_limit = capacity_ / 2;
+    while (len > 0) {
+        size_t piece = len < piece_limit ? len : piece_limit;
+        char* buf = Reserve(piece);
+        if (buf == NULL) {
+            return false;
+        }
+        memcpy(buf, data, piece);
+        Commit(piece);
+        data += piece;
+        len -= piece;
+    }
+    return true;
+}
+
+void ShmRing::CloseWrite() {
+    __sync_synchronize();
+    header_->writer_closed = 1;
+    // Wakes the reader whether or not it has announced a wait
+    header_->reader_waiting = 1;
+    Wake(&header_->data_seq, &header_->reader_waiting);
+}
+
+size_t ShmRing::Peek(const char** data, size_t min_len) {
+    uint64_t tail = header_->tail;
+    if (min_len > capacity_) {
+        min_len = capacity_;
+    }
+    while (true) {
+        int32_t seq = header_->data_seq;
+        __sync_synchronize();
+        if (header_->head - tail >= min_len || header_->writer_closed) {
+            break;
+        }
+        header_->reader_waiting = 1;
+        __sync_synchronize();
+        if (header_->head - tail >= min_len || header_->writer_closed) {
+            continue;
+        }
+        if (!Wait(&header_->data_seq, seq)) {
+            // Whatever the writer committed before going is still read
+            break;
+        }
+    }
+    __sync_synchronize();
+    *data = data_ + tail % capacity_;
+    return header_->head - tail;
+}
+
+void ShmRing::Consume(size_t len) {
+    __sync_synchronize();
+    header_->tail = header_->tail + len;
+    Wake(&header_->space_seq, &header_->writer_waiting);
+}
+
+void ShmRing::CloseRead() {
+    __sync_synchronize();
+    header_->reader_closed = 1;
+    header_->writer_waiting = 1;
+    Wake(&header_->space_seq, &header_->writer_waiting);
+}
+
+ShmRingStreamBuf::ShmRingStreamBuf(ShmRing* ring)
+    : ring_(ring), chunk_size_(ring->Capacity() / 4) {
+}
+
+ShmRingStreamBuf::~ShmRingStreamBuf() {
+    sync();
+}
+
+bool ShmRingStreamBuf::Reset() {
+    char* buf = ring_->Reserve(chunk_size_);
+    if (buf == NULL) {
+        setp(NULL, NULL);
+        return false;
+    }
+    setp(buf, buf + chunk_size_);
+    return true;
+}
+
+ShmRingStreamBuf::int_type ShmRingStreamBuf::overflow(int_type c) {
+    if (sync() != 0 || !Reset()) {
+        return traits_type::eof();
+    }
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+    }
+    return traits_type::not_eof(c);
+}
+
+std::streamsize ShmRingStreamBuf::xsputn(const char* s, std::streamsize n) {
+    std::streamsize done = 0;
+    while (done < n) {
+        if (pptr() == epptr() && overflow(traits_type::eof()) == traits_type::eof()) {
+            break;
+        }
+        std::streamsize room = epptr() - pptr();
+        std::streamsize piece = n - done < room ? n - done : room;
+        memcpy(pptr(), s + done, piece);
+        pbump(piece);
+        done += piece;
+    }
+    return done;
+}
+
+int ShmRingStreamBuf::sync() {
+    // Reserved space stays in place, only what is written is published
+    if (pptr() != pbase()) {
+        size_t len = pptr() - pbase();
+        ring_->Commit(len);
+        setp(pptr(), epptr());
+    }
+    return 0;
+}
+
+} //namespace shuttle
+} //namespace baidu
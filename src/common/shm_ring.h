@@ -0,0 +1,103 @@
+#ifndef _BAIDU_SHUTTLE_COMMON_SHM_RING_H_
+#define _BAIDU_SHUTTLE_COMMON_SHM_RING_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <string>
+#include <streambuf>
+#include <boost/function.hpp>
+
+namespace baidu {
+namespace shuttle {
+
+struct ShmRingHeader;
+
+// Single-producer single-consumer byte stream in a POSIX shared memory
+// object. The data area is mapped twice back to back, so every readable
+// or writable span is contiguous and is handed out without copies.
+// Positions are published with barriers, and futexes are only touched
+// when the other side is asleep on an empty or a full ring
+class ShmRing {
+public:
+    enum Role {
+        kReader = 0,
+        kWriter = 1
+    };
+    // Creates the object under name, which must start with '/', and
+    // unlinks it again when the creator is destroyed
+    static ShmRing* Create(const std::string& name, size_t capacity, Role role);
+    // Attaches to a ring made by Create, on the opposite side of it
+    static ShmRing* Attach(const std::string& name, Role role);
+    ~ShmRing();
+    // Removes the name, the ring stays mapped until destruction
+    void Unlink();
+
+    const std::string& Name() const {
+        return name_;
+    }
+    size_t Capacity() const {
+        return capacity_;
+    }
+    Role GetRole() const {
+        return role_;
+    }
+    // Polled while waiting for the peer, a wait is abandoned and fails
+    // once it returns true
+    void SetGiveUpChecker(const boost::function<bool ()>& give_up) {
+        give_up_ = give_up;
+    }
+
+    // Writer side. Reserve waits for len contiguous free bytes, which
+    // become visible to the reader with Commit. NULL means the reader
+    // has gone, or len is larger than the ring
+    char* Reserve(size_t len);
+    void Commit(size_t len);
+    bool Write(const char* data, size_t len);
+    // Marks the end of the stream
+    void CloseWrite();
+
+    // Reader side. Peek waits for at least min_len bytes and returns the
+    // size of the readable span, which is shorter only at the end of the
+    // stream, and 0 when nothing is left
+    size_t Peek(const char** data, size_t min_len = 1);
+    void Consume(size_t len);
+    // Tells the writer nobody is reading anymore, like closing a pipe
+    void CloseRead();
+private:
+    ShmRing(const std::string& name, Role role, bool owner);
+    bool Map(int fd, size_t capacity);
+    bool PeerGone(int32_t pid) const;
+    bool Wait(volatile int32_t* seq, int32_t expected);
+    void Wake(volatile int32_t* seq, volatile int32_t* waiting);
+private:
+    std::string name_;
+    Role role_;
+    bool owner_;
+    ShmRingHeader* header_;
+    char* data_;
+    size_t capacity_;
+    size_t map_size_;
+    boost::function<bool ()> give_up_;
+};
+
+// Lets streams of the standard library write into a ring
+class ShmRingStreamBuf : public std::streambuf {
+public:
+    explicit ShmRingStreamBuf(ShmRing* ring);
+    virtual ~ShmRingStreamBuf();
+protected:
+    virtual int_type overflow(int_type c);
+    virtual std::streamsize xsputn(const char* s, std::streamsize n);
+    virtual int sync();
+private:
+    bool Reset();
+private:
+    ShmRing* ring_;
+    size_t chunk_size_;
+};
+
+} //namespace shuttle
+} //namespace baidu
+
+#endif
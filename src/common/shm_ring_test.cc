@@ -0,0 +1,162 @@
+#include <gtest/gtest.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <string>
+#include <boost/lexical_cast.hpp>
+#include <boost/scoped_ptr.hpp>
+#include "shm_ring.h"
+
+using namespace baidu::shuttle;
+
+static std::string RingName(const std::string& test) {
+    return "/shuttle_ring_test_" + test + "_"
+        + boost::lexical_cast<std::string>(getpid());
+}
+
+static bool GiveUp() {
+    return true;
+}
+
+TEST(ShmRing, WrapAround) {
+    const std::string name = RingName("wrap");
+    boost::scoped_ptr<ShmRing> reader(ShmRing::Create(name, 4096, ShmRing::kReader));
+    ASSERT_TRUE(reader != NULL);
+    boost::scoped_ptr<ShmRing> writer(ShmRing::Attach(name, ShmRing::kWriter));
+    ASSERT_TRUE(writer != NULL);
+    const size_t capacity = reader->Capacity();
+    // Each round starts further into the ring, so spans cross its end
+    for (int round = 0; round < 8; round++) {
+        std::string record(capacity * 3 / 4, 'a' + round);
+        record[record.size() - 1] = 'z';
+        ASSERT_TRUE(writer->Write(record.data(), record.size()));
+        const char* data = NULL;
+        size_t len = reader->Peek(&data, record.size());
+        ASSERT_EQ(len, record.size());
+        EXPECT_EQ(std::string(data, len), record);
+        reader->Consume(len);
+    }
+}
+
+TEST(ShmRing, Full) {
+    const std::string name = RingName("full");
+    boost::scoped_ptr<ShmRing> writer(ShmRing::Create(name, 4096, ShmRing::kWriter));
+    ASSERT_TRUE(writer != NULL);
+    boost::scoped_ptr<ShmRing> reader(ShmRing::Attach(name, ShmRing::kReader));
+    ASSERT_TRUE(reader != NULL);
+    const size_t capacity = writer->Capacity();
+    EXPECT_TRUE(writer->Reserve(capacity + 1) == NULL);
+    char* buf = writer->Reserve(capacity);
+    ASSERT_TRUE(buf != NULL);
+    writer->Commit(capacity);
+    // Nothing is free, the wait is abandoned by the checker
+    writer->SetGiveUpChecker(GiveUp);
+    EXPECT_TRUE(writer->Reserve(1) == NULL);
+    const char* data = NULL;
+    ASSERT_EQ(reader->Peek(&data), capacity);
+    reader->Consume(16);
+    EXPECT_TRUE(writer->Reserve(16) != NULL);
+    EXPECT_TRUE(writer->Reserve(17) == NULL);
+}
+
+struct Stream {
+    ShmRing* writer;
+    size_t total;
+};
+
+static void* WriteStream(void* arg) {
+    Stream* stream = static_cast<Stream*>(arg);
+    char buf[1000];
+    for (size_t written = 0; written < stream->total; ) {
+        size_t len = std::min(sizeof(buf), stream->total - written);
+        for (size_t i = 0; i < len; i++) {
+            buf[i] = static_cast<char>((written + i) % 251);
+        }
+        if (!stream->writer->Write(buf, len)) {
+            break;
+        }
+        written += len;
+    }
+    stream->writer->CloseWrite();
+    return NULL;
+}
+
+TEST(ShmRing, BlockedWriter) {
+    const std::string name = RingName("blocked");
+    boost::scoped_ptr<ShmRing> reader(ShmRing::Create(name, 4096, ShmRing::kReader));
+    ASSERT_TRUE(reader != NULL);
+    boost::scoped_ptr<ShmRing> writer(ShmRing::Attach(name, ShmRing::kWriter));
+    ASSERT_TRUE(writer != NULL);
+    // Many times the ring, so the writer keeps waiting for space
+    Stream stream = {writer.get(), reader->Capacity() * 64 + 123};
+    pthread_t thread;
+    pthread_create(&thread, NULL, WriteStream, &stream);
+    size_t read = 0;
+    bool match = true;
+    const char* data = NULL;
+    size_t len = 0;
+    while ((len = reader->Peek(&data)) > 0) {
+        for (size_t i = 0; i < len; i++) {
+            match = match && data[i] == static_cast<char>((read + i) % 251);
+        }
+        read += len;
+        reader->Consume(len);
+    }
+    pthread_join(thread, NULL);
+    EXPECT_TRUE(match);
+    EXPECT_EQ(read, stream.total);
+}
+
+TEST(ShmRing, WriterCloses) {
+    const std::string name = RingName("close");
+    boost::scoped_ptr<ShmRing> reader(ShmRing::Create(name, 4096, ShmRing::kReader));
+    ASSERT_TRUE(reader != NULL);
+    boost::scoped_ptr<ShmRing> writer(ShmRing::Attach(name, ShmRing::kWriter));
+    ASSERT_TRUE(writer != NULL);
+    ASSERT_TRUE(writer->Write("hello", 5));
+    writer->CloseWrite();
+    // Less than asked for is returned at the end of the stream
+    const char* data = NULL;
+    ASSERT_EQ(reader->Peek(&data, 100), 5u);
+    EXPECT_EQ(std::string(data, 5), "hello");
+    reader->Consume(5);
+    EXPECT_EQ(reader->Peek(&data), 0u);
+}
+
+TEST(ShmRing, WriterDies) {
+    const std::string name = RingName("die");
+    boost::scoped_ptr<ShmRing> reader(ShmRing::Create(name, 4096, ShmRing::kReader));
+    ASSERT_TRUE(reader != NULL);
+    pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+    if (pid == 0) {
+        ShmRing* writer = ShmRing::Attach(name, ShmRing::kWriter);
+        if (writer != NULL) {
+            writer->Write("abc", 3);
+        }
+        // Gone without closing the stream
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    // What was committed before is still read, then the stream ends
+    const char* data = NULL;
+    ASSERT_EQ(reader->Peek(&data, 100), 3u);
+    EXPECT_EQ(std::string(data, 3), "abc");
+}
+
+TEST(ShmRing, ReaderCloses) {
+    const std::string name = RingName("reader");
+    boost::scoped_ptr<ShmRing> writer(ShmRing::Create(name, 4096, ShmRing::kWriter));
+    ASSERT_TRUE(writer != NULL);
+    boost::scoped_ptr<ShmRing> reader(ShmRing::Attach(name, ShmRing::kReader));
+    ASSERT_TRUE(reader != NULL);
+    reader->CloseRead();
+    EXPECT_FALSE(writer->Write("abc", 3));
+}
+
+int main(int argc, char* argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
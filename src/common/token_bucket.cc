@@ -0,0 +1,77 @@
+#include "token_bucket.h"
+
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+
+namespace baidu {
+namespace shuttle {
+
+const static int64_t sMaxSleepUs = 100 * 1000;
+
+static int64_t MonotonicUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+TokenBucket::TokenBucket(int64_t bytes_per_second, int64_t burst)
+    : rate_(bytes_per_second), burst_(std::max(burst, static_cast<int64_t>(1))),
+      tokens_(burst_), last_refill_us_(MonotonicUs()), remainder_(0) {
+}
+
+void TokenBucket::SetRate(int64_t bytes_per_second) {
+    MutexLock lock(&mu_);
+    Refill();
+    rate_ = bytes_per_second;
+}
+
+int64_t TokenBucket::Rate() {
+    MutexLock lock(&mu_);
+    return rate_;
+}
+
+void TokenBucket::Refill() {
+    int64_t now = MonotonicUs();
+    int64_t elapsed = now - last_refill_us_;
+    last_refill_us_ = now;
+    // Long enough to fill the bucket, which also keeps the product below
+    // from overflowing after a long idle time
+    if (rate_ <= 0 || elapsed > (burst_ - tokens_) * 1000000 / rate_) {
+        tokens_ = burst_;
+        remainder_ = 0;
+        return;
+    }
+    // Fractions are carried to the next refill, or frequent takers at a
+    // low rate would never see a token
+    int64_t credit = elapsed * rate_ + remainder_;
+    tokens_ = std::min(tokens_ + credit / 1000000, burst_);
+    remainder_ = credit % 1000000;
+}
+
+void TokenBucket::Take(int64_t n) {
+    int64_t sleep_us = 0;
+    {
+        MutexLock lock(&mu_);
+        Refill();
+        // Taken in advance, later takers queue up behind the debt
+        tokens_ -= n;
+        if (tokens_ >= 0 || rate_ <= 0) {
+            return;
+        }
+        sleep_us = -tokens_ * 1000000 / rate_;
+    }
+    // In slices, so a rate raised meanwhile is caught up soon
+    while (sleep_us > 0) {
+        usleep(std::min(sleep_us, sMaxSleepUs));
+        MutexLock lock(&mu_);
+        Refill();
+        if (tokens_ >= 0 || rate_ <= 0) {
+            return;
+        }
+        sleep_us = -tokens_ * 1000000 / rate_;
+    }
+}
+
+} //namespace shuttle
+} //namespace baidu
@@ -0,0 +1,37 @@
+#ifndef _BAIDU_SHUTTLE_COMMON_TOKEN_BUCKET_H_
+#define _BAIDU_SHUTTLE_COMMON_TOKEN_BUCKET_H_
+
+#include <stdint.h>
+#include "mutex.h"
+
+namespace baidu {
+namespace shuttle {
+
+// Shapes a byte stream to a steady rate. Tokens are refilled as time
+// goes, up to the burst, and takers sleep until their bytes are covered,
+// so a flow is slowed down evenly instead of being stopped and resumed
+class TokenBucket {
+public:
+    // A rate not above 0 takes everything at once
+    TokenBucket(int64_t bytes_per_second, int64_t burst);
+    void SetRate(int64_t bytes_per_second);
+    int64_t Rate();
+    // Waits until n bytes are allowed, safe from any thread
+    void Take(int64_t n);
+private:
+    void Refill();
+private:
+    Mutex mu_;
+    int64_t rate_;
+    int64_t burst_;
+    // Goes below zero while takers wait for more than the bucket holds
+    int64_t tokens_;
+    int64_t last_refill_us_;
+    // Fraction of a token not credited yet, in bytes times us per second
+    int64_t remainder_;
+};
+
+} //namespace shuttle
+} //namespace baidu
+
+#endif
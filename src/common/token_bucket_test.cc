@@ -0,0 +1,48 @@
+#include <gtest/gtest.h>
+#include <time.h>
+#include "token_bucket.h"
+
+using namespace baidu::shuttle;
+
+static int64_t NowMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+TEST(TokenBucket, Unlimited) {
+    TokenBucket bucket(0, 1);
+    int64_t begin = NowMs();
+    bucket.Take(1L << 40);
+    EXPECT_LT(NowMs() - begin, 100);
+}
+
+TEST(TokenBucket, Rate) {
+    TokenBucket bucket(1 << 20, 1 << 10);
+    int64_t begin = NowMs();
+    // 256k beyond the burst, a quarter of a second
+    for (int i = 0; i < 257; i++) {
+        bucket.Take(1 << 10);
+    }
+    int64_t elapsed = NowMs() - begin;
+    EXPECT_GE(elapsed, 200);
+    EXPECT_LT(elapsed, 1000);
+}
+
+TEST(TokenBucket, SmallTakesAtLowRate) {
+    // Each take comes much sooner than a whole token is refilled, the
+    // fractions have to add up
+    TokenBucket bucket(1000, 1);
+    int64_t begin = NowMs();
+    for (int i = 0; i < 200; i++) {
+        bucket.Take(1);
+    }
+    int64_t elapsed = NowMs() - begin;
+    EXPECT_GE(elapsed, 150);
+    EXPECT_LT(elapsed, 1000);
+}
+
+int main(int argc, char* argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -71,6 +71,46 @@ bool PatternMatch(const std::string& origin, const std::string& pattern) {
     return !*pat;
 }
 
+std::string HexEncode(const std::string& data) {
+    static const char* digits = "0123456789abcdef";
+    std::string hex;
+    hex.reserve(data.size() * 2);
+    for (size_t i = 0; i < data.size(); ++i) {
+        unsigned char c = data[i];
+        hex.push_back(digits[c >> 4]);
+        hex.push_back(digits[c & 0xF]);
+    }
+    return hex;
+}
+
+static int HexDigit(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+bool HexDecode(const std::string& hex, std::string* data) {
+    if (hex.size() % 2 != 0) {
+        return false;
+    }
+    data->clear();
+    data->reserve(hex.size() / 2);
+    for (size_t i = 0; i < hex.size(); i += 2) {
+        int high = HexDigit(hex[i]);
+        int low = HexDigit(hex[i + 1]);
+        if (high < 0 || low < 0) {
+            return false;
+        }
+        data->push_back(static_cast<char>((high << 4) | low));
+    }
+    return true;
+}
+
 }
 }
 
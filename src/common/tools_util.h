@@ -1,6 +1,8 @@
 #ifndef _BAIDU_SHUTTLE_COMMON_TOOLS_UTIL_H_
 #define _BAIDU_SHUTTLE_COMMON_TOOLS_UTIL_H_
 #include <string>
+#include <algorithm>
+#include <math.h>
 #include "timer.h"
 
 namespace baidu {
@@ -13,8 +15,22 @@ static inline std::string GetLogName(const char* prefix) {
     return buf;
 }
 
+// Map outputs merged into one tuo by a reduce of total maps, unless
+// shuffle_tool is told otherwise
+static inline int32_t DefaultTuoSize(int32_t total) {
+    int32_t tuo_size = std::min((int32_t)ceil(sqrt(total)), 300);
+    int n_tuo = (int)ceil((float)total / tuo_size);
+    if (n_tuo < 100) {
+        tuo_size = std::max((int32_t)ceil(sqrt(tuo_size)), 10);
+    }
+    return tuo_size;
+}
+
 void ParseHdfsAddress(const std::string& address, std::string* host, int* port, std::string* path);
 bool PatternMatch(const std::string& origin, const std::string& pattern);
+// Keys passed through command lines may contain any bytes
+std::string HexEncode(const std::string& data);
+bool HexDecode(const std::string& hex, std::string* data);
 
 }
 }
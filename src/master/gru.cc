@@ -4,9 +4,11 @@
 #include <gflags/gflags.h>
 #include <boost/algorithm/string.hpp>
 #include <vector>
+#include <algorithm>
 #include <cmath>
 #include "logging.h"
 #include "util.h"
+#include "minion_pool.h"
 
 DECLARE_int32(galaxy_deploy_step);
 DECLARE_string(minion_path);
@@ -20,6 +22,9 @@ DECLARE_string(galaxy_user);
 DECLARE_string(galaxy_token);
 DECLARE_string(galaxy_pool);
 DECLARE_int32(max_minions_per_host);
+DECLARE_int32(minion_slots);
+DECLARE_int32(minion_pool_millicores);
+DECLARE_int64(minion_pool_memory);
 
 namespace baidu {
 namespace shuttle {
@@ -35,14 +40,69 @@ int64_t Gru::additional_map_memory = default_additional_map_memory;
 int64_t Gru::additional_reduce_memory = default_additional_reduce_memory;
 
 Gru::Gru(::baidu::galaxy::sdk::AppMaster* galaxy, JobDescriptor* job,
-         const std::string& job_id, WorkMode mode) :
-        galaxy_(galaxy), job_(job), job_id_(job_id), mode_(mode) {
+         const std::string& job_id, WorkMode mode, MinionPool* pool) :
+        galaxy_(galaxy), job_(job), job_id_(job_id), mode_(mode),
+        pool_(pool), pooled_(false), replica_(0), tasks_(-1), demanded_(0) {
     mode_str_ = ((mode == kReduce) ? "reduce" : "map");
     minion_name_ = job->name() + "_" + mode_str_;
 }
 
-Status Gru::Start() {
-    ::baidu::galaxy::sdk::SubmitJobRequest galaxy_job;
+Gru::Gru(::baidu::galaxy::sdk::AppMaster* galaxy, const std::string& name, int replica) :
+        galaxy_(galaxy), minion_name_(name), job_(NULL), mode_(kMap),
+        pool_(NULL), pooled_(false), replica_(replica), tasks_(-1), demanded_(0) {
+}
+
+int Gru::Replicas(int capacity) const {
+    // Capacities count tasks, a replica runs slots of them
+    const int slots = std::max(FLAGS_minion_slots, 1);
+    int tasks = 0;
+    if (mode_ == kReduce) {
+        tasks = std::min(capacity != -1 ? capacity : job_->reduce_capacity(),
+                std::max(job_->reduce_total() * 6 / 5, 20));
+    } else {
+        tasks = std::min(capacity != -1 ? capacity : job_->map_capacity(),
+                std::max(job_->map_total() * 6 / 5, 20));
+    }
+    return (tasks + slots - 1) / slots;
+}
+
+int Gru::PooledReplicas(int capacity) const {
+    const int replicas = Replicas(capacity);
+    if (tasks_ < 0) {
+        return replicas;
+    }
+    const int slots = std::max(FLAGS_minion_slots, 1);
+    return std::min(replicas, (tasks_ + slots - 1) / slots);
+}
+
+std::string Gru::BootEnv(const JobDescriptor& job) {
+    std::string app_package;
+    std::vector<std::string> cache_archive_list;
+    int file_size = job.files().size();
+    for (int i = 0; i < file_size; ++i) {
+        const std::string& file = job.files(i);
+        if (boost::starts_with(file, "hdfs://")) {
+            cache_archive_list.push_back(file);
+        } else {
+            app_package = file;
+        }
+    }
+    std::stringstream ss;
+    if (!job.input_dfs().user().empty()) {
+        ss << "hadoop_job_ugi=" << job.input_dfs().user()
+           << "," << job.input_dfs().password()
+           << " fs_default_name=hdfs://" << job.input_dfs().host()
+           << ":" << job.input_dfs().port() << " "; 
+    }
+    for (size_t i = 0; i < cache_archive_list.size(); i++) {
+        ss << "cache_archive_" << i << "=" << cache_archive_list[i] << " ";
+    }
+    ss << "app_package=" << app_package;
+    return ss.str();
+}
+
+void Gru::BuildGalaxyJob(::baidu::galaxy::sdk::SubmitJobRequest* request) {
+    ::baidu::galaxy::sdk::SubmitJobRequest& galaxy_job = *request;
     galaxy_job.user.user = FLAGS_galaxy_user;
     galaxy_job.user.token = FLAGS_galaxy_token;
     galaxy_job.hostname = ::baidu::common::util::GetLocalHostName();
@@ -51,16 +111,11 @@ Status Gru::Start() {
     galaxy_job.job.deploy.pools = pools;
     galaxy_job.job.name = minion_name_ + "@minion";
     galaxy_job.job.type = ::baidu::galaxy::sdk::kJobBatch;
-    if (mode_ == kReduce) {
-        galaxy_job.job.deploy.replica = std::min(job_->reduce_capacity(),
-                std::max(job_->reduce_total() * 6 / 5, 20));
-    } else {
-        galaxy_job.job.deploy.replica = std::min(job_->map_capacity(),
-                std::max(job_->map_total() * 6 / 5, 20));
-    }
+    const int slots = std::max(FLAGS_minion_slots, 1);
+    galaxy_job.job.deploy.replica = (job_ != NULL) ? Replicas(-1) : replica_;
     galaxy_job.job.deploy.step = std::min((int)FLAGS_galaxy_deploy_step, (int)galaxy_job.job.deploy.replica);
     galaxy_job.job.deploy.interval = 1;
-    galaxy_job.job.deploy.max_per_host = FLAGS_max_minions_per_host;
+    galaxy_job.job.deploy.max_per_host = std::max(FLAGS_max_minions_per_host / slots, 1);
     galaxy_job.job.deploy.update_break_count = 0;
     galaxy_job.job.version = "1.0.0";
     galaxy_job.job.run_user = "galaxy";
@@ -79,43 +134,35 @@ Status Gru::Start() {
     pod_desc.workspace_volum.type = ::baidu::galaxy::sdk::kEmptyDir;
 
     ::baidu::galaxy::sdk::TaskDescription task_desc;
-    if (mode_str_ == "map") {
-        task_desc.cpu.milli_core = job_->millicores() + additional_map_millicores;
+    std::stringstream ss;
+    std::stringstream ss_stop;
+    if (job_ == NULL) {
+        // Pooled minions run tasks of both kinds
+        task_desc.cpu.milli_core = FLAGS_minion_pool_millicores * slots
+            + std::max(additional_map_millicores, additional_reduce_millicores);
+        task_desc.memory.size = FLAGS_minion_pool_memory * slots
+            + std::max(additional_map_memory, additional_reduce_memory);
+        ss << "./minion_boot.sh -pooled -nexus_addr=" << FLAGS_nexus_server_list
+           << " -master_nexus_path=" << FLAGS_nexus_root_path + FLAGS_master_path
+           << " -minion_slots=" << slots;
     } else {
-        task_desc.cpu.milli_core = job_->millicores() + additional_reduce_millicores;
-    }
-    task_desc.memory.size = job_->memory() +
-        ((mode_ == kReduce) ? additional_reduce_memory : additional_map_memory);
-    std::string app_package;
-    std::vector<std::string> cache_archive_list;
-    int file_size = job_->files().size();
-    for (int i = 0; i < file_size; ++i) {
-        const std::string& file = job_->files(i);
-        if (boost::starts_with(file, "hdfs://")) {
-            cache_archive_list.push_back(file);
+        if (mode_str_ == "map") {
+            task_desc.cpu.milli_core = job_->millicores() * slots + additional_map_millicores;
         } else {
-            app_package = file;
+            task_desc.cpu.milli_core = job_->millicores() * slots + additional_reduce_millicores;
         }
+        task_desc.memory.size = job_->memory() * slots +
+            ((mode_ == kReduce) ? additional_reduce_memory : additional_map_memory);
+        ss << BootEnv(*job_)
+           << " ./minion_boot.sh -jobid=" << job_id_ << " -nexus_addr=" << FLAGS_nexus_server_list
+           << " -master_nexus_path=" << FLAGS_nexus_root_path + FLAGS_master_path
+           << " -work_mode=" << ((mode_ == kMapOnly) ? "map-only" : mode_str_)
+           << " -minion_slots=" << slots;
+        ss_stop << "source ./hdfs_env.sh; ./minion -jobid=" << job_id_ << " -nexus_addr=" << FLAGS_nexus_server_list
+                << " -master_nexus_path=" << FLAGS_nexus_root_path + FLAGS_master_path
+                << " -work_mode=" << ((mode_ == kMapOnly) ? "map-only" : mode_str_)
+                << " -minion_slots=" << slots << " -kill_task";
     }
-    std::stringstream ss;
-    if (!job_->input_dfs().user().empty()) {
-        ss << "hadoop_job_ugi=" << job_->input_dfs().user()
-           << "," << job_->input_dfs().password()
-           << " fs_default_name=hdfs://" << job_->input_dfs().host()
-           << ":" << job_->input_dfs().port() << " "; 
-    }
-    for (size_t i = 0; i < cache_archive_list.size(); i++) {
-        ss << "cache_archive_" << i << "=" << cache_archive_list[i] << " ";
-    }
-    ss << "app_package=" << app_package
-       << " ./minion_boot.sh -jobid=" << job_id_ << " -nexus_addr=" << FLAGS_nexus_server_list
-       << " -master_nexus_path=" << FLAGS_nexus_root_path + FLAGS_master_path
-       << " -work_mode=" << ((mode_ == kMapOnly) ? "map-only" : mode_str_);
-    std::stringstream ss_stop;
-    ss_stop << "source ./hdfs_env.sh; ./minion -jobid=" << job_id_ << " -nexus_addr=" << FLAGS_nexus_server_list
-            << " -master_nexus_path=" << FLAGS_nexus_root_path + FLAGS_master_path
-            << " -work_mode=" << ((mode_ == kMapOnly) ? "map-only" : mode_str_)
-            << " -kill_task";
     task_desc.exe_package.package.source_path = FLAGS_minion_path;
     task_desc.exe_package.package.dest_path = ".";
     task_desc.exe_package.package.version = "1.0";
@@ -143,6 +190,18 @@ Status Gru::Start() {
         task_desc.memory.excess = false;
     }
     pod_desc.tasks.push_back(task_desc);
+}
+
+Status Gru::Start() {
+    if (job_ != NULL && pool_ != NULL && MinionPool::Fits(*job_)) {
+        demanded_ = PooledReplicas(-1);
+        pool_->Demand(job_id_, mode_, BootEnv(*job_), demanded_);
+        pooled_ = true;
+        LOG(INFO, "%s minions are lent by the pool: %s", mode_str_.c_str(), job_id_.c_str());
+        return kOk;
+    }
+    ::baidu::galaxy::sdk::SubmitJobRequest galaxy_job;
+    BuildGalaxyJob(&galaxy_job);
     std::string minion_id;
     ::baidu::galaxy::sdk::SubmitJobResponse rsps;
     if (galaxy_->SubmitJob(galaxy_job, &rsps)) {
@@ -161,7 +220,18 @@ Status Gru::Start() {
     return kGalaxyError;
 }
 
+void Gru::Attach(const std::string& minion_id) {
+    LOG(INFO, "attach galaxy job: %s", minion_id.c_str());
+    BuildGalaxyJob(&galaxy_job_);
+    minion_id_ = minion_id;
+}
+
 Status Gru::Kill() {
+    if (pooled_) {
+        pool_->Withdraw(job_id_, mode_);
+        pooled_ = false;
+        return kOk;
+    }
     LOG(INFO, "kill galaxy job: %s", minion_id_.c_str());
     if (minion_id_.empty()) {
         return kOk;
@@ -181,13 +251,35 @@ Status Gru::Kill() {
 
 Status Gru::Update(const std::string& priority,
                    int capacity) {
-    ::baidu::galaxy::sdk::JobDescription job_desc = galaxy_job_.job;
     if (!priority.empty()) {
-        //job_desc.priority = priority;
+        //galaxy_job_.priority = priority;
+    }
+    if (capacity == -1) {
+        return kOk;
+    }
+    if (pooled_) {
+        demanded_ = PooledReplicas(capacity);
+        pool_->Demand(job_id_, mode_, BootEnv(*job_), demanded_);
+        return kOk;
     }
-    if (capacity != -1) {
-        job_desc.deploy.replica = capacity;
+    return Resize(Replicas(capacity));
+}
+
+void Gru::Follow(int tasks) {
+    tasks_ = std::max(tasks, 0);
+    if (!pooled_) {
+        return;
     }
+    const int replicas = PooledReplicas(-1);
+    if (replicas != demanded_) {
+        demanded_ = replicas;
+        pool_->Demand(job_id_, mode_, BootEnv(*job_), demanded_);
+    }
+}
+
+Status Gru::Resize(int replica) {
+    ::baidu::galaxy::sdk::JobDescription job_desc = galaxy_job_.job;
+    job_desc.deploy.replica = replica;
     ::baidu::galaxy::sdk::UpdateJobRequest rqst;
     ::baidu::galaxy::sdk::UpdateJobResponse rsps;
     rqst.user = galaxy_job_.user;
@@ -196,12 +288,7 @@ Status Gru::Update(const std::string& priority,
     rqst.hostname = ::baidu::common::util::GetLocalHostName();
     rqst.operate = ::baidu::galaxy::sdk::kUpdateJobStart;
     if (galaxy_->UpdateJob(rqst, &rsps)) {
-        if (!priority.empty()) {
-            //galaxy_job_.priority = priority;
-        }
-        if (capacity != -1) {
-            galaxy_job_.job.deploy.replica = capacity;
-        }
+        galaxy_job_.job.deploy.replica = job_desc.deploy.replica;
         return kOk;
     } else {
         LOG(WARNING, "galaxy error: %s", rsps.error_code.reason.c_str());
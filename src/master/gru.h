@@ -10,16 +10,38 @@
 namespace baidu {
 namespace shuttle {
 
+class MinionPool;
+
 class Gru {
 
 public:
+    // Minions of a job phase, lent by pool when the job fits minions of
+    // it. pool may be NULL
     Gru(::baidu::galaxy::sdk::AppMaster* galaxy, JobDescriptor* job,
-        const std::string& job_id, WorkMode mode);
-    virtual ~Gru() { Kill(); }
+        const std::string& job_id, WorkMode mode, MinionPool* pool);
+    // Generic minions of the pool, which outlive masters
+    Gru(::baidu::galaxy::sdk::AppMaster* galaxy, const std::string& name, int replica);
+    virtual ~Gru() {
+        if (job_ != NULL) {
+            Kill();
+        }
+    }
 
     Status Start();
+    // Takes over the galaxy job a former master started
+    void Attach(const std::string& minion_id);
     Status Kill();
     Status Update(const std::string& priority, int capacity);
+    // Pooled minions follow the tasks of the phase still pending or running,
+    // up to its capacity
+    void Follow(int tasks);
+    Status Resize(int replica);
+    const std::string& GetMinionId() const {
+        return minion_id_;
+    }
+
+    // Variables minion_boot.sh fetches the packages of job with
+    static std::string BootEnv(const JobDescriptor& job);
 
     static int additional_map_millicores;
     static int additional_reduce_millicores;
@@ -27,6 +49,11 @@ public:
     static int64_t additional_reduce_memory;
 
 private:
+    // Minions of the phase for capacity tasks, -1 for that of the job
+    int Replicas(int capacity) const;
+    // Replicas for the tasks left as well, what the pool is asked for
+    int PooledReplicas(int capacity) const;
+    void BuildGalaxyJob(::baidu::galaxy::sdk::SubmitJobRequest* galaxy_job);
     // For galaxy manangement
     ::baidu::galaxy::sdk::AppMaster* galaxy_;
     ::baidu::galaxy::sdk::SubmitJobRequest galaxy_job_;
@@ -35,9 +62,16 @@ private:
     // Minion information
     std::string minion_name_;
     JobDescriptor* job_;
-    const std::string& job_id_;
+    std::string job_id_;
     WorkMode mode_;
     std::string mode_str_;
+    MinionPool* pool_;
+    // Minions of the phase are lent by pool_
+    bool pooled_;
+    int replica_;
+    // Tasks of the phase left as last followed, -1 for all of them
+    int tasks_;
+    int demanded_;
 
 };
 
@@ -10,6 +10,8 @@
 #include <string>
 #include <sstream>
 #include <set>
+#include <map>
+#include <cstdio>
 #include <cmath>
 #include <sys/time.h>
 
@@ -18,9 +20,12 @@
 #include "proto/minion.pb.h"
 #include "resource_manager.h"
 #include "master_impl.h"
+#include "minion_pool.h"
 #include "common/tools_util.h"
 #include "timer.h"
 #include "sort/sort_file.h"
+#include "sort/input_reader.h"
+#include "minion/partition.h"
 
 DECLARE_int32(galaxy_deploy_step);
 DECLARE_string(minion_path);
@@ -33,6 +38,11 @@ DECLARE_int32(retry_bound);
 DECLARE_int32(left_percent);
 DECLARE_int32(max_counters_per_job);
 DECLARE_int32(parallel_attempts);
+DECLARE_int32(reduce_skew_factor);
+DECLARE_int32(reduce_max_splits);
+DECLARE_int32(hot_keys_per_partition);
+DECLARE_int32(range_sample_splits);
+DECLARE_int32(range_sample_records);
 
 namespace baidu {
 namespace shuttle {
@@ -44,6 +54,8 @@ JobTracker::JobTracker(MasterImpl* master, ::baidu::galaxy::sdk::AppMaster* gala
                       state_(kPending),
                       map_allow_duplicates_(true),
                       reduce_allow_duplicates_(true),
+                      version_(0),
+                      epoch_(common::timer::get_micros()),
                       map_(NULL),
                       map_manager_(NULL),
                       map_end_game_begin_(0),
@@ -79,6 +91,10 @@ JobTracker::JobTracker(MasterImpl* master, ::baidu::galaxy::sdk::AppMaster* gala
             job_descriptor_.set_reduce_capacity(scale_down_cap);
         }
     }
+    if (job_descriptor_.job_type() == kMapReduceJob
+            && job_descriptor_.reduce_ranges_size() == 0) {
+        partition_sizes_.resize(job_descriptor_.partition_total(), 0);
+    }
     monitor_ = new ThreadPool(1);
 
     map_allow_duplicates_ = job_descriptor_.map_allow_duplicates();
@@ -171,12 +187,90 @@ Status JobTracker::BuildResourceManagers() {
 
     if (job_descriptor_.job_type() == kMapReduceJob) {
         reduce_manager_ = new IdManager(job_descriptor_.reduce_total());
+        if (job_descriptor_.partition() == kRangePartitioner
+                && !SampleRangeSplitPoints(input_param)) {
+            LOG(WARNING, "no key sampled for range partitions, failed: %s", job_id_.c_str());
+            error_msg_ = "Failed to sample input keys for range partitions\n";
+            state_ = kFailed;
+            return kOpenFileFail;
+        }
     }
 
     failed_count_.resize(sum_of_map, 0);
     return kOk;
 }
 
+bool JobTracker::SampleRangeSplitPoints(FileSystem::Param& param) {
+    const int partitions = job_descriptor_.partition_total() > 0 ?
+        job_descriptor_.partition_total() : job_descriptor_.reduce_total();
+    if (partitions <= 1) {
+        return true;
+    }
+    // Input keys stand for map output keys, which holds for sorting jobs
+    const bool binary = job_descriptor_.input_format() == kBinaryInput;
+    if (job_descriptor_.decompress_input()) {
+        param["decompress"] = "true";
+    }
+    RangePartitioner sampler(job_descriptor_.key_fields_num(),
+                             job_descriptor_.partition_fields_num(),
+                             std::vector<std::string>(),
+                             job_descriptor_.key_separator());
+    KeyNormalizer normalizer(job_descriptor_);
+    const std::vector<ResourceItem>& items = map_manager_->Dump();
+    const size_t splits = std::min(items.size(),
+            static_cast<size_t>(std::max(FLAGS_range_sample_splits, 1)));
+    std::vector<std::string> samples;
+    for (size_t i = 0; i < splits; ++i) {
+        const ResourceItem& item = items[i * items.size() / splits];
+        InputReader* reader = binary ? InputReader::CreateSeqFileReader()
+                                     : InputReader::CreateHdfsTextReader();
+        boost::scoped_ptr<InputReader> reader_guard(reader);
+        if (reader->Open(item.input_file, param) != kOk) {
+            LOG(WARNING, "fail to open input for sampling: %s", item.input_file.c_str());
+            continue;
+        }
+        InputReader::Iterator* it = reader->Read(item.offset, item.size);
+        boost::scoped_ptr<InputReader::Iterator> it_guard(it);
+        for (int n = 0; n < FLAGS_range_sample_records && !it->Done(); ++n, it->Next()) {
+            std::string line = it->Record();
+            if (binary) {
+                // Records of sequence files are <key_len, key, value_len, value>
+                int32_t key_len = 0;
+                if (line.size() < sizeof(key_len)) {
+                    continue;
+                }
+                memcpy(&key_len, line.data(), sizeof(key_len));
+                line = line.substr(sizeof(key_len), key_len);
+            }
+            // Records are routed by the sort key, so reduces hold ranges of
+            // the order outputs are sorted in
+            std::string key;
+            std::string partition_key;
+            sampler.ExtractKeys(line, &key, &partition_key);
+            if (normalizer.Enabled()) {
+                normalizer.Normalize(key, &partition_key);
+                key.swap(partition_key);
+            }
+            samples.push_back(key);
+        }
+        reader->Close();
+    }
+    if (samples.empty()) {
+        // Every record would go to the first reduce
+        return false;
+    }
+    std::vector<std::string> split_points;
+    RangePartitioner::ComputeSplitPoints(&samples, partitions, &split_points);
+    job_descriptor_.clear_range_split_points();
+    for (size_t i = 0; i < split_points.size(); ++i) {
+        job_descriptor_.add_range_split_points(split_points[i]);
+    }
+    LOG(INFO, "sample %lu keys from %lu splits for %d range partitions: %s",
+            static_cast<unsigned long>(samples.size()),
+            static_cast<unsigned long>(splits), partitions, job_id_.c_str());
+    return true;
+}
+
 void JobTracker::BuildEndGameCounters() {
     if (map_manager_ == NULL) {
         return;
@@ -198,6 +292,181 @@ void JobTracker::BuildEndGameCounters() {
     }
 }
 
+void JobTracker::AccumulateHotKeys(const std::vector<PartitionKey>& hot_keys) {
+    mu_.AssertHeld();
+    std::set<int> touched;
+    for (size_t i = 0; i < hot_keys.size(); ++i) {
+        const PartitionKey& hot_key = hot_keys[i];
+        if (hot_key.partition() < 0
+                || static_cast<size_t>(hot_key.partition()) >= partition_sizes_.size()) {
+            continue;
+        }
+        partition_keys_[hot_key.partition()][hot_key.key()] += hot_key.size();
+        touched.insert(hot_key.partition());
+        dirty_partitions_.insert(hot_key.partition());
+    }
+    const size_t limit = std::max(FLAGS_hot_keys_per_partition, 1);
+    for (std::set<int>::iterator it = touched.begin(); it != touched.end(); ++it) {
+        std::map<std::string, int64_t>& keys = partition_keys_[*it];
+        while (keys.size() > limit) {
+            std::map<std::string, int64_t>::iterator lightest = keys.begin();
+            for (std::map<std::string, int64_t>::iterator jt = keys.begin();
+                    jt != keys.end(); ++jt) {
+                if (jt->second < lightest->second) {
+                    lightest = jt;
+                }
+            }
+            keys.erase(lightest);
+        }
+    }
+}
+
+static ReduceRange* AddReduceRange(JobDescriptor* job, int partition_begin,
+                                   int partition_end) {
+    ReduceRange* range = job->add_reduce_ranges();
+    range->set_partition_begin(partition_begin);
+    range->set_partition_end(partition_end);
+    return range;
+}
+
+void JobTracker::PlanReducePartitions() {
+    mu_.AssertHeld();
+    // Sizes observed so far stand for the whole map output, the remaining
+    // maps are few once reduces are about to be pulled up
+    const int partition_total = partition_sizes_.size();
+    const int max_reduce = std::max(std::min(job_descriptor_.reduce_total(),
+                                             partition_total), 1);
+    int64_t total_size = 0;
+    for (int i = 0; i < partition_total; ++i) {
+        total_size += partition_sizes_[i];
+    }
+    const int64_t target = std::max(std::max(job_descriptor_.reduce_target_size(),
+                                    (total_size + max_reduce - 1) / max_reduce), 1L);
+    // A key range split keeps records of a key together, which is enough
+    // only when records are grouped by the whole sort key and sorted
+    const bool splittable = !job_descriptor_.hash_aggregation()
+        && (job_descriptor_.partition() == kIntHashPartitioner
+            || std::max(job_descriptor_.partition_fields_num(), 1)
+               >= std::max(job_descriptor_.key_fields_num(), 1));
+    job_descriptor_.clear_reduce_ranges();
+    int range_begin = 0;
+    int coalesced = 0;
+    int split = 0;
+    int64_t range_size = 0;
+    for (int i = 0; i < partition_total; ++i) {
+        std::map<int, std::map<std::string, int64_t> >::iterator it = partition_keys_.find(i);
+        if (splittable && it != partition_keys_.end()
+                && partition_sizes_[i] > target * FLAGS_reduce_skew_factor) {
+            if (i > range_begin) {
+                AddReduceRange(&job_descriptor_, range_begin, i);
+            }
+            SplitPartition(i, target, it->second);
+            ++split;
+            range_begin = i + 1;
+            range_size = 0;
+            continue;
+        }
+        range_size += partition_sizes_[i];
+        if (range_size >= target && coalesced < max_reduce - 1 && i + 1 < partition_total) {
+            AddReduceRange(&job_descriptor_, range_begin, i + 1);
+            ++coalesced;
+            range_begin = i + 1;
+            range_size = 0;
+        }
+    }
+    if (range_begin < partition_total) {
+        AddReduceRange(&job_descriptor_, range_begin, partition_total);
+    }
+    const int reduce_total = job_descriptor_.reduce_ranges_size();
+    LOG(INFO, "plan %d partitions (%ld bytes) into %d reduces, target: %ld, split: %d: %s",
+            partition_total, total_size, reduce_total, target, split, job_id_.c_str());
+    if (reduce_total != job_descriptor_.reduce_total()) {
+        job_descriptor_.set_reduce_total(reduce_total);
+        if (job_descriptor_.reduce_capacity() > reduce_total * 2) {
+            job_descriptor_.set_reduce_capacity(std::max(reduce_total * 2, 60));
+        }
+        delete reduce_manager_;
+        reduce_manager_ = new IdManager(reduce_total);
+        BuildEndGameCounters();
+    }
+    // Ranges are kept in the descriptor from now on
+    std::vector<int64_t>().swap(partition_sizes_);
+    partition_keys_.clear();
+    dirty_partitions_.clear();
+}
+
+void JobTracker::SplitPartition(int partition, int64_t target,
+                                const std::map<std::string, int64_t>& keys) {
+    mu_.AssertHeld();
+    // Partials of a hot key are concatenated and reduced again,
+    // which is only sound for plain lines of an associative reducer
+    const bool two_phase = job_descriptor_.reduce_associative()
+        && job_descriptor_.output_format() == kTextOutput
+        && job_descriptor_.pipe_style() == kStreaming;
+    int64_t sketched = 0;
+    std::map<std::string, int64_t>::const_iterator it;
+    for (it = keys.begin(); it != keys.end(); ++it) {
+        sketched += it->second;
+    }
+    // Keys out of the sketch are assumed to spread evenly between sketched ones
+    const int64_t gap = std::max(partition_sizes_[partition] - sketched,
+                                 static_cast<int64_t>(0))
+                        / static_cast<int64_t>(keys.size() + 1);
+    ReduceRange* range = AddReduceRange(&job_descriptor_, partition, partition + 1);
+    int64_t range_size = 0;
+    for (it = keys.begin(); it != keys.end(); ++it) {
+        const std::string& key = it->first;
+        // The smallest key after this one
+        const std::string key_end = key + std::string(1, '\0');
+        range_size += gap;
+        if (it->second < target) {
+            range_size += it->second;
+            if (range_size >= target) {
+                range->set_key_end(key_end);
+                range = AddReduceRange(&job_descriptor_, partition, partition + 1);
+                range->set_key_begin(key_end);
+                range_size = 0;
+            }
+            continue;
+        }
+        int splits = std::min((it->second + target - 1) / target,
+                              static_cast<int64_t>(FLAGS_reduce_max_splits));
+        // Partials take tuo files by turns, more of them would be left empty
+        const int32_t tuo_size = DefaultTuoSize(job_descriptor_.map_total());
+        splits = std::min(splits, (job_descriptor_.map_total() + tuo_size - 1) / tuo_size);
+        if (two_phase && splits > 1) {
+            range->set_key_end(key);
+            int partial_begin = job_descriptor_.reduce_ranges_size();
+            for (int i = 0; i < splits; ++i) {
+                range = AddReduceRange(&job_descriptor_, partition, partition + 1);
+                range->set_key_begin(key);
+                range->set_key_end(key_end);
+                range->set_split_no(i);
+                range->set_split_total(splits);
+            }
+            range = AddReduceRange(&job_descriptor_, partition, partition + 1);
+            range->set_key_begin(key);
+            range->set_key_end(key_end);
+            range->set_partial_begin(partial_begin);
+            range->set_partial_end(partial_begin + splits);
+            LOG(INFO, "aggregate hot key of partition %d in %d partials: %s",
+                    partition, splits, job_id_.c_str());
+        } else {
+            // Nothing to do for a single hot key but giving it a reduce alone,
+            // apart from the keys gathered before it
+            range->set_key_end(key);
+            range = AddReduceRange(&job_descriptor_, partition, partition + 1);
+            range->set_key_begin(key);
+            range->set_key_end(key_end);
+            LOG(WARNING, "hot key of partition %d takes %ld bytes: %s",
+                    partition, it->second, job_id_.c_str());
+        }
+        range = AddReduceRange(&job_descriptor_, partition, partition + 1);
+        range->set_key_begin(key_end);
+        range_size = 0;
+    }
+}
+
 Status JobTracker::Start() {
     start_time_ = common::timer::now_time();
     BuildOutputFsPointer();
@@ -214,7 +483,8 @@ Status JobTracker::Start() {
     BuildEndGameCounters();
     rpc_client_ = new RpcClient();
     map_ = new Gru(galaxy_, &job_descriptor_, job_id_,
-            (job_descriptor_.job_type() == kMapOnlyJob) ? kMapOnly : kMap);
+            (job_descriptor_.job_type() == kMapOnlyJob) ? kMapOnly : kMap,
+            master_->GetMinionPool());
     if (map_->Start() == kOk) {
         LOG(INFO, "start a new map reduce job: %s -> %s",
                 job_descriptor_.name().c_str(), job_id_.c_str());
@@ -293,6 +563,7 @@ Status JobTracker::Kill(JobState end_state) {
             (*it)->state = kTaskKilled;
             (*it)->period = std::time(NULL) - (*it)->alloc_time;
             (*it)->is_map ? ++map_killed_ : ++reduce_killed_;
+            TouchAllocation(*it);
         }
     }
     finish_time_ =  common::timer::now_time();
@@ -301,6 +572,14 @@ Status JobTracker::Kill(JobState end_state) {
     return kOk;
 }
 
+// Dismissed minions are counted by slot, as capacities count tasks
+static std::string DismissKey(const std::string& endpoint, int32_t slot) {
+    if (slot <= 0) {
+        return endpoint;
+    }
+    return endpoint + "#" + boost::lexical_cast<std::string>(slot);
+}
+
 void JobTracker::CanMapDismiss(Status* status, const std::string& endpoint) {
     mu_.AssertHeld();
     int completed = map_manager_->Done();
@@ -349,7 +628,8 @@ void JobTracker::CanReduceDismiss(Status* status, const std::string& endpoint) {
     }
 }
 
-ResourceItem* JobTracker::AssignMap(const std::string& endpoint, Status* status) {
+ResourceItem* JobTracker::AssignMap(const std::string& endpoint, int32_t slot,
+                                    bool prefetch, Status* status) {
     if (state_ == kPending) {
         state_ = kRunning;
     }
@@ -362,9 +642,13 @@ ResourceItem* JobTracker::AssignMap(const std::string& endpoint, Status* status)
             map_slug_.pop();
         }
         if (map_slug_.empty()) {
+            if (prefetch) {
+                *status = kSuspend;
+                return NULL;
+            }
             alloc_mu_.Unlock();
             mu_.Lock();
-            CanMapDismiss(status, endpoint);
+            CanMapDismiss(status, DismissKey(endpoint, slot));
             mu_.Unlock();
             alloc_mu_.Lock();
             return NULL;
@@ -373,9 +657,13 @@ ResourceItem* JobTracker::AssignMap(const std::string& endpoint, Status* status)
         cur = map_manager_->GetCertainItem(map_slug_.front());
         map_slug_.pop();
         if (cur == NULL) {
+            if (prefetch) {
+                *status = kSuspend;
+                return NULL;
+            }
             alloc_mu_.Unlock();
             mu_.Lock();
-            CanMapDismiss(status, endpoint);
+            CanMapDismiss(status, DismissKey(endpoint, slot));
             mu_.Unlock();
             alloc_mu_.Lock();
             return NULL;
@@ -402,19 +690,26 @@ ResourceItem* JobTracker::AssignMap(const std::string& endpoint, Status* status)
     alloc->is_map = true;
     alloc->alloc_time = std::time(NULL);
     alloc->period = -1;
+    alloc->alloc_us = common::timer::get_micros();
+    alloc->slot = slot;
+    alloc->prefetch = prefetch;
     MutexLock lock(&alloc_mu_);
+    alloc->seq = allocation_table_.size();
     allocation_table_.push_back(alloc);
+    TouchAllocation(alloc);
     map_index_[alloc->resource_no][alloc->attempt] = alloc;
     time_heap_.push(alloc);
-    LOG(INFO, "assign map: < no - %d, attempt - %d >, to %s: %s",
-            alloc->resource_no, alloc->attempt, endpoint.c_str(), job_id_.c_str());
+    LOG(INFO, "assign map: < no - %d, attempt - %d >, to %s%s: %s",
+            alloc->resource_no, alloc->attempt, endpoint.c_str(),
+            prefetch ? " in advance" : "", job_id_.c_str());
     if (status != NULL) {
         *status = kOk;
     }
     return cur;
 }
 
-IdItem* JobTracker::AssignReduce(const std::string& endpoint, Status* status) {
+IdItem* JobTracker::AssignReduce(const std::string& endpoint, int32_t slot,
+                                 bool prefetch, Status* status) {
     if (state_ == kPending) {
         state_ = kRunning;
     }
@@ -426,9 +721,13 @@ IdItem* JobTracker::AssignReduce(const std::string& endpoint, Status* status) {
             reduce_slug_.pop();
         }
         if (reduce_slug_.empty()) {
+            if (prefetch) {
+                *status = kSuspend;
+                return NULL;
+            }
             alloc_mu_.Unlock();
             mu_.Lock();
-            CanReduceDismiss(status, endpoint);
+            CanReduceDismiss(status, DismissKey(endpoint, slot));
             mu_.Unlock();
             alloc_mu_.Lock();
             return NULL;
@@ -436,9 +735,13 @@ IdItem* JobTracker::AssignReduce(const std::string& endpoint, Status* status) {
         cur = reduce_manager_->GetCertainItem(reduce_slug_.front());
         reduce_slug_.pop();
         if (cur == NULL) {
+            if (prefetch) {
+                *status = kSuspend;
+                return NULL;
+            }
             alloc_mu_.Unlock();
             mu_.Lock();
-            CanReduceDismiss(status, endpoint);
+            CanReduceDismiss(status, DismissKey(endpoint, slot));
             mu_.Unlock();
             alloc_mu_.Lock();
             return NULL;
@@ -465,12 +768,18 @@ IdItem* JobTracker::AssignReduce(const std::string& endpoint, Status* status) {
     alloc->is_map = false;
     alloc->alloc_time = std::time(NULL);
     alloc->period = -1;
+    alloc->alloc_us = common::timer::get_micros();
+    alloc->slot = slot;
+    alloc->prefetch = prefetch;
     MutexLock lock(&alloc_mu_);
+    alloc->seq = allocation_table_.size();
     allocation_table_.push_back(alloc);
+    TouchAllocation(alloc);
     reduce_index_[alloc->resource_no][alloc->attempt] = alloc;
     time_heap_.push(alloc);
-    LOG(INFO, "assign reduce: < no - %d, attempt - %d >, to %s: %s",
-            alloc->resource_no, alloc->attempt, endpoint.c_str(), job_id_.c_str());
+    LOG(INFO, "assign reduce: < no - %d, attempt - %d >, to %s%s: %s",
+            alloc->resource_no, alloc->attempt, endpoint.c_str(),
+            prefetch ? " in advance" : "", job_id_.c_str());
     if (status != NULL) {
         *status = kOk;
     }
@@ -496,6 +805,7 @@ void JobTracker::CancelOtherAttempts(
             }
             candidate->state = kTaskCanceled;
             candidate->period = std::time(NULL) - candidate->alloc_time;
+            TouchAllocation(candidate);
             rpc_client_->GetStub(candidate->endpoint, &stub);
             boost::scoped_ptr<Minion_Stub> stub_guard(stub);
             LOG(INFO, "cancel %s task: job:%s, task:%d, attempt:%d",
@@ -516,7 +826,9 @@ void JobTracker::CancelOtherAttempts(
 
 Status JobTracker::FinishMap(int no, int attempt, TaskState state, 
                              const std::string& err_msg,
-                             const std::map<std::string, int64_t>& counters) {
+                             const std::map<std::string, int64_t>& counters,
+                             const std::vector<int64_t>& partition_sizes,
+                             const std::vector<PartitionKey>& hot_keys) {
     AllocateItem* cur = NULL;
     {
         MutexLock lock(&alloc_mu_);
@@ -596,12 +908,30 @@ Status JobTracker::FinishMap(int no, int attempt, TaskState state,
                 break;
             }
             AccumulateCounters(counters);
+            if (!partition_sizes_.empty()) {
+                size_t n = std::min(partition_sizes.size(), partition_sizes_.size());
+                for (size_t i = 0; i < n; ++i) {
+                    if (partition_sizes[i] != 0) {
+                        partition_sizes_[i] += partition_sizes[i];
+                        dirty_partitions_.insert(i);
+                    }
+                }
+                AccumulateHotKeys(hot_keys);
+            }
             int completed = map_manager_->Done();
             LOG(INFO, "complete a map task(%d/%d): %s",
                     completed, map_manager_->SumOfItem(), job_id_.c_str());
+            if (map_ != NULL) {
+                // Pooled minions of the phase are returned as it drains
+                map_->Follow(map_manager_->Pending() + map_manager_->Allocated());
+            }
             if (completed == reduce_begin_ && job_descriptor_.job_type() != kMapOnlyJob) {
                 LOG(INFO, "map phrase nearly ends, pull up reduce tasks: %s", job_id_.c_str());
-                reduce_ = new Gru(galaxy_, &job_descriptor_, job_id_, kReduce);
+                if (!partition_sizes_.empty()) {
+                    PlanReducePartitions();
+                }
+                reduce_ = new Gru(galaxy_, &job_descriptor_, job_id_, kReduce,
+                                  master_->GetMinionPool());
                 if (reduce_->Start() != kOk) {
                     LOG(WARNING, "reduce failed due to galaxy issue: %s", job_id_.c_str());
                     error_msg_ = "Failed to submit job on Galaxy\n";
@@ -710,6 +1040,7 @@ Status JobTracker::FinishMap(int no, int attempt, TaskState state,
         MutexLock lock(&alloc_mu_);
         cur->state = state;
         cur->period = std::time(NULL) - cur->alloc_time;
+        TouchAllocation(cur);
         if (map_allow_duplicates_ &&
             (state == kTaskKilled || state == kTaskFailed) ) {
             map_slug_.push(cur->resource_no);
@@ -797,6 +1128,9 @@ Status JobTracker::FinishReduce(int no, int attempt, TaskState state,
             int completed = reduce_manager_->Done();
             LOG(INFO, "complete a reduce task(%d/%d): %s",
                     completed, reduce_manager_->SumOfItem(), job_id_.c_str());
+            if (reduce_ != NULL) {
+                reduce_->Follow(reduce_manager_->Pending() + reduce_manager_->Allocated());
+            }
             if (completed == reduce_manager_->SumOfItem()) {
                 LOG(INFO, "map-reduce job finish: %s", job_id_.c_str());
                 std::string work_dir = job_descriptor_.output() + "/_temporary";
@@ -858,6 +1192,7 @@ Status JobTracker::FinishReduce(int no, int attempt, TaskState state,
         MutexLock lock(&alloc_mu_);
         cur->state = state;
         cur->period = std::time(NULL) - cur->alloc_time;
+        TouchAllocation(cur);
         if (reduce_allow_duplicates_&&
             (state == kTaskKilled || state == kTaskFailed) ) {
             reduce_slug_.push(cur->resource_no);
@@ -922,6 +1257,43 @@ TaskStatistics JobTracker::GetReduceStatistics() {
     return task;
 }
 
+void JobTracker::AccumulateUsage(bool is_map, int no, int attempt,
+                                 const TaskUsage& usage) {
+    {
+        MutexLock lock(&alloc_mu_);
+        std::map<int, std::map<int, AllocateItem*> >& index =
+            is_map ? map_index_ : reduce_index_;
+        std::map<int, std::map<int, AllocateItem*> >::iterator it = index.find(no);
+        if (it != index.end()) {
+            std::map<int, AllocateItem*>::iterator jt = it->second.find(attempt);
+            if (jt != it->second.end()) {
+                // A killed attempt may be reported finished more than once
+                if (jt->second->usage_reported) {
+                    return;
+                }
+                jt->second->usage_reported = true;
+                jt->second->phases.assign(usage.phases().begin(), usage.phases().end());
+                jt->second->start_us = usage.start_us();
+            }
+        }
+    }
+    MutexLock lock(&mu_);
+    UsageSummary& summary = is_map ? map_usage_ : reduce_usage_;
+    summary.set_attempts(summary.attempts() + 1);
+    TaskUsage* total = summary.mutable_total();
+    total->set_user_time_ms(total->user_time_ms() + usage.user_time_ms());
+    total->set_sys_time_ms(total->sys_time_ms() + usage.sys_time_ms());
+    total->set_max_rss_kb(std::max(total->max_rss_kb(), usage.max_rss_kb()));
+    total->set_dfs_read_bytes(total->dfs_read_bytes() + usage.dfs_read_bytes());
+    total->set_dfs_write_bytes(total->dfs_write_bytes() + usage.dfs_write_bytes());
+    total->set_local_read_bytes(total->local_read_bytes() + usage.local_read_bytes());
+    total->set_local_write_bytes(total->local_write_bytes() + usage.local_write_bytes());
+    total->set_pipe_in_bytes(total->pipe_in_bytes() + usage.pipe_in_bytes());
+    total->set_pipe_out_bytes(total->pipe_out_bytes() + usage.pipe_out_bytes());
+    total->set_pipe_in_wait_ms(total->pipe_in_wait_ms() + usage.pipe_in_wait_ms());
+    total->set_pipe_out_wait_ms(total->pipe_out_wait_ms() + usage.pipe_out_wait_ms());
+}
+
 void JobTracker::Replay(const std::vector<AllocateItem>& history, std::vector<IdItem>& table, bool is_map) {
     for (size_t i = 0; i < table.size(); ++i) {
         table[i].no = i;
@@ -957,9 +1329,16 @@ bool JobTracker::Load(const std::string& jobid, const JobState state,
                       const std::vector<AllocateItem>& data,
                       const std::vector<ResourceItem>& resource,
                       int32_t start_time,
-                      int32_t finish_time) {
+                      int32_t finish_time,
+                      const std::vector<int64_t>& partition_sizes,
+                      const std::vector<PartitionKey>& partition_keys) {
     LOG(INFO, "reload job: %s, data.size(): %d", jobid.c_str(), data.size());
     job_id_ = jobid;
+    if (!partition_sizes_.empty() && partition_sizes.size() == partition_sizes_.size()) {
+        MutexLock lock(&mu_);
+        partition_sizes_ = partition_sizes;
+        AccumulateHotKeys(partition_keys);
+    }
     state_ = state;
     start_time_ = start_time;
     finish_time_ = finish_time;
@@ -993,6 +1372,19 @@ bool JobTracker::Load(const std::string& jobid, const JobState state,
         reduce_manager_->Load(id_data);
     }
     BuildEndGameCounters();
+    if (job_descriptor_.job_type() != kMapOnlyJob && !partition_sizes_.empty()
+            && job_descriptor_.reduce_ranges_size() == 0
+            && map_manager_ != NULL && map_manager_->Done() >= reduce_begin_) {
+        // The plan made as maps reached reduce_begin_ was lost with the
+        // old master, make it again from the restored stats
+        LOG(INFO, "[failover] plan reduce partitions again: %s", job_id_.c_str());
+        MutexLock lock(&mu_);
+        PlanReducePartitions();
+        std::vector<IdItem> id_data;
+        id_data.resize(reduce_manager_->SumOfItem());
+        Replay(data, id_data, false);
+        reduce_manager_->Load(id_data);
+    }
     bool is_map = true;
     failed_count_.resize(job_descriptor_.map_total());
     if (map_manager_ && map_manager_->Done() == job_descriptor_.map_total()) {
@@ -1000,6 +1392,26 @@ bool JobTracker::Load(const std::string& jobid, const JobState state,
         failed_count_.resize(0);
         failed_count_.resize(job_descriptor_.reduce_total());
     }
+    // Pooled minions are asked for again, galaxy jobs of the other phases
+    // keep running on their own
+    MinionPool* pool = master_->GetMinionPool();
+    if (state_ == kRunning && pool != NULL && MinionPool::Fits(job_descriptor_)) {
+        MutexLock lock(&mu_);
+        if (is_map) {
+            map_ = new Gru(galaxy_, &job_descriptor_, job_id_,
+                    (job_descriptor_.job_type() == kMapOnlyJob) ? kMapOnly : kMap, pool);
+            if (map_manager_ != NULL) {
+                map_->Follow(map_manager_->Pending() + map_manager_->Allocated());
+            }
+            map_->Start();
+        }
+        if (job_descriptor_.job_type() != kMapOnlyJob && reduce_manager_ != NULL
+                && (!is_map || map_manager_->Done() >= reduce_begin_)) {
+            reduce_ = new Gru(galaxy_, &job_descriptor_, job_id_, kReduce, pool);
+            reduce_->Follow(reduce_manager_->Pending() + reduce_manager_->Allocated());
+            reduce_->Start();
+        }
+    }
     MutexLock lock(&alloc_mu_);
     if (state_ == kRunning) {
         monitor_->AddTask(boost::bind(&JobTracker::KeepMonitoring, this, is_map));
@@ -1018,6 +1430,8 @@ bool JobTracker::Load(const std::string& jobid, const JobState state,
     for (std::vector<AllocateItem>::const_iterator it = data.begin();
             it != data.end(); ++it) {
         AllocateItem* alloc = new AllocateItem(*it);
+        alloc->seq = allocation_table_.size();
+        alloc->version = ++version_;
         allocation_table_.push_back(alloc);
         if (alloc->is_map) {
             map_index_[alloc->resource_no][alloc->attempt] = alloc;
@@ -1036,6 +1450,264 @@ bool JobTracker::Load(const std::string& jobid, const JobState state,
     return true;
 }
 
+void JobTracker::TouchAllocation(AllocateItem* alloc) {
+    alloc_mu_.AssertHeld();
+    alloc->version = ++version_;
+    dirty_allocs_.insert(alloc->seq);
+    // Every end of an attempt passes here, whoever ends it
+    if (alloc->state != kTaskRunning && alloc->end_us == 0) {
+        alloc->end_us = common::timer::get_micros();
+    }
+}
+
+Status JobTracker::Check(const ShowJobRequest* request, ShowJobResponse* response) {
+    std::set<int> states(request->task_states().begin(), request->task_states().end());
+    size_t limit = request->limit() > 0 ? request->limit() : 0;
+    int64_t since = request->since_version();
+    std::vector<AllocateItem> matched;
+    {
+        // Only copy matched items here, responses are built out of the lock
+        MutexLock lock(&alloc_mu_);
+        if (request->since_epoch() != epoch_ || since > version_) {
+            // Version from another tracker, fall back to a full query
+            since = 0;
+        }
+        response->set_version(version_);
+        response->set_epoch(epoch_);
+        for (size_t i = std::max(request->offset(), 0);
+                i < allocation_table_.size(); ++i) {
+            const AllocateItem* cur = allocation_table_[i];
+            if (cur->version <= since) {
+                continue;
+            }
+            if (!states.empty() && states.find(cur->state) == states.end()) {
+                continue;
+            }
+            if (limit != 0 && matched.size() >= limit) {
+                response->set_next_offset(i);
+                break;
+            }
+            matched.push_back(*cur);
+        }
+    }
+    WorkMode map_type = (job_descriptor_.job_type() == kMapOnlyJob) ? kMapOnly : kMap;
+    for (std::vector<AllocateItem>::iterator it = matched.begin();
+            it != matched.end(); ++it) {
+        TaskOverview* task = response->add_tasks();
+        TaskInfo* info = task->mutable_info();
+        info->set_task_id(it->resource_no);
+        info->set_attempt_id(it->attempt);
+        info->set_task_type(it->is_map ? map_type : kReduce);
+        // XXX Warning: input will NOT return
+        task->set_state(it->state);
+        task->set_minion_addr(it->endpoint);
+        task->set_start_time(it->alloc_time);
+        task->set_end_time(it->alloc_time + it->period);
+        for (size_t i = 0; i < it->phases.size(); ++i) {
+            task->add_phases()->CopyFrom(it->phases[i]);
+        }
+    }
+    return kOk;
+}
+
+// Escaped and quoted for json
+static std::string JsonString(const std::string& str) {
+    std::string quoted = "\"";
+    for (size_t i = 0; i < str.size(); ++i) {
+        unsigned char c = str[i];
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+            quoted += c;
+        } else if (c < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            quoted += buf;
+        } else {
+            quoted += c;
+        }
+    }
+    quoted += "\"";
+    return quoted;
+}
+
+// One event of the trace, dur is only for complete events ('X')
+static std::string TraceEvent(const std::string& name, const std::string& cat, char ph,
+                              int64_t ts, int64_t dur, int pid, int tid,
+                              const std::string& args) {
+    std::stringstream event;
+    event << "{\"name\":" << JsonString(name) << ",\"cat\":" << JsonString(cat)
+          << ",\"ph\":\"" << ph << "\",\"ts\":" << ts;
+    if (ph == 'X') {
+        event << ",\"dur\":" << dur;
+    } else if (ph == 'i') {
+        event << ",\"s\":\"t\"";
+    }
+    event << ",\"pid\":" << pid << ",\"tid\":" << tid
+          << ",\"args\":{" << args << "}}";
+    return event.str();
+}
+
+struct TraceSpan {
+    const AllocateItem* item;
+    int64_t alloc_us;
+    int64_t begin_us;
+    int64_t end_us;
+    int pid;
+    int lane;
+    // Begun while an earlier attempt of the task still ran
+    bool speculative;
+};
+
+static bool TraceSpanLess(const TraceSpan& a, const TraceSpan& b) {
+    if (a.alloc_us != b.alloc_us) {
+        return a.alloc_us < b.alloc_us;
+    }
+    return a.item->seq < b.item->seq;
+}
+
+void JobTracker::Trace(std::string* trace) {
+    std::vector<AllocateItem> items;
+    {
+        MutexLock lock(&alloc_mu_);
+        for (std::vector<AllocateItem*>::iterator it = allocation_table_.begin();
+                it != allocation_table_.end(); ++it) {
+            items.push_back(**it);
+        }
+    }
+    std::string name;
+    {
+        MutexLock lock(&mu_);
+        name = job_descriptor_.name();
+    }
+    const int64_t now = common::timer::get_micros();
+    std::vector<TraceSpan> spans(items.size());
+    for (size_t i = 0; i < items.size(); ++i) {
+        const AllocateItem& item = items[i];
+        TraceSpan& span = spans[i];
+        span.item = &item;
+        span.alloc_us = item.alloc_us > 0 ? item.alloc_us : item.alloc_time * 1000000L;
+        // Clocks of minion and master may differ a little
+        span.begin_us = std::max(span.alloc_us, item.start_us);
+        int64_t end_us = item.end_us;
+        if (end_us == 0) {
+            end_us = item.state == kTaskRunning ? now
+                : (item.alloc_time + item.period) * 1000000L;
+        }
+        span.end_us = std::max(end_us, span.begin_us);
+    }
+    std::sort(spans.begin(), spans.end(), TraceSpanLess);
+
+    std::map<std::pair<bool, int>, int64_t> task_end;
+    std::map<std::string, int> pids;
+    // End of the last attempt in each lane of a minion
+    std::map<std::string, std::vector<int64_t> > lanes;
+    std::vector<std::string> events;
+    for (size_t i = 0; i < spans.size(); ++i) {
+        TraceSpan& span = spans[i];
+        const AllocateItem& item = *span.item;
+        std::pair<bool, int> task(item.is_map, item.resource_no);
+        std::map<std::pair<bool, int>, int64_t>::iterator tt = task_end.find(task);
+        span.speculative = tt != task_end.end() && tt->second > span.alloc_us;
+        if (tt == task_end.end() || tt->second < span.end_us) {
+            task_end[task] = span.end_us;
+        }
+        std::map<std::string, int>::iterator pt = pids.find(item.endpoint);
+        if (pt == pids.end()) {
+            int pid = pids.size() + 1;
+            pt = pids.insert(std::make_pair(item.endpoint, pid)).first;
+            events.push_back(TraceEvent("process_name", "", 'M', 0, 0, pid, 0,
+                        "\"name\":" + JsonString(item.endpoint)));
+        }
+        span.pid = pt->second;
+        // Attempts overlapping on a minion, e.g. in other slots, go to
+        // lanes of their own so slices nest
+        std::vector<int64_t>& ends = lanes[item.endpoint];
+        size_t lane = 0;
+        while (lane < ends.size() && ends[lane] > span.alloc_us) {
+            ++lane;
+        }
+        if (lane == ends.size()) {
+            ends.push_back(0);
+            events.push_back(TraceEvent("thread_name", "", 'M', 0, 0, span.pid, lane,
+                        "\"name\":\"lane " + boost::lexical_cast<std::string>(lane) + "\""));
+        }
+        ends[lane] = span.end_us;
+        span.lane = lane;
+    }
+
+    for (size_t i = 0; i < spans.size(); ++i) {
+        const TraceSpan& span = spans[i];
+        const AllocateItem& item = *span.item;
+        const std::string kind = item.is_map ? "map" : "reduce";
+        const std::string task_name = kind + "_"
+            + boost::lexical_cast<std::string>(item.resource_no);
+        std::stringstream args;
+        args << "\"task_id\":" << item.resource_no << ",\"attempt_id\":" << item.attempt
+             << ",\"minion\":" << JsonString(item.endpoint);
+        if (item.slot >= 0) {
+            args << ",\"slot\":" << item.slot;
+        }
+        args << ",\"state\":" << JsonString(TaskState_Name(item.state))
+             << ",\"speculative\":" << (span.speculative ? "true" : "false")
+             << ",\"prefetch\":" << (item.prefetch ? "true" : "false");
+        int64_t setup_us = 0;
+        int64_t first_input_us = 0;
+        int64_t commit_us = 0;
+        for (size_t j = 0; j < item.phases.size(); ++j) {
+            const PhaseTime& phase = item.phases[j];
+            args << ",\"" << phase.phase() << "_ms\":" << phase.ms();
+            if (phase.phase() == "setup") {
+                setup_us = phase.ms() * 1000;
+            } else if (phase.phase() == "first_input") {
+                first_input_us = phase.ms() * 1000;
+            } else if (phase.phase() == "commit") {
+                commit_us = phase.ms() * 1000;
+            }
+        }
+        // A prefetch waits for its slot to be free
+        if (span.begin_us > span.alloc_us) {
+            events.push_back(TraceEvent("reserved", kind, 'X', span.alloc_us,
+                        span.begin_us - span.alloc_us, span.pid, span.lane, args.str()));
+        }
+        events.push_back(TraceEvent(task_name, span.speculative ? kind + ",speculative" : kind,
+                    'X', span.begin_us, span.end_us - span.begin_us,
+                    span.pid, span.lane, args.str()));
+        // Only these phases have a place in time: setup and the wait for
+        // the first input run back to back from the start, and the commit
+        // is last. The others overlap and are left in args
+        const int64_t dur = span.end_us - span.begin_us;
+        setup_us = std::min(setup_us, dur);
+        first_input_us = std::min(first_input_us, dur - setup_us);
+        commit_us = std::min(commit_us, dur - setup_us - first_input_us);
+        if (setup_us > 0) {
+            events.push_back(TraceEvent("setup", "phase", 'X', span.begin_us, setup_us,
+                        span.pid, span.lane, ""));
+        }
+        if (first_input_us > 0) {
+            events.push_back(TraceEvent("first_input", "phase", 'X', span.begin_us + setup_us,
+                        first_input_us, span.pid, span.lane, ""));
+        }
+        if (commit_us > 0) {
+            events.push_back(TraceEvent("commit", "phase", 'X', span.end_us - commit_us,
+                        commit_us, span.pid, span.lane, ""));
+        }
+        if (item.state == kTaskFailed || item.state == kTaskKilled
+                || item.state == kTaskCanceled) {
+            events.push_back(TraceEvent(TaskState_Name(item.state), kind, 'i', span.end_us, 0,
+                        span.pid, span.lane, args.str()));
+        }
+    }
+
+    std::stringstream json;
+    json << "{\"displayTimeUnit\":\"ms\",\"otherData\":{\"job_id\":" << JsonString(job_id_)
+         << ",\"name\":" << JsonString(name) << "},\"traceEvents\":[";
+    for (size_t i = 0; i < events.size(); ++i) {
+        json << (i == 0 ? "\n" : ",\n") << events[i];
+    }
+    json << "\n]}\n";
+    *trace = json.str();
+}
+
 const std::vector<AllocateItem> JobTracker::HistoryForDump() {
     MutexLock lock(&alloc_mu_);
     std::vector<AllocateItem> copy;
@@ -1043,9 +1715,73 @@ const std::vector<AllocateItem> JobTracker::HistoryForDump() {
             it != allocation_table_.end(); ++it) {
         copy.push_back(*(*it));
     }
+    // A full dump covers everything changed so far
+    dirty_allocs_.clear();
     return copy;
 }
 
+const std::vector<AllocateItem> JobTracker::HistoryDeltaForDump() {
+    MutexLock lock(&alloc_mu_);
+    std::vector<AllocateItem> copy;
+    for (std::set<int>::iterator it = dirty_allocs_.begin();
+            it != dirty_allocs_.end(); ++it) {
+        copy.push_back(*allocation_table_[*it]);
+    }
+    dirty_allocs_.clear();
+    return copy;
+}
+
+void JobTracker::PartitionStatsForDump(std::vector<int64_t>* sizes,
+                                       std::vector<PartitionKey>* keys) {
+    MutexLock lock(&mu_);
+    dirty_partitions_.clear();
+    *sizes = partition_sizes_;
+    keys->clear();
+    std::map<int, std::map<std::string, int64_t> >::iterator it;
+    for (it = partition_keys_.begin(); it != partition_keys_.end(); ++it) {
+        std::map<std::string, int64_t>::iterator jt;
+        for (jt = it->second.begin(); jt != it->second.end(); ++jt) {
+            PartitionKey key;
+            key.set_partition(it->first);
+            key.set_key(jt->first);
+            key.set_size(jt->second);
+            keys->push_back(key);
+        }
+    }
+}
+
+bool JobTracker::PartitionStatsDeltaForDump(std::vector<PartitionSize>* sizes,
+                                            std::vector<PartitionKey>* keys) {
+    MutexLock lock(&mu_);
+    sizes->clear();
+    keys->clear();
+    if (dirty_partitions_.empty()) {
+        return false;
+    }
+    for (std::set<int>::iterator it = dirty_partitions_.begin();
+            it != dirty_partitions_.end(); ++it) {
+        PartitionSize size;
+        size.set_partition(*it);
+        size.set_size(partition_sizes_[*it]);
+        sizes->push_back(size);
+        std::map<int, std::map<std::string, int64_t> >::iterator keys_it =
+            partition_keys_.find(*it);
+        if (keys_it == partition_keys_.end()) {
+            continue;
+        }
+        std::map<std::string, int64_t>::iterator jt;
+        for (jt = keys_it->second.begin(); jt != keys_it->second.end(); ++jt) {
+            PartitionKey key;
+            key.set_partition(*it);
+            key.set_key(jt->first);
+            key.set_size(jt->second);
+            keys->push_back(key);
+        }
+    }
+    dirty_partitions_.clear();
+    return true;
+}
+
 const std::vector<ResourceItem> JobTracker::InputDataForDump() {
     return map_manager_ == NULL ? std::vector<ResourceItem>() : map_manager_->Dump();
 }
@@ -1124,6 +1860,9 @@ void JobTracker::KeepMonitoring(bool map_now) {
         if (not_allow_duplicates || (now - top->alloc_time < timeout) || need_random_query) {
             QueryRequest request;
             QueryResponse response;
+            // A multi-slot minion answers for the slot running the attempt
+            request.set_task_id(top->resource_no);
+            request.set_attempt_id(top->attempt);
             Minion_Stub* stub = NULL;
             rpc_client_->GetStub(top->endpoint, &stub);
             boost::scoped_ptr<Minion_Stub> stub_guard(stub);
@@ -1146,6 +1885,7 @@ void JobTracker::KeepMonitoring(bool map_now) {
                     top->state = kTaskKilled;
                     top->period = std::time(NULL) - top->alloc_time;
                     map_now ? ++map_killed_ : ++reduce_killed_;
+                    TouchAllocation(top);
                 }
                 ++ counter;
                 continue;
@@ -1156,6 +1896,7 @@ void JobTracker::KeepMonitoring(bool map_now) {
             top->state = kTaskKilled;
             top->period = std::time(NULL) - top->alloc_time;
             map_now ? ++map_killed_ : ++reduce_killed_;
+            TouchAllocation(top);
         }
         if (map_now) {
             if (top->attempt >= FLAGS_parallel_attempts - 1
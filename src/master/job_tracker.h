@@ -30,6 +30,24 @@ struct AllocateItem {
     time_t alloc_time;
     time_t period;
     bool is_map;
+    // Position in allocation table
+    int seq;
+    // Version of the job when last changed
+    int64_t version;
+    // Reported once the attempt finishes, not persisted
+    std::vector<PhaseTime> phases;
+    bool usage_reported;
+    // For the timeline of the job, not persisted either, so restored
+    // attempts only have alloc_time and period. Wall clock in us, 0 when
+    // unknown. start_us comes from minion, after alloc_us for a prefetch
+    int64_t alloc_us;
+    int64_t start_us;
+    int64_t end_us;
+    int32_t slot;
+    bool prefetch;
+    AllocateItem() : resource_no(0), attempt(0), state(kTaskRunning),
+                     alloc_time(0), period(-1), is_map(false), seq(0), version(0),
+                     usage_reported(false), alloc_us(0), start_us(0), end_us(0), slot(-1), prefetch(false) { }
 };
 
 struct AllocateItemComparator {
@@ -51,11 +69,17 @@ public:
     Status Start();
     Status Update(const std::string& priority, int map_capacity, int reduce_capacity);
     Status Kill(JobState end_state);
-    ResourceItem* AssignMap(const std::string& endpoint, Status* status);
-    IdItem* AssignReduce(const std::string& endpoint, Status* status);
+    // slot is the task slot of the minion at endpoint asking. A prefetch
+    // reserves a task for a slot still running one, it is never dismissed
+    ResourceItem* AssignMap(const std::string& endpoint, int32_t slot,
+                            bool prefetch, Status* status);
+    IdItem* AssignReduce(const std::string& endpoint, int32_t slot,
+                         bool prefetch, Status* status);
     Status FinishMap(int no, int attempt, TaskState state, 
                      const std::string& err_msg,
-                     const std::map<std::string, int64_t>& counters);
+                     const std::map<std::string, int64_t>& counters,
+                     const std::vector<int64_t>& partition_sizes,
+                     const std::vector<PartitionKey>& hot_keys);
     Status FinishReduce(int no, int attempt, TaskState state, 
                         const std::string& err_msg,
                         const std::map<std::string, int64_t>& counters);
@@ -70,6 +94,10 @@ public:
         MutexLock lock(&mu_);
         return job_descriptor_;
     }
+    std::string GetJobName() {
+        MutexLock lock(&mu_);
+        return job_descriptor_.name();
+    }
     JobState GetState() {
         MutexLock lock(&mu_);
         return state_;
@@ -88,37 +116,46 @@ public:
     }
     TaskStatistics GetMapStatistics();
     TaskStatistics GetReduceStatistics();
-
-    Status Check(ShowJobResponse* response) {
-        MutexLock lock(&alloc_mu_);
-        for (std::vector<AllocateItem*>::iterator it = allocation_table_.begin();
-                it != allocation_table_.end(); ++it) {
-            AllocateItem* cur = *it;
-            TaskOverview* task = response->add_tasks();
-            TaskInfo* info = task->mutable_info();
-            info->set_task_id(cur->resource_no);
-            info->set_attempt_id(cur->attempt);
-            info->set_task_type((job_descriptor_.job_type() == kMapOnlyJob) ? kMapOnly :
-                    (cur->is_map ? kMap : kReduce));
-            // XXX Warning: input will NOT return
-            task->set_state(cur->state);
-            task->set_minion_addr(cur->endpoint);
-            task->set_start_time(cur->alloc_time);
-            task->set_end_time(cur->alloc_time + cur->period);
-        }
-        return kOk;
+    // Adds the usage reported by an attempt to its phase, and keeps the
+    // phase timings with the attempt. Called once the attempt is finished,
+    // only the first report of an attempt counts
+    void AccumulateUsage(bool is_map, int no, int attempt, const TaskUsage& usage);
+    UsageSummary GetMapUsage() {
+        MutexLock lock(&mu_);
+        return map_usage_;
     }
+    UsageSummary GetReduceUsage() {
+        MutexLock lock(&mu_);
+        return reduce_usage_;
+    }
+
+    Status Check(const ShowJobRequest* request, ShowJobResponse* response);
+    // Attempts on the minions they ran on as a Chrome trace, see TraceJob
+    void Trace(std::string* trace);
     bool Load(const std::string& jobid, const JobState state,
               const std::vector<AllocateItem>& data,
               const std::vector<ResourceItem>& resource,
               int32_t start_time,
-              int32_t finish_time);
+              int32_t finish_time,
+              const std::vector<int64_t>& partition_sizes,
+              const std::vector<PartitionKey>& partition_keys);
     const std::vector<AllocateItem> HistoryForDump();
+    // Allocations changed since last dump, used for incremental persistence
+    const std::vector<AllocateItem> HistoryDeltaForDump();
     const std::vector<ResourceItem> InputDataForDump();
+    // Observed partition sizes and hot keys
+    void PartitionStatsForDump(std::vector<int64_t>* sizes,
+                               std::vector<PartitionKey>* keys);
+    // Sizes and hot keys of the partitions changed since last dump,
+    // false if none is
+    bool PartitionStatsDeltaForDump(std::vector<PartitionSize>* sizes,
+                                    std::vector<PartitionKey>* keys);
 
 private:
     void BuildOutputFsPointer();
     Status BuildResourceManagers();
+    // False if no key could be sampled to split the range by
+    bool SampleRangeSplitPoints(FileSystem::Param& param);
     void BuildEndGameCounters();
     void KeepMonitoring(bool map_now);
     std::string GenerateJobId();
@@ -128,6 +165,11 @@ private:
                              int no, int attempt) ;
     void CanReduceDismiss(Status* status, const std::string& endpoint);
     void CanMapDismiss(Status* status, const std::string& endpoint);
+    void TouchAllocation(AllocateItem* alloc);
+    void PlanReducePartitions();
+    void SplitPartition(int partition, int64_t target,
+                        const std::map<std::string, int64_t>& keys);
+    void AccumulateHotKeys(const std::vector<PartitionKey>& hot_keys);
 private:
     MasterImpl* master_;
     ::baidu::galaxy::sdk::AppMaster* galaxy_;
@@ -141,6 +183,10 @@ private:
     // Resource allocation
     Mutex alloc_mu_;
     std::vector<AllocateItem*> allocation_table_;
+    std::set<int> dirty_allocs_;
+    int64_t version_;
+    // Versions restart with every tracker, e.g. one restored by a new master
+    int64_t epoch_;
     std::priority_queue<AllocateItem*, std::vector<AllocateItem*>,
                         AllocateItemComparator> time_heap_;
     std::vector<int> failed_count_;
@@ -181,6 +227,14 @@ private:
     int32_t ignored_map_failures_;
     int32_t ignored_reduce_failures_;
     FileSystem::Param output_param_;
+    // Bytes of each fine-grained partition reported by completed maps
+    std::vector<int64_t> partition_sizes_;
+    // Heavy hitters of each skewed partition
+    std::map<int, std::map<std::string, int64_t> > partition_keys_;
+    std::set<int> dirty_partitions_;
+    // Not persisted, a restored job only sums attempts reported since
+    UsageSummary map_usage_;
+    UsageSummary reduce_usage_;
 };
 
 }
@@ -19,6 +19,13 @@ DEFINE_string(nexus_server_list, "", "server list for nexus to store meta data")
 DEFINE_string(jobdata_header, "his_", "header of history item in nexus key data");
 DEFINE_int32(gc_interval, 600, "time interval for master recycling outdated job");
 DEFINE_int32(backup_interval, 60000, "millisecond time interval for master backup jobs information");
+DEFINE_int32(jobdata_chunk_size, 4096, "max records in a single nexus value of job data snapshot");
+DEFINE_int32(jobdata_compact_interval, 30, "number of job data logs appended before compacting them into a snapshot");
+DEFINE_int32(reduce_skew_factor, 2, "partitions larger than this times target reduce size are split by key");
+DEFINE_int32(reduce_max_splits, 32, "max partial reduces a hot key is aggregated in");
+DEFINE_int32(hot_keys_per_partition, 64, "max hot keys kept for each partition by master");
+DEFINE_int32(range_sample_splits, 20, "input splits sampled for split points of range partitioner");
+DEFINE_int32(range_sample_records, 1000, "records sampled from each input split for range partitioner");
 DEFINE_int32(retry_bound, 3, "retry times when a certain task failed before the job is considered failed");
 DEFINE_bool(recovery, false, "whether fallen into recovery process at the beginning");
 DEFINE_int32(master_rpc_thread_num, 12, "rpc thread num of master");
@@ -29,9 +36,19 @@ DEFINE_bool(enable_memory_soft_limit, false, "enable memory soft limit or not");
 DEFINE_string(galaxy_node_label, "", "set deploying node label on Galaxy");
 DEFINE_bool(ignore_ins_error, false, "whether ignore nexus errors");
 DEFINE_bool(skip_history, false, "whether skip history when master restarting");
+DEFINE_int32(restore_threadpool_size, 8, "size of thread pool restoring jobs when master restarting");
+DEFINE_int32(lazy_restore_age, 300, "finished jobs older than this in seconds are restored only when queried");
 DEFINE_string(galaxy_user, "", "galaxy login user");
 DEFINE_string(galaxy_token, "", "galaxy login token");
 DEFINE_string(galaxy_pool, "test", "galaxy pool");
 DEFINE_string(galaxy_am_path, "", "galaxy AppMaster path on nexus");
 DEFINE_int32(max_minions_per_host, 15, "max minions per one host");
 
+DEFINE_int32(minion_slots, 1, "task slots of each minion, a galaxy replica runs this many tasks at the same time");
+DEFINE_int32(minion_pool_max, 0, "max minions kept deployed and lent to jobs, 0 to deploy minions for each job phase");
+DEFINE_int32(minion_pool_min, 10, "minions the pool keeps while no job asks for them");
+DEFINE_int32(minion_pool_millicores, 1000, "millicores of each slot of pooled minions, jobs asking for more deploy their own");
+DEFINE_int64(minion_pool_memory, 2L * 1024 * 1024 * 1024, "memory of each slot of pooled minions, jobs asking for more deploy their own");
+DEFINE_int32(minion_pool_timeout, 30, "seconds after which a pooled minion not heard from is considered lost");
+DEFINE_int32(minion_pool_shrink_delay, 300, "seconds the demand stays low before the pool shrinks");
+DEFINE_string(minion_pool_path, "minion_pool", "the key of the galaxy job of the minion pool in nexus");
@@ -3,6 +3,8 @@
 #include <string>
 #include <sstream>
 #include <stdlib.h>
+#include <stdio.h>
+#include <algorithm>
 #include <time.h>
 #include <assert.h>
 #include <sys/utsname.h>
@@ -21,25 +23,64 @@ DECLARE_string(nexus_server_list);
 DECLARE_string(jobdata_header);
 DECLARE_int32(gc_interval);
 DECLARE_int32(backup_interval);
+DECLARE_int32(jobdata_chunk_size);
+DECLARE_int32(jobdata_compact_interval);
 DECLARE_int32(submit_threadpool_size);
 DECLARE_bool(recovery);
 DECLARE_bool(ignore_ins_error);
 DECLARE_bool(skip_history);
+DECLARE_int32(restore_threadpool_size);
+DECLARE_int32(lazy_restore_age);
 DECLARE_string(galaxy_am_path);
+DECLARE_int32(minion_pool_max);
 
 namespace baidu {
 namespace shuttle {
 
-MasterImpl::MasterImpl() : gc_(2), submitter_(FLAGS_submit_threadpool_size) {
+static Gauge* s_rpcs_in_flight = Metrics::GetGauge("shuttle_master_rpcs_in_flight",
+        "Rpcs master is serving");
+static Counter* s_assigned_maps = Metrics::GetCounter(
+        "shuttle_master_assigned_tasks_total{phase=\"map\"}", "Tasks master has assigned");
+static Counter* s_assigned_reduces = Metrics::GetCounter(
+        "shuttle_master_assigned_tasks_total{phase=\"reduce\"}", "Tasks master has assigned");
+
+static Gauge* s_failover_assign_ms = Metrics::GetGauge(
+        "shuttle_master_failover_first_assign_ms",
+        "Time from the restoring of jobs to the first task assigned after it");
+
+static Histogram* RpcLatency(const std::string& method) {
+    return Metrics::GetHistogram("shuttle_master_rpc_latency_us{method=\"" + method + "\"}",
+                                 "Time master takes to serve an rpc");
+}
+
+MasterImpl::MasterImpl() : gc_(2), submitter_(FLAGS_submit_threadpool_size),
+                           restorer_(FLAGS_restore_threadpool_size),
+                           restore_begin_(0), all_restored_(true),
+                           first_assigned_(1), minion_pool_(NULL),
+                           metrics_collector_(-1) {
     srand(time(NULL));
     galaxy_sdk_ = ::baidu::galaxy::sdk::AppMaster::ConnectAppMaster(
                     FLAGS_nexus_server_list, FLAGS_galaxy_am_path);
     assert(galaxy_sdk_);
-    nexus_ = new ::galaxy::ins::sdk::InsSDK(FLAGS_nexus_server_list);
+    nexus_ = Nexus::Create(FLAGS_nexus_server_list);
+    gc_.AddTask(boost::bind(&MasterImpl::KeepGarbageCollecting, this));
+}
+
+MasterImpl::MasterImpl(::baidu::galaxy::sdk::AppMaster* galaxy) :
+        galaxy_sdk_(galaxy), gc_(2), submitter_(FLAGS_submit_threadpool_size),
+        restorer_(FLAGS_restore_threadpool_size),
+        restore_begin_(0), all_restored_(true),
+        first_assigned_(1), minion_pool_(NULL), metrics_collector_(-1) {
+    srand(time(NULL));
+    nexus_ = Nexus::Create(FLAGS_nexus_server_list);
     gc_.AddTask(boost::bind(&MasterImpl::KeepGarbageCollecting, this));
 }
 
 MasterImpl::~MasterImpl() {
+    // Before the lock, a collector running meanwhile takes it
+    if (metrics_collector_ >= 0) {
+        Metrics::RemoveCollector(metrics_collector_);
+    }
     MutexLock lock(&(tracker_mu_));
     std::map<std::string, JobTracker*>::iterator it;
     for (it = job_trackers_.begin(); it != job_trackers_.end(); ++it) {
@@ -48,22 +89,36 @@ MasterImpl::~MasterImpl() {
     for (it = dead_trackers_.begin(); it != dead_trackers_.end(); ++it) {
         delete it->second;
     }
+    delete minion_pool_;
     delete galaxy_sdk_;
     delete nexus_;
 }
 
 void MasterImpl::Init() {
-    LOG(INFO, "master alive, recovering");
+    // Jobs are restored in background, lock first so that a standby master
+    // never touches the data in nexus
+    AcquireMasterLock();
+    metrics_collector_ = Metrics::AddCollector(
+            boost::bind(&MasterImpl::CollectMetrics, this, _1));
+    if (FLAGS_minion_pool_max > 0) {
+        minion_pool_ = new MinionPool(galaxy_sdk_, nexus_);
+        if (minion_pool_->Start() != kOk) {
+            LOG(WARNING, "minion pool unavailable, deploy minions for each job");
+            delete minion_pool_;
+            minion_pool_ = NULL;
+        }
+    }
     if (FLAGS_recovery) {
+        LOG(INFO, "master alive, recovering");
         Reload();
-        LOG(INFO, "master recovered");
     }
-    AcquireMasterLock();
 }
 
 void MasterImpl::SubmitJobRoutine(const ::baidu::shuttle::SubmitJobRequest* request,
                                   ::baidu::shuttle::SubmitJobResponse* response,
                                   ::google::protobuf::Closure* done) {
+    static Histogram* latency = RpcLatency("SubmitJob");
+    LatencyScope rpc(latency, s_rpcs_in_flight);
     const JobDescriptor& job = request->job();
     LOG(INFO, "use dfs user: %s", job.input_dfs().user().c_str());
     LOG(INFO, "use output dfs user: %s", job.output_dfs().user().c_str());
@@ -99,6 +154,8 @@ void MasterImpl::UpdateJob(::google::protobuf::RpcController* /*controller*/,
                            const ::baidu::shuttle::UpdateJobRequest* request,
                            ::baidu::shuttle::UpdateJobResponse* response,
                            ::google::protobuf::Closure* done) {
+    static Histogram* latency = RpcLatency("UpdateJob");
+    LatencyScope rpc(latency, s_rpcs_in_flight);
     static const char* galaxy_priority[] = {
         "kMonitor",
         "kOnline",
@@ -125,6 +182,8 @@ void MasterImpl::UpdateJob(::google::protobuf::RpcController* /*controller*/,
     if (jobtracker != NULL) {
         Status status = jobtracker->Update(priority, map_capacity, reduce_capacity);
         response->set_status(status);
+    } else if (IsRestoring(job_id)) {
+        response->set_status(kSuspend);
     } else {
         LOG(WARNING, "try to update an inexist job: %s", job_id.c_str());
         response->set_status(kNoSuchJob);
@@ -136,6 +195,8 @@ void MasterImpl::KillJob(::google::protobuf::RpcController* /*controller*/,
                          const ::baidu::shuttle::KillJobRequest* request,
                          ::baidu::shuttle::KillJobResponse* response,
                          ::google::protobuf::Closure* done) {
+    static Histogram* latency = RpcLatency("KillJob");
+    LatencyScope rpc(latency, s_rpcs_in_flight);
     const std::string& job_id = request->jobid();
     JobTracker* jobtracker = NULL;
     {
@@ -148,6 +209,8 @@ void MasterImpl::KillJob(::google::protobuf::RpcController* /*controller*/,
     if (jobtracker != NULL) {
         Status status = RetractJob(job_id, kKilled);
         response->set_status(status);
+    } else if (IsRestoring(job_id)) {
+        response->set_status(kSuspend);
     } else {
         LOG(WARNING, "try to kill an inexist job: %s", job_id.c_str());
         response->set_status(kNoSuchJob);
@@ -159,12 +222,14 @@ void MasterImpl::ListJobs(::google::protobuf::RpcController* /*controller*/,
                           const ::baidu::shuttle::ListJobsRequest* request,
                           ::baidu::shuttle::ListJobsResponse* response,
                           ::google::protobuf::Closure* done) {
+    static Histogram* latency = RpcLatency("ListJobs");
+    LatencyScope rpc(latency, s_rpcs_in_flight);
     std::map<std::string, JobTracker*>::iterator it;
     {
         MutexLock lock1(&(tracker_mu_));
         for (it = job_trackers_.begin(); it != job_trackers_.end(); ++it) {
             JobOverview* job = response->add_jobs();
-            job->mutable_desc()->CopyFrom(it->second->GetJobDescriptor());
+            FillJobOverview(it->second, request->summary(), job);
             job->set_jobid(it->first);
             job->set_state(it->second->GetState());
             job->mutable_map_stat()->CopyFrom(it->second->GetMapStatistics());
@@ -175,20 +240,33 @@ void MasterImpl::ListJobs(::google::protobuf::RpcController* /*controller*/,
         MutexLock lock2(&(dead_mu_));
         for (it = dead_trackers_.begin(); it != dead_trackers_.end(); ++it) {
             JobOverview* job = response->add_jobs();
-            job->mutable_desc()->CopyFrom(it->second->GetJobDescriptor());
+            FillJobOverview(it->second, request->summary(), job);
             job->set_jobid(it->first);
             job->set_state(it->second->GetState());
             job->mutable_map_stat()->CopyFrom(it->second->GetMapStatistics());
             job->mutable_reduce_stat()->CopyFrom(it->second->GetReduceStatistics());
         }
     }
+    if (request->all()) {
+        ListLazyJobs(request->summary(), response);
+    }
     done->Run();
 }
 
+void MasterImpl::FillJobOverview(JobTracker* jobtracker, bool summary, JobOverview* job) {
+    if (summary) {
+        job->mutable_desc()->set_name(jobtracker->GetJobName());
+    } else {
+        job->mutable_desc()->CopyFrom(jobtracker->GetJobDescriptor());
+    }
+}
+
 void MasterImpl::ShowJob(::google::protobuf::RpcController* /*controller*/,
                          const ::baidu::shuttle::ShowJobRequest* request,
                          ::baidu::shuttle::ShowJobResponse* response,
                          ::google::protobuf::Closure* done) {
+    static Histogram* latency = RpcLatency("ShowJob");
+    LatencyScope rpc(latency, s_rpcs_in_flight);
     const std::string& job_id = request->jobid();
     JobTracker* jobtracker = NULL;
     {
@@ -199,6 +277,7 @@ void MasterImpl::ShowJob(::google::protobuf::RpcController* /*controller*/,
         }
     }
     if (jobtracker == NULL && request->all()) {
+        RestoreLazyJob(job_id);
         MutexLock lock(&(dead_mu_));
         std::map<std::string, JobTracker*>::iterator it = dead_trackers_.find(job_id);
         if (it != dead_trackers_.end()) {
@@ -213,14 +292,21 @@ void MasterImpl::ShowJob(::google::protobuf::RpcController* /*controller*/,
         job->set_state(jobtracker->GetState());
         job->mutable_map_stat()->CopyFrom(jobtracker->GetMapStatistics());
         job->mutable_reduce_stat()->CopyFrom(jobtracker->GetReduceStatistics());
+        job->mutable_map_usage()->CopyFrom(jobtracker->GetMapUsage());
+        job->mutable_reduce_usage()->CopyFrom(jobtracker->GetReduceUsage());
         job->set_start_time(jobtracker->GetStartTime());
         job->set_finish_time(jobtracker->GetFinishTime());
         response->set_error_msg(jobtracker->GetErrorMsg());
         if (request->show_detail()) {
-            jobtracker->Check(response);
-            jobtracker->FillCounters(response);
+            jobtracker->Check(request, response);
+            // Counters are sent with the first page only
+            if (request->offset() == 0) {
+                jobtracker->FillCounters(response);
+            }
         }
         // TODO Query progress here
+    } else if (IsRestoring(job_id)) {
+        response->set_status(kSuspend);
     } else {
         LOG(WARNING, "try to access an inexist job: %s", job_id.c_str());
         response->set_status(kNoSuchJob);
@@ -228,10 +314,47 @@ void MasterImpl::ShowJob(::google::protobuf::RpcController* /*controller*/,
     done->Run();
 }
 
+void MasterImpl::TraceJob(::google::protobuf::RpcController* /*controller*/,
+                          const ::baidu::shuttle::TraceJobRequest* request,
+                          ::baidu::shuttle::TraceJobResponse* response,
+                          ::google::protobuf::Closure* done) {
+    static Histogram* latency = RpcLatency("TraceJob");
+    LatencyScope rpc(latency, s_rpcs_in_flight);
+    const std::string& job_id = request->jobid();
+    JobTracker* jobtracker = NULL;
+    {
+        MutexLock lock(&(tracker_mu_));
+        std::map<std::string, JobTracker*>::iterator it = job_trackers_.find(job_id);
+        if (it != job_trackers_.end()) {
+            jobtracker = it->second;
+        }
+    }
+    if (jobtracker == NULL) {
+        RestoreLazyJob(job_id);
+        MutexLock lock(&(dead_mu_));
+        std::map<std::string, JobTracker*>::iterator it = dead_trackers_.find(job_id);
+        if (it != dead_trackers_.end()) {
+            jobtracker = it->second;
+        }
+    }
+    if (jobtracker != NULL) {
+        jobtracker->Trace(response->mutable_trace());
+        response->set_status(kOk);
+    } else if (IsRestoring(job_id)) {
+        response->set_status(kSuspend);
+    } else {
+        LOG(WARNING, "try to trace an inexist job: %s", job_id.c_str());
+        response->set_status(kNoSuchJob);
+    }
+    done->Run();
+}
+
 void MasterImpl::AssignTask(::google::protobuf::RpcController* /*controller*/,
                             const ::baidu::shuttle::AssignTaskRequest* request,
                             ::baidu::shuttle::AssignTaskResponse* response,
                             ::google::protobuf::Closure* done) {
+    static Histogram* latency = RpcLatency("AssignTask");
+    LatencyScope rpc(latency, s_rpcs_in_flight);
     const std::string& job_id = request->jobid();
     
     JobTracker* jobtracker = NULL;
@@ -245,7 +368,8 @@ void MasterImpl::AssignTask(::google::protobuf::RpcController* /*controller*/,
     if (jobtracker != NULL) {
         Status assign_status;
         if (request->work_mode() == kReduce) {
-            IdItem* resource = jobtracker->AssignReduce(request->endpoint(), &assign_status);
+            IdItem* resource = jobtracker->AssignReduce(request->endpoint(),
+                    request->slot(), request->prefetch(), &assign_status);
             response->set_status(assign_status);
             if (resource == NULL) {
                 done->Run();
@@ -256,9 +380,14 @@ void MasterImpl::AssignTask(::google::protobuf::RpcController* /*controller*/,
             task->set_task_id(resource->no);
             task->set_attempt_id(resource->attempt);
             task->mutable_job()->CopyFrom(jobtracker->GetJobDescriptor());
+            if (task->job().reduce_ranges_size() > resource->no) {
+                task->mutable_reduce_range()->CopyFrom(task->job().reduce_ranges(resource->no));
+            }
             delete resource;
+            s_assigned_reduces->Inc();
         } else {
-            ResourceItem* resource = jobtracker->AssignMap(request->endpoint(), &assign_status);
+            ResourceItem* resource = jobtracker->AssignMap(request->endpoint(),
+                    request->slot(), request->prefetch(), &assign_status);
             response->set_status(assign_status);
             if (resource == NULL) {
                 done->Run();
@@ -274,7 +403,9 @@ void MasterImpl::AssignTask(::google::protobuf::RpcController* /*controller*/,
             input->set_input_size(resource->size);
             task->mutable_job()->CopyFrom(jobtracker->GetJobDescriptor());
             delete resource;
+            s_assigned_maps->Inc();
         }
+        RecordFirstAssignment();
     } else {
         {
             MutexLock lock(&(dead_mu_));
@@ -285,6 +416,8 @@ void MasterImpl::AssignTask(::google::protobuf::RpcController* /*controller*/,
         }
         if (jobtracker != NULL) {
             response->set_status(kNoMore);
+        } else if (IsRestoring(job_id)) {
+            response->set_status(kSuspend);
         } else {
             LOG(WARNING, "assign task failed: job inexist: %s", job_id.c_str());
             response->set_status(kNoSuchJob);
@@ -297,6 +430,8 @@ void MasterImpl::FinishTask(::google::protobuf::RpcController* /*controller*/,
                             const ::baidu::shuttle::FinishTaskRequest* request,
                             ::baidu::shuttle::FinishTaskResponse* response,
                             ::google::protobuf::Closure* done) {
+    static Histogram* latency = RpcLatency("FinishTask");
+    LatencyScope rpc(latency, s_rpcs_in_flight);
     const std::string& job_id = request->jobid();
     JobTracker* jobtracker = NULL;
     {
@@ -310,6 +445,20 @@ void MasterImpl::FinishTask(::google::protobuf::RpcController* /*controller*/,
         Status status = kOk;
         std::map<std::string, int64_t> counters;
         ParseJobCounters(request->counters(), &counters);
+        Metrics::GetCounter("shuttle_master_finished_tasks_total{state=\""
+                            + TaskState_Name(request->task_state()) + "\"}",
+                            "Task attempts reported finished to master")->Inc();
+        if (request->has_usage()) {
+            const TaskUsage& usage = request->usage();
+            LOG(INFO, "task usage: %s, %d, %d, slot %d of %s: user %lld ms, sys %lld ms, rss %lld KB, "
+                "dfs r/w %lld/%lld, local r/w %lld/%lld, pipe in/out %lld/%lld bytes, "
+                "pipe wait in/out %lld/%lld ms",
+                job_id.c_str(), request->task_id(), request->attempt_id(), request->slot(),
+                request->endpoint().c_str(), usage.user_time_ms(), usage.sys_time_ms(),
+                usage.max_rss_kb(), usage.dfs_read_bytes(), usage.dfs_write_bytes(),
+                usage.local_read_bytes(), usage.local_write_bytes(), usage.pipe_in_bytes(),
+                usage.pipe_out_bytes(), usage.pipe_in_wait_ms(), usage.pipe_out_wait_ms());
+        }
 
         if (request->work_mode() == kReduce) {
             status = jobtracker->FinishReduce(request->task_id(),
@@ -318,11 +467,23 @@ void MasterImpl::FinishTask(::google::protobuf::RpcController* /*controller*/,
                                               request->error_msg(),
                                               counters);
         } else {
+            std::vector<int64_t> partition_sizes(request->partition_sizes().begin(),
+                                                 request->partition_sizes().end());
+            std::vector<PartitionKey> hot_keys(request->hot_keys().begin(),
+                                               request->hot_keys().end());
             status = jobtracker->FinishMap(request->task_id(),
                                            request->attempt_id(),
                                            request->task_state(),
                                            request->error_msg(),
-                                           counters);
+                                           counters,
+                                           partition_sizes,
+                                           hot_keys);
+        }
+        // Only once the attempt is taken as finished, retries of the report
+        // and reports of stale attempts are not counted again
+        if (status == kOk && request->has_usage()) {
+            jobtracker->AccumulateUsage(request->work_mode() != kReduce, request->task_id(),
+                                        request->attempt_id(), request->usage());
         }
         response->set_status(status);
     } else {
@@ -335,6 +496,8 @@ void MasterImpl::FinishTask(::google::protobuf::RpcController* /*controller*/,
         }
         if (jobtracker != NULL) {
             response->set_status(kOk);
+        } else if (IsRestoring(job_id)) {
+            response->set_status(kSuspend);
         } else {
             LOG(WARNING, "finish task failed: job inexist: %s", job_id.c_str());
             response->set_status(kNoSuchJob);
@@ -343,6 +506,62 @@ void MasterImpl::FinishTask(::google::protobuf::RpcController* /*controller*/,
     done->Run();
 }
 
+void MasterImpl::BindMinion(::google::protobuf::RpcController* /*controller*/,
+                            const ::baidu::shuttle::BindMinionRequest* request,
+                            ::baidu::shuttle::BindMinionResponse* response,
+                            ::google::protobuf::Closure* done) {
+    static Histogram* latency = RpcLatency("BindMinion");
+    LatencyScope rpc(latency, s_rpcs_in_flight);
+    if (minion_pool_ != NULL) {
+        minion_pool_->Bind(request, response);
+    } else {
+        LOG(WARNING, "minion pool disabled, dismiss: %s", request->endpoint().c_str());
+        response->set_status(kNoMore);
+    }
+    done->Run();
+}
+
+void MasterImpl::GetMetrics(::google::protobuf::RpcController* /*controller*/,
+                            const ::baidu::shuttle::GetMetricsRequest* request,
+                            ::baidu::shuttle::GetMetricsResponse* response,
+                            ::google::protobuf::Closure* done) {
+    Metrics::Collect(request->prefix(), response);
+    done->Run();
+}
+
+void MasterImpl::CollectMetrics(GetMetricsResponse* response) {
+    Metrics::AddValue("shuttle_master_submit_queue_depth", "Submitted jobs waiting to be started",
+                      kGaugeMetric, submitter_.PendingNum(), response);
+    Metrics::AddValue("shuttle_master_restore_queue_depth", "Jobs waiting to be restored",
+                      kGaugeMetric, restorer_.PendingNum(), response);
+    {
+        MutexLock lock(&dead_mu_);
+        Metrics::AddValue("shuttle_master_jobs{state=\"dead\"}", "Jobs master keeps",
+                          kGaugeMetric, dead_trackers_.size(), response);
+    }
+    MutexLock lock(&tracker_mu_);
+    Metrics::AddValue("shuttle_master_jobs{state=\"alive\"}", "Jobs master keeps",
+                      kGaugeMetric, job_trackers_.size(), response);
+    std::map<std::string, JobTracker*>::iterator it;
+    for (it = job_trackers_.begin(); it != job_trackers_.end(); ++it) {
+        const TaskStatistics maps = it->second->GetMapStatistics();
+        const TaskStatistics reduces = it->second->GetReduceStatistics();
+        const std::string job = "{job=\"" + it->first + "\",phase=";
+        Metrics::AddValue("shuttle_master_running_tasks" + job + "\"map\"}",
+                          "Task attempts running of each job", kGaugeMetric,
+                          maps.running(), response);
+        Metrics::AddValue("shuttle_master_running_tasks" + job + "\"reduce\"}",
+                          "Task attempts running of each job", kGaugeMetric,
+                          reduces.running(), response);
+        Metrics::AddValue("shuttle_master_pending_tasks" + job + "\"map\"}",
+                          "Tasks waiting to be assigned of each job", kGaugeMetric,
+                          maps.pending(), response);
+        Metrics::AddValue("shuttle_master_pending_tasks" + job + "\"reduce\"}",
+                          "Tasks waiting to be assigned of each job", kGaugeMetric,
+                          reduces.pending(), response);
+    }
+}
+
 Status MasterImpl::RetractJob(const std::string& jobid, JobState end_state) {
     MutexLock lock(&(tracker_mu_));
     MutexLock lock2(&(dead_mu_));
@@ -419,69 +638,255 @@ std::string MasterImpl::SelfEndpoint() {
 }
 
 void MasterImpl::KeepGarbageCollecting() {
-    MutexLock lock(&(dead_mu_));
-    std::set<std::string> gc_jobs;
-    for (std::map<std::string, JobTracker*>::iterator it = dead_trackers_.begin();
-            it != dead_trackers_.end(); ++it) {
-        JobTracker* jobtracker = it->second;
-        const std::string& jobid = it->first;
-        int32_t interval_seconds = common::timer::now_time() - jobtracker->GetFinishTime();
-        if (interval_seconds < 0 || interval_seconds > FLAGS_gc_interval) {
-            gc_jobs.insert(jobid);
-        }
-    }
-    std::set<std::string>::iterator it;
-    for (it = gc_jobs.begin(); it != gc_jobs.end(); it++) {
-        const std::string& jobid = *it;
-        std::map<std::string, JobTracker*>::iterator jt = dead_trackers_.find(jobid);
-        if (jt != dead_trackers_.end()) {
-            JobTracker* jobtracker = jt->second;
-            dead_trackers_.erase(jobid);
-            delete jobtracker;
-            LOG(INFO, "[gc] remove dead jobtracker: %s", jobid.c_str());
-            RemoveJobFromNexus(jobid);
+    std::vector<std::string> removed;
+    std::vector<JobTracker*> trackers;
+    {
+        MutexLock lock(&(dead_mu_));
+        std::map<std::string, JobTracker*>::iterator it = dead_trackers_.begin();
+        while (it != dead_trackers_.end()) {
+            int32_t interval_seconds = common::timer::now_time() - it->second->GetFinishTime();
+            if (interval_seconds < 0 || interval_seconds > FLAGS_gc_interval) {
+                LOG(INFO, "[gc] remove dead jobtracker: %s", it->first.c_str());
+                removed.push_back(it->first);
+                trackers.push_back(it->second);
+                dead_trackers_.erase(it++);
+            } else {
+                ++it;
+            }
         }
     }
+    {
+        MutexLock lock(&restore_mu_);
+        std::map<std::string, LazyJob>::iterator it = lazy_jobs_.begin();
+        while (it != lazy_jobs_.end()) {
+            int32_t interval_seconds = common::timer::now_time() - it->second.head.finish_time();
+            if (interval_seconds < 0 || interval_seconds > FLAGS_gc_interval) {
+                LOG(INFO, "[gc] remove lazy job: %s", it->first.c_str());
+                removed.push_back(it->first);
+                lazy_jobs_.erase(it++);
+            } else {
+                ++it;
+            }
+        }
+    }
+    // Out of the locks, every rpc takes them while nexus may be slow
+    for (size_t i = 0; i < trackers.size(); ++i) {
+        delete trackers[i];
+    }
+    for (size_t i = 0; i < removed.size(); ++i) {
+        RemoveJobFromNexus(removed[i]);
+    }
     gc_.DelayTask(60000,
                   boost::bind(&MasterImpl::KeepGarbageCollecting, this));
 }
 
+static std::string JobDataKey(const std::string& jobid) {
+    return FLAGS_nexus_root_path + FLAGS_jobdata_header + jobid;
+}
+
+static std::string JobSnapshotKey(const std::string& jobid, int32_t gen, int32_t chunk) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "/snap_%08d_%05d", gen, chunk);
+    return JobDataKey(jobid) + buf;
+}
+
+// Chunks of snapshots taken before generations were named by sequence
+static int32_t SnapshotGen(const JobCollection& head) {
+    return head.has_snapshot_gen() ? head.snapshot_gen() : head.snapshot_seq();
+}
+
+static std::string JobLogKey(const std::string& jobid, int32_t seq) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "/log_%08d", seq);
+    return JobDataKey(jobid) + buf;
+}
+
+static void FillJobAllocation(const AllocateItem& item, JobAllocation* job) {
+    job->set_resource_no(item.resource_no);
+    job->set_attempt(item.attempt);
+    job->set_endpoint(item.endpoint);
+    job->set_state(item.state);
+    job->set_alloc_time(item.alloc_time);
+    job->set_period(item.period);
+    job->set_is_map(item.is_map);
+    job->set_seq(item.seq);
+}
+
+static void ParseJobAllocation(const JobAllocation& job, AllocateItem& item) {
+    item.resource_no = job.resource_no();
+    item.attempt = job.attempt();
+    item.endpoint = job.endpoint();
+    item.state = job.state();
+    item.alloc_time = job.alloc_time();
+    item.period = job.period();
+    item.is_map = job.is_map();
+    item.seq = job.seq();
+}
+
+void MasterImpl::RemoveJobDataFromNexus(const std::string& jobid, int32_t snapshot_seq,
+                                        int32_t snapshot_gen) {
+    // Remove logs older than snapshot_seq and chunks of snapshots other than
+    // snapshot_gen, or all of them if snapshot_seq is negative
+    const std::string& prefix = JobDataKey(jobid) + "/";
+    Nexus::ScanResult* result = nexus_->Scan(prefix, JobDataKey(jobid) + "0");
+    if (result == NULL) {
+        return;
+    }
+    std::vector<std::string> outdated;
+    for (; !result->Done(); result->Next()) {
+        const std::string& key = result->Key();
+        if (key.size() <= prefix.size()) {
+            continue;
+        }
+        const char* name = key.c_str() + prefix.size();
+        int32_t seq = -1;
+        int32_t gen = -1;
+        int32_t chunk = 0;
+        if (sscanf(name, "log_%d", &seq) == 1) {
+            if (snapshot_seq < 0 || seq < snapshot_seq) {
+                outdated.push_back(key);
+            }
+        } else if (sscanf(name, "snap_%d_%d", &gen, &chunk) == 2) {
+            if (snapshot_seq < 0 || gen != snapshot_gen) {
+                outdated.push_back(key);
+            }
+        }
+    }
+    delete result;
+    for (std::vector<std::string>::iterator it = outdated.begin();
+            it != outdated.end(); ++it) {
+        nexus_->Delete(*it, NULL);
+    }
+    LOG(DEBUG, "remove %d outdated job data: %s", outdated.size(), jobid.c_str());
+}
+
 bool MasterImpl::RemoveJobFromNexus(const std::string& jobid) {
+    MutexLock lock(&persist_mu_);
     bool ok = nexus_->Delete(FLAGS_nexus_root_path + jobid, NULL);
     if (ok) {
-        ok = nexus_->Delete(FLAGS_nexus_root_path + FLAGS_jobdata_header + jobid, NULL);
+        ok = nexus_->Delete(JobDataKey(jobid), NULL);
     }
-    LOG(INFO, "[%s] remove job from nexus",
+    if (ok) {
+        RemoveJobDataFromNexus(jobid, -1, -1);
+        persistences_.erase(jobid);
+    }
+    LOG(INFO, "[%s] remove job from nexus: %s",
             ok ? "OK": "FAIL",
             jobid.c_str());
     return ok;
 }
 
-bool MasterImpl::SaveJobToNexus(JobTracker* jobtracker) {
+bool MasterImpl::SaveJobToNexus(JobTracker* jobtracker, bool compact) {
     std::stringstream ss;
     jobtracker->GetJobDescriptor().SerializeToOstream(&ss);
     std::string compressed_str;
     snappy::Compress(ss.str().data(), ss.str().size(), &compressed_str);
     const std::string& jobid = jobtracker->GetJobId();
     const std::string& descriptor = compressed_str;
-    const std::string& jobdata = SerialJobData(jobtracker);
-    bool ok = nexus_->Put(FLAGS_nexus_root_path + jobid, descriptor, NULL);
+    MutexLock lock(&persist_mu_);
+    JobPersistence& persist = persistences_[jobid];
+    // Descriptor only changes when the job is updated
+    if (persist.descriptor != descriptor) {
+        bool ok = nexus_->Put(FLAGS_nexus_root_path + jobid, descriptor, NULL);
+        LOG(INFO, "[%s] job descriptor persistence: %s, desc: %d bytes",
+                ok ? "OK": "FAIL", jobid.c_str(), descriptor.size());
+        if (!ok) {
+            return false;
+        }
+        persist.descriptor = descriptor;
+    }
+    if (compact || persist.need_snapshot ||
+            persist.log_seq - persist.snapshot_seq >= FLAGS_jobdata_compact_interval) {
+        return SaveJobSnapshot(jobtracker, persist);
+    }
+    return AppendJobLog(jobtracker, persist);
+}
+
+bool MasterImpl::SaveJobSnapshot(JobTracker* jobtracker, JobPersistence& persist) {
+    persist_mu_.AssertHeld();
+    const std::string& jobid = jobtracker->GetJobId();
+    JobCollection head;
+    std::vector<std::string> chunks;
+    SerialJobSnapshot(jobtracker, head, chunks);
+    // Chunks of a new snapshot go to keys of a new generation and never
+    // overwrite the ones the head points to, even when no log came since,
+    // so a failure in the middle leaves the previous snapshot intact
+    const int32_t seq = persist.log_seq;
+    const int32_t gen = persist.snapshot_gen + 1;
+    size_t data_size = 0;
+    bool ok = true;
+    for (size_t i = 0; ok && i < chunks.size(); ++i) {
+        ok = nexus_->Put(JobSnapshotKey(jobid, gen, i), chunks[i], NULL);
+        data_size += chunks[i].size();
+    }
+    if (ok) {
+        head.set_snapshot_seq(seq);
+        head.set_snapshot_gen(gen);
+        head.set_snapshot_chunks(chunks.size());
+        ok = nexus_->Put(JobDataKey(jobid), SerialJobData(head), NULL);
+    }
     if (ok) {
-        ok = nexus_->Put(FLAGS_nexus_root_path + FLAGS_jobdata_header + jobid, jobdata, NULL);
+        persist.snapshot_seq = seq;
+        persist.snapshot_gen = gen;
+        persist.state = head.state();
+        RemoveJobDataFromNexus(jobid, seq, gen);
     }
-    LOG(INFO, "[%s] job persistence: %s, desc:%d bytes, data: %d bytes",
+    // The pending delta has been taken by the snapshot, so retry with a full one
+    persist.need_snapshot = !ok;
+    LOG(INFO, "[%s] job snapshot persistence: %s, seq: %d, gen: %d, chunks: %d, data: %d bytes",
             ok ? "OK": "FAIL",
-            jobid.c_str(), descriptor.size(), jobdata.size());
+            jobid.c_str(), seq, gen, chunks.size(), data_size);
+    return ok;
+}
+
+bool MasterImpl::AppendJobLog(JobTracker* jobtracker, JobPersistence& persist) {
+    persist_mu_.AssertHeld();
+    const std::string& jobid = jobtracker->GetJobId();
+    JobCollection jc;
+    jc.set_state(jobtracker->GetState());
+    jc.set_start_time(jobtracker->GetStartTime());
+    jc.set_finish_time(jobtracker->GetFinishTime());
+    const std::vector<AllocateItem>& delta = jobtracker->HistoryDeltaForDump();
+    // Only partitions reported since the former log are written
+    std::vector<PartitionSize> partition_sizes;
+    std::vector<PartitionKey> partition_keys;
+    bool sizes_changed = jobtracker->PartitionStatsDeltaForDump(&partition_sizes,
+                                                                &partition_keys);
+    if (delta.empty() && !sizes_changed && jc.state() == persist.state) {
+        return true;
+    }
+    for (size_t i = 0; i < partition_sizes.size(); ++i) {
+        jc.add_changed_partitions()->CopyFrom(partition_sizes[i]);
+    }
+    for (size_t i = 0; i < partition_keys.size(); ++i) {
+        jc.add_partition_keys()->CopyFrom(partition_keys[i]);
+    }
+    for (std::vector<AllocateItem>::const_iterator it = delta.begin();
+            it != delta.end(); ++it) {
+        FillJobAllocation(*it, jc.add_jobs());
+    }
+    const std::string& jobdata = SerialJobData(jc);
+    const int32_t seq = persist.log_seq++;
+    bool ok = nexus_->Put(JobLogKey(jobid, seq), jobdata, NULL);
+    if (ok) {
+        persist.state = jc.state();
+    } else {
+        // The sequence is skipped anyway in case the value actually landed,
+        // and the lost delta is recovered by a full snapshot
+        persist.need_snapshot = true;
+    }
+    LOG(INFO, "[%s] job log persistence: %s, seq: %d, records: %d, data: %d bytes",
+            ok ? "OK": "FAIL",
+            jobid.c_str(), seq, jc.jobs_size(), jobdata.size());
     return ok;
 }
 
 void MasterImpl::KeepDataPersistence() {
-    // TODO Maybe do diff here to reduce pressure
     {
         MutexLock lock(&tracker_mu_);
         for (std::map<std::string, JobTracker*>::iterator it = job_trackers_.begin();
                 it != job_trackers_.end(); ++it) {
-            SaveJobToNexus(it->second);
+            SaveJobToNexus(it->second, false);
         }
     }
 
@@ -490,7 +895,7 @@ void MasterImpl::KeepDataPersistence() {
         for (std::map<std::string, JobTracker*>::iterator it = dead_trackers_.begin();
              it != dead_trackers_.end(); ++it) {
             if (saved_dead_jobs_.find(it->first) == saved_dead_jobs_.end()) {
-                if (SaveJobToNexus(it->second)) {
+                if (SaveJobToNexus(it->second, true)) {
                     saved_dead_jobs_.insert(it->first);
                 }
             }
@@ -503,35 +908,161 @@ void MasterImpl::KeepDataPersistence() {
 void MasterImpl::Reload() {
     std::string jobid;
     JobDescriptor job;
+    std::vector<std::pair<std::string, JobDescriptor> > jobs;
+    {
+        MutexLock lock(&restore_mu_);
+        restore_begin_ = common::timer::get_micros();
+        all_restored_ = false;
+        __sync_lock_test_and_set(&first_assigned_, 0);
+        while (GetJobDescFromNexus(jobid, job)) {
+            restoring_jobs_.insert(jobid);
+            jobs.push_back(std::make_pair(jobid, job));
+        }
+        if (jobs.empty()) {
+            all_restored_ = true;
+        }
+    }
+    LOG(INFO, "[failover] %d jobs found, restoring", jobs.size());
+    for (std::vector<std::pair<std::string, JobDescriptor> >::iterator it = jobs.begin();
+            it != jobs.end(); ++it) {
+        restorer_.AddTask(boost::bind(&MasterImpl::RestoreJob, this, it->first, it->second));
+    }
+    gc_.AddTask(boost::bind(&MasterImpl::KeepDataPersistence, this));
+}
+
+void MasterImpl::RestoreJob(const std::string& jobid, const JobDescriptor& job) {
+    LoadJobFromNexus(jobid, job, true);
+    FinishRestoring(jobid);
+}
+
+bool MasterImpl::RestoreLazyJob(const std::string& jobid) {
+    JobDescriptor job;
+    {
+        MutexLock lock(&restore_mu_);
+        std::map<std::string, LazyJob>::iterator it = lazy_jobs_.find(jobid);
+        if (it == lazy_jobs_.end()) {
+            return false;
+        }
+        job.CopyFrom(it->second.desc);
+        lazy_jobs_.erase(it);
+        restoring_jobs_.insert(jobid);
+    }
+    LOG(INFO, "restore job on demand: %s", jobid.c_str());
+    bool ok = LoadJobFromNexus(jobid, job, false);
+    FinishRestoring(jobid);
+    return ok;
+}
+
+bool MasterImpl::LoadJobFromNexus(const std::string& jobid, const JobDescriptor& job, bool lazy) {
+    JobCollection head;
+    if (!GetJobHeadFromNexus(jobid, head)) {
+        LOG(WARNING, "fail to get job data from nexus: %s", jobid.c_str());
+        return false;
+    }
+    bool finished = head.state() != kRunning && head.state() != kPending;
+    if (FLAGS_skip_history && finished) {
+        return false;
+    }
+    if (lazy && finished &&
+            common::timer::now_time() - head.finish_time() > FLAGS_lazy_restore_age) {
+        MutexLock lock(&restore_mu_);
+        LazyJob& lazy_job = lazy_jobs_[jobid];
+        lazy_job.desc.CopyFrom(job);
+        lazy_job.head.set_state(head.state());
+        lazy_job.head.set_start_time(head.start_time());
+        lazy_job.head.set_finish_time(head.finish_time());
+        return true;
+    }
     JobState state;
     std::vector<AllocateItem> history;
     std::vector<ResourceItem> resources;
     int32_t start_time;
     int32_t finish_time;
-    while (GetJobDescFromNexus(jobid, job)) {
-        if (FLAGS_skip_history && state != kRunning) {
-            continue;
-        }
-        if (!GetJobInfoFromNexus(jobid, state, history, resources, start_time, finish_time)) {
-            continue;
-        }
-        JobTracker* jobtracker = new JobTracker(this, galaxy_sdk_, job);
-        bool load_succ = jobtracker->Load(jobid, state, history, resources, start_time, finish_time);
-        if (load_succ) {
-            if (jobtracker->GetState() == kRunning) {
-                job_trackers_[jobid] = jobtracker;
-            } else {
-                dead_trackers_[jobid] = jobtracker;
-            }
+    int32_t log_seq;
+    std::vector<int64_t> partition_sizes;
+    std::vector<PartitionKey> partition_keys;
+    if (!GetJobInfoFromNexus(jobid, head, state, history, resources, start_time,
+                             finish_time, partition_sizes, partition_keys, log_seq)) {
+        return false;
+    }
+    JobTracker* jobtracker = new JobTracker(this, galaxy_sdk_, job);
+    if (!jobtracker->Load(jobid, state, history, resources, start_time, finish_time,
+                          partition_sizes, partition_keys)) {
+        delete jobtracker;
+        return false;
+    }
+    {
+        // Compact the replayed logs into a fresh snapshot at first backup
+        MutexLock lock(&persist_mu_);
+        JobPersistence& persist = persistences_[jobid];
+        persist.log_seq = log_seq;
+        persist.snapshot_seq = log_seq;
+        persist.snapshot_gen = SnapshotGen(head);
+        persist.need_snapshot = true;
+    }
+    if (jobtracker->GetState() == kRunning) {
+        MutexLock lock(&tracker_mu_);
+        job_trackers_[jobid] = jobtracker;
+    } else {
+        MutexLock lock(&dead_mu_);
+        dead_trackers_[jobid] = jobtracker;
+    }
+    return true;
+}
+
+void MasterImpl::FinishRestoring(const std::string& jobid) {
+    MutexLock lock(&restore_mu_);
+    restoring_jobs_.erase(jobid);
+    if (restoring_jobs_.empty() && !all_restored_) {
+        all_restored_ = true;
+        LOG(INFO, "[failover] jobs restored in %ld ms, %d to be restored on demand",
+                (common::timer::get_micros() - restore_begin_) / 1000, lazy_jobs_.size());
+    }
+}
+
+bool MasterImpl::IsRestoring(const std::string& jobid) {
+    MutexLock lock(&restore_mu_);
+    return restoring_jobs_.find(jobid) != restoring_jobs_.end();
+}
+
+void MasterImpl::ListLazyJobs(bool summary, ListJobsResponse* response) {
+    MutexLock lock(&restore_mu_);
+    for (std::map<std::string, LazyJob>::iterator it = lazy_jobs_.begin();
+            it != lazy_jobs_.end(); ++it) {
+        const JobDescriptor& desc = it->second.desc;
+        const JobCollection& head = it->second.head;
+        JobOverview* job = response->add_jobs();
+        if (summary) {
+            job->mutable_desc()->set_name(desc.name());
+        } else {
+            job->mutable_desc()->CopyFrom(desc);
         }
-        history.clear();
-        resources.clear();
+        job->set_jobid(it->first);
+        job->set_state(head.state());
+        job->set_start_time(head.start_time());
+        job->set_finish_time(head.finish_time());
+        // Statistics are not replayed until the job is queried
+        bool completed = head.state() == kCompleted;
+        job->mutable_map_stat()->set_total(desc.map_total());
+        job->mutable_map_stat()->set_completed(completed ? desc.map_total() : 0);
+        job->mutable_reduce_stat()->set_total(desc.reduce_total());
+        job->mutable_reduce_stat()->set_completed(completed ? desc.reduce_total() : 0);
     }
-    gc_.AddTask(boost::bind(&MasterImpl::KeepDataPersistence, this));
+}
+
+void MasterImpl::RecordFirstAssignment() {
+    // Called by every assignment, only the one flipping the flag takes the lock
+    if (!__sync_bool_compare_and_swap(&first_assigned_, 0, 1)) {
+        return;
+    }
+    MutexLock lock(&restore_mu_);
+    const int64_t elapsed_ms = (common::timer::get_micros() - restore_begin_) / 1000;
+    s_failover_assign_ms->Set(elapsed_ms);
+    LOG(INFO, "[failover] first task assigned %ld ms after restoring began", elapsed_ms);
 }
 
 bool MasterImpl::GetJobDescFromNexus(std::string& jobid, JobDescriptor& job) {
-    static ::galaxy::ins::sdk::ScanResult* result = nexus_->Scan(
+    static Nexus::ScanResult* result = nexus_->Scan(
             FLAGS_nexus_root_path + "job_", FLAGS_nexus_root_path + "job`");
     if (result == NULL) {
         return false;
@@ -553,49 +1084,104 @@ bool MasterImpl::GetJobDescFromNexus(std::string& jobid, JobDescriptor& job) {
     return true;
 }
 
-bool MasterImpl::GetJobInfoFromNexus(const std::string& jobid, JobState& state,
+bool MasterImpl::GetJobHeadFromNexus(const std::string& jobid, JobCollection& head) {
+    std::string data_str;
+    return nexus_->Get(JobDataKey(jobid), &data_str, NULL) && ParseJobData(data_str, head);
+}
+
+bool MasterImpl::GetJobInfoFromNexus(const std::string& jobid, const JobCollection& head,
+                                     JobState& state,
                                      std::vector<AllocateItem>& history,
                                      std::vector<ResourceItem>& resources,
                                      int32_t& start_time,
-                                     int32_t& finish_time) {
+                                     int32_t& finish_time,
+                                     std::vector<int64_t>& partition_sizes,
+                                     std::vector<PartitionKey>& partition_keys,
+                                     int32_t& log_seq) {
     std::string data_str;
-    bool ok = nexus_->Get(FLAGS_nexus_root_path + FLAGS_jobdata_header + jobid, &data_str, NULL);
-    if (ok) {
-        ParseJobData(data_str, state, history, resources, start_time, finish_time);
+    state = head.state();
+    start_time = head.start_time();
+    finish_time = head.finish_time();
+    partition_sizes.assign(head.partition_sizes().begin(), head.partition_sizes().end());
+    partition_keys.assign(head.partition_keys().begin(), head.partition_keys().end());
+    log_seq = 0;
+    if (!head.has_snapshot_seq()) {
+        // Data in the legacy layout lies in the head itself
+        ParseJobData(head, history, resources);
+        return true;
     }
-    return ok;
+    for (int32_t i = 0; i < head.snapshot_chunks(); ++i) {
+        JobCollection jc;
+        if (!nexus_->Get(JobSnapshotKey(jobid, SnapshotGen(head), i), &data_str, NULL)
+                || !ParseJobData(data_str, jc)) {
+            LOG(WARNING, "fail to get snapshot chunk %d: %s", i, jobid.c_str());
+            return false;
+        }
+        ParseJobData(jc, history, resources);
+        // Partition stats of a snapshot are chunked in order as well
+        partition_sizes.insert(partition_sizes.end(),
+                jc.partition_sizes().begin(), jc.partition_sizes().end());
+        partition_keys.insert(partition_keys.end(),
+                jc.partition_keys().begin(), jc.partition_keys().end());
+    }
+    log_seq = head.snapshot_seq();
+    const std::string& prefix = JobDataKey(jobid) + "/";
+    Nexus::ScanResult* result = nexus_->Scan(
+            JobLogKey(jobid, log_seq), prefix + "log`");
+    if (result == NULL) {
+        return true;
+    }
+    for (; !result->Done(); result->Next()) {
+        const std::string& key = result->Key();
+        int32_t seq = -1;
+        JobCollection jc;
+        if (key.size() <= prefix.size() ||
+                sscanf(key.c_str() + prefix.size(), "log_%d", &seq) != 1 ||
+                seq != log_seq || !ParseJobData(result->Value(), jc)) {
+            LOG(WARNING, "job data log broken at %d: %s", log_seq, jobid.c_str());
+            break;
+        }
+        ReplayJobLog(jc, history);
+        if (jc.partition_sizes_size() > 0) {
+            // Logs of former masters carry the partition stats as a whole
+            partition_sizes.assign(jc.partition_sizes().begin(), jc.partition_sizes().end());
+            partition_keys.assign(jc.partition_keys().begin(), jc.partition_keys().end());
+        } else if (jc.changed_partitions_size() > 0) {
+            ReplayPartitionStats(jc, partition_sizes, partition_keys);
+        }
+        state = jc.state();
+        start_time = jc.start_time();
+        finish_time = jc.finish_time();
+        ++log_seq;
+    }
+    delete result;
+    LOG(INFO, "replay job data: %s, snapshot: %d, logs: %d", jobid.c_str(),
+            head.snapshot_seq(), log_seq - head.snapshot_seq());
+    return true;
 }
 
-void MasterImpl::ParseJobData(const std::string& history_str, JobState& state,
-                              std::vector<AllocateItem>& history,
-                              std::vector<ResourceItem>& resources,
-                              int32_t& start_time,
-                              int32_t& finish_time) {
-    JobCollection jc;
+bool MasterImpl::ParseJobData(const std::string& history_str, JobCollection& jc) {
     std::string uncompressed_str;
-    snappy::Uncompress(history_str.data(), history_str.size(), &uncompressed_str);
+    if (!snappy::Uncompress(history_str.data(), history_str.size(), &uncompressed_str)) {
+        return false;
+    }
     std::stringstream ss(uncompressed_str);
-    jc.ParseFromIstream(&ss);
-    state = jc.state();
-    start_time = jc.start_time();
-    finish_time = jc.finish_time();
+    return jc.ParseFromIstream(&ss);
+}
+
+void MasterImpl::ParseJobData(const JobCollection& jc,
+                              std::vector<AllocateItem>& history,
+                              std::vector<ResourceItem>& resources) {
     ::google::protobuf::RepeatedPtrField< JobAllocation >::const_iterator it;
     for (it = jc.jobs().begin(); it != jc.jobs().end(); ++it) {
         AllocateItem item;
-        item.resource_no = it->resource_no();
-        item.attempt = it->attempt();
-        item.endpoint = it->endpoint();
-        item.state = it->state();
-        item.alloc_time = it->alloc_time();
-        item.period = it->period();
-        item.is_map = it->is_map();
+        ParseJobAllocation(*it, item);
         history.push_back(item);
     }
-    int i = 0;
     ::google::protobuf::RepeatedPtrField< InputInfo >::const_iterator it2;
     for (it2 = jc.inputs().begin(); it2 != jc.inputs().end(); ++it2) {
         ResourceItem item;
-        item.no = i++;
+        item.no = resources.size();
         item.attempt = 0;
         item.status = kResPending;
         item.allocated = 0;
@@ -606,32 +1192,47 @@ void MasterImpl::ParseJobData(const std::string& history_str, JobState& state,
     }
 }
 
-std::string MasterImpl::SerialJobData(JobTracker* const jobtracker) {
-    JobCollection jc;
-    jc.set_state(jobtracker->GetState());
-    jc.set_start_time(jobtracker->GetStartTime());
-    jc.set_finish_time(jobtracker->GetFinishTime());
-    const std::vector<AllocateItem>& history = jobtracker->HistoryForDump();
-    const std::vector<ResourceItem>& resources = jobtracker->InputDataForDump();
-    for (std::vector<AllocateItem>::const_iterator it = history.begin();
-            it != history.end(); ++it) {
-        JobAllocation* job = jc.add_jobs();
-        job->set_resource_no(it->resource_no);
-        job->set_attempt(it->attempt);
-        job->set_endpoint(it->endpoint);
-        job->set_state(it->state);
-        job->set_alloc_time(it->alloc_time);
-        job->set_period(it->period);
-        job->set_is_map(it->is_map);
-    }
-    for (std::vector<ResourceItem>::const_iterator it = resources.begin();
-            it != resources.end(); ++it) {
-        InputInfo* input = jc.add_inputs();
-        input->set_input_file(it->input_file);
-        input->set_offset(it->offset);
-        input->set_size(it->size);
-    }
-    LOG(DEBUG, "jc.job_size(): %d", jc.jobs_size());
+void MasterImpl::ReplayJobLog(const JobCollection& jc, std::vector<AllocateItem>& history) {
+    ::google::protobuf::RepeatedPtrField< JobAllocation >::const_iterator it;
+    for (it = jc.jobs().begin(); it != jc.jobs().end(); ++it) {
+        size_t seq = static_cast<size_t>(it->seq());
+        AllocateItem item;
+        ParseJobAllocation(*it, item);
+        if (seq < history.size()) {
+            history[seq] = item;
+        } else if (seq == history.size()) {
+            history.push_back(item);
+        } else {
+            LOG(WARNING, "skip discontinuous allocation: %d, %d", seq, history.size());
+        }
+    }
+}
+
+void MasterImpl::ReplayPartitionStats(const JobCollection& jc,
+                                      std::vector<int64_t>& partition_sizes,
+                                      std::vector<PartitionKey>& partition_keys) {
+    std::set<int> changed;
+    ::google::protobuf::RepeatedPtrField< PartitionSize >::const_iterator it;
+    for (it = jc.changed_partitions().begin(); it != jc.changed_partitions().end(); ++it) {
+        size_t partition = static_cast<size_t>(it->partition());
+        if (partition >= partition_sizes.size()) {
+            partition_sizes.resize(partition + 1, 0);
+        }
+        partition_sizes[partition] = it->size();
+        changed.insert(it->partition());
+    }
+    // Hot keys of a changed partition are logged as a whole
+    std::vector<PartitionKey> kept;
+    for (size_t i = 0; i < partition_keys.size(); ++i) {
+        if (changed.find(partition_keys[i].partition()) == changed.end()) {
+            kept.push_back(partition_keys[i]);
+        }
+    }
+    kept.insert(kept.end(), jc.partition_keys().begin(), jc.partition_keys().end());
+    partition_keys.swap(kept);
+}
+
+std::string MasterImpl::SerialJobData(const JobCollection& jc) {
     std::stringstream ss;
     jc.SerializeToOstream(&ss);
     std::string compressed_str;
@@ -639,6 +1240,46 @@ std::string MasterImpl::SerialJobData(JobTracker* const jobtracker) {
     return compressed_str;
 }
 
+void MasterImpl::SerialJobSnapshot(JobTracker* const jobtracker, JobCollection& head,
+                                   std::vector<std::string>& chunks) {
+    head.set_state(jobtracker->GetState());
+    head.set_start_time(jobtracker->GetStartTime());
+    head.set_finish_time(jobtracker->GetFinishTime());
+    // Partition stats go to the chunks too, keeping the head small
+    std::vector<int64_t> partition_sizes;
+    std::vector<PartitionKey> partition_keys;
+    jobtracker->PartitionStatsForDump(&partition_sizes, &partition_keys);
+    const std::vector<AllocateItem>& history = jobtracker->HistoryForDump();
+    const std::vector<ResourceItem>& resources = jobtracker->InputDataForDump();
+    const size_t chunk_size = std::max(FLAGS_jobdata_chunk_size, 1);
+    size_t i = 0;
+    size_t j = 0;
+    size_t k = 0;
+    size_t l = 0;
+    do {
+        JobCollection jc;
+        for (size_t n = 0; n < chunk_size && i < history.size(); ++n, ++i) {
+            FillJobAllocation(history[i], jc.add_jobs());
+        }
+        for (size_t n = 0; n < chunk_size && j < resources.size(); ++n, ++j) {
+            InputInfo* input = jc.add_inputs();
+            input->set_input_file(resources[j].input_file);
+            input->set_offset(resources[j].offset);
+            input->set_size(resources[j].size);
+        }
+        for (size_t n = 0; n < chunk_size && k < partition_sizes.size(); ++n, ++k) {
+            jc.add_partition_sizes(partition_sizes[k]);
+        }
+        for (size_t n = 0; n < chunk_size && l < partition_keys.size(); ++n, ++l) {
+            jc.add_partition_keys()->CopyFrom(partition_keys[l]);
+        }
+        chunks.push_back(SerialJobData(jc));
+    } while (i < history.size() || j < resources.size()
+             || k < partition_sizes.size() || l < partition_keys.size());
+    LOG(DEBUG, "snapshot of %s: %d allocations, %d inputs",
+            jobtracker->GetJobId().c_str(), history.size(), resources.size());
+}
+
 void MasterImpl::ParseJobCounters(const google::protobuf::RepeatedPtrField<baidu::shuttle::TaskCounter>& rpc_counters,
                                   std::map<std::string, int64_t>* counters) {
     assert(counters);
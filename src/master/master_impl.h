@@ -5,11 +5,13 @@
 #include <set>
 
 #include "galaxy_sdk_appmaster.h"
-#include "ins_sdk.h"
+#include "common/nexus.h"
+#include "common/metrics.h"
 #include "mutex.h"
 #include "thread_pool.h"
 #include "proto/app_master.pb.h"
 #include "job_tracker.h"
+#include "minion_pool.h"
 
 namespace baidu {
 namespace shuttle {
@@ -18,6 +20,9 @@ class MasterImpl : public Master {
 public:
 
     MasterImpl();
+    // Deploys minions through galaxy instead of the one on nexus, master
+    // takes it over
+    explicit MasterImpl(::baidu::galaxy::sdk::AppMaster* galaxy);
     virtual ~MasterImpl();
 
     void Init();
@@ -42,6 +47,10 @@ public:
                  const ::baidu::shuttle::ShowJobRequest* request,
                  ::baidu::shuttle::ShowJobResponse* response,
                  ::google::protobuf::Closure* done);
+    void TraceJob(::google::protobuf::RpcController* controller,
+                  const ::baidu::shuttle::TraceJobRequest* request,
+                  ::baidu::shuttle::TraceJobResponse* response,
+                  ::google::protobuf::Closure* done);
     void AssignTask(::google::protobuf::RpcController* controller,
                     const ::baidu::shuttle::AssignTaskRequest* request,
                     ::baidu::shuttle::AssignTaskResponse* response,
@@ -50,10 +59,42 @@ public:
                     const ::baidu::shuttle::FinishTaskRequest* request,
                     ::baidu::shuttle::FinishTaskResponse* response,
                     ::google::protobuf::Closure* done);
+    void BindMinion(::google::protobuf::RpcController* controller,
+                    const ::baidu::shuttle::BindMinionRequest* request,
+                    ::baidu::shuttle::BindMinionResponse* response,
+                    ::google::protobuf::Closure* done);
+    void GetMetrics(::google::protobuf::RpcController* controller,
+                    const ::baidu::shuttle::GetMetricsRequest* request,
+                    ::baidu::shuttle::GetMetricsResponse* response,
+                    ::google::protobuf::Closure* done);
 
     Status RetractJob(const std::string& jobid, JobState end_state);
+    // NULL unless minions are pooled
+    MinionPool* GetMinionPool() {
+        return minion_pool_;
+    }
 
 private:
+    // Incremental persistence progress of each job
+    struct JobPersistence {
+        // Sequence of the next log to append
+        int32_t log_seq;
+        // Sequence of the first log not covered by the latest snapshot
+        int32_t snapshot_seq;
+        // Generation of the latest snapshot, in the keys of its chunks
+        int32_t snapshot_gen;
+        bool need_snapshot;
+        JobState state;
+        std::string descriptor;
+        JobPersistence() : log_seq(0), snapshot_seq(0), snapshot_gen(0),
+                           need_snapshot(true), state(kPending) { }
+    };
+    // Long-finished job waiting to be restored on demand
+    struct LazyJob {
+        JobDescriptor desc;
+        JobCollection head;
+    };
+
     void AcquireMasterLock();
     static void OnMasterSessionTimeout(void* ctx);
     void OnSessionTimeout();
@@ -61,27 +102,51 @@ private:
                                    ::galaxy::ins::sdk::SDKError err);
     void OnLockChange(const std::string& lock_session_id);
     std::string SelfEndpoint();
+    void FillJobOverview(JobTracker* jobtracker, bool summary, JobOverview* job);
     void KeepGarbageCollecting();
     void KeepDataPersistence();
     void Reload();
+    void RestoreJob(const std::string& jobid, const JobDescriptor& job);
+    bool RestoreLazyJob(const std::string& jobid);
+    bool LoadJobFromNexus(const std::string& jobid, const JobDescriptor& job, bool lazy);
+    void FinishRestoring(const std::string& jobid);
+    bool IsRestoring(const std::string& jobid);
+    void ListLazyJobs(bool summary, ListJobsResponse* response);
+    void RecordFirstAssignment();
     bool GetJobDescFromNexus(std::string& jobid, JobDescriptor& job);
-    bool GetJobInfoFromNexus(const std::string& jobid, JobState& state,
+    bool GetJobHeadFromNexus(const std::string& jobid, JobCollection& head);
+    bool GetJobInfoFromNexus(const std::string& jobid, const JobCollection& head,
+                             JobState& state,
                              std::vector<AllocateItem>& history,
                              std::vector<ResourceItem>& resources,
                              int32_t& start_time,
-                             int32_t& finish_time);
-    void ParseJobData(const std::string& history_str, JobState& state,
+                             int32_t& finish_time,
+                             std::vector<int64_t>& partition_sizes,
+                             std::vector<PartitionKey>& partition_keys,
+                             int32_t& log_seq);
+    bool ParseJobData(const std::string& history_str, JobCollection& jc);
+    void ParseJobData(const JobCollection& jc,
                       std::vector<AllocateItem>& history,
-                      std::vector<ResourceItem>& resources,
-                      int32_t& start_time,
-                      int32_t& finish_time);
-    std::string SerialJobData(JobTracker* const jobtracker);
-    bool SaveJobToNexus(JobTracker* jobtracker);
+                      std::vector<ResourceItem>& resources);
+    void ReplayJobLog(const JobCollection& jc, std::vector<AllocateItem>& history);
+    void ReplayPartitionStats(const JobCollection& jc,
+                              std::vector<int64_t>& partition_sizes,
+                              std::vector<PartitionKey>& partition_keys);
+    std::string SerialJobData(const JobCollection& jc);
+    void SerialJobSnapshot(JobTracker* const jobtracker, JobCollection& head,
+                           std::vector<std::string>& chunks);
+    bool SaveJobToNexus(JobTracker* jobtracker, bool compact);
+    bool SaveJobSnapshot(JobTracker* jobtracker, JobPersistence& persist);
+    bool AppendJobLog(JobTracker* jobtracker, JobPersistence& persist);
+    void RemoveJobDataFromNexus(const std::string& jobid, int32_t snapshot_seq,
+                                int32_t snapshot_gen);
     bool RemoveJobFromNexus(const std::string& jobid);
     void ParseJobCounters(const google::protobuf::RepeatedPtrField<baidu::shuttle::TaskCounter>& rpc_counters,
                           std::map<std::string, int64_t>* counters);
     void SubmitJobRoutine(const SubmitJobRequest* request, SubmitJobResponse* response,
                           ::google::protobuf::Closure* done);
+    // Queues of master and tasks of each job, read by GetMetrics
+    void CollectMetrics(GetMetricsResponse* response);
 private:
     ::baidu::galaxy::sdk::AppMaster* galaxy_sdk_;
     Mutex tracker_mu_;
@@ -90,9 +155,22 @@ private:
     std::map<std::string, JobTracker*> dead_trackers_;
     ThreadPool gc_;
     ThreadPool submitter_;
+    // For restoring jobs in parallel when master fails over
+    ThreadPool restorer_;
+    Mutex restore_mu_;
+    std::set<std::string> restoring_jobs_;
+    std::map<std::string, LazyJob> lazy_jobs_;
+    int64_t restore_begin_;
+    bool all_restored_;
+    // Accessed by __sync builtins only, the assignment path never waits for restore_mu_
+    volatile int first_assigned_;
     // For persistent of meta data and addressing of minion
-    ::galaxy::ins::sdk::InsSDK* nexus_;
+    Nexus* nexus_;
     std::set<std::string> saved_dead_jobs_;
+    Mutex persist_mu_;
+    std::map<std::string, JobPersistence> persistences_;
+    MinionPool* minion_pool_;
+    int metrics_collector_;
 };
 
 }
@@ -0,0 +1,218 @@
+#include "minion_pool.h"
+
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <gflags/gflags.h>
+#include "logging.h"
+#include "timer.h"
+
+DECLARE_string(nexus_root_path);
+DECLARE_string(minion_pool_path);
+DECLARE_int32(minion_pool_min);
+DECLARE_int32(minion_pool_max);
+DECLARE_int32(minion_pool_millicores);
+DECLARE_int64(minion_pool_memory);
+DECLARE_int32(minion_pool_timeout);
+DECLARE_int32(minion_pool_shrink_delay);
+
+namespace baidu {
+namespace shuttle {
+
+const static int32_t sScaleIntervalMs = 5000;
+
+MinionPool::MinionPool(::baidu::galaxy::sdk::AppMaster* galaxy,
+                       Nexus* nexus) :
+        nexus_(nexus), gru_(galaxy, "shuttle_pool", FLAGS_minion_pool_min),
+        demand_seq_(0), size_(FLAGS_minion_pool_min), deployed_(-1),
+        retiring_(0), surplus_since_(0), scaler_(1) {
+}
+
+MinionPool::~MinionPool() {
+    scaler_.Stop(false);
+}
+
+Status MinionPool::Start() {
+    std::string pool_key = FLAGS_nexus_root_path + FLAGS_minion_pool_path;
+    std::string minion_id;
+    ::galaxy::ins::sdk::SDKError err;
+    if (nexus_->Get(pool_key, &minion_id, &err) && err == ::galaxy::ins::sdk::kOK
+            && !minion_id.empty()) {
+        // Replicas of it are unknown, it is resized at the first check
+        gru_.Attach(minion_id);
+    } else {
+        Status status = gru_.Start();
+        if (status != kOk) {
+            LOG(WARNING, "fail to deploy the minion pool");
+            return status;
+        }
+        deployed_ = size_;
+        if (!nexus_->Put(pool_key, gru_.GetMinionId(), &err)) {
+            LOG(WARNING, "fail to save the minion pool to nexus, err: %d", err);
+        }
+    }
+    LOG(INFO, "minion pool started: %s", gru_.GetMinionId().c_str());
+    scaler_.AddTask(boost::bind(&MinionPool::KeepScaling, this));
+    return kOk;
+}
+
+bool MinionPool::Fits(const JobDescriptor& job) {
+    return job.millicores() <= FLAGS_minion_pool_millicores
+        && job.memory() <= FLAGS_minion_pool_memory;
+}
+
+std::string MinionPool::PhaseKey(const std::string& jobid, WorkMode mode) {
+    return jobid + ":" + WorkMode_Name(mode);
+}
+
+void MinionPool::Demand(const std::string& jobid, WorkMode mode,
+                        const std::string& boot_env, int minions) {
+    MutexLock lock(&mu_);
+    const std::string key = PhaseKey(jobid, mode);
+    std::map<std::string, PhaseDemand>::iterator it = demands_.find(key);
+    if (it == demands_.end()) {
+        PhaseDemand& demand = demands_[key];
+        demand.jobid = jobid;
+        demand.mode = mode;
+        demand.bound = 0;
+        demand.seq = demand_seq_++;
+        it = demands_.find(key);
+    }
+    it->second.boot_env = boot_env;
+    it->second.wanted = minions;
+    LOG(INFO, "demand %d pooled minions: %s", minions, key.c_str());
+}
+
+void MinionPool::Withdraw(const std::string& jobid, WorkMode mode) {
+    MutexLock lock(&mu_);
+    const std::string key = PhaseKey(jobid, mode);
+    if (demands_.erase(key) > 0) {
+        LOG(INFO, "withdraw demand of pooled minions: %s", key.c_str());
+    }
+}
+
+void MinionPool::Unbind(PooledMinion* minion) {
+    mu_.AssertHeld();
+    if (minion->phase.empty()) {
+        return;
+    }
+    std::map<std::string, PhaseDemand>::iterator it = demands_.find(minion->phase);
+    if (it != demands_.end()) {
+        --it->second.bound;
+    }
+    minion->last_phase = minion->phase;
+    minion->phase.clear();
+}
+
+void MinionPool::Bind(const BindMinionRequest* request, BindMinionResponse* response) {
+    MutexLock lock(&mu_);
+    const std::string& endpoint = request->endpoint();
+    std::map<std::string, PooledMinion>::iterator it = minions_.find(endpoint);
+    if (it == minions_.end()) {
+        LOG(INFO, "minion joins the pool: %s, %d slots", endpoint.c_str(), request->slots());
+        it = minions_.insert(std::make_pair(endpoint, PooledMinion())).first;
+    }
+    PooledMinion& minion = it->second;
+    minion.last_seen = common::timer::now_time();
+    if (request->has_jobid() && !request->jobid().empty()) {
+        // Busy minions only keep alive, and are counted again by a new master
+        const std::string key = PhaseKey(request->jobid(), request->work_mode());
+        if (minion.phase != key) {
+            Unbind(&minion);
+            std::map<std::string, PhaseDemand>::iterator demand = demands_.find(key);
+            if (demand != demands_.end()) {
+                ++demand->second.bound;
+            }
+            minion.phase = key;
+        }
+        response->set_status(kOk);
+        return;
+    }
+    Unbind(&minion);
+    if (retiring_ > 0) {
+        --retiring_;
+        --size_;
+        minions_.erase(it);
+        LOG(INFO, "minion retires from the pool: %s", endpoint.c_str());
+        response->set_status(kNoMore);
+        return;
+    }
+    PhaseDemand* oldest = NULL;
+    std::map<std::string, PhaseDemand>::iterator demand = demands_.begin();
+    for (; demand != demands_.end(); ++demand) {
+        PhaseDemand& cur = demand->second;
+        if (cur.bound >= cur.wanted || demand->first == minion.last_phase) {
+            continue;
+        }
+        if (oldest == NULL || cur.seq < oldest->seq) {
+            oldest = &cur;
+        }
+    }
+    if (oldest == NULL) {
+        response->set_status(kSuspend);
+        return;
+    }
+    ++oldest->bound;
+    minion.phase = PhaseKey(oldest->jobid, oldest->mode);
+    MinionBinding* binding = response->mutable_binding();
+    binding->set_jobid(oldest->jobid);
+    binding->set_work_mode(oldest->mode);
+    binding->set_boot_env(oldest->boot_env);
+    response->set_status(kOk);
+    LOG(INFO, "bind pooled minion %s to %s (%d/%d)", endpoint.c_str(),
+        minion.phase.c_str(), oldest->bound, oldest->wanted);
+}
+
+void MinionPool::KeepScaling() {
+    int32_t size = 0;
+    bool resize = false;
+    {
+        MutexLock lock(&mu_);
+        int32_t now = common::timer::now_time();
+        // Minions not heard from are gone, with the tasks they ran
+        std::map<std::string, PooledMinion>::iterator it = minions_.begin();
+        while (it != minions_.end()) {
+            if (now - it->second.last_seen > FLAGS_minion_pool_timeout) {
+                LOG(WARNING, "pooled minion lost: %s", it->first.c_str());
+                Unbind(&it->second);
+                minions_.erase(it++);
+            } else {
+                ++it;
+            }
+        }
+        int32_t wanted = 0;
+        std::map<std::string, PhaseDemand>::iterator demand = demands_.begin();
+        for (; demand != demands_.end(); ++demand) {
+            wanted += demand->second.wanted;
+        }
+        const int32_t target = std::max(std::min(wanted, FLAGS_minion_pool_max),
+                                        FLAGS_minion_pool_min);
+        const int32_t staying = size_ - retiring_;
+        if (target > staying) {
+            // Minions about to quit are kept for new demand first
+            retiring_ -= std::min(retiring_, target - staying);
+            if (target > size_) {
+                LOG(INFO, "grow the minion pool: %d -> %d", size_, target);
+                size_ = target;
+            }
+            surplus_since_ = 0;
+        } else if (target == staying) {
+            surplus_since_ = 0;
+        } else if (surplus_since_ == 0) {
+            surplus_since_ = now;
+        } else if (now - surplus_since_ >= FLAGS_minion_pool_shrink_delay) {
+            LOG(INFO, "shrink the minion pool: %d -> %d", size_, target);
+            retiring_ = size_ - target;
+            surplus_since_ = 0;
+        }
+        resize = (size_ != deployed_);
+        size = size_;
+    }
+    if (resize && gru_.Resize(size) == kOk) {
+        MutexLock lock(&mu_);
+        deployed_ = size;
+    }
+    scaler_.DelayTask(sScaleIntervalMs, boost::bind(&MinionPool::KeepScaling, this));
+}
+
+}
+}
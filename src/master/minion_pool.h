@@ -0,0 +1,79 @@
+#ifndef _BAIDU_SHUTTLE_MINION_POOL_H_
+#define _BAIDU_SHUTTLE_MINION_POOL_H_
+#include <string>
+#include <map>
+
+#include <stdint.h>
+
+#include "galaxy_sdk_appmaster.h"
+#include "common/nexus.h"
+#include "mutex.h"
+#include "thread_pool.h"
+#include "proto/app_master.pb.h"
+#include "gru.h"
+
+namespace baidu {
+namespace shuttle {
+
+// Generic minions kept deployed across jobs. Idle minions ask master for
+// work all the time and are lent to the job phases in need of minions, the
+// oldest first. Galaxy only grows the pool with demand and shrinks it once
+// demand stays low
+class MinionPool {
+public:
+    MinionPool(::baidu::galaxy::sdk::AppMaster* galaxy,
+               Nexus* nexus);
+    ~MinionPool();
+
+    // Deploys the pool, or takes over the one of the former master
+    Status Start();
+    // Whether pooled minions have the resources tasks of job need
+    static bool Fits(const JobDescriptor& job);
+    // Asks for minions to run a phase of job, replacing the former number
+    void Demand(const std::string& jobid, WorkMode mode,
+                const std::string& boot_env, int minions);
+    void Withdraw(const std::string& jobid, WorkMode mode);
+    // Heartbeat of a pooled minion, binds it to a phase once it is idle
+    void Bind(const BindMinionRequest* request, BindMinionResponse* response);
+private:
+    struct PhaseDemand {
+        std::string jobid;
+        WorkMode mode;
+        std::string boot_env;
+        int32_t wanted;
+        int32_t bound;
+        // Order of the first demand
+        int64_t seq;
+    };
+    struct PooledMinion {
+        // Key of the phase the minion works for
+        std::string phase;
+        // The phase it finished last, which has no more task for it
+        std::string last_phase;
+        int32_t last_seen;
+    };
+    static std::string PhaseKey(const std::string& jobid, WorkMode mode);
+    // Called with mu_ held
+    void Unbind(PooledMinion* minion);
+    void KeepScaling();
+private:
+    Nexus* nexus_;
+    Gru gru_;
+    Mutex mu_;
+    std::map<std::string, PhaseDemand> demands_;
+    std::map<std::string, PooledMinion> minions_;
+    int64_t demand_seq_;
+    // Replicas of the pool as wanted, and as galaxy is asked to keep
+    int32_t size_;
+    int32_t deployed_;
+    // Idle minions still to be told to quit while shrinking
+    int32_t retiring_;
+    // Since when the pool is larger than demand
+    int32_t surplus_since_;
+    ThreadPool scaler_;
+};
+
+}
+}
+
+#endif
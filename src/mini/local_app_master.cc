@@ -0,0 +1,223 @@
+#include "local_app_master.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include "logging.h"
+
+extern char** environ;
+
+using baidu::common::INFO;
+using baidu::common::WARNING;
+
+namespace baidu {
+namespace shuttle {
+
+const static int32_t sReapIntervalMs = 200;
+
+LocalAppMaster::LocalAppMaster(const std::string& root_dir,
+                               const std::vector<std::string>& package, int base_port)
+    : root_dir_(root_dir), next_job_(0), next_port_(base_port), started_(0),
+      cpu_ms_(0), max_rss_kb_(0), reaper_(1) {
+    for (size_t i = 0; i < package.size(); i++) {
+        char path[PATH_MAX];
+        if (realpath(package[i].c_str(), path) == NULL) {
+            LOG(WARNING, "file of minion package not found: %s", package[i].c_str());
+            continue;
+        }
+        package_.push_back(path);
+    }
+    reaper_.DelayTask(sReapIntervalMs, boost::bind(&LocalAppMaster::KeepReaping, this));
+}
+
+LocalAppMaster::~LocalAppMaster() {
+    reaper_.Stop(true);
+    MutexLock lock(&mu_);
+    std::map<std::string, LocalJob>::iterator it = jobs_.begin();
+    for (; it != jobs_.end(); ++it) {
+        Terminate(&it->second, 0);
+        for (size_t i = 0; i < it->second.quitting.size(); i++) {
+            waitpid(it->second.quitting[i], NULL, 0);
+        }
+    }
+}
+
+bool LocalAppMaster::SubmitJob(const ::baidu::galaxy::sdk::SubmitJobRequest& request,
+                               ::baidu::galaxy::sdk::SubmitJobResponse* response) {
+    MutexLock lock(&mu_);
+    const ::baidu::galaxy::sdk::JobDescription& desc = request.job;
+    if (desc.pod.tasks.empty()) {
+        response->error_code.status = -1;
+        response->error_code.reason = "no task in pod";
+        return false;
+    }
+    const std::string jobid = "local_job_" + boost::lexical_cast<std::string>(next_job_++);
+    LocalJob& job = jobs_[jobid];
+    job.start_cmd = desc.pod.tasks[0].exe_package.start_cmd;
+    job.replica = desc.deploy.replica;
+    job.launched = 0;
+    for (int i = 0; i < job.replica; i++) {
+        Launch(jobid, &job);
+    }
+    LOG(INFO, "local job %s of %s: %d replicas", jobid.c_str(), desc.name.c_str(), job.replica);
+    response->jobid = jobid;
+    response->error_code.status = 0;
+    return true;
+}
+
+bool LocalAppMaster::UpdateJob(const ::baidu::galaxy::sdk::UpdateJobRequest& request,
+                               ::baidu::galaxy::sdk::UpdateJobResponse* response) {
+    MutexLock lock(&mu_);
+    std::map<std::string, LocalJob>::iterator it = jobs_.find(request.jobid);
+    if (it == jobs_.end()) {
+        response->error_code.status = -1;
+        response->error_code.reason = "no such job";
+        return false;
+    }
+    LocalJob& job = it->second;
+    const int32_t replica = request.job.deploy.replica;
+    // Replicas which quit are not counted, as galaxy does for batch jobs
+    for (int32_t i = job.replica; i < replica; i++) {
+        Launch(it->first, &job);
+    }
+    Terminate(&job, std::max(replica, 0));
+    job.replica = replica;
+    response->error_code.status = 0;
+    return true;
+}
+
+bool LocalAppMaster::RemoveJob(const ::baidu::galaxy::sdk::RemoveJobRequest& request,
+                               ::baidu::galaxy::sdk::RemoveJobResponse* response) {
+    MutexLock lock(&mu_);
+    std::map<std::string, LocalJob>::iterator it = jobs_.find(request.jobid);
+    if (it == jobs_.end()) {
+        response->error_code.status = -1;
+        response->error_code.reason = "no such job";
+        return false;
+    }
+    // Reaped later, the job is gone for galaxy at once
+    Terminate(&it->second, 0);
+    it->second.replica = 0;
+    response->error_code.status = 0;
+    return true;
+}
+
+void LocalAppMaster::Count(int* started, int* running) {
+    MutexLock lock(&mu_);
+    *started = started_;
+    *running = 0;
+    std::map<std::string, LocalJob>::iterator it = jobs_.begin();
+    for (; it != jobs_.end(); ++it) {
+        *running += it->second.pids.size();
+    }
+}
+
+void LocalAppMaster::Usage(int64_t* cpu_ms, int64_t* max_rss_kb) {
+    MutexLock lock(&mu_);
+    *cpu_ms = cpu_ms_;
+    *max_rss_kb = max_rss_kb_;
+}
+
+bool LocalAppMaster::Launch(const std::string& jobid, LocalJob* job) {
+    mu_.AssertHeld();
+    const std::string dir = root_dir_ + "/" + jobid + "/"
+        + boost::lexical_cast<std::string>(job->launched++);
+    std::string cmd = "mkdir -p " + dir;
+    if (system(cmd.c_str()) != 0) {
+        LOG(WARNING, "fail to make dir of replica: %s", dir.c_str());
+        return false;
+    }
+    for (size_t i = 0; i < package_.size(); i++) {
+        const std::string& file = package_[i];
+        const std::string link = dir + "/" + file.substr(file.find_last_of('/') + 1);
+        if (symlink(file.c_str(), link.c_str()) != 0) {
+            LOG(WARNING, "fail to link %s: %s", link.c_str(), strerror(errno));
+        }
+    }
+    // Prepared before fork, the child only execs
+    const std::string port_env = "GALAXY_PORT_MINION_PORT="
+        + boost::lexical_cast<std::string>(next_port_++);
+    std::vector<char*> envp;
+    for (char** env = environ; *env != NULL; ++env) {
+        envp.push_back(*env);
+    }
+    envp.push_back(const_cast<char*>(port_env.c_str()));
+    envp.push_back(NULL);
+    const std::string out_file = dir + "/stdout";
+    const std::string err_file = dir + "/stderr";
+    pid_t pid = fork();
+    if (pid < 0) {
+        LOG(WARNING, "fail to fork replica of %s: %s", jobid.c_str(), strerror(errno));
+        return false;
+    }
+    if (pid == 0) {
+        // Own process group, so that apps and tools are killed along
+        setsid();
+        int out = open(out_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        int err = open(err_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (chdir(dir.c_str()) != 0 || out < 0 || err < 0) {
+            _exit(127);
+        }
+        dup2(out, STDOUT_FILENO);
+        dup2(err, STDERR_FILENO);
+        execle("/bin/sh", "sh", "-c", job->start_cmd.c_str(), (char*)NULL, &envp[0]);
+        _exit(127);
+    }
+    job->pids.push_back(pid);
+    ++started_;
+    return true;
+}
+
+void LocalAppMaster::Terminate(LocalJob* job, size_t n) {
+    mu_.AssertHeld();
+    while (job->pids.size() > n) {
+        // Apps and tools are in the process group of the replica
+        kill(-job->pids.back(), SIGTERM);
+        job->quitting.push_back(job->pids.back());
+        job->pids.pop_back();
+    }
+}
+
+void LocalAppMaster::Reap(const std::string& jobid, std::vector<pid_t>* pids) {
+    mu_.AssertHeld();
+    for (size_t i = 0; i < pids->size();) {
+        int status = 0;
+        struct rusage usage;
+        if (wait4((*pids)[i], &status, WNOHANG, &usage) <= 0) {
+            ++i;
+            continue;
+        }
+        LOG(INFO, "replica %d of %s quit with %d", (*pids)[i], jobid.c_str(),
+            WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+        cpu_ms_ += usage.ru_utime.tv_sec * 1000L + usage.ru_utime.tv_usec / 1000
+            + usage.ru_stime.tv_sec * 1000L + usage.ru_stime.tv_usec / 1000;
+        max_rss_kb_ = std::max(max_rss_kb_, static_cast<int64_t>(usage.ru_maxrss));
+        pids->erase(pids->begin() + i);
+    }
+}
+
+void LocalAppMaster::KeepReaping() {
+    {
+        MutexLock lock(&mu_);
+        std::map<std::string, LocalJob>::iterator it = jobs_.begin();
+        for (; it != jobs_.end(); ++it) {
+            Reap(it->first, &it->second.pids);
+            Reap(it->first, &it->second.quitting);
+        }
+    }
+    reaper_.DelayTask(sReapIntervalMs, boost::bind(&LocalAppMaster::KeepReaping, this));
+}
+
+}
+}
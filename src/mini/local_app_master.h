@@ -0,0 +1,73 @@
+#ifndef _BAIDU_SHUTTLE_MINI_LOCAL_APP_MASTER_H_
+#define _BAIDU_SHUTTLE_MINI_LOCAL_APP_MASTER_H_
+
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "galaxy_sdk_appmaster.h"
+#include "mutex.h"
+#include "thread_pool.h"
+
+namespace baidu {
+namespace shuttle {
+
+// Galaxy of a cluster on one host. Each replica of a job is a process
+// running the start command in a directory of its own, where the files of
+// the minion package are linked. Replicas quitting are not started again
+class LocalAppMaster : public ::baidu::galaxy::sdk::AppMaster {
+public:
+    // Replicas work under root_dir, and are given ports from base_port on
+    LocalAppMaster(const std::string& root_dir,
+                   const std::vector<std::string>& package, int base_port);
+    virtual ~LocalAppMaster();
+
+    bool SubmitJob(const ::baidu::galaxy::sdk::SubmitJobRequest& request,
+                   ::baidu::galaxy::sdk::SubmitJobResponse* response);
+    // Only the number of replicas is updated
+    bool UpdateJob(const ::baidu::galaxy::sdk::UpdateJobRequest& request,
+                   ::baidu::galaxy::sdk::UpdateJobResponse* response);
+    bool RemoveJob(const ::baidu::galaxy::sdk::RemoveJobRequest& request,
+                   ::baidu::galaxy::sdk::RemoveJobResponse* response);
+
+    // Replicas started and still running, of all jobs so far
+    void Count(int* started, int* running);
+    // Resources used by the replicas which quit, and by all their
+    // descendants, e.g. user apps and the tools
+    void Usage(int64_t* cpu_ms, int64_t* max_rss_kb);
+private:
+    struct LocalJob {
+        std::string start_cmd;
+        int32_t replica;
+        // Running replicas, the oldest first
+        std::vector<pid_t> pids;
+        // Replicas told to quit, not reaped yet
+        std::vector<pid_t> quitting;
+        int32_t launched;
+    };
+    // Called with mu_ held
+    bool Launch(const std::string& jobid, LocalJob* job);
+    // Moves the replicas after the first n to quitting
+    void Terminate(LocalJob* job, size_t n);
+    // Reaps the replicas in pids which quit, called with mu_ held
+    void Reap(const std::string& jobid, std::vector<pid_t>* pids);
+    void KeepReaping();
+private:
+    std::string root_dir_;
+    std::vector<std::string> package_;
+    Mutex mu_;
+    std::map<std::string, LocalJob> jobs_;
+    int32_t next_job_;
+    int32_t next_port_;
+    int32_t started_;
+    int64_t cpu_ms_;
+    int64_t max_rss_kb_;
+    ThreadPool reaper_;
+};
+
+}
+}
+
+#endif
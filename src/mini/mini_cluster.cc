@@ -0,0 +1,350 @@
+// A cluster of shuttle on one host, which runs a few typical jobs end to end
+// and reports how fast they went. The master runs in this process, with a
+// galaxy forking the minions locally, a nexus in a directory and the dfs on
+// the local disk, so a change of the data path is measured as a whole
+// before it goes to a real cluster:
+//
+//   make mini_cluster minion input_tool shuffle_tool tuo_merger combine_tool
+//   ./mini_cluster --mini_workloads=wordcount,terasort --mini_input_mb=512
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <gflags/gflags.h>
+#include <sofa/pbrpc/pbrpc.h>
+#include "common/rpc_client.h"
+#include "common/table_printer.h"
+#include "logging.h"
+#include "master/master_impl.h"
+#include "mini/local_app_master.h"
+#include "mini/workload.h"
+#include "proto/app_master.pb.h"
+
+DEFINE_int32(mini_minions, 4, "minions of each job phase");
+DEFINE_int32(mini_reduces, 8, "reduce tasks of each job");
+DEFINE_string(mini_workloads, "wordcount,terasort,join", "jobs to run in order, "
+              "of wordcount, terasort and join");
+DEFINE_int32(mini_input_mb, 256, "size of inputs of each job in MB");
+DEFINE_int64(mini_split_size, 32L << 20, "bytes of input of each map");
+DEFINE_string(mini_root, "/tmp/shuttle_mini", "directory of inputs, outputs and minions");
+DEFINE_string(mini_nexus_dir, "", "directory of the nexus, under /dev/shm when empty "
+              "and it is there, otherwise under mini_root");
+DEFINE_string(mini_package, "minion,input_tool,shuffle_tool,tuo_merger,combine_tool,"
+              "src/minion/app_wrapper.sh,src/mini/minion_boot.sh",
+              "files minions start with, linked in their directories");
+DEFINE_int32(mini_base_port, 19917, "port of master, minions listen on the next ones");
+DEFINE_int32(mini_timeout, 1800, "seconds after which a job is considered failed");
+DEFINE_bool(mini_keep_data, false, "keep inputs and outputs of jobs after they finish");
+
+DECLARE_string(nexus_server_list);
+DECLARE_string(master_port);
+DECLARE_int32(master_rpc_thread_num);
+
+using baidu::common::FATAL;
+using baidu::common::INFO;
+using baidu::common::WARNING;
+
+namespace baidu {
+namespace shuttle {
+
+const static char* sStateNames[] = {"pending", "running", "failed", "killed", "completed"};
+
+static int64_t NowMs() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000L + tv.tv_usec / 1000;
+}
+
+static std::string FormatBytes(int64_t bytes) {
+    const char* units[] = {"B", "K", "M", "G", "T"};
+    double size = bytes;
+    size_t unit = 0;
+    while (size >= 1024 && unit + 1 < sizeof(units) / sizeof(units[0])) {
+        size /= 1024;
+        unit++;
+    }
+    char buf[32];
+    snprintf(buf, sizeof(buf), unit == 0 ? "%.0f%s" : "%.1f%s", size, units[unit]);
+    return buf;
+}
+
+static std::string ToString(int64_t value) {
+    return boost::lexical_cast<std::string>(value);
+}
+
+struct JobResult {
+    JobResult() : state(kFailed), input_bytes(0), wall_ms(0), minions(0), minion_cpu_ms(0) { }
+    std::string workload;
+    JobState state;
+    int64_t input_bytes;
+    int64_t wall_ms;
+    JobOverview job;
+    // Minions started for the job, and their cpu, from LocalAppMaster
+    int minions;
+    int64_t minion_cpu_ms;
+};
+
+class MiniCluster {
+public:
+    MiniCluster() : galaxy_(NULL), master_stub_(NULL) { }
+    ~MiniCluster() {
+        delete master_stub_;
+    }
+    bool Start();
+    bool Run(const std::string& name, JobResult* result);
+    // Minions are terminated along with master, which owns galaxy
+    void Stop();
+private:
+    bool Submit(const JobDescriptor& desc, std::string* jobid);
+    bool Wait(const std::string& jobid, JobOverview* job);
+private:
+    LocalAppMaster* galaxy_;
+    boost::scoped_ptr<MasterImpl> master_;
+    boost::scoped_ptr<sofa::pbrpc::RpcServer> rpc_server_;
+    RpcClient rpc_client_;
+    Master_Stub* master_stub_;
+};
+
+bool MiniCluster::Start() {
+    // Minions, the tools and user apps inherit it, see FileSystem::LocalDfs
+    setenv("shuttle_local_dfs", "1", 1);
+    std::string nexus_dir = FLAGS_mini_nexus_dir;
+    if (nexus_dir.empty()) {
+        nexus_dir = access("/dev/shm", W_OK) == 0 ? "/dev/shm" : FLAGS_mini_root;
+        nexus_dir += "/shuttle_mini_nexus_" + ToString(getpid());
+    }
+    FLAGS_nexus_server_list = "local:" + nexus_dir;
+    FLAGS_master_port = ToString(FLAGS_mini_base_port);
+    std::vector<std::string> package;
+    boost::split(package, FLAGS_mini_package, boost::is_any_of(","));
+    galaxy_ = new LocalAppMaster(FLAGS_mini_root + "/minions", package,
+                                 FLAGS_mini_base_port + 1);
+    master_.reset(new MasterImpl(galaxy_));
+    master_->Init();
+    sofa::pbrpc::RpcServerOptions options;
+    options.work_thread_num = FLAGS_master_rpc_thread_num;
+    rpc_server_.reset(new sofa::pbrpc::RpcServer(options));
+    if (!rpc_server_->RegisterService(static_cast<Master*>(master_.get()), false)) {
+        LOG(WARNING, "failed to register master service");
+        return false;
+    }
+    std::string endpoint = "0.0.0.0:" + FLAGS_master_port;
+    if (!rpc_server_->Start(endpoint)) {
+        LOG(WARNING, "failed to start server on %s", endpoint.c_str());
+        return false;
+    }
+    rpc_client_.GetStub("127.0.0.1:" + FLAGS_master_port, &master_stub_);
+    LOG(INFO, "mini cluster started, nexus: %s", FLAGS_nexus_server_list.c_str());
+    return true;
+}
+
+void MiniCluster::Stop() {
+    if (rpc_server_) {
+        rpc_server_->Stop();
+    }
+    master_.reset();
+    galaxy_ = NULL;
+    std::string cmd = "rm -rf " + FLAGS_nexus_server_list.substr(strlen("local:"));
+    system(cmd.c_str());
+}
+
+bool MiniCluster::Submit(const JobDescriptor& desc, std::string* jobid) {
+    SubmitJobRequest request;
+    SubmitJobResponse response;
+    request.mutable_job()->CopyFrom(desc);
+    bool ok = rpc_client_.SendRequest(master_stub_, &Master_Stub::SubmitJob,
+                                      &request, &response, 5, 1);
+    if (!ok || response.status() != kOk) {
+        LOG(WARNING, "fail to submit %s: %s", desc.name().c_str(),
+            ok ? Status_Name(response.status()).c_str() : "rpc error");
+        return false;
+    }
+    *jobid = response.jobid();
+    return true;
+}
+
+bool MiniCluster::Wait(const std::string& jobid, JobOverview* job) {
+    const int64_t deadline = NowMs() + FLAGS_mini_timeout * 1000L;
+    while (NowMs() < deadline) {
+        ShowJobRequest request;
+        ShowJobResponse response;
+        request.set_jobid(jobid);
+        bool ok = rpc_client_.SendRequest(master_stub_, &Master_Stub::ShowJob,
+                                          &request, &response, 5, 1);
+        if (ok && response.status() == kOk) {
+            job->CopyFrom(response.job());
+            if (job->state() != kPending && job->state() != kRunning) {
+                return true;
+            }
+        }
+        sleep(1);
+    }
+    LOG(WARNING, "job timed out: %s", jobid.c_str());
+    KillJobRequest request;
+    KillJobResponse response;
+    request.set_jobid(jobid);
+    rpc_client_.SendRequest(master_stub_, &Master_Stub::KillJob, &request, &response, 5, 1);
+    return false;
+}
+
+bool MiniCluster::Run(const std::string& name, JobResult* result) {
+    boost::scoped_ptr<Workload> workload(Workload::Create(name));
+    result->workload = name;
+    result->state = kFailed;
+    if (!workload) {
+        LOG(WARNING, "unknown workload: %s", name.c_str());
+        return false;
+    }
+    const std::string dir = FLAGS_mini_root + "/" + name;
+    LOG(INFO, "preparing %d MB of input of %s", FLAGS_mini_input_mb, name.c_str());
+    result->input_bytes = workload->Prepare(dir, FLAGS_mini_input_mb * (1L << 20));
+    if (result->input_bytes < 0) {
+        return false;
+    }
+    JobDescriptor desc;
+    workload->Describe(dir, &desc);
+    desc.set_map_capacity(FLAGS_mini_minions);
+    desc.set_reduce_capacity(FLAGS_mini_minions);
+    desc.set_reduce_total(FLAGS_mini_reduces);
+    desc.set_split_size(FLAGS_mini_split_size);
+
+    int started_before = 0;
+    int running = 0;
+    int64_t cpu_before = 0;
+    int64_t max_rss = 0;
+    galaxy_->Count(&started_before, &running);
+    galaxy_->Usage(&cpu_before, &max_rss);
+    const int64_t begin = NowMs();
+    std::string jobid;
+    bool done = Submit(desc, &jobid) && Wait(jobid, &result->job);
+    result->wall_ms = NowMs() - begin;
+    if (done) {
+        result->state = result->job.state();
+    }
+    // Minions of the job quit once it is done, wait for them to be reaped
+    for (int i = 0; i < 10 && running > 0; i++) {
+        sleep(1);
+        int started = 0;
+        galaxy_->Count(&started, &running);
+    }
+    int started = 0;
+    int64_t cpu = 0;
+    galaxy_->Count(&started, &running);
+    galaxy_->Usage(&cpu, &max_rss);
+    result->minions = started - started_before;
+    result->minion_cpu_ms = cpu - cpu_before;
+    if (!FLAGS_mini_keep_data) {
+        std::string cmd = "rm -rf " + dir;
+        system(cmd.c_str());
+    }
+    return result->state == kCompleted;
+}
+
+static std::vector<std::string> UsageRow(const std::string& phase, const UsageSummary& summary) {
+    const TaskUsage& usage = summary.total();
+    std::vector<std::string> row;
+    row.push_back(phase);
+    row.push_back(ToString(summary.attempts()));
+    row.push_back(ToString((usage.user_time_ms() + usage.sys_time_ms()) / 1000) + "s");
+    row.push_back(FormatBytes(usage.max_rss_kb() * 1024));
+    row.push_back(FormatBytes(usage.dfs_read_bytes()) + "/" + FormatBytes(usage.dfs_write_bytes()));
+    row.push_back(FormatBytes(usage.pipe_in_bytes()) + "/" + FormatBytes(usage.pipe_out_bytes()));
+    row.push_back(ToString(usage.pipe_in_wait_ms() / 1000) + "s/"
+                  + ToString(usage.pipe_out_wait_ms() / 1000) + "s");
+    return row;
+}
+
+static void PrintResults(const std::vector<JobResult>& results) {
+    TPrinter tp(9);
+    tp.AddRow(9, "Workload", "state", "input", "wall", "MB/s", "maps", "reduces",
+              "minions", "minion cpu");
+    for (size_t i = 0; i < results.size(); i++) {
+        const JobResult& r = results[i];
+        std::vector<std::string> row;
+        row.push_back(r.workload);
+        row.push_back(sStateNames[r.state]);
+        row.push_back(FormatBytes(r.input_bytes));
+        row.push_back(ToString(r.wall_ms / 1000) + "." + ToString(r.wall_ms % 1000 / 100) + "s");
+        char rate[32];
+        snprintf(rate, sizeof(rate), "%.1f",
+                 r.wall_ms > 0 ? r.input_bytes / 1048576.0 / (r.wall_ms / 1000.0) : 0);
+        row.push_back(rate);
+        row.push_back(ToString(r.job.map_stat().completed()) + "/"
+                      + ToString(r.job.map_stat().total()));
+        row.push_back(ToString(r.job.reduce_stat().completed()) + "/"
+                      + ToString(r.job.reduce_stat().total()));
+        row.push_back(ToString(r.minions));
+        row.push_back(ToString(r.minion_cpu_ms / 1000) + "s");
+        tp.AddRow(row);
+    }
+    printf("%s\n", tp.ToString().c_str());
+
+    // Bytes are totals of the phase, r/w and in/out
+    TPrinter usage_tp(7);
+    usage_tp.AddRow(7, "Usage", "attempts", "cpu", "max rss", "dfs r/w",
+                    "pipe in/out", "pipe wait");
+    // Wall time of the phases of attempts, summed over them
+    TPrinter phase_tp(4);
+    phase_tp.AddRow(4, "Phase", "count", "total(ms)", "ms/attempt");
+    for (size_t i = 0; i < results.size(); i++) {
+        const JobResult& r = results[i];
+        const UsageSummary* summaries[] = {&r.job.map_usage(), &r.job.reduce_usage()};
+        const char* kinds[] = {"map", "reduce"};
+        for (int k = 0; k < 2; k++) {
+            const UsageSummary& summary = *summaries[k];
+            if (summary.attempts() == 0) {
+                continue;
+            }
+            const std::string phase = r.workload + " " + kinds[k];
+            usage_tp.AddRow(UsageRow(phase, summary));
+            for (int p = 0; p < summary.total().phases_size(); p++) {
+                const PhaseTime& time = summary.total().phases(p);
+                std::vector<std::string> phase_row;
+                phase_row.push_back(phase + " " + time.phase());
+                phase_row.push_back(ToString(time.count()));
+                phase_row.push_back(ToString(time.ms()));
+                phase_row.push_back(ToString(time.ms() / summary.attempts()));
+                phase_tp.AddRow(phase_row);
+            }
+        }
+    }
+    printf("%s\n", usage_tp.ToString().c_str());
+    printf("%s\n", phase_tp.ToString().c_str());
+}
+
+}
+}
+
+int main(int argc, char* argv[]) {
+    google::ParseCommandLineFlags(&argc, &argv, true);
+    std::vector<std::string> workloads;
+    boost::split(workloads, FLAGS_mini_workloads, boost::is_any_of(","));
+    std::string cmd = "mkdir -p " + FLAGS_mini_root;
+    if (system(cmd.c_str()) != 0) {
+        LOG(FATAL, "fail to make root of mini cluster: %s", FLAGS_mini_root.c_str());
+        return 1;
+    }
+    baidu::shuttle::MiniCluster cluster;
+    if (!cluster.Start()) {
+        cluster.Stop();
+        return 1;
+    }
+    std::vector<baidu::shuttle::JobResult> results;
+    bool ok = true;
+    for (size_t i = 0; i < workloads.size(); i++) {
+        baidu::shuttle::JobResult result;
+        if (!cluster.Run(workloads[i], &result)) {
+            ok = false;
+        }
+        results.push_back(result);
+    }
+    cluster.Stop();
+    baidu::shuttle::PrintResults(results);
+    return ok ? 0 : 1;
+}
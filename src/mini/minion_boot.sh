@@ -0,0 +1,12 @@
+#!/bin/sh
+# Started by LocalAppMaster in place of minion/minion_boot.sh. The files of
+# the package are linked in the working directory already, and inputs and
+# outputs are local files, so there is nothing to fetch
+
+# Jobs of the mini cluster have no packages of their own
+if [ "$1" = "-bind_job" ]; then
+    exit 0
+fi
+
+ls . | grep -v '^log$' > common.list
+exec ./minion "$@"
@@ -0,0 +1,221 @@
+#include "workload.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include "common/record_generator.h"
+#include "logging.h"
+
+using baidu::common::WARNING;
+
+namespace baidu {
+namespace shuttle {
+
+// Inputs are split in files of about the same size, read by maps in parallel
+const static int sInputFiles = 8;
+
+static bool WriteScript(const std::string& dir, const std::string& name,
+                        const std::string& script) {
+    const std::string path = dir + "/apps/" + name;
+    FILE* fp = fopen(path.c_str(), "w");
+    if (fp == NULL) {
+        LOG(WARNING, "fail to write script: %s", path.c_str());
+        return false;
+    }
+    fprintf(fp, "%s\n", script.c_str());
+    fclose(fp);
+    return true;
+}
+
+// app_wrapper.sh quotes commands, so the scripts are run by their paths
+static std::string Command(const std::string& dir, const std::string& name) {
+    return "sh " + dir + "/apps/" + name;
+}
+
+static bool MakeDirs(const std::string& dir) {
+    std::string cmd = "rm -rf " + dir + "/input " + dir + "/output " + dir + "/apps"
+        + " && mkdir -p " + dir + "/input " + dir + "/apps";
+    return system(cmd.c_str()) == 0;
+}
+
+static FILE* OpenInput(const std::string& dir, const std::string& name, int n) {
+    char path[64];
+    snprintf(path, sizeof(path), "/input/%s-%05d", name.c_str(), n);
+    FILE* fp = fopen((dir + path).c_str(), "w");
+    if (fp == NULL) {
+        LOG(WARNING, "fail to write input: %s%s", dir.c_str(), path);
+    }
+    return fp;
+}
+
+static void SetDefaults(const std::string& dir, const std::string& name, JobDescriptor* job) {
+    job->set_name("mini_" + name);
+    job->set_user("mini");
+    job->set_priority(kNormal);
+    job->set_job_type(kMapReduceJob);
+    job->add_inputs(dir + "/input");
+    job->set_output(dir + "/output");
+    job->set_key_separator("\t");
+    job->set_millicores(1000);
+    job->set_memory(1L << 30);
+    job->set_map_retry(3);
+    job->set_reduce_retry(3);
+}
+
+// Lines of Zipf distributed words, the most common first
+class WordCount : public Workload {
+public:
+    std::string Name() {
+        return "wordcount";
+    }
+    int64_t Prepare(const std::string& dir, int64_t bytes) {
+        if (!MakeDirs(dir)
+                || !WriteScript(dir, "map.sh",
+                                "awk '{for (i = 1; i <= NF; i++) print $i \"\\t1\"}'")
+                || !WriteScript(dir, "reduce.sh",
+                                "awk -F'\\t' '$1 != k {if (NR > 1) print k \"\\t\" n; k = $1; n = 0}"
+                                " {n += $2} END {if (NR > 0) print k \"\\t\" n}'")) {
+            return -1;
+        }
+        RecordGenerator gen(6, 0, 100000, 1.0, 1);
+        std::string word;
+        std::string value;
+        int64_t written = 0;
+        for (int i = 0; i < sInputFiles; i++) {
+            FILE* fp = OpenInput(dir, "words", i);
+            if (fp == NULL) {
+                return -1;
+            }
+            for (int64_t n = 0; n < bytes / sInputFiles;) {
+                std::string line;
+                for (int w = 0; w < 10; w++) {
+                    gen.Next(&word, &value);
+                    line.append(w == 0 ? "w" : " w");
+                    line.append(word);
+                }
+                line.push_back('\n');
+                fwrite(line.data(), 1, line.size(), fp);
+                n += line.size();
+            }
+            written += ftell(fp);
+            fclose(fp);
+        }
+        return written;
+    }
+    void Describe(const std::string& dir, JobDescriptor* job) {
+        SetDefaults(dir, Name(), job);
+        job->set_map_command(Command(dir, "map.sh"));
+        job->set_reduce_command(Command(dir, "reduce.sh"));
+        job->set_combine_command(Command(dir, "reduce.sh"));
+        job->set_partition(kKeyFieldBasedPartitioner);
+    }
+};
+
+// Records of a 10 bytes key and a value, 100 bytes a line, ordered as a
+// whole by the range partitioner
+class TeraSort : public Workload {
+public:
+    std::string Name() {
+        return "terasort";
+    }
+    int64_t Prepare(const std::string& dir, int64_t bytes) {
+        if (!MakeDirs(dir) || !WriteScript(dir, "cat.sh", "cat")) {
+            return -1;
+        }
+        RecordGenerator gen(10, 88, 1000000000, 0, 2);
+        std::string line;
+        int64_t written = 0;
+        for (int i = 0; i < sInputFiles; i++) {
+            FILE* fp = OpenInput(dir, "records", i);
+            if (fp == NULL) {
+                return -1;
+            }
+            for (int64_t n = 0; n < bytes / sInputFiles; n += line.size()) {
+                gen.NextLine(&line);
+                line.push_back('\n');
+                fwrite(line.data(), 1, line.size(), fp);
+            }
+            written += ftell(fp);
+            fclose(fp);
+        }
+        return written;
+    }
+    void Describe(const std::string& dir, JobDescriptor* job) {
+        SetDefaults(dir, Name(), job);
+        job->set_map_command(Command(dir, "cat.sh"));
+        job->set_reduce_command(Command(dir, "cat.sh"));
+        job->set_partition(kRangePartitioner);
+    }
+};
+
+// Events joined with the users they belong to. Users are tagged A and
+// events B, so that a user sorts before its events in a reduce, and most
+// events belong to a few users, as they do in logs
+class Join : public Workload {
+public:
+    std::string Name() {
+        return "join";
+    }
+    int64_t Prepare(const std::string& dir, int64_t bytes) {
+        if (!MakeDirs(dir) || !WriteScript(dir, "cat.sh", "cat")
+                || !WriteScript(dir, "join.sh",
+                                "awk -F'\\t' '$2 == \"A\" {k = $1; n = $3; next}"
+                                " $1 == k {print $1 \"\\t\" n \"\\t\" $3}'")) {
+            return -1;
+        }
+        // A tenth of the bytes are users
+        const int users = static_cast<int>(std::max(bytes / 10 / sUserLineSize, 1000L));
+        int64_t written = 0;
+        FILE* fp = OpenInput(dir, "users", 0);
+        if (fp == NULL) {
+            return -1;
+        }
+        for (int i = 0; i < users; i++) {
+            fprintf(fp, "u%08d\tA\tuser%d\n", i, i);
+        }
+        written += ftell(fp);
+        fclose(fp);
+        const int64_t events_bytes = bytes - written;
+        RecordGenerator gen(8, 40, users, 1.0, 3);
+        std::string key;
+        std::string value;
+        for (int i = 0; i < sInputFiles; i++) {
+            fp = OpenInput(dir, "events", i);
+            if (fp == NULL) {
+                return -1;
+            }
+            for (int64_t n = 0; n < events_bytes / sInputFiles;) {
+                gen.Next(&key, &value);
+                n += fprintf(fp, "u%s\tB\t%s\n", key.c_str(), value.c_str());
+            }
+            written += ftell(fp);
+            fclose(fp);
+        }
+        return written;
+    }
+    void Describe(const std::string& dir, JobDescriptor* job) {
+        SetDefaults(dir, Name(), job);
+        job->set_map_command(Command(dir, "cat.sh"));
+        job->set_reduce_command(Command(dir, "join.sh"));
+        job->set_partition(kKeyFieldBasedPartitioner);
+        // Sorted by user and tag, partitioned by user alone
+        job->set_key_fields_num(2);
+        job->set_partition_fields_num(1);
+    }
+private:
+    const static int64_t sUserLineSize = 24;
+};
+
+Workload* Workload::Create(const std::string& name) {
+    if (name == "wordcount") {
+        return new WordCount();
+    } else if (name == "terasort") {
+        return new TeraSort();
+    } else if (name == "join") {
+        return new Join();
+    }
+    return NULL;
+}
+
+}
+}
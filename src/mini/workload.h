@@ -0,0 +1,29 @@
+#ifndef _BAIDU_SHUTTLE_MINI_WORKLOAD_H_
+#define _BAIDU_SHUTTLE_MINI_WORKLOAD_H_
+
+#include <stdint.h>
+#include <string>
+#include "proto/shuttle.pb.h"
+
+namespace baidu {
+namespace shuttle {
+
+// A job run by the mini cluster, with inputs it generates. The user
+// programs are shell scripts, so that no build of them is needed
+class Workload {
+public:
+    // wordcount, terasort or join, NULL for others
+    static Workload* Create(const std::string& name);
+    virtual ~Workload() {}
+    virtual std::string Name() = 0;
+    // Writes about bytes of inputs under dir/input, and the scripts under
+    // dir/apps. Returns the bytes written
+    virtual int64_t Prepare(const std::string& dir, int64_t bytes) = 0;
+    // Inputs, output and commands of the job, output is dir/output
+    virtual void Describe(const std::string& dir, JobDescriptor* job) = 0;
+};
+
+}
+}
+
+#endif
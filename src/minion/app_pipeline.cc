@@ -0,0 +1,420 @@
+#include "app_pipeline.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/wait.h>
+#include <vector>
+#include <boost/bind.hpp>
+#include "logging.h"
+
+using baidu::common::Log;
+using baidu::common::INFO;
+using baidu::common::WARNING;
+
+namespace baidu {
+namespace shuttle {
+
+const static size_t sMaxQueuedBytes = 8 << 20;
+const static size_t sMaxStderrLine = 4096;
+const static int sWaitIntervalMs = 100;
+
+static int64_t MonotonicUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void ClosePipe(int* fd) {
+    if (*fd >= 0) {
+        close(*fd);
+        *fd = -1;
+    }
+}
+
+// The app leaving its stdin fails the write with EPIPE instead of
+// killing minion by SIGPIPE
+static ssize_t WriteNoSigPipe(int fd, const char* data, size_t len) {
+    sigset_t pipe_mask;
+    sigset_t old_mask;
+    sigemptyset(&pipe_mask);
+    sigaddset(&pipe_mask, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_mask, &old_mask);
+    ssize_t n = write(fd, data, len);
+    int err = errno;
+    if (n < 0 && err == EPIPE) {
+        struct timespec zero = {0, 0};
+        sigtimedwait(&pipe_mask, NULL, &zero);
+    }
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+    errno = err;
+    return n;
+}
+
+AppPipeline::AppPipeline(EventLoop* loop)
+    : loop_(loop), pid_(-1), stdin_fd_(-1), stdout_fd_(-1), stderr_fd_(-1),
+      event_fd_(-1), stdin_watched_(false), stdout_ready_(false),
+      input_cond_(&mu_), queued_bytes_(0), head_written_(0),
+      input_closed_(false), input_done_(true), input_failed_(false),
+      exited_(true), input_bytes_(0), input_wait_us_(0) {
+    memset(&usage_, 0, sizeof(usage_));
+}
+
+AppPipeline::~AppPipeline() {
+    if (pid_ > 0) {
+        Wait();
+    }
+}
+
+bool AppPipeline::Start(const std::string& cmd, bool feed_input,
+                        const std::map<std::string, std::string>& envs) {
+    // Built before fork, the child may not allocate. Slots of a minion run
+    // tasks at the same time, so the environment can not be the process one
+    std::vector<std::string> env_strs;
+    std::map<std::string, std::string>::const_iterator it;
+    for (it = envs.begin(); it != envs.end(); ++it) {
+        env_strs.push_back(it->first + "=" + it->second);
+    }
+    std::vector<char*> envp;
+    for (size_t i = 0; i < env_strs.size(); i++) {
+        envp.push_back(const_cast<char*>(env_strs[i].c_str()));
+    }
+    envp.push_back(NULL);
+    int cgroup_fd = -1;
+    if (!cgroup_.empty()) {
+        cgroup_fd = open((cgroup_ + "/cgroup.procs").c_str(), O_WRONLY | O_CLOEXEC);
+        if (cgroup_fd < 0) {
+            LOG(WARNING, "fail to open cgroup %s: %s", cgroup_.c_str(), strerror(errno));
+        }
+    }
+    int in_pipe[2] = {-1, -1};
+    int out_pipe[2] = {-1, -1};
+    int err_pipe[2] = {-1, -1};
+    bool ok = pipe2(out_pipe, O_CLOEXEC) == 0 && pipe2(err_pipe, O_CLOEXEC) == 0;
+    if (ok && feed_input) {
+        ok = pipe2(in_pipe, O_CLOEXEC) == 0;
+    } else if (ok) {
+        in_pipe[0] = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        ok = in_pipe[0] >= 0;
+    }
+    if (ok) {
+        pid_ = fork();
+        ok = pid_ >= 0;
+    }
+    if (ok && pid_ == 0) {
+        // Only async-signal-safe calls before exec, minion has threads.
+        // Writing 0 moves the child itself, before it starts anything
+        if (cgroup_fd >= 0 && write(cgroup_fd, "0", 1) != 1) {
+            _exit(126);
+        }
+        dup2(in_pipe[0], STDIN_FILENO);
+        dup2(out_pipe[1], STDOUT_FILENO);
+        dup2(err_pipe[1], STDERR_FILENO);
+        execle("/bin/sh", "sh", "-c", cmd.c_str(), (char*)NULL, &envp[0]);
+        _exit(127);
+    }
+    ClosePipe(&cgroup_fd);
+    ClosePipe(&in_pipe[0]);
+    ClosePipe(&out_pipe[1]);
+    ClosePipe(&err_pipe[1]);
+    stdin_fd_ = in_pipe[1];
+    stdout_fd_ = out_pipe[0];
+    stderr_fd_ = err_pipe[0];
+    if (!ok) {
+        LOG(WARNING, "fail to start user app: %s", strerror(errno));
+        ClosePipe(&stdin_fd_);
+        ClosePipe(&stdout_fd_);
+        ClosePipe(&stderr_fd_);
+        pid_ = -1;
+        return false;
+    }
+    EventLoop::SetNonBlocking(stdout_fd_);
+    EventLoop::SetNonBlocking(stderr_fd_);
+    loop_->Add(stderr_fd_, EPOLLIN, boost::bind(&AppPipeline::OnStderr, this, _1));
+    {
+        MutexLock lock(&mu_);
+        queue_.clear();
+        queued_bytes_ = 0;
+        head_written_ = 0;
+        input_closed_ = false;
+        input_done_ = !feed_input;
+        input_failed_ = false;
+        exited_ = false;
+        input_bytes_ = 0;
+        input_wait_us_ = 0;
+    }
+    memset(&usage_, 0, sizeof(usage_));
+    stdout_ready_ = false;
+    stdin_watched_ = false;
+    if (feed_input) {
+        EventLoop::SetNonBlocking(stdin_fd_);
+        MutexLock lock(&mu_);
+        event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        loop_->Add(event_fd_, EPOLLIN, boost::bind(&AppPipeline::OnInputEvent, this, _1));
+    }
+    return true;
+}
+
+ssize_t AppPipeline::Read(char* buf, size_t size) {
+    while (true) {
+        ssize_t n = read(stdout_fd_, buf, size);
+        if (n >= 0) {
+            return n;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno != EAGAIN) {
+            return -1;
+        }
+        // Only watched while somebody waits for it, an unread stdout
+        // must not spin the loop when input is drained
+        stdout_ready_ = false;
+        loop_->Add(stdout_fd_, EPOLLIN, boost::bind(&AppPipeline::OnStdout, this, _1));
+        while (!stdout_ready_) {
+            if (loop_->Poll(-1) < 0) {
+                loop_->Remove(stdout_fd_);
+                return -1;
+            }
+        }
+    }
+}
+
+void AppPipeline::OnStdout(uint32_t /*events*/) {
+    stdout_ready_ = true;
+    loop_->Remove(stdout_fd_);
+}
+
+bool AppPipeline::PushInput(const char* data, size_t len) {
+    {
+        MutexLock lock(&mu_);
+        if (queued_bytes_ >= sMaxQueuedBytes && !input_done_) {
+            int64_t wait_begin = MonotonicUs();
+            while (queued_bytes_ >= sMaxQueuedBytes && !input_done_) {
+                input_cond_.TimeWait(sWaitIntervalMs);
+            }
+            input_wait_us_ += MonotonicUs() - wait_begin;
+        }
+        if (input_done_ || input_closed_) {
+            return false;
+        }
+        queue_.push_back(std::string(data, len));
+        queued_bytes_ += len;
+        input_bytes_ += len;
+        NotifyInput();
+    }
+    return true;
+}
+
+void AppPipeline::CloseInput() {
+    MutexLock lock(&mu_);
+    input_closed_ = true;
+    NotifyInput();
+}
+
+void AppPipeline::NotifyInput() {
+    mu_.AssertHeld();
+    // The loop no longer listens once input is done, and Wait closes the fd
+    if (input_done_ || event_fd_ < 0) {
+        return;
+    }
+    uint64_t one = 1;
+    ssize_t ret = write(event_fd_, &one, sizeof(one));
+    (void)ret;
+}
+
+void AppPipeline::OnInputEvent(uint32_t /*events*/) {
+    uint64_t count = 0;
+    ssize_t ret = read(event_fd_, &count, sizeof(count));
+    (void)ret;
+    WatchInput();
+}
+
+void AppPipeline::WatchInput() {
+    if (stdin_watched_ || stdin_fd_ < 0) {
+        return;
+    }
+    stdin_watched_ = loop_->Add(stdin_fd_, EPOLLOUT,
+                                boost::bind(&AppPipeline::OnStdin, this, _1));
+}
+
+void AppPipeline::OnStdin(uint32_t events) {
+    MutexLock lock(&mu_);
+    if (events & EPOLLERR) {
+        EndInput(false);
+        return;
+    }
+    while (!queue_.empty()) {
+        const std::string& head = queue_.front();
+        ssize_t n = WriteNoSigPipe(stdin_fd_, head.data() + head_written_,
+                                   head.size() - head_written_);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN) {
+                return;
+            }
+            LOG(INFO, "user app stops reading input: %s", strerror(errno));
+            EndInput(false);
+            return;
+        }
+        head_written_ += n;
+        if (head_written_ == head.size()) {
+            queued_bytes_ -= head.size();
+            queue_.pop_front();
+            head_written_ = 0;
+            input_cond_.Signal();
+        }
+    }
+    if (input_closed_) {
+        EndInput(true);
+        return;
+    }
+    // Watched again when more input is queued
+    loop_->Remove(stdin_fd_);
+    stdin_watched_ = false;
+}
+
+void AppPipeline::EndInput(bool ok) {
+    if (stdin_watched_) {
+        loop_->Remove(stdin_fd_);
+        stdin_watched_ = false;
+    }
+    ClosePipe(&stdin_fd_);
+    queue_.clear();
+    queued_bytes_ = 0;
+    head_written_ = 0;
+    input_done_ = true;
+    input_failed_ = input_failed_ || !ok;
+    input_cond_.Broadcast();
+}
+
+void AppPipeline::InputStats(int64_t* bytes, int64_t* wait_us) {
+    MutexLock lock(&mu_);
+    *bytes = input_bytes_;
+    *wait_us = input_wait_us_;
+}
+
+void AppPipeline::AbortInput() {
+    MutexLock lock(&mu_);
+    if (!input_done_) {
+        EndInput(false);
+    }
+}
+
+bool AppPipeline::DrainInput(const boost::function<bool ()>& should_stop) {
+    while (true) {
+        {
+            MutexLock lock(&mu_);
+            if (input_done_) {
+                return !input_failed_;
+            }
+        }
+        if (should_stop()) {
+            AbortInput();
+            return false;
+        }
+        if (loop_->Poll(sWaitIntervalMs) < 0) {
+            AbortInput();
+            return false;
+        }
+    }
+}
+
+void AppPipeline::OnStderr(uint32_t /*events*/) {
+    ReadStderr();
+}
+
+// Lines app_wrapper.sh itself prints, stderr of the user command goes to
+// files of the task
+void AppPipeline::ReadStderr() {
+    char buf[4096];
+    while (stderr_fd_ >= 0) {
+        ssize_t n = read(stderr_fd_, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n > 0) {
+            for (ssize_t i = 0; i < n; i++) {
+                if (buf[i] == '\n' || stderr_line_.size() >= sMaxStderrLine) {
+                    LOG(WARNING, "user app: %s", stderr_line_.c_str());
+                    stderr_line_.clear();
+                }
+                if (buf[i] != '\n') {
+                    stderr_line_.push_back(buf[i]);
+                }
+            }
+            continue;
+        }
+        if (n < 0 && errno == EAGAIN) {
+            return;
+        }
+        loop_->Remove(stderr_fd_);
+        ClosePipe(&stderr_fd_);
+    }
+    if (!stderr_line_.empty()) {
+        LOG(WARNING, "user app: %s", stderr_line_.c_str());
+        stderr_line_.clear();
+    }
+}
+
+bool AppPipeline::Exited() {
+    MutexLock lock(&mu_);
+    if (exited_ || stdout_fd_ < 0) {
+        return true;
+    }
+    // app_wrapper.sh keeps stdout of the app open until it exits, so the
+    // pipe hangs up then, even when the app writes to a ring instead
+    struct pollfd pfd;
+    pfd.fd = stdout_fd_;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    return poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLHUP);
+}
+
+int AppPipeline::Wait() {
+    if (pid_ <= 0) {
+        return -1;
+    }
+    AbortInput();
+    {
+        // Producers only notify with mu_ held
+        MutexLock lock(&mu_);
+        if (event_fd_ >= 0) {
+            loop_->Remove(event_fd_);
+            ClosePipe(&event_fd_);
+        }
+        loop_->Remove(stdout_fd_);
+        ClosePipe(&stdout_fd_);
+    }
+    // Keeps draining stderr, an app blocked on it would never exit
+    int status = -1;
+    while (true) {
+        pid_t ret = wait4(pid_, &status, WNOHANG, &usage_);
+        if (ret == pid_ || (ret < 0 && errno != EINTR)) {
+            break;
+        }
+        if (ret == 0) {
+            loop_->Poll(sWaitIntervalMs);
+        }
+    }
+    if (stderr_fd_ >= 0) {
+        ReadStderr();
+        loop_->Remove(stderr_fd_);
+        ClosePipe(&stderr_fd_);
+    }
+    pid_ = -1;
+    MutexLock lock(&mu_);
+    exited_ = true;
+    return status;
+}
+
+} //namespace shuttle
+} //namespace baidu
@@ -0,0 +1,109 @@
+#ifndef _BAIDU_SHUTTLE_MINION_APP_PIPELINE_H_
+#define _BAIDU_SHUTTLE_MINION_APP_PIPELINE_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <deque>
+#include <map>
+#include <string>
+#include <boost/function.hpp>
+#include "common/event_loop.h"
+#include "mutex.h"
+
+namespace baidu {
+namespace shuttle {
+
+// A user app with stdin, stdout and stderr on non-blocking pipes, which
+// are all driven by an event loop in the thread reading the output. The
+// loop writes input queued by producer threads whenever the app takes
+// it, and a full queue blocks the producers, so neither side of the app
+// can stall the other
+class AppPipeline {
+public:
+    // Several pipelines may share a loop driven by the same thread
+    explicit AppPipeline(EventLoop* loop);
+    ~AppPipeline();
+    // Runs sh -c cmd with the environment envs. With feed_input, stdin of
+    // the app takes what is pushed by PushInput, otherwise it reads /dev/null
+    bool Start(const std::string& cmd, bool feed_input,
+               const std::map<std::string, std::string>& envs);
+    // The app and all it starts are put in this cgroup directory, set
+    // before Start
+    void SetCgroup(const std::string& cgroup) {
+        cgroup_ = cgroup;
+    }
+
+    // Reads stdout of the app, and drives the loop until some data or the
+    // end of it comes. Returns 0 at the end and -1 on errors
+    ssize_t Read(char* buf, size_t size);
+    int StdoutFd() const {
+        return stdout_fd_;
+    }
+
+    // Called by producer threads, waits while the queue is full. Returns
+    // false once the input is given up, or the app has stopped reading
+    bool PushInput(const char* data, size_t len);
+    // Ends stdin of the app after the queued data
+    void CloseInput();
+    // Drives the loop until all input is written or given up, and gives it
+    // up once should_stop returns true
+    bool DrainInput(const boost::function<bool ()>& should_stop);
+    // Closes stdin at once, blocked producers return
+    void AbortInput();
+    // Bytes pushed so far, and the time producers waited for room
+    void InputStats(int64_t* bytes, int64_t* wait_us);
+
+    // Safe from any thread
+    bool Exited();
+    // Gives up the input, closes stdout and waits for the app. Returns the
+    // status of it as pclose does
+    int Wait();
+    // Resources used by the app and the children it waited, valid after Wait
+    const struct rusage& Usage() const {
+        return usage_;
+    }
+private:
+    void OnStdin(uint32_t events);
+    void OnStdout(uint32_t events);
+    void OnStderr(uint32_t events);
+    void OnInputEvent(uint32_t events);
+    void WatchInput();
+    // Called in the loop with mu_ held
+    void EndInput(bool ok);
+    void ReadStderr();
+    // Called with mu_ held
+    void NotifyInput();
+private:
+    EventLoop* loop_;
+    pid_t pid_;
+    int stdin_fd_;
+    int stdout_fd_;
+    int stderr_fd_;
+    // Signalled by producers, so the loop watches stdin again. Guarded by mu_
+    int event_fd_;
+    bool stdin_watched_;
+    bool stdout_ready_;
+    // Last line of stderr not logged yet
+    std::string stderr_line_;
+    std::string cgroup_;
+
+    Mutex mu_;
+    CondVar input_cond_;
+    std::deque<std::string> queue_;
+    size_t queued_bytes_;
+    // Bytes of the head of the queue already written
+    size_t head_written_;
+    bool input_closed_;
+    bool input_done_;
+    bool input_failed_;
+    bool exited_;
+    int64_t input_bytes_;
+    int64_t input_wait_us_;
+    struct rusage usage_;
+};
+
+} //namespace shuttle
+} //namespace baidu
+
+#endif
@@ -21,7 +21,12 @@ JailRun() {
 	ulimit -n 10240
 	if [ "${minion_compress_output}" == "" ]; then
 		if [ "${minion_combiner_cmd}" == "" ]; then
-			eval ${user_cmd}
+			if [ "${mapred_shm_output}" != "" ]; then
+				# records go through the ring, stray prints must not block on stdout
+				eval ${user_cmd} 1>&2
+			else
+				eval ${user_cmd}
+			fi
 		else
 			eval ${user_cmd} | eval ${minion_combiner_cmd}
 		fi
@@ -88,9 +93,14 @@ then
 	if [ "${minion_decompress_input}" == "true" ]; then
 		decompress_input="-decompress_input"
 	fi
+	shm_output=""
+	if [ "${mapred_shm_input}" != "" ]; then
+		shm_output="-shm_output=${mapred_shm_input}"
+	fi
 	input_cmd="./input_tool -file=${map_input_file} \
 	-offset=${map_input_start} \
-	-len=${map_input_length} ${dfs_flags} ${format} ${pipe_style} ${is_nline} ${decompress_input}"
+	-len=${map_input_length} ${dfs_flags} ${format} ${pipe_style} ${is_nline} ${decompress_input} \
+	${shm_output}"
 	(InputRun $input_cmd | JailRun) 2>./stderr
 	exit $?
 elif [ "${mapred_task_is_map}" == "false" ]
@@ -109,14 +119,28 @@ then
 		-dfs_user=${minion_output_dfs_user} 
 		-dfs_password=${minion_output_dfs_password}"
 	fi
+	if [ "${minion_shuffle_inprocess}" == "true" ]; then
+		# minion merges map outputs itself and writes them to our stdin
+		JailRun 2>./stderr
+		exit $?
+	fi
 	pipe_style=""
 	if [ "${minion_pipe_style}" != "" ]; then
 		pipe_style="-pipe ${minion_pipe_style}"
 	fi
+	shm_output=""
+	if [ "${mapred_shm_input}" != "" ]; then
+		shm_output="-shm_output=${mapred_shm_input}"
+	fi
+	read_limit=""
+	if [ "${minion_shuffle_read_bps}" != "" ]; then
+		read_limit="-read_bytes_per_second=${minion_shuffle_read_bps}"
+	fi
 	shuffle_cmd="./shuffle_tool -total=${mapred_map_tasks} \
 	-work_dir=${minion_shuffle_work_dir} \
 	-reduce_no=${mapred_task_partition} \
-	-attempt_id=${mapred_attempt_id} $dfs_flags $pipe_style"
+	-attempt_id=${mapred_attempt_id} $dfs_flags $pipe_style ${minion_shuffle_range} \
+	${minion_shuffle_group} ${shm_output} ${read_limit}"
 	(ShuffleRun $shuffle_cmd | JailRun) 2>./stderr
 	exit $?
 else
@@ -0,0 +1,193 @@
+#include "cgroup.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/types.h>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <boost/lexical_cast.hpp>
+#include "logging.h"
+
+using baidu::common::Log;
+using baidu::common::INFO;
+using baidu::common::WARNING;
+
+namespace baidu {
+namespace shuttle {
+
+const static char* sCgroupMount = "/sys/fs/cgroup";
+const static char* sControllers[] = {"cpu", "io", "memory"};
+
+bool Cgroup::WriteFile(const std::string& file, const std::string& value) {
+    int fd = open(file.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LOG(WARNING, "fail to open %s: %s", file.c_str(), strerror(errno));
+        return false;
+    }
+    ssize_t n = write(fd, value.data(), value.size());
+    int err = errno;
+    close(fd);
+    if (n != static_cast<ssize_t>(value.size())) {
+        LOG(WARNING, "fail to write %s to %s: %s", value.c_str(), file.c_str(), strerror(err));
+        return false;
+    }
+    return true;
+}
+
+std::string Cgroup::Delegate() {
+    // The unified hierarchy is the line of "0::/path"
+    std::ifstream self("/proc/self/cgroup");
+    std::string line;
+    std::string relative;
+    while (std::getline(self, line)) {
+        if (line.compare(0, 3, "0::") == 0) {
+            relative = line.substr(3);
+        }
+    }
+    if (relative.empty()) {
+        LOG(INFO, "cgroup v2 is not used by minion");
+        return "";
+    }
+    // The unified hierarchy is mounted on its own, or beside v1 ones
+    std::string mount = sCgroupMount;
+    if (access((mount + "/cgroup.controllers").c_str(), F_OK) != 0) {
+        mount += "/unified";
+    }
+    std::string base = mount + (relative == "/" ? "" : relative);
+    if (access((base + "/cgroup.subtree_control").c_str(), W_OK) != 0) {
+        LOG(INFO, "cgroup of minion is not delegated: %s", base.c_str());
+        return "";
+    }
+    std::ifstream available((base + "/cgroup.controllers").c_str());
+    std::string controllers;
+    std::getline(available, controllers);
+    controllers = " " + controllers + " ";
+    std::vector<std::string> wanted;
+    for (size_t i = 0; i < sizeof(sControllers) / sizeof(sControllers[0]); i++) {
+        const std::string name = sControllers[i];
+        if (controllers.find(" " + name + " ") == std::string::npos) {
+            LOG(WARNING, "controller %s is not available in %s", name.c_str(), base.c_str());
+        } else {
+            wanted.push_back(name);
+        }
+    }
+    if (wanted.empty()) {
+        return "";
+    }
+    const std::string leaf = base + "/minion";
+    if (mkdir(leaf.c_str(), 0755) != 0 && errno != EEXIST) {
+        LOG(WARNING, "fail to make %s: %s", leaf.c_str(), strerror(errno));
+        return "";
+    }
+    // Writing 0 moves the writer, so minion leaves base with all threads
+    if (!WriteFile(leaf + "/cgroup.procs", "0")) {
+        return "";
+    }
+    bool enabled = false;
+    for (size_t i = 0; i < wanted.size(); i++) {
+        enabled = WriteFile(base + "/cgroup.subtree_control", "+" + wanted[i]) || enabled;
+    }
+    if (!enabled) {
+        return "";
+    }
+    LOG(INFO, "task slots are put in cgroups under %s", base.c_str());
+    return base;
+}
+
+std::string Cgroup::DeviceOf(const std::string& path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        return "";
+    }
+    std::stringstream dev;
+    dev << major(st.st_dev) << ":" << minor(st.st_dev);
+    // io.max only takes whole disks, a partition is found under its disk
+    std::string sys_dir = "/sys/dev/block/" + dev.str();
+    if (access((sys_dir + "/partition").c_str(), F_OK) == 0) {
+        std::ifstream parent((sys_dir + "/../dev").c_str());
+        std::string parent_dev;
+        if (std::getline(parent, parent_dev) && !parent_dev.empty()) {
+            return parent_dev;
+        }
+    }
+    return dev.str();
+}
+
+Cgroup::Cgroup(const std::string& parent, const std::string& name)
+    : path_(parent + "/" + name), created_(false) {
+}
+
+Cgroup::~Cgroup() {
+    if (created_ && rmdir(path_.c_str()) != 0) {
+        LOG(WARNING, "fail to remove %s: %s", path_.c_str(), strerror(errno));
+    }
+}
+
+bool Cgroup::Create() {
+    if (mkdir(path_.c_str(), 0755) != 0 && errno != EEXIST) {
+        LOG(WARNING, "fail to make %s: %s", path_.c_str(), strerror(errno));
+        return false;
+    }
+    created_ = true;
+    return true;
+}
+
+bool Cgroup::SetCpuMax(int64_t quota_us, int64_t period_us) {
+    std::string quota = quota_us > 0 ? boost::lexical_cast<std::string>(quota_us) : "max";
+    return WriteFile(path_ + "/cpu.max",
+                     quota + " " + boost::lexical_cast<std::string>(period_us));
+}
+
+bool Cgroup::SetIoMax(const std::string& device, int64_t read_bps, int64_t write_bps) {
+    std::string rbps = read_bps > 0 ? boost::lexical_cast<std::string>(read_bps) : "max";
+    std::string wbps = write_bps > 0 ? boost::lexical_cast<std::string>(write_bps) : "max";
+    return WriteFile(path_ + "/io.max", device + " rbps=" + rbps + " wbps=" + wbps);
+}
+
+bool Cgroup::SetMemoryHigh(int64_t bytes) {
+    return WriteFile(path_ + "/memory.high",
+                     bytes > 0 ? boost::lexical_cast<std::string>(bytes) : "max");
+}
+
+bool Cgroup::ReadStat(CgroupStat* stat) const {
+    std::ifstream cpu((path_ + "/cpu.stat").c_str());
+    if (!cpu) {
+        return false;
+    }
+    *stat = CgroupStat();
+    std::string key;
+    int64_t value = 0;
+    while (cpu >> key >> value) {
+        if (key == "user_usec") {
+            stat->user_us = value;
+        } else if (key == "system_usec") {
+            stat->sys_us = value;
+        }
+    }
+    // Lines of "major:minor rbytes=... wbytes=... rios=..." for each device,
+    // missing without the io controller
+    std::ifstream io((path_ + "/io.stat").c_str());
+    std::string line;
+    while (std::getline(io, line)) {
+        std::stringstream fields(line);
+        std::string field;
+        while (fields >> field) {
+            if (field.compare(0, 7, "rbytes=") == 0) {
+                stat->read_bytes += atoll(field.c_str() + 7);
+            } else if (field.compare(0, 7, "wbytes=") == 0) {
+                stat->write_bytes += atoll(field.c_str() + 7);
+            }
+        }
+    }
+    return true;
+}
+
+} //namespace shuttle
+} //namespace baidu
@@ -0,0 +1,57 @@
+#ifndef _BAIDU_SHUTTLE_MINION_CGROUP_H_
+#define _BAIDU_SHUTTLE_MINION_CGROUP_H_
+
+#include <stdint.h>
+#include <string>
+
+namespace baidu {
+namespace shuttle {
+
+// Totals of all processes ever in a cgroup, the exited ones included
+struct CgroupStat {
+    int64_t user_us;
+    int64_t sys_us;
+    int64_t read_bytes;
+    int64_t write_bytes;
+    CgroupStat() : user_us(0), sys_us(0), read_bytes(0), write_bytes(0) { }
+};
+
+// A cgroup v2 a task slot runs its user apps in, below the cgroup of
+// minion. Limits are written to the control files of it, so the apps are
+// slowed down by the kernel instead of being stopped
+class Cgroup {
+public:
+    // Moves minion into a leaf of its own cgroup, since a cgroup with
+    // processes can not enable controllers for children, and enables cpu,
+    // io and memory ones. Returns the directory slots are made under, or
+    // an empty string when cgroup v2 is not mounted or not writable
+    static std::string Delegate();
+    // "major:minor" of the disk holding path, as io.max takes it
+    static std::string DeviceOf(const std::string& path);
+
+    Cgroup(const std::string& parent, const std::string& name);
+    // Leaves the directory behind if processes are still in it
+    ~Cgroup();
+    bool Create();
+    const std::string& Path() const {
+        return path_;
+    }
+    // A quota not above 0 removes the limit
+    bool SetCpuMax(int64_t quota_us, int64_t period_us);
+    // Bytes per second, 0 for no limit on that side
+    bool SetIoMax(const std::string& device, int64_t read_bps, int64_t write_bps);
+    // Above it the apps are reclaimed and slowed down, not killed
+    bool SetMemoryHigh(int64_t bytes);
+    // From cpu.stat and io.stat, summed over the devices
+    bool ReadStat(CgroupStat* stat) const;
+private:
+    static bool WriteFile(const std::string& file, const std::string& value);
+private:
+    std::string path_;
+    bool created_;
+};
+
+} //namespace shuttle
+} //namespace baidu
+
+#endif
@@ -0,0 +1,313 @@
+#include "emitter.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <gflags/gflags.h>
+#include "logging.h"
+#include "executor.h"
+#include "common/metrics.h"
+
+DECLARE_int32(hot_key_sketch_size);
+DECLARE_int32(hot_key_report_limit);
+
+using baidu::common::WARNING;
+using baidu::common::INFO;
+
+namespace baidu {
+namespace shuttle {
+
+const static size_t sMaxInMemTable = 512 << 20;
+const static size_t sMaxRecordSize = 2 << 20;
+
+static Counter* s_spills = Metrics::GetCounter("shuttle_minion_spills_total",
+        "Sorted files maps have spilled");
+static Histogram* s_spill_latency = Metrics::GetHistogram("shuttle_minion_spill_latency_us",
+        "Time maps take to sort and write a spill");
+
+struct EmitItem {
+    int reduce_no;
+    std::string key;
+    std::string record;
+    EmitItem(int l_reduce_no, const std::string& l_key, const std::string& l_record) {
+        reduce_no = l_reduce_no;
+        key = l_key;
+        record = l_record;
+    }
+    inline size_t Size() {
+        return sizeof(int) + key.capacity() + record.capacity() + sizeof(EmitItem*);
+    }
+};
+
+struct EmitItemLess {
+    bool operator()(EmitItem* const& a , EmitItem* const& b) {
+        if (a->reduce_no < b->reduce_no) {
+            return true;
+        } else if (a->reduce_no == b->reduce_no) {
+            return a->key < b->key;
+        } else {
+            return false;
+        }
+    }
+};
+
+struct PartitionKeyGreater {
+    bool operator()(const PartitionKey& a, const PartitionKey& b) const {
+        return a.size() > b.size();
+    }
+};
+
+Emitter::Emitter(const std::string& work_dir, const TaskInfo& task)
+  : task_(task), normalizer_(task.job()),
+    hash_aggregation_(task.job().hash_aggregation()),
+    combiner_(NULL), combiner_isolated_(false), partitioner_(NULL),
+    phases_(NULL), file_type_(kHdfsFile) {
+    work_dir_ = work_dir;
+    cur_byte_size_ = 0;
+    file_no_ = 0;
+    partition_sizes_.resize(task.job().partition_total(), 0);
+    // Hot keys are split by key ranges, which need sorted outputs
+    if (FLAGS_hot_key_sketch_size > 0 && !hash_aggregation_) {
+        partition_keys_.resize(partition_sizes_.size());
+    }
+}
+
+Emitter::~Emitter() {
+    Reset();
+}
+
+void Emitter::Reset() {
+    cur_byte_size_ = 0;
+    std::vector<EmitItem*>::iterator it;
+    for (it = mem_table_.begin(); it != mem_table_.end(); it++) {
+        delete (*it);
+    }
+    std::vector<EmitItem*>().swap(mem_table_);
+}
+
+Status Emitter::Emit(int reduce_no, const std::string& raw_key, const std::string& record) {
+    std::string normalized;
+    if (normalizer_.Enabled() && !hash_aggregation_) {
+        normalizer_.Normalize(raw_key, &normalized);
+    }
+    const std::string& key = hash_aggregation_ || normalizer_.Enabled() ?
+                             normalized : raw_key;
+    EmitItem* item = new EmitItem(reduce_no, key, record);
+    if (item->Size() > sMaxRecordSize) {
+        LOG(WARNING, "ignore too large records");
+        delete item;
+        return kOk;
+    }
+    mem_table_.push_back(item);
+    cur_byte_size_ += item->Size();
+    if (reduce_no >= 0 && static_cast<size_t>(reduce_no) < partition_sizes_.size()) {
+        partition_sizes_[reduce_no] += key.size() + record.size();
+        if (!partition_keys_.empty()) {
+            CountKey(reduce_no, key, key.size() + record.size());
+        }
+    }
+    
+    if (cur_byte_size_ < sMaxInMemTable) {
+        return kOk; //memtable is not big enough
+    }
+
+    return FlushMemTable();
+}
+
+void Emitter::CountKey(int reduce_no, const std::string& key, int64_t size) {
+    std::map<std::string, int64_t>& sketch = partition_keys_[reduce_no];
+    std::map<std::string, int64_t>::iterator it = sketch.find(key);
+    if (it != sketch.end()) {
+        it->second += size;
+        return;
+    }
+    if (sketch.size() < static_cast<size_t>(FLAGS_hot_key_sketch_size)) {
+        sketch[key] = size;
+        return;
+    }
+    // The new key replaces the lightest one and inherits its count,
+    // so a key heavier than total / capacity is never missed
+    std::map<std::string, int64_t>::iterator lightest = sketch.begin();
+    for (it = sketch.begin(); it != sketch.end(); ++it) {
+        if (it->second < lightest->second) {
+            lightest = it;
+        }
+    }
+    int64_t base = lightest->second;
+    sketch.erase(lightest);
+    sketch[key] = base + size;
+}
+
+void Emitter::HotKeys(std::vector<PartitionKey>* hot_keys) const {
+    hot_keys->clear();
+    if (partition_keys_.empty()) {
+        return;
+    }
+    int64_t total = 0;
+    for (size_t i = 0; i < partition_sizes_.size(); ++i) {
+        total += partition_sizes_[i];
+    }
+    // Only partitions well above the average are worth splitting
+    int64_t threshold = total / partition_sizes_.size() * 2;
+    for (size_t i = 0; i < partition_keys_.size(); ++i) {
+        if (partition_sizes_[i] <= threshold) {
+            continue;
+        }
+        std::map<std::string, int64_t>::const_iterator it;
+        for (it = partition_keys_[i].begin(); it != partition_keys_[i].end(); ++it) {
+            PartitionKey hot_key;
+            hot_key.set_partition(i);
+            hot_key.set_key(it->first);
+            hot_key.set_size(it->second);
+            hot_keys->push_back(hot_key);
+        }
+    }
+    std::sort(hot_keys->begin(), hot_keys->end(), PartitionKeyGreater());
+    if (hot_keys->size() > static_cast<size_t>(FLAGS_hot_key_report_limit)) {
+        hot_keys->resize(FLAGS_hot_key_report_limit);
+    }
+}
+
+void Emitter::OrderByPartition() {
+    int max_reduce_no = 0;
+    std::vector<EmitItem*>::iterator it;
+    for (it = mem_table_.begin(); it != mem_table_.end(); it++) {
+        max_reduce_no = std::max(max_reduce_no, (*it)->reduce_no);
+    }
+    std::vector<size_t> offsets(max_reduce_no + 2, 0);
+    for (it = mem_table_.begin(); it != mem_table_.end(); it++) {
+        offsets[(*it)->reduce_no + 1]++;
+    }
+    for (size_t i = 1; i < offsets.size(); i++) {
+        offsets[i] += offsets[i - 1];
+    }
+    std::vector<EmitItem*> ordered(mem_table_.size());
+    for (it = mem_table_.begin(); it != mem_table_.end(); it++) {
+        ordered[offsets[(*it)->reduce_no]++] = *it;
+    }
+    mem_table_.swap(ordered);
+}
+
+void Emitter::FileKey(int reduce_no, const std::string& key, std::string* file_key) const {
+    char s_reduce_no[256];
+    snprintf(s_reduce_no, sizeof(s_reduce_no), "%05d", reduce_no);
+    *file_key = s_reduce_no;
+    if (!hash_aggregation_) {
+        *file_key += "\t";
+        *file_key += key;
+    }
+}
+
+Status Emitter::Combine(SortFileWriter* writer) {
+    PluginRecordFormat format(task_.job());
+    Status status = kOk;
+    boost::scoped_ptr<PluginRunner> runner(PluginRunner::Create(combiner_,
+        kPluginCombine, combiner_isolated_, combiner_envs_,
+        boost::bind(&Emitter::PutCombined, this, writer, &format, &status, _1, _2)));
+    if (!runner->Start()) {
+        return kWriteFileFail;
+    }
+    std::vector<EmitItem*>::iterator it;
+    for (it = mem_table_.begin(); it != mem_table_.end(); it++) {
+        const std::string& record = (*it)->record;
+        shuttle_slice_t key;
+        shuttle_slice_t value;
+        if (!format.Split(record.data(), record.size(), &key, &value)
+                || !runner->Feed(key, value)) {
+            LOG(WARNING, "combiner fails: %s", combiner_->Path().c_str());
+            return status != kOk ? status : kWriteFileFail;
+        }
+    }
+    if (!runner->Finish()) {
+        LOG(WARNING, "combiner fails: %s", combiner_->Path().c_str());
+        return status != kOk ? status : kWriteFileFail;
+    }
+    return status;
+}
+
+bool Emitter::PutCombined(SortFileWriter* writer, const PluginRecordFormat* format,
+                          Status* status, const shuttle_slice_t& key,
+                          const shuttle_slice_t& value) {
+    std::string record;
+    format->Compose(key, value, &record);
+    std::string sort_key;
+    int reduce_no = format->Streaming() ?
+                    partitioner_->Calc(record, &sort_key) :
+                    partitioner_->Calc(std::string(key.data, key.size), &sort_key);
+    std::string normalized;
+    if (normalizer_.Enabled()) {
+        normalizer_.Normalize(sort_key, &normalized);
+        sort_key.swap(normalized);
+    }
+    std::string file_key;
+    FileKey(reduce_no, sort_key, &file_key);
+    *status = writer->Put(file_key, record);
+    return *status == kOk;
+}
+
+Status Emitter::FlushMemTable() {
+    SortFileWriter* writer = NULL;
+    Status status = kOk;
+    char file_name[4096];
+    int64_t sort_begin = PhaseTimer::NowUs();
+    int64_t spill_begin = sort_begin;
+    do {
+        if (hash_aggregation_) {
+            OrderByPartition();
+        } else {
+            std::sort(mem_table_.begin(), mem_table_.end(), EmitItemLess());
+        }
+        spill_begin = PhaseTimer::NowUs();
+        writer = SortFileWriter::Create(file_type_, &status);
+        if (status != kOk) {
+            break;
+        }
+        FileSystem::Param param;
+        Executor::FillParam(param, task_);
+        param["replica"] = "3";
+        snprintf(file_name, sizeof(file_name), "%s/%d.sort",
+                 work_dir_.c_str(), file_no_);
+        status = writer->Open(file_name, param);
+        if (status != kOk) {
+            break;
+        }
+        if (mem_table_.empty()) {
+            break;
+        }
+
+        if (combiner_ != NULL && !hash_aggregation_) {
+            status = Combine(writer);
+            break;
+        }
+        std::vector<EmitItem*>::iterator it;
+        std::string raw_key;
+        for (it = mem_table_.begin(); it != mem_table_.end(); it++) {
+            EmitItem* item = *it;
+            FileKey(item->reduce_no, item->key, &raw_key);
+            status = writer->Put(raw_key, item->record);
+            if (status != kOk) {
+                break;
+            }
+        }
+    } while(0);
+    
+    if (status == kOk) {
+        status = writer->Close();
+        file_no_ ++;
+    }
+    delete writer;
+    Reset();
+    if (phases_ != NULL) {
+        phases_->Add(kPhaseSort, spill_begin - sort_begin);
+        phases_->Add(kPhaseSpill, PhaseTimer::NowUs() - spill_begin);
+    }
+    if (status == kOk) {
+        s_spills->Inc();
+        s_spill_latency->Add(PhaseTimer::NowUs() - sort_begin);
+    }
+    return status;
+}
+
+}
+}
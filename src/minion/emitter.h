@@ -0,0 +1,83 @@
+#ifndef _BAIDU_SHUTTLE_MINION_EMITTER_H_
+#define _BAIDU_SHUTTLE_MINION_EMITTER_H_
+
+#include <map>
+#include <string>
+#include <vector>
+#include "proto/shuttle.pb.h"
+#include "sort/sort_file.h"
+#include "partition.h"
+#include "phase_timer.h"
+#include "plugin.h"
+
+namespace baidu {
+namespace shuttle {
+
+struct EmitItem;
+
+// Mem table of map outputs, which is sorted and spilled to a sorted file
+// of the work dir each time it is full
+class Emitter {
+public:
+    Emitter(const std::string& work_dir, const TaskInfo& task);
+    ~Emitter();
+    Status Emit(int reduce_no, const std::string& key, const std::string& record) ;
+    void Reset();
+    Status FlushMemTable();
+    const std::vector<int64_t>& PartitionSizes() const {
+        return partition_sizes_;
+    }
+    void HotKeys(std::vector<PartitionKey>* hot_keys) const;
+    // Sorted records of each flush go through the combine entry points of
+    // plugin, which keep keys, so they are partitioned again the same way
+    void SetCombiner(Plugin* plugin, bool isolated,
+                     const std::map<std::string, std::string>& envs,
+                     const Partitioner* partitioner) {
+        combiner_ = plugin;
+        combiner_isolated_ = isolated;
+        combiner_envs_ = envs;
+        partitioner_ = partitioner;
+    }
+    // Sorts and spills of the mem table are timed in phases
+    void SetPhaseTimer(PhaseTimer* phases) {
+        phases_ = phases;
+    }
+    // Sorted files are written to dfs unless set otherwise
+    void SetFileType(FileType file_type) {
+        file_type_ = file_type;
+    }
+private:
+    void FileKey(int reduce_no, const std::string& key, std::string* file_key) const;
+    Status Combine(SortFileWriter* writer);
+    bool PutCombined(SortFileWriter* writer, const PluginRecordFormat* format,
+                     Status* status, const shuttle_slice_t& key, const shuttle_slice_t& value);
+    void CountKey(int reduce_no, const std::string& key, int64_t size);
+    // Counting sort of the mem table by reduce_no, keeping the emit order
+    void OrderByPartition();
+private:
+    std::string work_dir_;
+    size_t cur_byte_size_;
+    std::vector<EmitItem*> mem_table_;
+    int file_no_;
+    const TaskInfo& task_;
+    // Bytes emitted to each fine-grained partition
+    std::vector<int64_t> partition_sizes_;
+    // Space-saving sketch of the heaviest keys in each partition
+    std::vector<std::map<std::string, int64_t> > partition_keys_;
+    // Encodes keys of typed orders, so the sort below is still by bytes
+    KeyNormalizer normalizer_;
+    // Records are grouped by reduces in hash tables, so they are only
+    // ordered by partition here and written without keys
+    bool hash_aggregation_;
+    Plugin* combiner_;
+    bool combiner_isolated_;
+    std::map<std::string, std::string> combiner_envs_;
+    const Partitioner* partitioner_;
+    PhaseTimer* phases_;
+    FileType file_type_;
+};
+
+} //namespace shuttle
+} //namespace baidu
+
+#endif
@@ -0,0 +1,92 @@
+#include <string>
+#include <vector>
+#include "common/benchmark.h"
+#include "emitter.h"
+
+using namespace baidu::shuttle;
+using namespace baidu::shuttle::bench;
+
+const static int sPartitions = 64;
+const static int sRecords = 100000;
+
+struct EmitRecord {
+    int reduce_no;
+    std::string key;
+    std::string record;
+};
+
+// Map outputs of value_size, keys of a Zipf skew in thousandths
+static void MapOutputs(State& state, std::vector<EmitRecord>* outputs) {
+    RecordGenerator gen(16, state.range(0), 100000, state.range(1) / 1000.0, 1);
+    outputs->resize(sRecords);
+    std::string value;
+    for (int i = 0; i < sRecords; i++) {
+        EmitRecord& output = (*outputs)[i];
+        gen.Next(&output.key, &value);
+        output.reduce_no = Partitioner::HashCode(output.key.data(), output.key.size())
+                           % sPartitions;
+        output.record = output.key + "\t" + value;
+    }
+}
+
+static void PartitionTotal(TaskInfo* task) {
+    task->mutable_job()->set_partition_total(sPartitions);
+    task->mutable_job()->set_reduce_total(sPartitions);
+}
+
+// Records put into the mem table, with the counting of hot keys
+static void BM_EmitterEmit(State& state) {
+    std::vector<EmitRecord> outputs;
+    MapOutputs(state, &outputs);
+    TaskInfo task;
+    PartitionTotal(&task);
+    TempDir dir("bench_emitter");
+    Emitter emitter(dir.Path(), task);
+    emitter.SetFileType(kLocalFile);
+    int64_t bytes = 0;
+    size_t i = 0;
+    while (state.KeepRunning()) {
+        const EmitRecord& output = outputs[i];
+        emitter.Emit(output.reduce_no, output.key, output.record);
+        bytes += output.key.size() + output.record.size();
+        if (++i == outputs.size()) {
+            // Keeps it from spilling in the middle
+            state.PauseTiming();
+            emitter.Reset();
+            i = 0;
+            state.ResumeTiming();
+        }
+    }
+    state.SetBytesProcessed(bytes);
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_EmitterEmit)->ArgPair(100, 0)->ArgPair(100, 1200)->ArgPair(1024, 0);
+
+// Sort and spill of a mem table of sRecords to a local sorted file
+static void BM_EmitterFlush(State& state) {
+    std::vector<EmitRecord> outputs;
+    MapOutputs(state, &outputs);
+    int64_t bytes = 0;
+    for (size_t i = 0; i < outputs.size(); i++) {
+        bytes += outputs[i].key.size() + outputs[i].record.size();
+    }
+    TaskInfo task;
+    PartitionTotal(&task);
+    TempDir dir("bench_emitter");
+    Emitter emitter(dir.Path(), task);
+    emitter.SetFileType(kLocalFile);
+    while (state.KeepRunning()) {
+        state.PauseTiming();
+        for (size_t i = 0; i < outputs.size(); i++) {
+            emitter.Emit(outputs[i].reduce_no, outputs[i].key, outputs[i].record);
+        }
+        state.ResumeTiming();
+        if (emitter.FlushMemTable() != kOk) {
+            state.SkipWithError("fail to flush");
+            break;
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * bytes);
+    state.SetItemsProcessed(state.iterations() * sRecords);
+}
+BENCHMARK(BM_EmitterFlush)->ArgPair(100, 0)->ArgPair(100, 1200)->ArgPair(1024, 0);
@@ -6,9 +6,19 @@
 #include <vector>
 #include <utility>
 #include <set>
+#include <map>
+#include <boost/function.hpp>
+#include <boost/scoped_ptr.hpp>
+#include "common/event_loop.h"
 #include "common/filesystem.h"
+#include "common/token_bucket.h"
+#include "common/shm_ring.h"
 #include "proto/shuttle.pb.h"
 #include "mutex.h"
+#include "app_pipeline.h"
+#include "phase_timer.h"
+#include "plugin.h"
+#include "sort/input_reader.h"
 
 using baidu::common::Log;
 using baidu::common::FATAL;
@@ -30,14 +40,51 @@ public:
     virtual ~Executor();
     static Executor* GetExecutor(WorkMode mode);
     void SetEnv(const std::string& jobid, const TaskInfo& task, WorkMode mode);
+    // Called before Exec, ends the setup phase started by SetEnv
+    void SetupDone();
     virtual TaskState Exec(const TaskInfo& task) = 0;
     void Stop(int32_t task_id);
     std::string GetErrorMsg(const TaskInfo& task, bool is_map);
     void UploadErrorMsg(const TaskInfo& task, bool is_map, const std::string& error_msg);
     static void FillParam(FileSystem::Param& param, const TaskInfo& task);
+    // Reads a key and a value of bistreaming apps, each after its length.
+    // Both are left as they are at the end of user_app
+    static bool ReadRecord(FILE* user_app, std::string* key, std::string* value);
     bool ParseCounters(const TaskInfo& task,
                        std::map<std::string, int64_t>* counters,
                        bool is_map);
+    const std::vector<int64_t>& GetPartitionSizes() const {
+        return partition_sizes_;
+    }
+    const std::vector<PartitionKey>& GetHotKeys() const {
+        return hot_keys_;
+    }
+    // Resources used by the current task and its user apps, called once
+    // in the thread of Exec after it returns
+    TaskUsage CollectUsage();
+    // Of the threads the current task started in minion and joined,
+    // which the thread of Exec does not count
+    const struct rusage& ThreadUsage() const {
+        return thread_usage_;
+    }
+    // Called in the thread of Exec once a task has taken all its input,
+    // and only has its output to write
+    void SetInputDoneCallback(const boost::function<void ()>& callback);
+    // Opens the input split of a task to run next while the current one
+    // still runs, so its first chunk is read ahead. Only plugins take
+    // input in minion, commands read it with input_tool
+    void PrefetchInput(const TaskInfo& task);
+    // User apps are started in this cgroup, empty for the one of minion
+    void SetCgroup(const std::string& cgroup) {
+        cgroup_ = cgroup;
+    }
+    // Shapes reads of map outputs by reduces, may be retuned while they run
+    void SetShuffleReadLimiter(TokenBucket* limiter) {
+        shuffle_read_limiter_ = limiter;
+    }
+    // Reads of the stream returned by StartUserApp
+    ssize_t ReadUserApp(char* buf, size_t size);
+    void CloseUserAppOutput();
 protected:
     Executor() ;
     bool ShouldStop(int32_t task_id);
@@ -47,11 +94,57 @@ protected:
     const std::string GetReduceWorkDir(const TaskInfo& task);
     bool MoveTempToOutput(const TaskInfo& task, FileSystem* fs, bool is_map);
     bool MoveTempToShuffle(const TaskInfo& task);
+    bool MoveTempToPartial(const TaskInfo& task, FileSystem* fs);
     bool MoveByPassData(const TaskInfo& task, FileSystem* fs, bool is_map);
     const std::string GetShuffleWorkDir(const TaskInfo& task);
 
+    // Environment of the user apps, kept by each executor since the slots
+    // of a minion run their tasks at the same time
+    void SetTaskEnv(const std::string& key, const std::string& value);
+    void UnsetTaskEnv(const std::string& key);
+    // NULL if not set
+    const char* GetTaskEnv(const std::string& key) const;
+
+    // Creates the rings of the shared-memory transport if the job asks
+    // for it and names them in the environment of the user app. The
+    // minion takes input_role of the input ring until the app attaches
+    bool PrepareShmRings(const TaskInfo& task, ShmRing::Role input_role);
+    ShmRing* GetInputRing() {
+        return input_ring_.get();
+    }
+    // Output of the user app is read from the returned stream, which is
+    // the output ring when there is one, and the pipe of the app otherwise.
+    // Reads of it drive the event loop of the app, see AppPipeline
+    FILE* StartUserApp(const std::string& cmd, bool feed_input = false);
+    AppPipeline* GetUserApp() {
+        return user_app_.get();
+    }
+    // Waits for the user app like pclose
+    int CloseUserApp(FILE* user_app);
+    // Tells whether the app has exited, which a ring cannot tell by itself
+    // if the app never attached to it
+    bool UserAppExited();
+
+    // Returns false if the job names a plugin which can not be loaded,
+    // plugin is left NULL when it has no entry points of the phase
+    bool LoadPlugin(const TaskInfo& task, PluginPhase phase, Plugin** plugin);
+    // Plugins read the job configuration from the environment. One run in
+    // process reads the environment of minion, which is set to the one of
+    // the task then. Slots share it, so multi-slot minions isolate plugins
+    bool PluginIsolated(const TaskInfo& task);
+    const std::map<std::string, std::string>& GetTaskEnvs() const {
+        return envs_;
+    }
+    // Reads the input split of the task into a plugin, as input_tool does
+    // for commands
+    TaskState FeedPluginInput(const TaskInfo& task, PluginRunner* runner);
+    bool OpenPluginInput(const TaskInfo& task, InputReader** reader,
+                         InputReader::Iterator** it);
+    void InputDone();
+    // Called with the first data from the user app or the input split
+    void FirstInput();
+
     bool ReadLine(FILE* user_app, std::string* line);
-    bool ReadRecord(FILE* user_app, std::string* key, std::string* value);
     bool ReadBlock(FILE* user_app, std::string* line);
 
     TaskState TransTextOutput(FILE* user_app, const std::string& temp_file_name,
@@ -64,10 +157,40 @@ protected:
 
 protected:
     char* line_buf_;
+    // Output bytes of each partition of the last completed map
+    std::vector<int64_t> partition_sizes_;
+    std::vector<PartitionKey> hot_keys_;
+    TaskUsage usage_;
+    struct rusage thread_usage_;
+    TokenBucket* shuffle_read_limiter_;
+    PhaseTimer phases_;
 
 private:
+    std::map<std::string, std::string> envs_;
     std::set<int32_t> stop_task_ids_;
     Mutex mu_;
+    EventLoop loop_;
+    boost::scoped_ptr<AppPipeline> user_app_;
+    boost::scoped_ptr<ShmRing> input_ring_;
+    boost::scoped_ptr<ShmRing> output_ring_;
+    boost::scoped_ptr<Plugin> plugin_;
+    boost::function<void ()> input_done_callback_;
+    std::string cgroup_;
+    // Dfs bytes moved by minion for the task, and the file the tools of it
+    // append theirs to
+    DfsCounters dfs_counters_;
+    std::string dfs_stats_file_;
+    int64_t output_bytes_;
+    int64_t output_wait_us_;
+    int64_t setup_begin_us_;
+    int64_t exec_begin_us_;
+    int64_t app_begin_us_;
+    bool first_input_seen_;
+    // Guarded by mu_
+    boost::scoped_ptr<InputReader> prefetch_reader_;
+    boost::scoped_ptr<InputReader::Iterator> prefetch_it_;
+    int32_t prefetch_task_id_;
+    int32_t prefetch_attempt_id_;
 
 };
 
@@ -80,6 +203,8 @@ public:
                               const Partitioner* partitioner, Emitter* emitter);
     TaskState BiStreamingShuffle(FILE* user_app, const TaskInfo& task,
                                 const Partitioner* partitioner, Emitter* emitter);
+    TaskState PluginShuffle(Plugin* plugin, const TaskInfo& task,
+                            const Partitioner* partitioner, Emitter* emitter);
 };
 
 class ReduceExecutor : public Executor {
@@ -87,6 +212,11 @@ public:
     ReduceExecutor();
     virtual TaskState Exec(const TaskInfo& task);
     virtual ~ReduceExecutor();
+private:
+    bool FeederShouldStop(int32_t task_id);
+    TaskState PluginReduce(Plugin* plugin, const TaskInfo& task,
+                           const std::string& temp_file_name, FileSystem::Param& param);
+    TaskState MoveReduceOutput(const TaskInfo& task, FileSystem::Param& param);
 };
 
 class MapOnlyExecutor: public Executor {
@@ -94,6 +224,10 @@ public:
     MapOnlyExecutor();
     virtual TaskState Exec(const TaskInfo& task);
     virtual ~MapOnlyExecutor();
+private:
+    TaskState PluginMap(Plugin* plugin, const TaskInfo& task,
+                        const std::string& temp_file_name, FileSystem::Param& param);
+    TaskState MoveMapOnlyOutput(const TaskInfo& task, FileSystem::Param& param);
 };
 
 }
@@ -0,0 +1,50 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include "common/benchmark.h"
+#include "executor.h"
+
+using namespace baidu::shuttle;
+using namespace baidu::shuttle::bench;
+
+// Records read from the pipe of a bistreaming app, from a file in its format
+static void BM_ReadRecord(State& state) {
+    FILE* records = tmpfile();
+    if (records == NULL) {
+        state.SkipWithError("fail to create a temporary file");
+        return;
+    }
+    RecordGenerator gen(16, state.range(0), 1 << 20, 0, 1);
+    std::string key;
+    std::string value;
+    int64_t size = 0;
+    while (size < (8 << 20)) {
+        gen.Next(&key, &value);
+        int32_t key_len = key.size();
+        int32_t value_len = value.size();
+        fwrite(&key_len, sizeof(key_len), 1, records);
+        fwrite(key.data(), 1, key_len, records);
+        fwrite(&value_len, sizeof(value_len), 1, records);
+        fwrite(value.data(), 1, value_len, records);
+        size += sizeof(key_len) + key_len + sizeof(value_len) + value_len;
+    }
+    int64_t read = 0;
+    while (state.KeepRunning()) {
+        rewind(records);
+        while (true) {
+            key.clear();
+            if (!Executor::ReadRecord(records, &key, &value)) {
+                state.SkipWithError("fail to read record");
+                break;
+            }
+            if (feof(records)) {
+                break;
+            }
+            ++read;
+        }
+    }
+    fclose(records);
+    state.SetBytesProcessed(state.iterations() * size);
+    state.SetItemsProcessed(read);
+}
+BENCHMARK(BM_ReadRecord)->Arg(16)->Arg(100)->Arg(1024);
@@ -1,14 +1,39 @@
 #include "executor.h"
 #include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+#include <sstream>
+#include <limits>
 #include <boost/algorithm/string/predicate.hpp>
+#include <boost/bind.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/scoped_ptr.hpp>
+#include <gflags/gflags.h>
+#include "common/tools_util.h"
+#include "sort/input_reader.h"
+
+DECLARE_int64(shm_ring_size);
+DECLARE_int32(minion_slots);
+DECLARE_int32(partial_reduce_timeout);
 
 namespace baidu {
 namespace shuttle {
 
-Executor::Executor() {
+const static size_t sAppStreamBufferSize = 1 << 20;
+
+Executor::Executor() : shuffle_read_limiter_(NULL), output_bytes_(0),
+                       output_wait_us_(0), setup_begin_us_(0), exec_begin_us_(0),
+                       app_begin_us_(0), first_input_seen_(false),
+                       prefetch_task_id_(-1), prefetch_attempt_id_(-1) {
     line_buf_ = (char*)malloc(sLineBufferSize);
+    // Starts from what minion is given, e.g. by hdfs_env.sh
+    for (char** env = environ; *env != NULL; env++) {
+        const char* sep = strchr(*env, '=');
+        if (sep != NULL) {
+            envs_[std::string(*env, sep - *env)] = sep + 1;
+        }
+    }
 }
 
 Executor::~Executor() {
@@ -48,12 +73,41 @@ Executor* Executor::GetExecutor(WorkMode mode) {
     return executor;
 }
 
+void Executor::SetTaskEnv(const std::string& key, const std::string& value) {
+    envs_[key] = value;
+}
+
+void Executor::UnsetTaskEnv(const std::string& key) {
+    envs_.erase(key);
+}
+
+const char* Executor::GetTaskEnv(const std::string& key) const {
+    std::map<std::string, std::string>::const_iterator it = envs_.find(key);
+    return it == envs_.end() ? NULL : it->second.c_str();
+}
+
 void Executor::SetEnv(const std::string& jobid, const TaskInfo& task,
                       WorkMode mode) {
     {
         MutexLock locker(&mu_);
         stop_task_ids_.clear();
     }
+    usage_.Clear();
+    memset(&thread_usage_, 0, sizeof(thread_usage_));
+    phases_.Reset();
+    setup_begin_us_ = PhaseTimer::NowUs();
+    first_input_seen_ = false;
+    dfs_counters_ = DfsCounters();
+    FileSystem::BindCounters(&dfs_counters_);
+    char cwd[4096];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        cwd[0] = '\0';
+    }
+    std::stringstream stats_file;
+    stats_file << cwd << "/dfs_stats_" << task.task_id() << "_" << task.attempt_id();
+    dfs_stats_file_ = stats_file.str();
+    remove(dfs_stats_file_.c_str());
+    SetTaskEnv("minion_dfs_stats_file", dfs_stats_file_);
     for (int i = 0; i < task.job().cmdenvs_size(); i++) {
         const std::string& env_kv = task.job().cmdenvs(i);
         std::size_t sep_idx = env_kv.find_first_of("=");
@@ -63,52 +117,78 @@ void Executor::SetEnv(const std::string& jobid, const TaskInfo& task,
         std::string env_key = env_kv.substr(0, sep_idx);
         std::string env_value = env_kv.substr(sep_idx+1);
         LOG(INFO, "user env setting: %s: %s", env_key.c_str(), env_value.c_str());
-        ::setenv(env_key.c_str(), env_value.c_str(), 1);
-    }
-    ::setenv("mapred_job_id", jobid.c_str(), 1);
-    ::setenv("mapred_job_name", task.job().name().c_str(), 1);
-    ::setenv("mapred_output_dir", task.job().output().c_str(), 1);
-    ::setenv("map_input_file", task.input().input_file().c_str(), 1);
-    ::setenv("map_input_start", 
-             boost::lexical_cast<std::string>(task.input().input_offset()).c_str(), 
-             1);
-    ::setenv("map_input_length", 
-             boost::lexical_cast<std::string>(task.input().input_size()).c_str(),
-             1);
-
-    ::setenv("mapred_map_tasks", 
-             boost::lexical_cast<std::string>(task.job().map_total()).c_str(), 
-            1);
-    ::setenv("mapred_reduce_tasks", 
-             boost::lexical_cast<std::string>(task.job().reduce_total()).c_str(), 
-            1);
-    ::setenv("mapred_task_partition", 
-             boost::lexical_cast<std::string>(task.task_id()).c_str(), 
-            1);
-    ::setenv("mapred_memory_limit",
-             boost::lexical_cast<std::string>(task.job().memory() / 1024).c_str(),
-             1);
+        SetTaskEnv(env_key, env_value);
+    }
+    SetTaskEnv("mapred_job_id", jobid);
+    SetTaskEnv("mapred_job_name", task.job().name());
+    SetTaskEnv("mapred_output_dir", task.job().output());
+    SetTaskEnv("map_input_file", task.input().input_file());
+    SetTaskEnv("map_input_start",
+               boost::lexical_cast<std::string>(task.input().input_offset()));
+    SetTaskEnv("map_input_length",
+               boost::lexical_cast<std::string>(task.input().input_size()));
+
+    SetTaskEnv("mapred_map_tasks",
+               boost::lexical_cast<std::string>(task.job().map_total()));
+    SetTaskEnv("mapred_reduce_tasks",
+               boost::lexical_cast<std::string>(task.job().reduce_total()));
+    SetTaskEnv("mapred_task_partition",
+               boost::lexical_cast<std::string>(task.task_id()));
+    SetTaskEnv("mapred_memory_limit",
+               boost::lexical_cast<std::string>(task.job().memory() / 1024));
     std::stringstream ss;
     ss << "attempt_" << jobid << "_" << task.task_id() << "_" << task.attempt_id();
-    ::setenv("mapred_task_id",
-             ss.str().c_str(), 
-            1);
-
-    ::setenv("mapred_attempt_id",
-             boost::lexical_cast<std::string>(task.attempt_id()).c_str(),
-             1);
-    ::setenv("minion_shuffle_work_dir", GetShuffleWorkDir(task).c_str(), 1);
-    ::setenv("minion_input_dfs_host", task.job().input_dfs().host().c_str(), 1);
-    ::setenv("minion_input_dfs_port", task.job().input_dfs().port().c_str(), 1);
-    ::setenv("minion_input_dfs_user", task.job().input_dfs().user().c_str(), 1);
-    ::setenv("minion_input_dfs_password", task.job().input_dfs().password().c_str(), 1);
-    ::setenv("minion_output_dfs_host", task.job().output_dfs().host().c_str(), 1);
-    ::setenv("minion_output_dfs_port", task.job().output_dfs().port().c_str(), 1);
-    ::setenv("minion_output_dfs_user", task.job().output_dfs().user().c_str(), 1);
-    ::setenv("minion_output_dfs_password", task.job().output_dfs().password().c_str(), 1);
+    SetTaskEnv("mapred_task_id", ss.str());
+
+    SetTaskEnv("mapred_attempt_id",
+               boost::lexical_cast<std::string>(task.attempt_id()));
+    SetTaskEnv("minion_shuffle_work_dir", GetShuffleWorkDir(task));
+    if (task.has_reduce_range()) {
+        const ReduceRange& range = task.reduce_range();
+        std::stringstream range_flags;
+        range_flags << "-partition_begin=" << range.partition_begin()
+                    << " -partition_end=" << range.partition_end();
+        if (range.has_key_begin()) {
+            range_flags << " -key_begin=" << HexEncode(range.key_begin());
+        }
+        if (range.has_key_end()) {
+            range_flags << " -key_end=" << HexEncode(range.key_end());
+        }
+        if (range.split_total() > 0) {
+            range_flags << " -split_no=" << range.split_no()
+                        << " -split_total=" << range.split_total();
+        }
+        if (range.partial_end() > range.partial_begin()) {
+            range_flags << " -partial_begin=" << range.partial_begin()
+                        << " -partial_end=" << range.partial_end()
+                        << " -partial_timeout=" << FLAGS_partial_reduce_timeout;
+        }
+        SetTaskEnv("minion_shuffle_range", range_flags.str());
+        LOG(INFO, "shuffle range: %s", range_flags.str().c_str());
+    } else {
+        UnsetTaskEnv("minion_shuffle_range");
+    }
+    if (task.job().hash_aggregation()) {
+        std::stringstream group_flags;
+        group_flags << "-hash_aggregation -key_fields="
+                    << std::max(task.job().key_fields_num(), 1)
+                    << " -separator=" << HexEncode(task.job().key_separator().empty() ?
+                                                   "\t" : task.job().key_separator());
+        SetTaskEnv("minion_shuffle_group", group_flags.str());
+    } else {
+        UnsetTaskEnv("minion_shuffle_group");
+    }
+    SetTaskEnv("minion_input_dfs_host", task.job().input_dfs().host());
+    SetTaskEnv("minion_input_dfs_port", task.job().input_dfs().port());
+    SetTaskEnv("minion_input_dfs_user", task.job().input_dfs().user());
+    SetTaskEnv("minion_input_dfs_password", task.job().input_dfs().password());
+    SetTaskEnv("minion_output_dfs_host", task.job().output_dfs().host());
+    SetTaskEnv("minion_output_dfs_port", task.job().output_dfs().port());
+    SetTaskEnv("minion_output_dfs_user", task.job().output_dfs().user());
+    SetTaskEnv("minion_output_dfs_password", task.job().output_dfs().password());
 
     bool is_map = false;
-    char* c_is_map = getenv("mapred_task_is_map");
+    const char* c_is_map = GetTaskEnv("mapred_task_is_map");
     if (c_is_map != NULL) {
         std::string s_is_map = c_is_map;
         if (s_is_map == "true") {
@@ -132,36 +212,394 @@ void Executor::SetEnv(const std::string& jobid, const TaskInfo& task,
         if (!task.job().key_separator().empty()) {
             combiner_cmd += "-separator '" + task.job().key_separator() +"' ";
         }
-        ::setenv("minion_combiner_cmd", combiner_cmd.c_str(), 1);
+        SetTaskEnv("minion_combiner_cmd", combiner_cmd);
         LOG(INFO, "combiner_cmd: %s", combiner_cmd.c_str());
     }
     if (task.job().input_format() == kTextInput) {
-        ::setenv("minion_input_format", "text", 1);
+        SetTaskEnv("minion_input_format", "text");
         if (task.job().has_decompress_input() 
             && task.job().decompress_input()) {
-            ::setenv("minion_decompress_input", "true", 1);
+            SetTaskEnv("minion_decompress_input", "true");
         }
     } else if (task.job().input_format() == kBinaryInput) {
-        ::setenv("minion_input_format", "binary", 1);
+        SetTaskEnv("minion_input_format", "binary");
     } else if (task.job().input_format() == kNLineInput) {
-        ::setenv("minion_input_format", "text", 1);
-        ::setenv("minion_input_is_nline", "true", 1);
+        SetTaskEnv("minion_input_format", "text");
+        SetTaskEnv("minion_input_is_nline", "true");
     }
     if (task.job().output_format() == kTextOutput) {
-        ::setenv("minion_output_format", "text", 1);
+        SetTaskEnv("minion_output_format", "text");
+        // Partial outputs of a hot key are reduced again, so keep them plain
         if (task.job().has_compress_output()
             && task.job().compress_output()
-            && (mode == kReduce || mode == kMapOnly)) {
-            ::setenv("minion_compress_output", "true", 1);
+            && (mode == kReduce || mode == kMapOnly)
+            && task.reduce_range().split_total() == 0) {
+            SetTaskEnv("minion_compress_output", "true");
+        } else {
+            UnsetTaskEnv("minion_compress_output");
         }
     } else if (task.job().output_format() == kBinaryOutput) {
-        ::setenv("minion_output_format", "binary", 1);
+        SetTaskEnv("minion_output_format", "binary");
     }
     if (task.job().pipe_style() == kStreaming) {
-        ::setenv("minion_pipe_style", "streaming", 1);
+        SetTaskEnv("minion_pipe_style", "streaming");
     } else if (task.job().pipe_style() == kBiStreaming) {
-        ::setenv("minion_pipe_style", "bistreaming", 1);
+        SetTaskEnv("minion_pipe_style", "bistreaming");
+    }
+}
+
+// Adds the time of writing the output, reads waiting for the app are
+// counted in pipe_wait
+class OutputScope {
+public:
+    OutputScope(PhaseTimer* timer, const int64_t* wait_us)
+        : timer_(timer), wait_us_(wait_us), begin_(PhaseTimer::NowUs()),
+          wait_begin_(*wait_us) {
+    }
+    ~OutputScope() {
+        int64_t waited = *wait_us_ - wait_begin_;
+        timer_->Add(kPhaseOutput, PhaseTimer::NowUs() - begin_ - waited);
+    }
+private:
+    PhaseTimer* timer_;
+    const int64_t* wait_us_;
+    int64_t begin_;
+    int64_t wait_begin_;
+};
+
+static ssize_t ReadOutput(void* cookie, char* buf, size_t size) {
+    return static_cast<Executor*>(cookie)->ReadUserApp(buf, size);
+}
+
+static int CloseOutput(void* cookie) {
+    static_cast<Executor*>(cookie)->CloseUserAppOutput();
+    return 0;
+}
+
+ssize_t Executor::ReadUserApp(char* buf, size_t size) {
+    // Reads only block while the app has nothing for us
+    int64_t begin = PhaseTimer::NowUs();
+    ssize_t n = 0;
+    if (output_ring_) {
+        const char* data = NULL;
+        n = std::min(output_ring_->Peek(&data), size);
+        memcpy(buf, data, n);
+        output_ring_->Consume(n);
+    } else {
+        n = user_app_->Read(buf, size);
+    }
+    output_wait_us_ += PhaseTimer::NowUs() - begin;
+    if (n > 0) {
+        output_bytes_ += n;
+        FirstInput();
+    }
+    return n;
+}
+
+void Executor::CloseUserAppOutput() {
+    if (output_ring_) {
+        output_ring_->CloseRead();
+    }
+}
+
+bool Executor::PrepareShmRings(const TaskInfo& task, ShmRing::Role input_role) {
+    input_ring_.reset();
+    output_ring_.reset();
+    UnsetTaskEnv("mapred_shm_input");
+    UnsetTaskEnv("mapred_shm_output");
+    if (!task.job().shm_transport()) {
+        return false;
+    }
+    std::stringstream prefix;
+    prefix << "/shuttle_" << getpid() << "_" << task.task_id()
+           << "_" << task.attempt_id();
+    // Combiner and compression of app_wrapper.sh read stdout of the app,
+    // only the input goes through a ring then
+    const bool direct_output = GetTaskEnv("minion_combiner_cmd") == NULL
+                               && GetTaskEnv("minion_compress_output") == NULL;
+    input_ring_.reset(ShmRing::Create(prefix.str() + "_in",
+                                      FLAGS_shm_ring_size, input_role));
+    if (input_ring_ && direct_output) {
+        output_ring_.reset(ShmRing::Create(prefix.str() + "_out",
+                                           FLAGS_shm_ring_size, ShmRing::kReader));
+    }
+    if (!input_ring_ || (direct_output && !output_ring_)) {
+        // Programs using the rings fall back to stdin and stdout as well
+        LOG(WARNING, "fail to create shared-memory rings, use pipes: %s",
+            strerror(errno));
+        input_ring_.reset();
+        output_ring_.reset();
+        return false;
+    }
+    SetTaskEnv("mapred_shm_input", input_ring_->Name());
+    if (output_ring_) {
+        SetTaskEnv("mapred_shm_output", output_ring_->Name());
+    }
+    LOG(INFO, "use shared-memory rings: %s", prefix.str().c_str());
+    return true;
+}
+
+FILE* Executor::StartUserApp(const std::string& cmd, bool feed_input) {
+    user_app_.reset(new AppPipeline(&loop_));
+    user_app_->SetCgroup(cgroup_);
+    app_begin_us_ = PhaseTimer::NowUs();
+    bool started = user_app_->Start(cmd, feed_input, envs_);
+    phases_.Add(kPhaseSetup, PhaseTimer::NowUs() - app_begin_us_);
+    if (!started) {
+        return NULL;
+    }
+    output_bytes_ = 0;
+    output_wait_us_ = 0;
+    cookie_io_functions_t io_funcs = {ReadOutput, NULL, NULL, CloseOutput};
+    FILE* output = fopencookie(this, "r", io_funcs);
+    if (output == NULL) {
+        LOG(WARNING, "fail to open output of user app: %s", strerror(errno));
+        if (output_ring_) {
+            output_ring_->CloseRead();
+        }
+        user_app_->Wait();
+        return NULL;
+    }
+    setvbuf(output, NULL, _IOFBF, sAppStreamBufferSize);
+    if (output_ring_) {
+        output_ring_->SetGiveUpChecker(boost::bind(&Executor::UserAppExited, this));
+    }
+    return output;
+}
+
+bool Executor::UserAppExited() {
+    return !user_app_ || user_app_->Exited();
+}
+
+int Executor::CloseUserApp(FILE* user_app) {
+    fclose(user_app);
+    // Writers of a ring the app has left learn nobody reads any more, as
+    // with the pipes closed by Wait. The in-process shuffle still holds
+    // a ring it writes, so rings are unmapped with the next task
+    if (input_ring_ && input_ring_->GetRole() == ShmRing::kReader) {
+        input_ring_->CloseRead();
+    }
+    // The app is kept for the in-process shuffle, which may still ask
+    // whether it has exited
+    int ret = user_app_->Wait();
+    phases_.Add(kPhaseCompute, PhaseTimer::NowUs() - app_begin_us_);
+    const struct rusage& usage = user_app_->Usage();
+    usage_.set_user_time_ms(usage_.user_time_ms() + usage.ru_utime.tv_sec * 1000
+                            + usage.ru_utime.tv_usec / 1000);
+    usage_.set_sys_time_ms(usage_.sys_time_ms() + usage.ru_stime.tv_sec * 1000
+                           + usage.ru_stime.tv_usec / 1000);
+    usage_.set_max_rss_kb(std::max(usage_.max_rss_kb(), (int64_t)usage.ru_maxrss));
+    // Blocks of 512 bytes, as getrusage counts them
+    usage_.set_local_read_bytes(usage_.local_read_bytes() + usage.ru_inblock * 512L);
+    usage_.set_local_write_bytes(usage_.local_write_bytes() + usage.ru_oublock * 512L);
+    int64_t input_bytes = 0;
+    int64_t input_wait_us = 0;
+    user_app_->InputStats(&input_bytes, &input_wait_us);
+    usage_.set_pipe_in_bytes(usage_.pipe_in_bytes() + input_bytes);
+    usage_.set_pipe_in_wait_ms(usage_.pipe_in_wait_ms() + input_wait_us / 1000);
+    usage_.set_pipe_out_bytes(usage_.pipe_out_bytes() + output_bytes_);
+    usage_.set_pipe_out_wait_ms(usage_.pipe_out_wait_ms() + output_wait_us_ / 1000);
+    phases_.Add(kPhasePipeWait, input_wait_us + output_wait_us_);
+    if (input_ring_) {
+        input_ring_->Unlink();
+    }
+    if (output_ring_) {
+        output_ring_->Unlink();
+    }
+    return ret;
+}
+
+void Executor::SetupDone() {
+    exec_begin_us_ = PhaseTimer::NowUs();
+    phases_.Add(kPhaseSetup, exec_begin_us_ - setup_begin_us_);
+}
+
+void Executor::FirstInput() {
+    if (!first_input_seen_) {
+        first_input_seen_ = true;
+        phases_.Add(kPhaseFirstInput, PhaseTimer::NowUs() - exec_begin_us_);
+    }
+}
+
+TaskUsage Executor::CollectUsage() {
+    FileSystem::BindCounters(NULL);
+    DfsCounters total = dfs_counters_;
+    // Tools exit before the task is done, so their bytes are all there
+    FileSystem::LoadCounters(dfs_stats_file_, &total);
+    remove(dfs_stats_file_.c_str());
+    usage_.set_dfs_read_bytes(total.read_bytes);
+    usage_.set_dfs_write_bytes(total.write_bytes);
+    phases_.Fill(&usage_);
+    return usage_;
+}
+
+bool Executor::LoadPlugin(const TaskInfo& task, PluginPhase phase, Plugin** plugin) {
+    *plugin = NULL;
+    if (task.job().plugin().empty()) {
+        return true;
+    }
+    PhaseScope setup(&phases_, kPhaseSetup);
+    // Files of the job are fetched into the working directory of minion
+    const std::string path = "./" + task.job().plugin();
+    if (!plugin_ || plugin_->Path() != path) {
+        plugin_.reset(Plugin::Load(path));
+    }
+    if (!plugin_) {
+        LOG(WARNING, "fail to load plugin: %s", path.c_str());
+        return false;
+    }
+    if (plugin_->Provides(phase)) {
+        *plugin = plugin_.get();
+    }
+    return true;
+}
+
+bool Executor::PluginIsolated(const TaskInfo& task) {
+    return task.job().plugin_isolation() || FLAGS_minion_slots > 1;
+}
+
+bool Executor::OpenPluginInput(const TaskInfo& task, InputReader** reader,
+                               InputReader::Iterator** it) {
+    const JobDescriptor& job = task.job();
+    const std::string& input_file = task.input().input_file();
+    InputReader* new_reader = job.input_format() == kBinaryInput ?
+                              InputReader::CreateSeqFileReader() :
+                              InputReader::CreateHdfsTextReader();
+    FileSystem::Param param;
+    bool decompress = job.decompress_input();
+    if (boost::ends_with(input_file, ".gz")) {
+        decompress = true;
+        param["decompress_format"] = "gzip";
+    } else if (boost::ends_with(input_file, ".lzma")) {
+        decompress = true;
+        param["decompress_format"] = "lzma";
+    }
+    if (decompress) {
+        param["decompress"] = "true";
+    }
+    if (!job.input_dfs().user().empty()) {
+        param["user"] = job.input_dfs().user();
     }
+    if (!job.input_dfs().password().empty()) {
+        param["password"] = job.input_dfs().password();
+    }
+    if (!job.input_dfs().host().empty()) {
+        param["host"] = job.input_dfs().host();
+    }
+    if (!job.input_dfs().port().empty()) {
+        param["port"] = job.input_dfs().port();
+    }
+    std::string host;
+    int port = 0;
+    ParseHdfsAddress(input_file, &host, &port, NULL);
+    if (!host.empty() && host != param["host"]) {
+        param["host"] = host;
+        param["port"] = boost::lexical_cast<std::string>(port);
+    }
+    Status status = new_reader->Open(input_file, param);
+    if (status != kOk) {
+        LOG(WARNING, "fail to open input: %s", input_file.c_str());
+        delete new_reader;
+        return false;
+    }
+    int64_t offset = task.input().input_offset();
+    int64_t len = task.input().input_size();
+    if (decompress) {
+        offset = 0;
+        len = std::numeric_limits<int64_t>::max();
+    }
+    *it = new_reader->Read(offset, len);
+    *reader = new_reader;
+    return true;
+}
+
+void Executor::PrefetchInput(const TaskInfo& task) {
+    if (task.job().plugin().empty() || !task.has_input()) {
+        return;
+    }
+    InputReader* reader = NULL;
+    InputReader::Iterator* it = NULL;
+    if (!OpenPluginInput(task, &reader, &it)) {
+        return;
+    }
+    LOG(INFO, "input of task %d prefetched: %s", task.task_id(),
+        task.input().input_file().c_str());
+    MutexLock locker(&mu_);
+    prefetch_it_.reset(it);
+    prefetch_reader_.reset(reader);
+    prefetch_task_id_ = task.task_id();
+    prefetch_attempt_id_ = task.attempt_id();
+}
+
+void Executor::SetInputDoneCallback(const boost::function<void ()>& callback) {
+    input_done_callback_ = callback;
+}
+
+void Executor::InputDone() {
+    if (input_done_callback_) {
+        input_done_callback_();
+    }
+}
+
+TaskState Executor::FeedPluginInput(const TaskInfo& task, PluginRunner* runner) {
+    const JobDescriptor& job = task.job();
+    const std::string& input_file = task.input().input_file();
+    boost::scoped_ptr<InputReader> reader;
+    boost::scoped_ptr<InputReader::Iterator> it;
+    {
+        MutexLock locker(&mu_);
+        if (prefetch_reader_ && prefetch_task_id_ == task.task_id()
+                && prefetch_attempt_id_ == task.attempt_id()) {
+            it.swap(prefetch_it_);
+            reader.swap(prefetch_reader_);
+        }
+        prefetch_it_.reset();
+        prefetch_reader_.reset();
+    }
+    if (!reader) {
+        InputReader* new_reader = NULL;
+        InputReader::Iterator* new_it = NULL;
+        if (!OpenPluginInput(task, &new_reader, &new_it)) {
+            return kTaskFailed;
+        }
+        reader.reset(new_reader);
+        it.reset(new_it);
+    }
+    int32_t record_no = 0;
+    std::string s_record_no;
+    while (!it->Done()) {
+        if (ShouldStop(task.task_id())) {
+            LOG(WARNING, "task: %d is canceled.", task.task_id());
+            return kTaskCanceled;
+        }
+        const std::string& record = it->Record();
+        shuttle_slice_t key = {"", 0};
+        shuttle_slice_t value = {record.data(), record.size()};
+        FirstInput();
+        if (job.input_format() == kBinaryInput) {
+            if (!PluginRecordFormat::SplitPair(record.data(), record.size(), &key, &value)) {
+                LOG(WARNING, "bad record in %s", input_file.c_str());
+                return kTaskFailed;
+            }
+        } else if (job.input_format() == kNLineInput) {
+            s_record_no = boost::lexical_cast<std::string>(record_no);
+            key.data = s_record_no.data();
+            key.size = s_record_no.size();
+        }
+        if (!runner->Feed(key, value)) {
+            LOG(WARNING, "plugin fails on input: %s", input_file.c_str());
+            return kTaskFailed;
+        }
+        it->Next();
+        record_no++;
+    }
+    if (it->Error() != kOk && it->Error() != kNoMore) {
+        LOG(WARNING, "errors in reading: %s", input_file.c_str());
+        return kTaskFailed;
+    }
+    reader->Close();
+    LOG(INFO, "plugin takes %d records", record_no);
+    return kTaskCompleted;
 }
 
 const std::string Executor::GetShuffleWorkDir(const TaskInfo& task) {
@@ -216,6 +654,7 @@ const std::string Executor::GetReduceWorkFilename(const TaskInfo& task) {
 }
 
 bool Executor::MoveTempToOutput(const TaskInfo& task, FileSystem* fs, bool is_map) {
+    PhaseScope commit(&phases_, kPhaseCommit);
     std::string old_name;
     if (is_map) {
         old_name = GetMapWorkFilename(task);
@@ -244,7 +683,25 @@ bool Executor::MoveTempToOutput(const TaskInfo& task, FileSystem* fs, bool is_ma
     }
 }
 
+bool Executor::MoveTempToPartial(const TaskInfo& task, FileSystem* fs) {
+    PhaseScope commit(&phases_, kPhaseCommit);
+    const std::string& old_name = GetReduceWorkFilename(task);
+    char new_name[4096];
+    snprintf(new_name, sizeof(new_name), "%s/partial_%d",
+             GetShuffleWorkDir(task).c_str(), task.task_id());
+    LOG(INFO, "rename %s -> %s", old_name.c_str(), new_name);
+    if (fs->Rename(old_name, new_name)) {
+        return true;
+    }
+    if (fs->Exist(new_name)) {
+        LOG(WARNING, "an early attempt has done the task.");
+        return true;
+    }
+    return false;
+}
+
 bool Executor::MoveTempToShuffle(const TaskInfo& task) {
+    PhaseScope commit(&phases_, kPhaseCommit);
     std::string old_dir = GetMapWorkDir(task);
     char new_dir[4096];
     snprintf(new_dir, sizeof(new_dir), 
@@ -339,6 +796,7 @@ bool Executor::ReadRecord(FILE* user_app, std::string* p_key, std::string* p_val
 
 TaskState Executor::TransTextOutput(FILE* user_app, const std::string& temp_file_name,
                                     FileSystem::Param param, const TaskInfo& task) {
+    OutputScope output(&phases_, &output_wait_us_);
     FileSystem* fs = FileSystem::CreateInfHdfs();
     boost::scoped_ptr<FileSystem> fs_guard(fs);
     bool ok = fs->Open(temp_file_name, param, kWriteFile);
@@ -353,7 +811,7 @@ TaskState Executor::TransTextOutput(FILE* user_app, const std::string& temp_file
     while (!feof(user_app)) {
         if (ShouldStop(task.task_id())) {
             LOG(WARNING, "task: %d is canceled.", task.task_id());
-            pclose(user_app);
+            CloseUserApp(user_app);
             return kTaskCanceled;
         }
         if (pipe_style == kStreaming) {
@@ -376,6 +834,7 @@ TaskState Executor::TransTextOutput(FILE* user_app, const std::string& temp_file
             return kTaskFailed;
         }
     }
+    InputDone();
     ok = fs->Close();
     if (!ok) {
         LOG(WARNING, "close file fail: %s", temp_file_name.c_str());
@@ -386,6 +845,7 @@ TaskState Executor::TransTextOutput(FILE* user_app, const std::string& temp_file
 
 TaskState Executor::TransBinaryOutput(FILE* user_app, const std::string& temp_file_name,
                                       FileSystem::Param param, const TaskInfo& task) {
+    OutputScope output(&phases_, &output_wait_us_);
     InfSeqFile seqfile;
     if (!seqfile.Open(temp_file_name, param, kWriteFile)) {
         LOG(WARNING, "fail to open %s for wirte", temp_file_name.c_str());
@@ -398,7 +858,7 @@ TaskState Executor::TransBinaryOutput(FILE* user_app, const std::string& temp_fi
     while (!feof(user_app)) {
         if (ShouldStop(task.task_id())) {
             LOG(WARNING, "task: %d is canceled.", task.task_id());
-            pclose(user_app);
+            CloseUserApp(user_app);
             return kTaskCanceled;
         }
         if (pipe_style == kStreaming) {
@@ -422,6 +882,7 @@ TaskState Executor::TransBinaryOutput(FILE* user_app, const std::string& temp_fi
             return kTaskFailed;
         }
     }
+    InputDone();
 
     if (!seqfile.Close()) {
         LOG(WARNING, "fail to close %s", temp_file_name.c_str());
@@ -433,6 +894,7 @@ TaskState Executor::TransBinaryOutput(FILE* user_app, const std::string& temp_fi
 
 TaskState Executor::TransMultipleTextOutput(FILE* user_app, const std::string& temp_file_name,
                                             FileSystem::Param param, const TaskInfo& task) {
+    OutputScope output(&phases_, &output_wait_us_);
     boost::scoped_ptr<FileSystem> fs_array[26];
     PipeStyle pipe_style = task.job().pipe_style();
     std::string raw_data;
@@ -440,7 +902,7 @@ TaskState Executor::TransMultipleTextOutput(FILE* user_app, const std::string& t
     while (!feof(user_app)) {
         if (ShouldStop(task.task_id())) {
             LOG(WARNING, "task: %d is canceled.", task.task_id());
-            pclose(user_app);
+            CloseUserApp(user_app);
             return kTaskCanceled;
         }
         if (pipe_style == kStreaming) {
@@ -511,6 +973,7 @@ TaskState Executor::TransMultipleTextOutput(FILE* user_app, const std::string& t
             return kTaskFailed;
         }
     }
+    InputDone();
     for (int i = 0; i < 26; i++) {
         if (fs_array[i].get() == NULL) {
             continue;
@@ -581,6 +1044,7 @@ std::string Executor::GetErrorMsg(const TaskInfo& task, bool is_map) {
 }
 
 bool Executor::MoveMultipleTempToOutput(const TaskInfo& task, FileSystem* fs, bool is_map) {
+    PhaseScope commit(&phases_, kPhaseCommit);
     std::string old_name;
     if (is_map) {
         old_name = GetMapWorkFilename(task);
@@ -6,8 +6,12 @@
 #include <errno.h>
 #include <sstream>
 #include <vector>
+#include <map>
 #include <logging.h>
-#include "sort/sort_file.h"
+#include <boost/bind.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <gflags/gflags.h>
+#include "emitter.h"
 #include "partition.h"
 
 using baidu::common::WARNING;
@@ -16,56 +20,10 @@ using baidu::common::INFO;
 namespace baidu {
 namespace shuttle {
 
-const static size_t sMaxInMemTable = 512 << 20;
-const static size_t sMaxRecordSize = 2 << 20;
-
-struct EmitItem {
-    int reduce_no;
-    std::string key;
-    std::string record;
-    EmitItem(int l_reduce_no, const std::string& l_key, const std::string& l_record) {
-        reduce_no = l_reduce_no;
-        key = l_key;
-        record = l_record;
-    }
-    inline size_t Size() {
-        return sizeof(int) + key.capacity() + record.capacity() + sizeof(EmitItem*);
-    }
-};
-
-struct EmitItemLess {
-    bool operator()(EmitItem* const& a , EmitItem* const& b) {
-        if (a->reduce_no < b->reduce_no) {
-            return true;
-        } else if (a->reduce_no == b->reduce_no) {
-            return a->key < b->key;
-        } else {
-            return false;
-        }
-    }
-};
-
-class Emitter {
-public:
-    Emitter(const std::string& work_dir, const TaskInfo& task) : task_(task) {
-        work_dir_ = work_dir;
-        cur_byte_size_ = 0;
-        file_no_ = 0;
-    }
-    ~Emitter();
-    Status Emit(int reduce_no, const std::string& key, const std::string& record) ;
-    void Reset();
-    Status FlushMemTable();
-private:
-    std::string work_dir_;
-    size_t cur_byte_size_;
-    std::vector<EmitItem*> mem_table_;
-    int file_no_;
-    const TaskInfo& task_;
-};
+const static size_t sPartitionBatchSize = 256;
 
 MapExecutor::MapExecutor() {
-    ::setenv("mapred_task_is_map", "true", 1);
+    SetTaskEnv("mapred_task_is_map", "true");
 }
 
 MapExecutor::~MapExecutor() {
@@ -74,21 +32,39 @@ MapExecutor::~MapExecutor() {
 
 TaskState MapExecutor::Exec(const TaskInfo& task) {
     LOG(INFO, "exec map task");
-    ::setenv("mapred_work_output_dir", GetMapWorkDir(task).c_str(), 1);
+    SetTaskEnv("mapred_work_output_dir", GetMapWorkDir(task));
     std::string cmd = "sh ./app_wrapper.sh \"" + task.job().map_command() + "\"";
-    LOG(INFO, "map command is: %s", cmd.c_str());
-    FILE* user_app = popen(cmd.c_str(), "r");
-    if (user_app == NULL) {
-        LOG(WARNING, "start user app fail, cmd is %s, (%s)", 
-            cmd.c_str(), strerror(errno));
+    Plugin* plugin = NULL;
+    Plugin* combiner = NULL;
+    if (!LoadPlugin(task, kPluginMap, &plugin)
+            || !LoadPlugin(task, kPluginCombine, &combiner)) {
         return kTaskFailed;
     }
+    // The combine command runs behind the map command in app_wrapper.sh
+    if (plugin != NULL && combiner == NULL && !task.job().combine_command().empty()) {
+        LOG(INFO, "combine command is set, run map command");
+        plugin = NULL;
+    }
+    FILE* user_app = NULL;
+    if (plugin == NULL) {
+        LOG(INFO, "map command is: %s", cmd.c_str());
+        PrepareShmRings(task, ShmRing::kReader);
+        user_app = StartUserApp(cmd);
+        if (user_app == NULL) {
+            LOG(WARNING, "start user app fail, cmd is %s, (%s)", 
+                cmd.c_str(), strerror(errno));
+            return kTaskFailed;
+        }
+    }
 
     KeyFieldBasedPartitioner key_field_partition(task);
     IntHashPartitioner int_hash_partition(task);
+    RangePartitioner range_partition(task);
     Partitioner* partitioner = &key_field_partition;
     if (task.job().partition() == kIntHashPartitioner) {
         partitioner =  &int_hash_partition;
+    } else if (task.job().partition() == kRangePartitioner) {
+        partitioner = &range_partition;
     }
 
     FileSystem::Param param;
@@ -97,8 +73,19 @@ TaskState MapExecutor::Exec(const TaskInfo& task) {
     fs->Mkdirs(GetShuffleWorkDir(task));
     delete fs;
 
+    partition_sizes_.clear();
+    hot_keys_.clear();
     Emitter emitter(GetMapWorkDir(task), task);
-    if (task.job().pipe_style() == kStreaming) {
+    emitter.SetPhaseTimer(&phases_);
+    if (combiner != NULL) {
+        emitter.SetCombiner(combiner, PluginIsolated(task), GetTaskEnvs(), partitioner);
+    }
+    if (plugin != NULL) {
+        TaskState state = PluginShuffle(plugin, task, partitioner, &emitter);
+        if (state != kTaskCompleted) {
+            return state;
+        }
+    } else if (task.job().pipe_style() == kStreaming) {
         TaskState state = StreamingShuffle(user_app, task, partitioner, &emitter);
         if (state != kTaskCompleted) {
             return state;
@@ -111,130 +98,119 @@ TaskState MapExecutor::Exec(const TaskInfo& task) {
     } else {
         LOG(FATAL, "unkown output format: %d", task.job().output_format());
     }
+    InputDone();
 
     Status status = emitter.FlushMemTable();
     if (status != kOk) {
         LOG(WARNING, "flush fail, %s", Status_Name(status).c_str());
         return kTaskFailed;
     }
-    int ret = pclose(user_app);
-    if (ret != 0) {
-        LOG(WARNING, "user app fail, cmd is %s, ret: %d", cmd.c_str(), ret);
-        return kTaskFailed;
+    if (user_app != NULL) {
+        int ret = CloseUserApp(user_app);
+        if (ret != 0) {
+            LOG(WARNING, "user app fail, cmd is %s, ret: %d", cmd.c_str(), ret);
+            return kTaskFailed;
+        }
     }
     if (!MoveTempToShuffle(task)) {
         LOG(WARNING, "move map result to shuffle dir fail");
         return kTaskFailed;
     }
+    partition_sizes_ = emitter.PartitionSizes();
+    emitter.HotKeys(&hot_keys_);
     return kTaskCompleted;
 }
 
-Emitter::~Emitter() {
-    Reset();
-}
-
-void Emitter::Reset() {
-    cur_byte_size_ = 0;
-    std::vector<EmitItem*>::iterator it;
-    for (it = mem_table_.begin(); it != mem_table_.end(); it++) {
-        delete (*it);
-    }
-    std::vector<EmitItem*>().swap(mem_table_);
-}
-
-Status Emitter::Emit(int reduce_no, const std::string& key, const std::string& record) {
-    EmitItem* item = new EmitItem(reduce_no, key, record);
-    if (item->Size() > sMaxRecordSize) {
-        LOG(WARNING, "ignore too large records");
-        delete item;
-        return kOk;
-    }
-    mem_table_.push_back(item);
-    cur_byte_size_ += item->Size();
-    
-    if (cur_byte_size_ < sMaxInMemTable) {
-        return kOk; //memtable is not big enough
-    }
-
-    return FlushMemTable();
-}
-
-Status Emitter::FlushMemTable() {
-    SortFileWriter* writer = NULL;
-    Status status = kOk;
-    char file_name[4096];
-    char s_reduce_no[256];
-    do {
-        std::sort(mem_table_.begin(), mem_table_.end(), EmitItemLess());
-        writer = SortFileWriter::Create(kHdfsFile, &status);
-        if (status != kOk) {
-            break;
-        }
-        FileSystem::Param param;
-        Executor::FillParam(param, task_);
-        param["replica"] = "3";
-        snprintf(file_name, sizeof(file_name), "%s/%d.sort",
-                 work_dir_.c_str(), file_no_);
-        status = writer->Open(file_name, param);
-        if (status != kOk) {
-            break;
-        }
-        if (mem_table_.empty()) {
-            break;
-        }
-
-        std::vector<EmitItem*>::iterator it;
-        for (it = mem_table_.begin(); it != mem_table_.end(); it++) {
-            EmitItem* item = *it;
-            snprintf(s_reduce_no, sizeof(s_reduce_no), "%05d", item->reduce_no);
-            std::string raw_key = s_reduce_no;
-            raw_key += "\t";
-            raw_key += item->key;
-            status = writer->Put(raw_key, item->record);
-            if (status != kOk) {
-                break;
-            }
+static bool EmitBatch(const Partitioner* partitioner, Emitter* emitter,
+                      const std::vector<std::string>& records) {
+    std::vector<int> reduce_nos;
+    std::vector<std::string> keys;
+    partitioner->CalcBatch(records, &reduce_nos, &keys);
+    for (size_t i = 0; i < records.size(); i++) {
+        Status em_status = emitter->Emit(reduce_nos[i], keys[i], records[i]);
+        if (em_status != kOk) {
+            LOG(WARNING, "emit fail, %s, %s", records[i].c_str(),
+                Status_Name(em_status).c_str());
+            return false;
         }
-    } while(0);
-    
-    if (status == kOk) {
-        status = writer->Close();
-        file_no_ ++;
     }
-    delete writer;
-    Reset();
-    return status;
+    return true;
 }
 
-
 TaskState MapExecutor::StreamingShuffle(FILE* user_app, const TaskInfo& task,
                                         const Partitioner* partitioner, Emitter* emitter) {
+    std::vector<std::string> records;
+    records.reserve(sPartitionBatchSize);
     while (!feof(user_app)) {
         if (ShouldStop(task.task_id())) {
             LOG(WARNING, "task: %d is canceled.", task.task_id());
-            pclose(user_app);
+            CloseUserApp(user_app);
             return kTaskCanceled;
         }
         if (fgets(line_buf_, sLineBufferSize, user_app) == NULL) {
             break;
         }
-        std::string record(line_buf_);
-        std::string key;
-        int reduce_no;
+        records.push_back(line_buf_);
+        std::string& record = records.back();
         if (record.size() > 0 && record[record.size() - 1] == '\n') {
             record.erase(record.size() - 1);
         }
         if (record.empty()) {
+            records.pop_back();
             continue;
         }
-        reduce_no = partitioner->Calc(record, &key);
-        Status em_status = emitter->Emit(reduce_no, key, record);
-        if (em_status != kOk) {
-            LOG(WARNING, "emit fail, %s, %s", record.c_str(),
-                Status_Name(em_status).c_str());
-            return kTaskFailed;
+        if (records.size() >= sPartitionBatchSize) {
+            if (!EmitBatch(partitioner, emitter, records)) {
+                return kTaskFailed;
+            }
+            records.clear();
         }
     }
+    if (!EmitBatch(partitioner, emitter, records)) {
+        return kTaskFailed;
+    }
+    return kTaskCompleted;
+}
+
+static bool EmitPluginRecord(const PluginRecordFormat* format, const Partitioner* partitioner,
+                             Emitter* emitter, const shuttle_slice_t& key,
+                             const shuttle_slice_t& value) {
+    std::string record;
+    format->Compose(key, value, &record);
+    if (record.empty()) {
+        return true;
+    }
+    std::string sort_key;
+    int reduce_no = format->Streaming() ?
+                    partitioner->Calc(record, &sort_key) :
+                    partitioner->Calc(std::string(key.data, key.size), &sort_key);
+    Status em_status = emitter->Emit(reduce_no, sort_key, record);
+    if (em_status != kOk) {
+        LOG(WARNING, "emit fail, %s, %s", record.c_str(),
+            Status_Name(em_status).c_str());
+        return false;
+    }
+    return true;
+}
+
+TaskState MapExecutor::PluginShuffle(Plugin* plugin, const TaskInfo& task,
+                                     const Partitioner* partitioner, Emitter* emitter) {
+    PhaseScope compute(&phases_, kPhaseCompute);
+    PluginRecordFormat format(task.job());
+    boost::scoped_ptr<PluginRunner> runner(PluginRunner::Create(plugin, kPluginMap,
+        PluginIsolated(task), GetTaskEnvs(),
+        boost::bind(&EmitPluginRecord, &format, partitioner, emitter, _1, _2)));
+    if (!runner->Start()) {
+        return kTaskFailed;
+    }
+    TaskState state = FeedPluginInput(task, runner.get());
+    if (state != kTaskCompleted) {
+        return state;
+    }
+    if (!runner->Finish()) {
+        LOG(WARNING, "plugin fails: %s", plugin->Path().c_str());
+        return kTaskFailed;
+    }
     return kTaskCompleted;
 }
 
@@ -243,7 +219,7 @@ TaskState MapExecutor::BiStreamingShuffle(FILE* user_app, const TaskInfo& task,
     while (!feof(user_app)) {
         if (ShouldStop(task.task_id())) {
             LOG(WARNING, "task: %d is canceled.", task.task_id());
-            pclose(user_app);
+            CloseUserApp(user_app);
             return kTaskCanceled;
         }
         std::string key;
@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <errno.h>
+#include <boost/bind.hpp>
 #include <boost/scoped_ptr.hpp>
 #include "common/filesystem.h"
 
@@ -9,8 +10,8 @@ namespace baidu {
 namespace shuttle {
 
 MapOnlyExecutor::MapOnlyExecutor() {
-    ::setenv("mapred_task_is_map", "true", 1);
-    ::setenv("mapred_task_is_maponly", "true", 1);
+    SetTaskEnv("mapred_task_is_map", "true");
+    SetTaskEnv("mapred_task_is_maponly", "true");
 }
 
 MapOnlyExecutor::~MapOnlyExecutor() {
@@ -19,10 +20,28 @@ MapOnlyExecutor::~MapOnlyExecutor() {
 
 TaskState MapOnlyExecutor::Exec(const TaskInfo& task) {
     LOG(INFO, "exec map-only task");
-    ::setenv("mapred_work_output_dir", GetMapWorkDir(task).c_str(), 1);
+    SetTaskEnv("mapred_work_output_dir", GetMapWorkDir(task));
+    Plugin* plugin = NULL;
+    if (!LoadPlugin(task, kPluginMap, &plugin)) {
+        return kTaskFailed;
+    }
+    if (plugin != NULL && !PluginOutput::Supports(task)) {
+        LOG(INFO, "output format is not written by plugins, run map command");
+        plugin = NULL;
+    }
+    if (plugin != NULL) {
+        FileSystem::Param param;
+        FillParam(param, task);
+        TaskState state = PluginMap(plugin, task, GetMapWorkFilename(task), param);
+        if (state != kTaskCompleted) {
+            return state;
+        }
+        return MoveMapOnlyOutput(task, param);
+    }
     std::string cmd = "sh ./app_wrapper.sh \"" + task.job().map_command() + "\"";
     LOG(INFO, "maponly command is: %s", cmd.c_str());
-    FILE* user_app = popen(cmd.c_str(), "r");
+    PrepareShmRings(task, ShmRing::kReader);
+    FILE* user_app = StartUserApp(cmd);
     if (user_app == NULL) {
         LOG(WARNING, "start user app fail, cmd is %s, (%s)",
             cmd.c_str(), strerror(errno));
@@ -51,11 +70,46 @@ TaskState MapOnlyExecutor::Exec(const TaskInfo& task) {
     } else {
         LOG(FATAL, "unknown output format");
     }
-    int ret = pclose(user_app);
+    int ret = CloseUserApp(user_app);
     if (ret != 0) {
         LOG(WARNING, "user app fail, cmd is %s, ret: %d", cmd.c_str(), ret);
         return kTaskFailed;
     }
+    return MoveMapOnlyOutput(task, param);
+}
+
+TaskState MapOnlyExecutor::PluginMap(Plugin* plugin, const TaskInfo& task,
+                                     const std::string& temp_file_name,
+                                     FileSystem::Param& param) {
+    PhaseScope compute(&phases_, kPhaseCompute);
+    PluginOutput output(task);
+    if (!output.Open(temp_file_name, param)) {
+        LOG(WARNING, "create output file fail, %s", temp_file_name.c_str());
+        return kTaskFailed;
+    }
+    boost::scoped_ptr<PluginRunner> runner(PluginRunner::Create(plugin, kPluginMap,
+        PluginIsolated(task), GetTaskEnvs(),
+        boost::bind(&PluginOutput::Write, &output, _1, _2)));
+    if (!runner->Start()) {
+        return kTaskFailed;
+    }
+    TaskState state = FeedPluginInput(task, runner.get());
+    if (state != kTaskCompleted) {
+        return state;
+    }
+    if (!runner->Finish()) {
+        LOG(WARNING, "plugin fails: %s", plugin->Path().c_str());
+        return kTaskFailed;
+    }
+    InputDone();
+    if (!output.Close()) {
+        LOG(WARNING, "close file fail: %s", temp_file_name.c_str());
+        return kTaskFailed;
+    }
+    return kTaskCompleted;
+}
+
+TaskState MapOnlyExecutor::MoveMapOnlyOutput(const TaskInfo& task, FileSystem::Param& param) {
     FileSystem* fs = FileSystem::CreateInfHdfs(param);
     boost::scoped_ptr<FileSystem> fs_guard(fs);
     if (task.job().output_format() == kSuffixMultipleTextOutput) {
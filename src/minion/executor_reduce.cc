@@ -1,62 +1,359 @@
 #include "executor.h"
 #include <unistd.h>
 #include <errno.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
 #include <boost/scoped_ptr.hpp>
+#include <gflags/gflags.h>
 #include "common/filesystem.h"
+#include "sort/shuffle.h"
+#include "thread.h"
+
+DECLARE_bool(reduce_inprocess_shuffle);
+DECLARE_int32(partial_reduce_timeout);
 
 namespace baidu {
 namespace shuttle {
 
+// Merges map outputs in a thread of minion and writes them to the stdin
+// queue or the ring the reducer reads, instead of shuffle_tool in
+// app_wrapper.sh. on_close is called once all records are written
+class ShuffleFeeder {
+public:
+    ShuffleFeeder(BatchWriter* writer, const ShuffleOptions& options,
+                  const boost::function<bool ()>& should_stop,
+                  const boost::function<void ()>& on_close, PhaseTimer* phases)
+        : writer_(writer), shuffler_(options), should_stop_(should_stop),
+          on_close_(on_close), aborted_(false), status_(kOk),
+          counters_(FileSystem::BoundCounters()), phases_(phases) {
+        memset(&usage_, 0, sizeof(usage_));
+        boost::function<bool ()> stopped = boost::bind(&ShuffleFeeder::Stopped, this);
+        writer_->SetStopChecker(stopped);
+        shuffler_.SetStopChecker(stopped);
+        thread_.Start(boost::bind(&ShuffleFeeder::Run, this));
+    }
+    // Waits for the thread, an aborted feeder stops at the next record
+    Status Join(bool abort) {
+        {
+            MutexLock lock(&mu_);
+            aborted_ = aborted_ || abort;
+        }
+        thread_.Join();
+        MutexLock lock(&mu_);
+        return status_;
+    }
+    // Adds what the thread used to usage, once it is joined
+    void AddUsage(struct rusage* usage) {
+        MutexLock lock(&mu_);
+        timeradd(&usage->ru_utime, &usage_.ru_utime, &usage->ru_utime);
+        timeradd(&usage->ru_stime, &usage_.ru_stime, &usage->ru_stime);
+        usage->ru_inblock += usage_.ru_inblock;
+        usage->ru_oublock += usage_.ru_oublock;
+    }
+private:
+    bool Stopped() {
+        MutexLock lock(&mu_);
+        return aborted_ || should_stop_();
+    }
+    void Run() {
+        // Counted for the task which started the feeder
+        FileSystem::BindCounters(counters_);
+        PhaseScope merge(phases_, kPhaseMerge);
+        Status status = shuffler_.Run(writer_.get());
+        if (!writer_->Close() && status == kOk) {
+            status = kWriteFileFail;
+        }
+        if (!on_close_.empty()) {
+            on_close_();
+        }
+        LOG(INFO, "shuffle feeder quits: %s", Status_Name(status).c_str());
+        // The thread is new to the feeder, so all it used counts for the task
+        struct rusage usage;
+        getrusage(RUSAGE_THREAD, &usage);
+        MutexLock lock(&mu_);
+        status_ = status;
+        usage_ = usage;
+    }
+private:
+    boost::scoped_ptr<BatchWriter> writer_;
+    Shuffler shuffler_;
+    boost::function<bool ()> should_stop_;
+    boost::function<void ()> on_close_;
+    Mutex mu_;
+    bool aborted_;
+    Status status_;
+    DfsCounters* counters_;
+    PhaseTimer* phases_;
+    struct rusage usage_;
+    common::Thread thread_;
+};
+
+// Cuts batches of the shuffle into records and feeds them to a plugin
+class PluginFeeder {
+public:
+    PluginFeeder(const TaskInfo& task, PluginRunner* runner)
+        : format_(task.job()), runner_(runner) {
+    }
+    bool Consume(const char* data, size_t size) {
+        if (!pending_.empty()) {
+            pending_.append(data, size);
+            size_t used = 0;
+            if (!FeedRecords(pending_.data(), pending_.size(), &used)) {
+                return false;
+            }
+            pending_.erase(0, used);
+            return true;
+        }
+        size_t used = 0;
+        if (!FeedRecords(data, size, &used)) {
+            return false;
+        }
+        pending_.assign(data + used, size - used);
+        return true;
+    }
+    // Tells whether the shuffle has ended with a whole record
+    bool Done() const {
+        return pending_.empty();
+    }
+private:
+    bool FeedRecords(const char* data, size_t size, size_t* used) {
+        size_t len = 0;
+        while ((len = format_.NextLength(data + *used, size - *used)) > 0) {
+            const char* record = data + *used;
+            // Lines are handed over without newlines
+            size_t record_size = format_.Streaming() ? len - 1 : len;
+            shuttle_slice_t key;
+            shuttle_slice_t value;
+            if (!format_.Split(record, record_size, &key, &value)) {
+                LOG(WARNING, "bad record from shuffle");
+                return false;
+            }
+            if (!runner_->Feed(key, value)) {
+                return false;
+            }
+            *used += len;
+        }
+        return true;
+    }
+private:
+    PluginRecordFormat format_;
+    PluginRunner* runner_;
+    // Head of a record cut by the end of a batch
+    std::string pending_;
+};
+
+static void FillShuffleOptions(const TaskInfo& task, ShuffleOptions* options) {
+    const JobDescriptor& job = task.job();
+    options->total = job.map_total();
+    options->reduce_no = task.task_id();
+    options->attempt_id = task.attempt_id();
+    options->dfs_host = job.output_dfs().host();
+    options->dfs_port = job.output_dfs().port();
+    options->dfs_user = job.output_dfs().user();
+    options->dfs_password = job.output_dfs().password();
+    options->streaming = job.pipe_style() == kStreaming;
+    if (task.has_reduce_range()) {
+        const ReduceRange& range = task.reduce_range();
+        options->partition_begin = range.partition_begin();
+        options->partition_end = range.partition_end();
+        options->key_begin = range.key_begin();
+        options->key_end = range.key_end();
+        options->split_no = range.split_no();
+        options->split_total = range.split_total();
+        options->partial_begin = range.partial_begin();
+        options->partial_end = range.partial_end();
+    }
+    options->partial_timeout = FLAGS_partial_reduce_timeout;
+    options->hash_aggregation = job.hash_aggregation();
+    options->key_fields = std::max(job.key_fields_num(), 1);
+    options->separator = job.key_separator().empty() ? "\t" : job.key_separator();
+    options->spill_prefix = "./hash_spill_"
+        + boost::lexical_cast<std::string>(task.task_id()) + "_"
+        + boost::lexical_cast<std::string>(task.attempt_id()) + "_";
+}
+
 ReduceExecutor::ReduceExecutor() {
-    ::setenv("mapred_task_is_map", "false", 1);
+    SetTaskEnv("mapred_task_is_map", "false");
 }
 
 ReduceExecutor::~ReduceExecutor() {
 
 }
 
+bool ReduceExecutor::FeederShouldStop(int32_t task_id) {
+    return ShouldStop(task_id) || UserAppExited();
+}
+
 TaskState ReduceExecutor::Exec(const TaskInfo& task) {
     LOG(INFO, "exec reduce task");
-    ::setenv("mapred_work_output_dir", GetReduceWorkDir(task).c_str(), 1);
+    SetTaskEnv("mapred_work_output_dir", GetReduceWorkDir(task));
+    Plugin* plugin = NULL;
+    if (!LoadPlugin(task, kPluginReduce, &plugin)) {
+        return kTaskFailed;
+    }
+    if (plugin != NULL && !PluginOutput::Supports(task)) {
+        LOG(INFO, "output format is not written by plugins, run reduce command");
+        plugin = NULL;
+    }
+    if (plugin != NULL) {
+        FileSystem::Param param;
+        FillParam(param, task);
+        TaskState state = PluginReduce(plugin, task, GetReduceWorkFilename(task), param);
+        if (state != kTaskCompleted) {
+            return state;
+        }
+        return MoveReduceOutput(task, param);
+    }
     std::string cmd = "sh ./app_wrapper.sh \"" + task.job().reduce_command() + "\"";
+    // The reducer reads the input ring instead of stdin, which is then
+    // written by minion or by shuffle_tool
+    const bool shm_input = PrepareShmRings(task, FLAGS_reduce_inprocess_shuffle ?
+                                           ShmRing::kWriter : ShmRing::kReader);
+    const bool inprocess = FLAGS_reduce_inprocess_shuffle;
+    const bool use_pipe = inprocess && !shm_input;
+    if (inprocess) {
+        SetTaskEnv("minion_shuffle_inprocess", "true");
+    } else {
+        UnsetTaskEnv("minion_shuffle_inprocess");
+    }
+    // shuffle_tool keeps the rate of the start
+    int64_t read_limit = shuffle_read_limiter_ != NULL ? shuffle_read_limiter_->Rate() : 0;
+    SetTaskEnv("minion_shuffle_read_bps", boost::lexical_cast<std::string>(read_limit));
     LOG(INFO, "reduce command is: %s", cmd.c_str());
-    FILE* user_app = popen(cmd.c_str(), "r");
+    FILE* user_app = StartUserApp(cmd, use_pipe);
     if (user_app == NULL) {
         LOG(WARNING, "start user app fail, cmd is %s, (%s)", 
             cmd.c_str(), strerror(errno));
         return kTaskFailed;
     }
+    // Batches of the feeder are queued for stdin of the app, and written by
+    // the event loop driven by reads of the output below
+    boost::scoped_ptr<ShuffleFeeder> feeder;
+    if (inprocess) {
+        ShuffleOptions options;
+        FillShuffleOptions(task, &options);
+        options.read_limiter = shuffle_read_limiter_;
+        options.work_dir = GetShuffleWorkDir(task);
+        BatchWriter* writer = NULL;
+        boost::function<bool ()> should_stop =
+            boost::bind(&ReduceExecutor::ShouldStop, this, task.task_id());
+        boost::function<void ()> on_close;
+        if (use_pipe) {
+            writer = new BatchWriter(boost::bind(&AppPipeline::PushInput,
+                                                 GetUserApp(), _1, _2));
+            on_close = boost::bind(&AppPipeline::CloseInput, GetUserApp());
+        } else {
+            // Nothing like EPIPE tells a reducer which never read the ring
+            writer = new BatchWriter(GetInputRing());
+            should_stop = boost::bind(&ReduceExecutor::FeederShouldStop, this,
+                                      task.task_id());
+        }
+        feeder.reset(new ShuffleFeeder(writer, options, should_stop, on_close, &phases_));
+    }
 
     FileSystem::Param param;
     FillParam(param, task);
     const std::string temp_file_name = GetReduceWorkFilename(task);
 
+    TaskState state = kTaskCompleted;
     if (task.job().output_format() == kTextOutput) {
-        TaskState status = TransTextOutput(user_app, temp_file_name, param, task);
-        if (status != kTaskCompleted) {
-            return status;
-        }
+        state = TransTextOutput(user_app, temp_file_name, param, task);
     } else if (task.job().output_format() == kBinaryOutput) {
-        TaskState status = TransBinaryOutput(user_app, temp_file_name, param, task);
-        if (status != kTaskCompleted) {
-            return status;
-        }
+        state = TransBinaryOutput(user_app, temp_file_name, param, task);
     } else if (task.job().output_format() == kSuffixMultipleTextOutput) {
-        TaskState status = TransMultipleTextOutput(user_app, temp_file_name, param, task);
-        if (status != kTaskCompleted) {
-            return status;
-        }
+        state = TransMultipleTextOutput(user_app, temp_file_name, param, task);
     } else {
         LOG(FATAL, "unknown output format");
     }
-    int ret = pclose(user_app);
+    if (feeder) {
+        // The reducer may have closed its output before all input is taken
+        if (use_pipe && state == kTaskCompleted) {
+            GetUserApp()->DrainInput(boost::bind(&ReduceExecutor::ShouldStop,
+                                                 this, task.task_id()));
+        } else if (use_pipe) {
+            GetUserApp()->AbortInput();
+        }
+        Status shuffle_status = feeder->Join(state != kTaskCompleted);
+        feeder->AddUsage(&thread_usage_);
+        if (state == kTaskCompleted && shuffle_status != kOk) {
+            LOG(WARNING, "in-process shuffle fail: %s", Status_Name(shuffle_status).c_str());
+            CloseUserApp(user_app);
+            return kTaskFailed;
+        }
+    }
+    if (state != kTaskCompleted) {
+        return state;
+    }
+    int ret = CloseUserApp(user_app);
     if (ret != 0) {
         LOG(WARNING, "user app fail, cmd is %s, ret: %d", cmd.c_str(), ret);
         return kTaskFailed;
     }
+    return MoveReduceOutput(task, param);
+}
+
+TaskState ReduceExecutor::PluginReduce(Plugin* plugin, const TaskInfo& task,
+                                       const std::string& temp_file_name,
+                                       FileSystem::Param& param) {
+    PhaseScope compute(&phases_, kPhaseCompute);
+    PluginOutput output(task);
+    if (!output.Open(temp_file_name, param)) {
+        LOG(WARNING, "create output file fail, %s", temp_file_name.c_str());
+        return kTaskFailed;
+    }
+    boost::scoped_ptr<PluginRunner> runner(PluginRunner::Create(plugin, kPluginReduce,
+        PluginIsolated(task), GetTaskEnvs(),
+        boost::bind(&PluginOutput::Write, &output, _1, _2)));
+    if (!runner->Start()) {
+        return kTaskFailed;
+    }
+    ShuffleOptions options;
+    FillShuffleOptions(task, &options);
+    options.read_limiter = shuffle_read_limiter_;
+    options.work_dir = GetShuffleWorkDir(task);
+    Shuffler shuffler(options);
+    shuffler.SetStopChecker(boost::bind(&ReduceExecutor::ShouldStop, this, task.task_id()));
+    PluginFeeder feeder(task, runner.get());
+    BatchWriter writer(boost::bind(&PluginFeeder::Consume, &feeder, _1, _2));
+    Status status = kOk;
+    {
+        PhaseScope merge(&phases_, kPhaseMerge);
+        status = shuffler.Run(&writer);
+    }
+    if (status == kOk && (!writer.Close() || !feeder.Done())) {
+        status = kWriteFileFail;
+    }
+    if (ShouldStop(task.task_id())) {
+        LOG(WARNING, "task: %d is canceled.", task.task_id());
+        return kTaskCanceled;
+    }
+    if (status != kOk) {
+        LOG(WARNING, "plugin reduce fail: %s", Status_Name(status).c_str());
+        return kTaskFailed;
+    }
+    if (!runner->Finish()) {
+        LOG(WARNING, "plugin fails: %s", plugin->Path().c_str());
+        return kTaskFailed;
+    }
+    InputDone();
+    if (!output.Close()) {
+        LOG(WARNING, "close file fail: %s", temp_file_name.c_str());
+        return kTaskFailed;
+    }
+    return kTaskCompleted;
+}
+
+TaskState ReduceExecutor::MoveReduceOutput(const TaskInfo& task, FileSystem::Param& param) {
     FileSystem* fs = FileSystem::CreateInfHdfs(param);
     boost::scoped_ptr<FileSystem> fs_guard(fs);
-    if (task.job().output_format() == kSuffixMultipleTextOutput) {
+    if (task.reduce_range().split_total() > 0) {
+        if (!MoveTempToPartial(task, fs)) {
+            LOG(WARNING, "fail to move partial output");
+            return kTaskMoveOutputFailed;
+        }
+    } else if (task.job().output_format() == kSuffixMultipleTextOutput) {
         if (!MoveMultipleTempToOutput(task, fs, false)) {
             LOG(WARNING, "fail to move multiple output");
             return kTaskMoveOutputFailed;
@@ -78,11 +78,116 @@ ExtractMinionTar() {
     return $ret
 }
 
+# Packages are kept per host under PACKAGE_CACHE, so minions of all jobs
+# on the host fetch and unpack each of them once:
+#   objects/<key>        the unpacked package, published by one rename
+#   objects/<key>.refs/  a link to the work dir of each minion using it
+#   objects/<key>.used   touched on each use, the oldest go first
+#   locks/<key>.lock     held while the package is fetched or evicted
+# Minions hard link the files, so they are made read-only before the
+# package is published, and cache archives, which are linked as a whole,
+# get read-only directories as well
+PACKAGE_CACHE=$CACHE_BASE/packages
+PACKAGE_CACHE_MB=${PACKAGE_CACHE_MB:-20480}
+
+HadoopFs() {
+    if [ "${hadoop_job_ugi}" == "" ]; then
+        ${HADOOP_CLIENT_HOME}/hadoop/bin/hadoop fs "$@"
+    else
+        ${HADOOP_CLIENT_HOME}/hadoop/bin/hadoop fs -Dhadoop.job.ugi=${hadoop_job_ugi} -Dfs.default.name=${fs_default_name} "$@"
+    fi
+}
+
+# CachePackage key fetch_cmd...: runs fetch_cmd with a temporary directory
+# appended, unless the package is in the cache, and takes a reference of
+# this minion to it. Other minions wait for the one fetching the key
+CachePackage() {
+    key=$1
+    shift
+    mkdir -p $PACKAGE_CACHE/objects $PACKAGE_CACHE/locks
+    (
+        flock -x 9
+        object=$PACKAGE_CACHE/objects/$key
+        if [ ! -d $object ]; then
+            tmp_dir=$PACKAGE_CACHE/tmp.$key.$$
+            rm -rf $tmp_dir && mkdir -p $tmp_dir
+            "$@" $tmp_dir
+            if [ $? -ne 0 ]; then
+                rm -rf $tmp_dir
+                exit 1
+            fi
+            find $tmp_dir -type f -exec chmod a-w {} +
+            mv -T $tmp_dir $object || exit 2
+        fi
+        mkdir -p $object.refs
+        ln -sfn $dir_name $object.refs/`echo $dir_name | md5sum | awk '{print $1}'`
+        touch $object.used
+    ) 9> $PACKAGE_CACHE/locks/$key.lock
+}
+
+# Removes the least recently used packages no live minion refers to,
+# until the cache fits in PACKAGE_CACHE_MB
+EvictPackages() {
+    mkdir -p $PACKAGE_CACHE/objects $PACKAGE_CACHE/locks
+    (
+        flock -n 9 || exit 0
+        cd $PACKAGE_CACHE/objects || exit 0
+        for stale in `find $PACKAGE_CACHE -maxdepth 1 -name 'tmp.*' -mmin +1440`
+        do
+            chmod -R u+w $stale && rm -rf $stale
+        done
+        used_mb=`du -sm . | awk '{print $1}'`
+        for stamp in `ls -tr | grep '\.used$'`
+        do
+            if [ $used_mb -le $PACKAGE_CACHE_MB ]; then
+                break
+            fi
+            key=${stamp%.used}
+            # Work dirs of finished minions are gone, their links dangle
+            find -L $key.refs -type l -delete 2>/dev/null
+            if [ "`ls -A $key.refs 2>/dev/null`" != "" ]; then
+                continue
+            fi
+            (
+                flock -n 8 || exit 0
+                # A minion may have taken a reference before the lock
+                find -L $key.refs -type l -delete 2>/dev/null
+                if [ "`ls -A $key.refs 2>/dev/null`" != "" ]; then
+                    exit 0
+                fi
+                rm -rf $key.refs $key.used
+                evicted=$PACKAGE_CACHE/tmp.evict.$key.$$
+                mv -T $key $evicted && chmod -R u+w $evicted && rm -rf $evicted
+            ) 8> $PACKAGE_CACHE/locks/$key.lock
+            used_mb=`du -sm . | awk '{print $1}'`
+        done
+    ) 9> $PACKAGE_CACHE/locks/evict.lock
+}
+
+FetchCacheArchive() {
+    mkdir -p $1/$cache_archive_dir
+    HadoopFs -get $cache_archive_addr $1/$cache_archive_dir
+    if [ $? -ne 0 ]; then
+        return 1
+    fi
+    (cd $1/$cache_archive_dir && (tar -xzf *.tar.gz || tar -xf *.tar)) \
+        && chmod -R a-w $1/$cache_archive_dir
+}
+
+FetchUserPackage() {
+    ./NfsShell get /disk/shuttle/${app_package} $1/${local_package}
+    if [ $? -ne 0 ]; then
+        return 1
+    fi
+    (cd $1 && tar -xzf ${local_package} && rm -f ${local_package})
+}
+
 DownloadUserTar() {
     if [ "$app_package" == "" ]; then
         echo "need app_pacakge"
         return 1
     fi
+    EvictPackages
     for ((i=0;i<5;i++))
     do
         cache_archive=$( eval echo \$cache_archive_${i} )
@@ -92,69 +197,81 @@ DownloadUserTar() {
             if [ "$cache_archive_dir" == "" ]; then
                 return 2
             fi
-            if [ "${hadoop_job_ugi}" == "" ]; then
-                cache_key=`${HADOOP_CLIENT_HOME}/hadoop/bin/hadoop fs -ls $cache_archive_addr | tail -1 | md5sum | awk '{print \$1}'`
-            else
-                cache_key=`${HADOOP_CLIENT_HOME}/hadoop/bin/hadoop fs -Dhadoop.job.ugi=${hadoop_job_ugi} -Dfs.default.name=${fs_default_name} -ls $cache_archive_addr | tail -1 | md5sum | awk '{print \$1}'`
+            # Path, size and modification time of the archive
+            cache_stat=`HadoopFs -ls $cache_archive_addr | tail -1`
+            if [ $? -ne 0 ]; then
+                return 3
             fi
-            if [ ! -d $CACHE_BASE/$cache_key ]; then
-                tmp_dump_dir="$CACHE_BASE/${cache_key}_`date +%s`_$$"
-                mkdir -p $tmp_dump_dir/$cache_archive_dir
-                if [ "${hadoop_job_ugi}" == "" ]; then
-                    ${HADOOP_CLIENT_HOME}/hadoop/bin/hadoop fs -get $cache_archive_addr $tmp_dump_dir/$cache_archive_dir
-                else
-                    ${HADOOP_CLIENT_HOME}/hadoop/bin/hadoop fs -Dhadoop.job.ugi=${hadoop_job_ugi} -Dfs.default.name=${fs_default_name} -get $cache_archive_addr $tmp_dump_dir/$cache_archive_dir
-                fi
-                if [ $? -ne 0 ]; then
-                    return 3
-                fi
-                (cd $tmp_dump_dir/$cache_archive_dir && (tar -xzf *.tar.gz || tar -xf *.tar))
-                if [ $? -eq 0 ]; then
-                    mv $tmp_dump_dir "$CACHE_BASE/${cache_key}"
-                else
-                    echo "extract failed"
-                    return 4
-                fi
+            cache_key=archive_`echo "$cache_stat#$cache_archive_dir" | md5sum | awk '{print \$1}'`
+            CachePackage $cache_key FetchCacheArchive
+            if [ $? -ne 0 ]; then
+                echo "fetch cache archive failed"
+                return 4
             fi
-            
-            if [ ! -d $CACHE_BASE/$cache_key/$cache_archive_dir ]; then
-                tmp_dump_dir="$CACHE_BASE/${cache_key}_`date +%s`_$$"
-                mkdir -p $tmp_dump_dir/$cache_archive_dir
-                if [ "${hadoop_job_ugi}" == "" ]; then
-                    ${HADOOP_CLIENT_HOME}/hadoop/bin/hadoop fs -get $cache_archive_addr $tmp_dump_dir/$cache_archive_dir
-                else
-                    ${HADOOP_CLIENT_HOME}/hadoop/bin/hadoop fs -Dhadoop.job.ugi=${hadoop_job_ugi} -Dfs.default.name=${fs_default_name} -get $cache_archive_addr $tmp_dump_dir/$cache_archive_dir
-                fi
-                if [ $? -ne 0 ]; then
-                    return 3
-                fi
-                (cd $tmp_dump_dir/$cache_archive_dir && (tar -xzf *.tar.gz || tar -xf *.tar))
-                if [ $? -eq 0 ]; then
-                    mv $tmp_dump_dir/$cache_archive_dir "$CACHE_BASE/${cache_key}"
-                else
-                    echo "extract failed"
-                    return 5
-                fi
-            fi 
-
-            for sub_dir in $( ls "${CACHE_BASE}/${cache_key}/" )
-            do
-                ln -s "${CACHE_BASE}/${cache_key}/$sub_dir" .
-            done
+            ln -sfn "$PACKAGE_CACHE/objects/$cache_key/$cache_archive_dir" .
+            echo $cache_archive_dir >> job.list
         else
             break
         fi
     done
     local_package=`echo $app_package | awk -F"/" '{print $NF}'`
-    ./NfsShell get /disk/shuttle/${app_package} ${local_package}
-    return $?   
+    # The client names packages by the hash of their contents, so jobs
+    # with the same files share one copy. Other names are uploaded once
+    package_hash=`echo $local_package | sed -n 's/.*\.\([0-9a-f]\{32\}\)\.tar\.gz$/\1/p'`
+    if [ "$package_hash" != "" ]; then
+        package_key=package_$package_hash
+    else
+        package_key=path_`echo $app_package | md5sum | awk '{print $1}'`
+    fi
+    CachePackage $package_key FetchUserPackage
+    return $?
 }
 
 ExtractUserTar() {
-    tar -xzf ${local_package}
+    ls -A $PACKAGE_CACHE/objects/$package_key >> job.list
+    # Hard links are only made within a file system, and read-only files
+    # do not stop root from changing the cache through them
+    if [ `id -u` -ne 0 ]; then
+        cp -alf $PACKAGE_CACHE/objects/$package_key/. . 2>/dev/null && return 0
+    fi
+    cp -af $PACKAGE_CACHE/objects/$package_key/. .
     return $?
 }
 
+FetchUserTar() {
+    for (( dn=0;dn<3;dn++ ))
+    do
+        DownloadUserTar
+        if [ $? -eq 0 ]; then
+            return 0
+        fi
+        hadoop_job_ugi=""
+    done
+    return 1
+}
+
+# Pooled minions start without a job, and the package of each job they are
+# lent to takes the place of the former one: files in job.list are
+# removed, but those in base.list the minion came with
+UnbindJob() {
+    if [ -f job.list ]; then
+        grep -vxF -f base.list job.list | while read f_name; do rm -rf "./$f_name"; done
+        rm -f job.list
+    fi
+    rm -f $PACKAGE_CACHE/objects/*.refs/`echo $dir_name | md5sum | awk '{print $1}'`
+}
+
+BindJob() {
+    UnbindJob
+    FetchUserTar
+    if [ $? -ne 0 ]; then
+        echo "download user pack fail"
+        return 1
+    fi
+    ExtractUserTar || return 2
+    ls . | grep -v '^log$' > common.list
+}
+
 StartMinon() {
     source hdfs_env.sh > /dev/null 2>&1
     ls . | grep -v '^log$' > common.list
@@ -175,6 +292,12 @@ CheckStatus() {
     fi
 }
 
+# Called by pooled minions each time master binds them to a job
+if [ "$1" == "-bind_job" ]; then
+    BindJob
+    exit $?
+fi
+
 DownloadHadoop
 CheckStatus $? "download hadoop fail"
 
@@ -184,26 +307,19 @@ CheckStatus $? "download minion package from DFS fail"
 ExtractMinionTar
 CheckStatus $? "extract minion package fail"
 
-let user_pack_ret=1
-
-for (( dn=0;dn<3;dn++ ))
-do
-    DownloadUserTar
-    if [ $? -eq 0 ]; then
-        let user_pack_ret=0
-        break
+if echo " $CmdArgs " | grep -q -- " -pooled "; then
+    (ls -A .; echo job.list; echo common.list) > base.list
+else
+    FetchUserTar
+    if [ $? -ne 0 ]; then
+        echo "download user pack fail"
+        exit 0
     fi
-    hadoop_job_ugi=""
-done
 
-if [ $user_pack_ret -ne 0 ]; then
-    echo "download user pack fail"
-    exit 0
+    ExtractUserTar
+    CheckStatus $? "extract user package fail"
 fi
 
-ExtractUserTar
-CheckStatus $? "extract user package fail"
-
 StartMinon
 CheckStatus $? "minion exit without success"
 
@@ -10,3 +10,17 @@ DEFINE_int32(suspend_time, 60, "suspend time in seconds when receive suspend op"
 DEFINE_int32(max_minions, 25, "max number of minions at one machine");
 DEFINE_int64(flow_limit_10gb, 800L * 1024 * 1024, "the limit of network traffic for 10gb machine, default is 384M");
 DEFINE_int64(flow_limit_1gb, 84L * 1024 * 1024, "the limit of network traffic for 1gb machine, default is 64M");
+DEFINE_int32(hot_key_sketch_size, 16, "heaviest keys tracked in each partition of map output");
+DEFINE_int32(hot_key_report_limit, 1000, "max hot keys a map reports to master");
+DEFINE_int32(partial_reduce_timeout, 3600, "seconds a final reduce waits for each partial reduce "
+             "of a hot key before failing, 0 for ever");
+DEFINE_bool(reduce_inprocess_shuffle, true, "merge map outputs in minion and feed reducers directly, "
+            "instead of running shuffle_tool");
+DEFINE_int64(shm_ring_size, 8L << 20, "bytes of each shared-memory ring between minion and user programs");
+DEFINE_int32(minion_slots, 1, "tasks a minion runs at the same time, each in a slot with its own executor");
+DEFINE_bool(task_prefetch, true, "reserve the next task of a slot once the input of its current task is exhausted");
+DEFINE_bool(cgroup_throttle, true, "throttle user apps of each slot through cgroup v2 under pressure, "
+            "instead of stopping the tools of every job on the host");
+DEFINE_int64(task_io_read_limit, 0, "bytes per second a task reads from the local disk, 0 for no limit");
+DEFINE_int64(task_io_write_limit, 0, "bytes per second a task writes to the local disk, 0 for no limit");
+DEFINE_bool(pooled, false, "start without a job, and work for the jobs master lends this minion to");
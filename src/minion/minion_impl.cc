@@ -2,12 +2,16 @@
 
 #include <time.h>
 #include <unistd.h>
+#include <sys/resource.h>
+#include <algorithm>
 #include <boost/bind.hpp>
 #include <boost/function.hpp>
 #include <boost/scoped_ptr.hpp>
+#include <boost/lexical_cast.hpp>
 #include <cstdlib>
 #include <gflags/gflags.h>
 #include "logging.h"
+#include "timer.h"
 #include "proto/app_master.pb.h"
 
 DECLARE_string(master_nexus_path);
@@ -18,6 +22,12 @@ DECLARE_bool(kill_task);
 DECLARE_int32(suspend_time);
 DECLARE_int64(flow_limit_10gb);
 DECLARE_int64(flow_limit_1gb);
+DECLARE_int32(minion_slots);
+DECLARE_bool(task_prefetch);
+DECLARE_bool(cgroup_throttle);
+DECLARE_int64(task_io_read_limit);
+DECLARE_int64(task_io_write_limit);
+DECLARE_bool(pooled);
 
 using baidu::common::Log;
 using baidu::common::FATAL;
@@ -28,48 +38,129 @@ namespace baidu {
 namespace shuttle {
 
 const std::string sBreakpointFile = "./task_running";
+const static int64_t sCpuPeriodUs = 100000;
+const static int64_t sMinCpuQuotaUs = 1000;
+const static int32_t sMinCpuShare = 10;
+const static int32_t sCpuShareStep = 10;
+const static int64_t sShuffleBurst = 8L << 20;
+// Throttling is changed at most once in it, load average moves slowly
+const static time_t sThrottleIntervalSec = 10;
+const static int32_t sBindIntervalMs = 1000;
 
-MinionImpl::MinionImpl() : ins_(FLAGS_nexus_addr),
+static Histogram* s_assign_latency = Metrics::GetHistogram("shuttle_minion_assign_latency_us",
+        "Time of the AssignTask rpcs minion sends to master");
+static Histogram* s_task_latency = Metrics::GetHistogram("shuttle_minion_task_latency_ms",
+        "Time minion takes to run a task attempt");
+static Counter* s_shuffle_bytes = Metrics::GetCounter("shuttle_minion_shuffle_bytes_total",
+        "Bytes of map outputs reduces have read");
+
+static std::string BreakpointFile(int32_t slot) {
+    // The first slot keeps the file of single-slot minions
+    if (slot == 0) {
+        return sBreakpointFile;
+    }
+    return sBreakpointFile + "." + boost::lexical_cast<std::string>(slot);
+}
+
+static int64_t TimevalToMs(const struct timeval& tv) {
+    return tv.tv_sec * 1000L + tv.tv_usec / 1000;
+}
+
+MinionImpl::MinionImpl() : pool_(std::max(FLAGS_minion_slots, 1)),
+                           nexus_(Nexus::Create(FLAGS_nexus_addr)),
                            stop_(false),
+                           reserve_cond_(&mu_),
+                           jobid_(FLAGS_jobid),
+                           running_slots_(0),
+                           prefetch_pool_(std::max(FLAGS_minion_slots, 1)),
                            task_frozen_(false),
                            over_loaded_(false),
-                           frozen_time_(0) {
+                           frozen_time_(0),
+                           use_cgroup_(false),
+                           cpu_share_(100),
+                           job_millicores_(0),
+                           shuffle_rate_(0),
+                           last_throttle_time_(0),
+                           metrics_collector_(-1) {
     if (FLAGS_work_mode == "map") {
-        executor_ = Executor::GetExecutor(kMap);
         work_mode_ =  kMap;
     } else if (FLAGS_work_mode == "reduce") {
-        executor_ = Executor::GetExecutor(kReduce);
         work_mode_ = kReduce;
     } else if (FLAGS_work_mode == "map-only") {
-        executor_ = Executor::GetExecutor(kMapOnly);
         work_mode_ = kMapOnly;
     } else {
         LOG(FATAL, "unkown work mode: %s", FLAGS_work_mode.c_str());
         abort();
     }
+    std::string cgroup_parent;
+    if (FLAGS_cgroup_throttle) {
+        cgroup_parent = Cgroup::Delegate();
+    }
+    for (int32_t i = 0; i < std::max(FLAGS_minion_slots, 1); i++) {
+        TaskSlot* slot = new TaskSlot();
+        slot->no = i;
+        slot->task_id = -1;
+        slot->attempt_id = -1;
+        slot->task_state = kTaskUnknown;
+        slot->reserving = false;
+        slot->reserved = false;
+        slot->reserve_canceled = false;
+        slot->cgroup = NULL;
+        if (!cgroup_parent.empty()) {
+            Cgroup* cgroup = new Cgroup(cgroup_parent,
+                                        "slot_" + boost::lexical_cast<std::string>(i));
+            if (cgroup->Create()) {
+                slot->cgroup = cgroup;
+                use_cgroup_ = true;
+            } else {
+                delete cgroup;
+            }
+        }
+        slot->shuffle_limiter = new TokenBucket(0, sShuffleBurst);
+        slot->executor = NewExecutor(slot);
+        slots_.push_back(slot);
+    }
     if (FLAGS_kill_task) {
        galaxy::ins::sdk::SDKError err;
-       ins_.Get(FLAGS_master_nexus_path, &master_endpoint_, &err);
+       nexus_->Get(FLAGS_master_nexus_path, &master_endpoint_, &err);
        if (err == galaxy::ins::sdk::kOK) {
            Master_Stub* stub;
            rpc_client_.GetStub(master_endpoint_, &stub);
            if (stub != NULL) {
                boost::scoped_ptr<Master_Stub> stub_guard(stub);
-               CheckUnfinishedTask(stub);
+               for (size_t i = 0; i < slots_.size(); i++) {
+                   CheckUnfinishedTask(stub, i);
+               }
                _exit(0);
            }
        } else {
            LOG(WARNING, "fail to connect nexus");
        }
     }
-    cur_task_id_ = -1;
-    cur_attempt_id_ = -1;
-    cur_task_state_ = kTaskUnknown;
+    metrics_collector_ = Metrics::AddCollector(
+            boost::bind(&MinionImpl::CollectMetrics, this, _1));
     watch_dog_.AddTask(boost::bind(&MinionImpl::WatchDogTask, this));
 }
 
 MinionImpl::~MinionImpl() {
-    delete executor_;
+    Metrics::RemoveCollector(metrics_collector_);
+    for (size_t i = 0; i < slots_.size(); i++) {
+        delete slots_[i]->executor;
+        delete slots_[i]->shuffle_limiter;
+        delete slots_[i]->cgroup;
+        delete slots_[i];
+    }
+}
+
+Executor* MinionImpl::NewExecutor(TaskSlot* slot) {
+    Executor* executor = Executor::GetExecutor(work_mode_);
+    executor->SetInputDoneCallback(
+        boost::bind(&MinionImpl::ReserveNextTask, this, slot));
+    if (slot->cgroup != NULL) {
+        executor->SetCgroup(slot->cgroup->Path());
+    }
+    executor->SetShuffleReadLimiter(slot->shuffle_limiter);
+    return executor;
 }
 
 void MinionImpl::WatchDogTask() {
@@ -86,36 +177,125 @@ void MinionImpl::WatchDogTask() {
     if (!netstat_.Is10gb()) {
        network_limit =  FLAGS_flow_limit_1gb;
     }
-    if (minute_load > 1.5 * numCPU) {
+    const bool overloaded = minute_load > 1.5 * numCPU;
+    const bool healthy = minute_load < 0.8 * numCPU;
+    const bool network_busy = netstat_.GetSendSpeed() > network_limit ||
+                              netstat_.GetRecvSpeed() > network_limit;
+    if (overloaded) {
         LOG(WARNING, "load average: %f, cores: %d", minute_load, numCPU);
-        LOG(WARNING, "machine may be overloaded, so froze the task");
-        if (!task_frozen_) {
-            frozen_time_ = ::time(NULL);
-        }
-        task_frozen_ = true;
-        over_loaded_ =  true;
-        system("killall -SIGSTOP input_tool shuffle_tool tuo_merger 2>/dev/null");
-    } else if (netstat_.GetSendSpeed() > network_limit ||
-               netstat_.GetRecvSpeed() > network_limit) {
+    }
+    if (network_busy) {
         LOG(WARNING, "traffic tx:%lld, rx:%lld",
             netstat_.GetSendSpeed(), netstat_.GetRecvSpeed());
-        LOG(WARNING, "network traffic is busy, so froze the task");
-        system("killall -SIGSTOP input_tool shuffle_tool tuo_merger 2>/dev/null");
-        if (!task_frozen_) {
-            frozen_time_ = ::time(NULL);
-        }
-        task_frozen_ = true;
-    } else {
-        if (task_frozen_ && minute_load < 0.8 * numCPU) {
+    }
+    if (!use_cgroup_) {
+        if (overloaded || network_busy) {
+            LOG(WARNING, "machine may be overloaded, so froze the task");
+            FreezeTools(true);
+            MutexLock locker(&mu_);
+            if (!task_frozen_) {
+                frozen_time_ = ::time(NULL);
+            }
+            task_frozen_ = true;
+            over_loaded_ = over_loaded_ || overloaded;
+        } else if (task_frozen_ && healthy) {
             LOG(INFO, "machine seems healthy, so resume the task");
-            system("killall -SIGCONT input_tool shuffle_tool tuo_merger 2>/dev/null");
+            FreezeTools(false);
+            MutexLock locker(&mu_);
             task_frozen_ = false;
             over_loaded_ = false;
         }
+        watch_dog_.DelayTask(1000, boost::bind(&MinionImpl::WatchDogTask, this));
+        return;
+    }
+    // Halved under pressure and raised back step by step, so tasks slow
+    // down and speed up smoothly instead of stopping
+    MutexLock locker(&mu_);
+    if (overloaded) {
+        over_loaded_ = true;
+    } else if (healthy) {
+        over_loaded_ = false;
+    }
+    time_t now = ::time(NULL);
+    if (now - last_throttle_time_ >= sThrottleIntervalSec) {
+        int32_t share = cpu_share_;
+        if (overloaded) {
+            share = std::max(share / 2, sMinCpuShare);
+        } else if (healthy) {
+            share = std::min(share + sCpuShareStep, 100);
+        }
+        if (share != cpu_share_) {
+            LOG(INFO, "cpu share of task slots: %d%% -> %d%%", cpu_share_, share);
+            cpu_share_ = share;
+            ApplyCpuShare();
+            last_throttle_time_ = now;
+        }
+        const int64_t full_rate = network_limit / static_cast<int64_t>(slots_.size());
+        int64_t rate = shuffle_rate_;
+        if (network_busy) {
+            rate = rate > 0 ? std::max(rate / 2, full_rate / 16) : full_rate / 2;
+        } else if (rate > 0) {
+            rate += full_rate / 10;
+            if (rate >= full_rate) {
+                rate = 0;
+            }
+        }
+        if (rate != shuffle_rate_) {
+            LOG(INFO, "shuffle read rate of task slots: %lld -> %lld", shuffle_rate_, rate);
+            shuffle_rate_ = rate;
+            for (size_t i = 0; i < slots_.size(); i++) {
+                slots_[i]->shuffle_limiter->SetRate(rate);
+            }
+            last_throttle_time_ = now;
+        }
     }
     watch_dog_.DelayTask(1000, boost::bind(&MinionImpl::WatchDogTask, this));
 }
 
+void MinionImpl::FreezeTools(bool freeze) {
+    if (freeze) {
+        system("killall -SIGSTOP input_tool shuffle_tool tuo_merger 2>/dev/null");
+    } else {
+        system("killall -SIGCONT input_tool shuffle_tool tuo_merger 2>/dev/null");
+    }
+}
+
+void MinionImpl::ApplyCpuShare() {
+    mu_.AssertHeld();
+    int64_t quota_us = 0;
+    if (cpu_share_ < 100) {
+        int64_t millicores = job_millicores_;
+        if (millicores <= 0) {
+            millicores = sysconf(_SC_NPROCESSORS_ONLN) * 1000L / slots_.size();
+        }
+        quota_us = std::max(millicores * sCpuPeriodUs / 1000 * cpu_share_ / 100,
+                            sMinCpuQuotaUs);
+    }
+    for (size_t i = 0; i < slots_.size(); i++) {
+        if (slots_[i]->cgroup != NULL) {
+            slots_[i]->cgroup->SetCpuMax(quota_us, sCpuPeriodUs);
+        }
+    }
+}
+
+void MinionImpl::LimitTask(TaskSlot* slot, const TaskInfo& task) {
+    if (slot->cgroup == NULL) {
+        return;
+    }
+    const JobDescriptor& job = task.job();
+    slot->cgroup->SetMemoryHigh(job.memory());
+    if (FLAGS_task_io_read_limit > 0 || FLAGS_task_io_write_limit > 0) {
+        // Local disk of the work dir, where outputs are spilled and sorted
+        std::string device = Cgroup::DeviceOf(".");
+        if (!device.empty()) {
+            slot->cgroup->SetIoMax(device, FLAGS_task_io_read_limit, FLAGS_task_io_write_limit);
+        }
+    }
+    MutexLock locker(&mu_);
+    job_millicores_ = job.millicores();
+    ApplyCpuShare();
+}
+
 void MinionImpl::Query(::google::protobuf::RpcController*,
                        const ::baidu::shuttle::QueryRequest* request,
                        ::baidu::shuttle::QueryResponse* response,
@@ -132,16 +312,46 @@ void MinionImpl::Query(::google::protobuf::RpcController*,
             return;
         }
     }
+    TaskSlot* slot = slots_[0];
+    TaskSlot* reserved = NULL;
+    for (size_t i = 0; i < slots_.size(); i++) {
+        TaskSlot* cur = slots_[i];
+        const TaskInfo& next = cur->next.task();
+        if (request->has_task_id() && cur->task_id == request->task_id()
+                && cur->attempt_id == request->attempt_id()) {
+            slot = cur;
+        } else if (request->has_task_id() && cur->reserved
+                && next.task_id() == request->task_id()
+                && next.attempt_id() == request->attempt_id()) {
+            reserved = cur;
+        }
+        SlotStatus* status = response->add_slots();
+        status->set_slot(cur->no);
+        status->set_task_id(cur->task_id);
+        status->set_attempt_id(cur->attempt_id);
+        status->set_task_state(cur->task_state);
+        status->mutable_usage()->CopyFrom(cur->usage);
+        if (cur->reserved) {
+            status->set_next_task_id(next.task_id());
+            status->set_next_attempt_id(next.attempt_id());
+        }
+    }
     response->set_job_id(jobid_);
-    response->set_task_id(cur_task_id_);
-    response->set_attempt_id(cur_attempt_id_);
-    response->set_task_state(cur_task_state_);
-    if (request->has_detail() && request->detail()) {
+    if (reserved != NULL) {
+        response->set_task_id(reserved->next.task().task_id());
+        response->set_attempt_id(reserved->next.task().attempt_id());
+        response->set_task_state(kTaskPending);
+    } else {
+        response->set_task_id(slot->task_id);
+        response->set_attempt_id(slot->attempt_id);
+        response->set_task_state(slot->task_state);
+    }
+    if (request->has_detail() && request->detail() && reserved == NULL) {
         mu_.Unlock();
         TaskInfo task;
         task.set_task_id(response->task_id());
         task.set_attempt_id(response->attempt_id());
-        response->set_log_msg(executor_->GetErrorMsg(task, work_mode_ != kReduce));
+        response->set_log_msg(slot->executor->GetErrorMsg(task, work_mode_ != kReduce));
         mu_.Lock();
     }
     done->Run();
@@ -155,16 +365,53 @@ void MinionImpl::CancelTask(::google::protobuf::RpcController*,
     const std::string jobid = request->job_id();
     {
         MutexLock locker(&mu_);
-        if (task_id != cur_task_id_ || jobid_ != jobid) {
-            response->set_status(kNoSuchTask);
-        } else {
-            executor_->Stop(task_id);
-            response->set_status(kOk);
+        response->set_status(kNoSuchTask);
+        for (size_t i = 0; i < slots_.size() && jobid_ == jobid; i++) {
+            TaskSlot* slot = slots_[i];
+            if (slot->task_id == task_id && (!request->has_attempt_id()
+                    || slot->attempt_id == request->attempt_id())) {
+                slot->executor->Stop(task_id);
+                response->set_status(kOk);
+            }
+            const TaskInfo& next = slot->next.task();
+            if (slot->reserved && next.task_id() == task_id && (!request->has_attempt_id()
+                    || next.attempt_id() == request->attempt_id())) {
+                slot->reserve_canceled = true;
+                response->set_status(kOk);
+            }
         }
     }
     done->Run();
 }
 
+void MinionImpl::GetMetrics(::google::protobuf::RpcController*,
+                            const ::baidu::shuttle::GetMetricsRequest* request,
+                            ::baidu::shuttle::GetMetricsResponse* response,
+                            ::google::protobuf::Closure* done) {
+    Metrics::Collect(request->prefix(), response);
+    done->Run();
+}
+
+void MinionImpl::CollectMetrics(GetMetricsResponse* response) {
+    MutexLock locker(&mu_);
+    int running = 0;
+    for (size_t i = 0; i < slots_.size(); i++) {
+        if (slots_[i]->task_state == kTaskRunning) {
+            ++running;
+        }
+    }
+    Metrics::AddValue("shuttle_minion_slots", "Slots of minion",
+                      kGaugeMetric, slots_.size(), response);
+    Metrics::AddValue("shuttle_minion_running_tasks", "Slots running a task",
+                      kGaugeMetric, running, response);
+    Metrics::AddValue("shuttle_minion_cpu_share", "Percent of its cpu a slot is allowed",
+                      kGaugeMetric, cpu_share_, response);
+    Metrics::AddValue("shuttle_minion_shuffle_rate_bps", "Rate shuffles of a slot read at, "
+                      "0 for no limit", kGaugeMetric, shuffle_rate_, response);
+    Metrics::AddValue("shuttle_minion_frozen", "1 while tasks are frozen for overload",
+                      kGaugeMetric, task_frozen_ ? 1 : 0, response);
+}
+
 void MinionImpl::SetEndpoint(const std::string& endpoint) {
     LOG(INFO, "minon bind endpoint on : %s", endpoint.c_str());
     endpoint_ = endpoint;
@@ -181,8 +428,9 @@ void MinionImpl::SleepRandomTime() {
     sleep(5 + random_period);
 }
 
-void MinionImpl::Loop() {
-    srand(time(NULL));
+void MinionImpl::Loop(TaskSlot* slot) {
+    srand(time(NULL) + slot->no);
+    Executor* executor = slot->executor;
     Master_Stub* stub;
     rpc_client_.GetStub(master_endpoint_, &stub);
     if (stub == NULL) {
@@ -190,17 +438,24 @@ void MinionImpl::Loop() {
     }
     boost::scoped_ptr<Master_Stub> stub_guard(stub);
     int task_count = 0;
-    CheckUnfinishedTask(stub);
+    CheckUnfinishedTask(stub, slot->no);
     while (!stop_) {
-        LOG(INFO, "======== task:%d ========", ++task_count);
+        LOG(INFO, "======== slot:%d, task:%d ========", slot->no, ++task_count);
         ::baidu::shuttle::AssignTaskRequest request;
         ::baidu::shuttle::AssignTaskResponse response;
         request.set_endpoint(endpoint_);
         request.set_jobid(jobid_);
         request.set_work_mode(work_mode_);
+        request.set_slot(slot->no);
         LOG(INFO, "endpoint: %s", endpoint_.c_str());
         LOG(INFO, "jobid_: %s", jobid_.c_str());
-        while (!stop_) {
+        bool canceled = false;
+        if (TakeReservation(slot, &response, &canceled)) {
+            LOG(INFO, "run reserved task: %d, %d", response.task().task_id(),
+                response.task().attempt_id());
+        }
+        while (!stop_ && !response.has_status()) {
+            const int64_t assign_begin = Metrics::NowUs();
             bool ok = rpc_client_.SendRequest(stub, &Master_Stub::AssignTask,
                                               &request, &response, 5, 1);
             if (!ok) {
@@ -208,6 +463,7 @@ void MinionImpl::Loop() {
                 SleepRandomTime();
                 continue;
             } else {
+                s_assign_latency->Add(Metrics::NowUs() - assign_begin);
                 break;
             }
         }
@@ -226,30 +482,78 @@ void MinionImpl::Loop() {
                 Status_Name(response.status()).c_str());
         }
         const TaskInfo& task = response.task();
-        SaveBreakpoint(task);
-        executor_->SetEnv(jobid_, task, work_mode_);
+        // Setup of the task counts from here, for its place in the
+        // timeline of the job
+        const int64_t start_us = common::timer::get_micros();
+        executor->SetEnv(jobid_, task, work_mode_);
+        LimitTask(slot, task);
         {
             MutexLock locker(&mu_);
-            cur_task_id_ = task.task_id();
-            cur_attempt_id_ = task.attempt_id();
-            cur_task_state_ = kTaskRunning;
+            slot->task_id = task.task_id();
+            slot->attempt_id = task.attempt_id();
+            slot->task_state = kTaskRunning;
+            SaveBreakpoint(slot, true);
         }
-        LOG(INFO, "try exec task: %s, %d, %d", jobid_.c_str(), cur_task_id_, cur_attempt_id_);
-        TaskState task_state = executor_->Exec(task); //exec here~~
+        LOG(INFO, "try exec task: %s, %d, %d", jobid_.c_str(), task.task_id(), task.attempt_id());
+        // Work the executor does in this thread counts for the task, as
+        // its user apps do
+        executor->SetupDone();
+        struct rusage thread_begin;
+        struct rusage thread_end;
+        getrusage(RUSAGE_THREAD, &thread_begin);
+        // The cgroup of slot also sees apps the wrappers never waited for
+        CgroupStat cgroup_begin;
+        bool cgroup_stat = slot->cgroup != NULL && slot->cgroup->ReadStat(&cgroup_begin);
+        // A reservation canceled by master is reported as the task
+        const int64_t exec_begin = Metrics::NowUs();
+        TaskState task_state = canceled ? kTaskCanceled : executor->Exec(task); //exec here~~
+        s_task_latency->Add((Metrics::NowUs() - exec_begin) / 1000);
+        getrusage(RUSAGE_THREAD, &thread_end);
+        TaskUsage usage = executor->CollectUsage();
+        usage.set_start_us(start_us);
+        CgroupStat cgroup_end;
+        if (cgroup_stat && slot->cgroup->ReadStat(&cgroup_end)) {
+            usage.set_user_time_ms((cgroup_end.user_us - cgroup_begin.user_us) / 1000);
+            usage.set_sys_time_ms((cgroup_end.sys_us - cgroup_begin.sys_us) / 1000);
+            usage.set_local_read_bytes(cgroup_end.read_bytes - cgroup_begin.read_bytes);
+            usage.set_local_write_bytes(cgroup_end.write_bytes - cgroup_begin.write_bytes);
+        }
+        // Threads the task started, e.g. the in-process shuffle, are not
+        // in the cgroup of slot either
+        const struct rusage& threads = executor->ThreadUsage();
+        usage.set_user_time_ms(usage.user_time_ms() + TimevalToMs(thread_end.ru_utime)
+                               - TimevalToMs(thread_begin.ru_utime)
+                               + TimevalToMs(threads.ru_utime));
+        usage.set_sys_time_ms(usage.sys_time_ms() + TimevalToMs(thread_end.ru_stime)
+                              - TimevalToMs(thread_begin.ru_stime)
+                              + TimevalToMs(threads.ru_stime));
+        usage.set_local_read_bytes(usage.local_read_bytes()
+                                   + (thread_end.ru_inblock - thread_begin.ru_inblock
+                                      + threads.ru_inblock) * 512L);
+        usage.set_local_write_bytes(usage.local_write_bytes()
+                                    + (thread_end.ru_oublock - thread_begin.ru_oublock
+                                       + threads.ru_oublock) * 512L);
         {
             MutexLock locker(&mu_);
-            cur_task_state_ = task_state;
+            slot->task_state = task_state;
+            slot->usage = usage;
         }
         LOG(INFO, "exec done, task state: %s", TaskState_Name(task_state).c_str());
+        Metrics::GetCounter("shuttle_minion_tasks_total{state=\""
+                            + TaskState_Name(task_state) + "\"}",
+                            "Task attempts minion has run")->Inc();
+        if (work_mode_ == kReduce) {
+            s_shuffle_bytes->Add(usage.dfs_read_bytes());
+        }
         std::string error_msg;
         if (task_state == kTaskFailed) {
-            error_msg = executor_->GetErrorMsg(task, (work_mode_ != kReduce));
+            error_msg = executor->GetErrorMsg(task, (work_mode_ != kReduce));
         }
 
         std::map<std::string, int64_t> counters;
         if (task_state == kTaskCompleted
             && task.job().has_check_counters() && task.job().check_counters()) {
-            executor_->ParseCounters(task, &counters, (work_mode_ != kReduce));
+            executor->ParseCounters(task, &counters, (work_mode_ != kReduce));
         }
 
         ::baidu::shuttle::FinishTaskRequest fn_request;
@@ -261,6 +565,8 @@ void MinionImpl::Loop() {
         fn_request.set_endpoint(endpoint_);
         fn_request.set_work_mode(work_mode_);
         fn_request.set_error_msg(error_msg);
+        fn_request.set_slot(slot->no);
+        fn_request.mutable_usage()->CopyFrom(usage);
 
         std::map<std::string, int64_t>::iterator it;
         for (it = counters.begin(); it != counters.end(); it++) {
@@ -270,6 +576,16 @@ void MinionImpl::Loop() {
             ct->set_key(key);
             ct->set_value(value);
         }
+        if (task_state == kTaskCompleted && work_mode_ == kMap) {
+            const std::vector<int64_t>& sizes = executor->GetPartitionSizes();
+            for (size_t i = 0; i < sizes.size(); ++i) {
+                fn_request.add_partition_sizes(sizes[i]);
+            }
+            const std::vector<PartitionKey>& hot_keys = executor->GetHotKeys();
+            for (size_t i = 0; i < hot_keys.size(); ++i) {
+                fn_request.add_hot_keys()->CopyFrom(hot_keys[i]);
+            }
+        }
 
         while (!stop_) {
             bool ok = rpc_client_.SendRequest(stub, &Master_Stub::FinishTask,
@@ -287,17 +603,23 @@ void MinionImpl::Loop() {
                 break;
             }
         }
-        ClearBreakpoint();
+        {
+            MutexLock locker(&mu_);
+            SaveBreakpoint(slot, false);
+        }
         if (task_state == kTaskFailed) {
             LOG(WARNING, "task state: %s", TaskState_Name(task_state).c_str());
-            executor_->UploadErrorMsg(task, (work_mode_ != kReduce), error_msg);
+            executor->UploadErrorMsg(task, (work_mode_ != kReduce), error_msg);
             SleepRandomTime();
         }
     }
 
     {
         MutexLock locker(&mu_);
-        stop_ = true;
+        // Pooled minions wait for another job
+        if (--running_slots_ == 0 && !FLAGS_pooled) {
+            stop_ = true;
+        }
     }
 }
 
@@ -307,37 +629,127 @@ bool MinionImpl::IsStop() {
 
 bool MinionImpl::Run() {
     galaxy::ins::sdk::SDKError err;
-    ins_.Get(FLAGS_master_nexus_path, &master_endpoint_, &err);
+    nexus_->Get(FLAGS_master_nexus_path, &master_endpoint_, &err);
     if (err != galaxy::ins::sdk::kOK) {
         LOG(WARNING, "failed to fetch master endpoint from nexus, errno: %d", err);
         LOG(WARNING, "master_endpoint (%s) -> %s", FLAGS_master_nexus_path.c_str(),
             master_endpoint_.c_str());
         return false;
     }
-    pool_.AddTask(boost::bind(&MinionImpl::Loop, this));
+    if (FLAGS_pooled) {
+        // Tasks a former run left are found lost by master
+        for (size_t i = 0; i < slots_.size(); i++) {
+            remove(BreakpointFile(i).c_str());
+        }
+        binder_.AddTask(boost::bind(&MinionImpl::KeepBinding, this));
+        return true;
+    }
+    {
+        MutexLock locker(&mu_);
+        running_slots_ = slots_.size();
+    }
+    for (size_t i = 0; i < slots_.size(); i++) {
+        pool_.AddTask(boost::bind(&MinionImpl::Loop, this, slots_[i]));
+    }
     return true;
 }
 
-void MinionImpl::CheckUnfinishedTask(Master_Stub* master_stub) {
-    FILE* breakpoint = fopen(sBreakpointFile.c_str(), "r");
+void MinionImpl::KeepBinding() {
+    ::baidu::shuttle::BindMinionRequest request;
+    ::baidu::shuttle::BindMinionResponse response;
+    request.set_endpoint(endpoint_);
+    request.set_slots(slots_.size());
+    {
+        MutexLock locker(&mu_);
+        if (running_slots_ > 0) {
+            request.set_jobid(jobid_);
+            request.set_work_mode(work_mode_);
+        }
+    }
+    Master_Stub* stub = NULL;
+    rpc_client_.GetStub(master_endpoint_, &stub);
+    boost::scoped_ptr<Master_Stub> stub_guard(stub);
+    bool ok = stub != NULL && rpc_client_.SendRequest(stub, &Master_Stub::BindMinion,
+                                                      &request, &response, 5, 1);
+    if (!ok) {
+        LOG(WARNING, "fail to send heartbeat to master[%s]", master_endpoint_.c_str());
+        if (!request.has_jobid()) {
+            // Master may have failed over, nothing else talks to it now
+            galaxy::ins::sdk::SDKError err;
+            nexus_->Get(FLAGS_master_nexus_path, &master_endpoint_, &err);
+        }
+    } else if (!request.has_jobid() && response.status() == kNoMore) {
+        LOG(INFO, "dismissed by the minion pool, so exit.");
+        MutexLock locker(&mu_);
+        stop_ = true;
+        return;
+    } else if (!request.has_jobid() && response.has_binding()) {
+        BindJob(response.binding());
+    }
+    binder_.DelayTask(sBindIntervalMs, boost::bind(&MinionImpl::KeepBinding, this));
+}
+
+void MinionImpl::BindJob(const MinionBinding& binding) {
+    LOG(INFO, "lent to job: %s, %s", binding.jobid().c_str(),
+        WorkMode_Name(binding.work_mode()).c_str());
+    // The package of the job takes the place of the former one
+    std::string cmd = binding.boot_env() + " ./minion_boot.sh -bind_job";
+    int ret = system(cmd.c_str());
+    if (ret != 0) {
+        LOG(WARNING, "fail to fetch the package of %s, ret: %d",
+            binding.jobid().c_str(), ret);
+        return;
+    }
+    MutexLock locker(&mu_);
+    jobid_ = binding.jobid();
+    if (work_mode_ != binding.work_mode()) {
+        work_mode_ = binding.work_mode();
+        for (size_t i = 0; i < slots_.size(); i++) {
+            delete slots_[i]->executor;
+            slots_[i]->executor = NewExecutor(slots_[i]);
+        }
+    }
+    running_slots_ = slots_.size();
+    for (size_t i = 0; i < slots_.size(); i++) {
+        TaskSlot* slot = slots_[i];
+        slot->task_id = -1;
+        slot->attempt_id = -1;
+        slot->task_state = kTaskUnknown;
+        slot->usage.Clear();
+        pool_.AddTask(boost::bind(&MinionImpl::Loop, this, slot));
+    }
+}
+
+void MinionImpl::CheckUnfinishedTask(Master_Stub* master_stub, int32_t slot) {
+    FILE* breakpoint = fopen(BreakpointFile(slot).c_str(), "r");
+    if (breakpoint == NULL) {
+        return;
+    }
+    // The running task, and the one reserved after it if any
+    std::vector<std::pair<int, int> > unfinished;
     int task_id;
     int attempt_id;
-    if (breakpoint) {
-        int n_ret = fscanf(breakpoint, "%d%d", &task_id, &attempt_id);
-        if (n_ret != 2) {
-            LOG(WARNING, "invalid breakpoint file");
-            return;
-        }
-        fclose(breakpoint);
+    while (fscanf(breakpoint, "%d%d", &task_id, &attempt_id) == 2) {
+        unfinished.push_back(std::make_pair(task_id, attempt_id));
+    }
+    fclose(breakpoint);
+    if (unfinished.empty()) {
+        LOG(WARNING, "invalid breakpoint file");
+        return;
+    }
+    for (size_t i = 0; i < unfinished.size(); i++) {
         ::baidu::shuttle::FinishTaskRequest fn_request;
         ::baidu::shuttle::FinishTaskResponse fn_response;
+        task_id = unfinished[i].first;
+        attempt_id = unfinished[i].second;
         LOG(WARNING, "found unfinished task: task_id: %d, attempt_id: %d", task_id, attempt_id);
-        fn_request.set_jobid(FLAGS_jobid);
+        fn_request.set_jobid(jobid_);
         fn_request.set_task_id(task_id);
         fn_request.set_attempt_id(attempt_id);
         fn_request.set_task_state(kTaskKilled);
         fn_request.set_endpoint(endpoint_);
         fn_request.set_work_mode(work_mode_);
+        fn_request.set_slot(slot);
         bool ok = rpc_client_.SendRequest(master_stub, &Master_Stub::FinishTask,
                                      &fn_request, &fn_response, 5, 1);
         if (!ok) {
@@ -347,18 +759,85 @@ void MinionImpl::CheckUnfinishedTask(Master_Stub* master_stub) {
     }
 }
 
-void MinionImpl::SaveBreakpoint(const TaskInfo& task) {
-    FILE* breakpoint = fopen(sBreakpointFile.c_str(), "w");
+void MinionImpl::SaveBreakpoint(TaskSlot* slot, bool running) {
+    mu_.AssertHeld();
+    const std::string file_name = BreakpointFile(slot->no);
+    if (!running && !slot->reserved) {
+        if (remove(file_name.c_str()) != 0 ) {
+            LOG(WARNING, "failed to remove breakponit file");
+        }
+        return;
+    }
+    FILE* breakpoint = fopen(file_name.c_str(), "w");
     if (breakpoint) {
-        fprintf(breakpoint, "%d %d\n", task.task_id(), task.attempt_id());
+        if (running) {
+            fprintf(breakpoint, "%d %d\n", slot->task_id, slot->attempt_id);
+        }
+        if (slot->reserved) {
+            fprintf(breakpoint, "%d %d\n", slot->next.task().task_id(),
+                    slot->next.task().attempt_id());
+        }
         fclose(breakpoint);
     }
 }
 
-void MinionImpl::ClearBreakpoint() {
-    if (remove(sBreakpointFile.c_str()) != 0 ) {
-        LOG(WARNING, "failed to remove breakponit file");
+void MinionImpl::ReserveNextTask(TaskSlot* slot) {
+    if (!FLAGS_task_prefetch) {
+        return;
+    }
+    MutexLock locker(&mu_);
+    if (stop_ || slot->reserving || slot->reserved) {
+        return;
+    }
+    slot->reserving = true;
+    prefetch_pool_.AddTask(boost::bind(&MinionImpl::FetchReservation, this, slot));
+}
+
+void MinionImpl::FetchReservation(TaskSlot* slot) {
+    ::baidu::shuttle::AssignTaskRequest request;
+    ::baidu::shuttle::AssignTaskResponse response;
+    request.set_endpoint(endpoint_);
+    request.set_jobid(jobid_);
+    request.set_work_mode(work_mode_);
+    request.set_slot(slot->no);
+    request.set_prefetch(true);
+    Master_Stub* stub = NULL;
+    rpc_client_.GetStub(master_endpoint_, &stub);
+    boost::scoped_ptr<Master_Stub> stub_guard(stub);
+    // Any failure only means the next task is asked for as usual
+    bool ok = stub != NULL && rpc_client_.SendRequest(stub, &Master_Stub::AssignTask,
+                                                      &request, &response, 5, 1);
+    if (ok && response.status() == kOk) {
+        LOG(INFO, "reserve next task: %d, %d", response.task().task_id(),
+            response.task().attempt_id());
+        {
+            MutexLock locker(&mu_);
+            slot->next.CopyFrom(response);
+            slot->reserved = true;
+            slot->reserve_canceled = false;
+            SaveBreakpoint(slot, slot->task_state == kTaskRunning);
+        }
+        slot->executor->PrefetchInput(response.task());
+    }
+    MutexLock locker(&mu_);
+    slot->reserving = false;
+    reserve_cond_.Broadcast();
+}
+
+bool MinionImpl::TakeReservation(TaskSlot* slot, AssignTaskResponse* response,
+                                 bool* canceled) {
+    MutexLock locker(&mu_);
+    while (slot->reserving) {
+        reserve_cond_.Wait();
+    }
+    if (!slot->reserved) {
+        return false;
     }
+    response->CopyFrom(slot->next);
+    *canceled = slot->reserve_canceled;
+    slot->reserved = false;
+    slot->reserve_canceled = false;
+    return true;
 }
 
 }
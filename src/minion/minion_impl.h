@@ -1,13 +1,19 @@
 #ifndef _BAIDU_SHUTTLE_MINION_H_
 #define _BAIDU_SHUTTLE_MINION_H_
 
+#include <vector>
+#include <boost/scoped_ptr.hpp>
 #include "thread_pool.h"
 #include "mutex.h"
 #include "common/rpc_client.h"
 #include "proto/minion.pb.h"
-#include "ins_sdk.h"
+#include "proto/app_master.pb.h"
+#include "common/nexus.h"
 #include "executor.h"
 #include "common/net_statistics.h"
+#include "common/token_bucket.h"
+#include "common/metrics.h"
+#include "cgroup.h"
 
 namespace baidu {
 namespace shuttle {
@@ -26,35 +32,88 @@ public:
                     const ::baidu::shuttle::CancelTaskRequest* request,
                     ::baidu::shuttle::CancelTaskResponse* response,
                     ::google::protobuf::Closure* done);
+    void GetMetrics(::google::protobuf::RpcController* controller,
+                    const ::baidu::shuttle::GetMetricsRequest* request,
+                    ::baidu::shuttle::GetMetricsResponse* response,
+                    ::google::protobuf::Closure* done);
     void SetEndpoint(const std::string& endpoint);
     void SetJobId(const std::string& jobid);
     bool Run();
     bool IsStop();
 private:
-    void Loop();
-    void SaveBreakpoint(const TaskInfo& task);
-    void ClearBreakpoint();
-    void CheckUnfinishedTask(Master_Stub* master_stub);
+    // Runs one task at a time with an executor of its own. Slots of a
+    // minion share its packages, rpc connections and watch dog
+    struct TaskSlot {
+        int32_t no;
+        Executor* executor;
+        int32_t task_id;
+        int32_t attempt_id;
+        TaskState task_state;
+        // of the last finished task
+        TaskUsage usage;
+        // The next task is reserved while the current one writes its
+        // output, see ReserveNextTask
+        bool reserving;
+        bool reserved;
+        bool reserve_canceled;
+        AssignTaskResponse next;
+        // NULL when user apps run in the cgroup of minion
+        Cgroup* cgroup;
+        TokenBucket* shuffle_limiter;
+    };
+    Executor* NewExecutor(TaskSlot* slot);
+    void Loop(TaskSlot* slot);
+    // Heartbeat of pooled minions, which takes a job from master when idle
+    void KeepBinding();
+    void BindJob(const MinionBinding& binding);
+    // Called by the executor of slot once its task has taken all input
+    void ReserveNextTask(TaskSlot* slot);
+    void FetchReservation(TaskSlot* slot);
+    // Waits for a reservation in flight, returns false if there is none
+    bool TakeReservation(TaskSlot* slot, AssignTaskResponse* response, bool* canceled);
+    // Records the running and reserved tasks of slot, so they are reported
+    // killed if minion is gone. Called with mu_ held
+    void SaveBreakpoint(TaskSlot* slot, bool running);
+    void CheckUnfinishedTask(Master_Stub* master_stub, int32_t slot);
     void SleepRandomTime();
     void WatchDogTask();
+    // Limits of the cgroup of slot for the task it starts
+    void LimitTask(TaskSlot* slot, const TaskInfo& task);
+    // Writes cpu.max of all slots from cpu_share_, called with mu_ held
+    void ApplyCpuShare();
+    // Fallback without cgroups, stops the tools of every job on the host
+    void FreezeTools(bool freeze);
+    // Slots and throttling of minion, read by GetMetrics
+    void CollectMetrics(GetMetricsResponse* response);
     std::string endpoint_;
     ThreadPool pool_;
     std::string master_endpoint_;
-    galaxy::ins::sdk::InsSDK ins_;
+    boost::scoped_ptr<Nexus> nexus_;
     bool stop_;
     Mutex mu_;
+    CondVar reserve_cond_;
     RpcClient rpc_client_;
     std::string jobid_;
-    Executor* executor_;
-    int32_t cur_task_id_;
-    int32_t cur_attempt_id_;
-    TaskState cur_task_state_;
+    std::vector<TaskSlot*> slots_;
+    int running_slots_;
     WorkMode work_mode_;
     ThreadPool watch_dog_;
+    ThreadPool binder_;
+    ThreadPool prefetch_pool_;
     NetStatistics netstat_;
     bool task_frozen_;
     bool over_loaded_;
     time_t frozen_time_;
+    bool use_cgroup_;
+    // Percent of its cpu a slot is allowed, lowered while the host is
+    // overloaded and raised back step by step
+    int32_t cpu_share_;
+    int32_t job_millicores_;
+    // Bytes per second shuffles of a slot read at while network is busy,
+    // 0 for no limit
+    int64_t shuffle_rate_;
+    time_t last_throttle_time_;
+    int metrics_collector_;
 };
 
 }
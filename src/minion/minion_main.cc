@@ -19,6 +19,7 @@ using baidu::common::WARNING;
 DECLARE_int32(minion_port);
 DECLARE_string(jobid);
 DECLARE_int32(max_minions);
+DECLARE_bool(pooled);
 
 static volatile bool s_quit = false;
 static void SignalIntHandler(int /*sig*/){
@@ -27,8 +28,8 @@ static void SignalIntHandler(int /*sig*/){
 
 int main(int argc, char* argv[]) {
     google::ParseCommandLineFlags(&argc, &argv, true);
-    if (FLAGS_jobid.empty()) {
-        LOG(WARNING, "use --jobid=[job id] to start minion");
+    if (FLAGS_jobid.empty() && !FLAGS_pooled) {
+        LOG(WARNING, "use --jobid=[job id] or --pooled to start minion");
         exit(-2);
     }
     baidu::shuttle::MinionImpl * minion = new baidu::shuttle::MinionImpl();
@@ -66,7 +67,9 @@ int main(int argc, char* argv[]) {
         }
     }
     minion->SetEndpoint(remote_ep);
-    minion->SetJobId(FLAGS_jobid);
+    if (!FLAGS_pooled) {
+        minion->SetJobId(FLAGS_jobid);
+    }
     if (!minion->Run()) {
         LOG(WARNING, "fail to start minion.");
         _exit(-1);
@@ -1,88 +1,283 @@
 #include "partition.h"
+#include <assert.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include <algorithm>
+#include <limits>
 
 namespace baidu {
 namespace shuttle {
 
-int Partitioner::HashCode(const std::string& str) const{
-    int h = 1;
-    if (str.empty()) {
+FieldSplitter::FieldSplitter(const std::string& separator)
+  : single_byte_(separator.size() == 1),
+    separator_(separator.empty() ? '\0' : separator[0]) {
+    memset(is_separator_, 0, sizeof(is_separator_));
+    for (size_t i = 0; i < separator.size(); i++) {
+        is_separator_[static_cast<unsigned char>(separator[i])] = true;
+    }
+    is_separator_[0] = true;
+}
+
+const char* FieldSplitter::FindFieldEnd(const char* begin, const char* end) const {
+    if (single_byte_) {
+        const char* p = static_cast<const char*>(memchr(begin, separator_, end - begin));
+        if (p == NULL) {
+            p = end;
+        }
+        // NUL is rare in records, so the second scan is bounded by the field
+        const char* nul = static_cast<const char*>(memchr(begin, '\0', p - begin));
+        return nul == NULL ? p : nul;
+    }
+    const char* p = begin;
+    while (p < end && !is_separator_[static_cast<unsigned char>(*p)]) {
+        ++p;
+    }
+    return p;
+}
+
+size_t FieldSplitter::PrefixLength(const char* head, size_t size, int num_fields) const {
+    const char* end = head + size;
+    const char* p = head;
+    for (int i = 0; i < num_fields && p < end; i++) {
+        p = FindFieldEnd(p, end) + 1;
+    }
+    if (p == head) {
+        return 0;
+    }
+    return p - 1 - head;
+}
+
+void FieldSplitter::Split(const char* head, size_t size, int max_fields,
+                          std::vector<size_t>* offsets) const {
+    assert(offsets);
+    offsets->clear();
+    const char* end = head + size;
+    const char* p = head;
+    for (int i = 0; i < max_fields && p < end; i++) {
+        const char* field_end = FindFieldEnd(p, end);
+        offsets->push_back(field_end - head);
+        p = field_end + 1;
+    }
+}
+
+KeyNormalizer::KeyNormalizer(const JobDescriptor& job)
+  : orders_(job.key_orders().begin(), job.key_orders().end()),
+    splitter_(job.key_separator().empty() ? "\t" : job.key_separator()),
+    max_fields_(0) {
+    for (size_t i = 0; i < orders_.size(); i++) {
+        int last = orders_[i].field_end() > 0 ? orders_[i].field_end()
+                                              : std::numeric_limits<int>::max();
+        max_fields_ = std::max(max_fields_, std::max(last, orders_[i].field_begin()));
+    }
+}
+
+void KeyNormalizer::Normalize(const std::string& key, std::string* normalized) const {
+    assert(normalized);
+    normalized->clear();
+    std::vector<size_t> field_ends;
+    splitter_.Split(key.data(), key.size(), max_fields_, &field_ends);
+    int num_fields = field_ends.size();
+    for (size_t i = 0; i < orders_.size(); i++) {
+        const KeyFieldOrder& order = orders_[i];
+        int first = std::max(order.field_begin(), 1);
+        int last = order.field_end() > 0 ? std::min(order.field_end(), num_fields)
+                                         : num_fields;
+        const char* data = key.data();
+        size_t len = 0;
+        if (first <= last) {
+            size_t begin = first == 1 ? 0 : field_ends[first - 2] + 1;
+            data += begin;
+            len = field_ends[last - 1] - begin;
+        }
+        size_t start = normalized->size();
+        if (order.numeric()) {
+            AppendNumber(data, len, normalized);
+        } else {
+            AppendString(data, len, order.ignore_case(), normalized);
+        }
+        if (order.reverse()) {
+            // Encodings are prefix free, so inverting bytes reverses the order
+            for (size_t j = start; j < normalized->size(); j++) {
+                (*normalized)[j] = ~(*normalized)[j];
+            }
+        }
+    }
+}
+
+void KeyNormalizer::AppendString(const char* data, size_t len, bool ignore_case,
+                                 std::string* normalized) {
+    // NUL is escaped as 0x00 0xff and the field ends with 0x00 0x00,
+    // so a shorter field sorts before the longer ones it prefixes
+    for (size_t i = 0; i < len; i++) {
+        char c = data[i];
+        if (c == '\0') {
+            normalized->push_back('\0');
+            normalized->push_back('\xff');
+            continue;
+        }
+        normalized->push_back(ignore_case ? tolower(static_cast<unsigned char>(c)) : c);
+    }
+    normalized->push_back('\0');
+    normalized->push_back('\0');
+}
+
+void KeyNormalizer::AppendNumber(const char* data, size_t len, std::string* normalized) {
+    // Leading number of the field like sort -n, anything else counts as 0
+    std::string field(data, len);
+    const char* p = field.c_str();
+    while (*p == ' ') {
+        ++p;
+    }
+    double value = 0;
+    if (*p == '-' || *p == '+' || *p == '.' || isdigit(static_cast<unsigned char>(*p))) {
+        value = strtod(p, NULL);
+    }
+    if (value != value || value == 0) { // NaN and -0
+        value = 0;
+    }
+    // IEEE 754 bits sort as unsigned integers after flipping the sign bit
+    // of positives and all bits of negatives
+    uint64_t bits = 0;
+    memcpy(&bits, &value, sizeof(bits));
+    if (bits >> 63) {
+        bits = ~bits;
+    } else {
+        bits |= 1ULL << 63;
+    }
+    for (int shift = 56; shift >= 0; shift -= 8) {
+        normalized->push_back(static_cast<char>((bits >> shift) & 0xFF));
+    }
+}
+
+int Partitioner::HashCode(const std::string& str) const {
+    return HashCode(str.data(), str.size());
+}
+
+int Partitioner::HashCode(const char* data, size_t len) {
+    if (len == 0) {
         return 0;
     }
-    for (size_t i = 0;  i < str.size(); i++) {
-        h = 31 * h + str[i];
+    // Same as h = 31 * h + c over signed chars starting from 1, wrapping in
+    // 32 bits, with four bytes folded per step to shorten the dependency chain
+    uint32_t h = 1;
+    size_t i = 0;
+    for (; i + 4 <= len; i += 4) {
+        h = h * 923521u
+            + static_cast<uint32_t>(static_cast<int>(static_cast<signed char>(data[i]))) * 29791u
+            + static_cast<uint32_t>(static_cast<int>(static_cast<signed char>(data[i + 1]))) * 961u
+            + static_cast<uint32_t>(static_cast<int>(static_cast<signed char>(data[i + 2]))) * 31u
+            + static_cast<uint32_t>(static_cast<int>(static_cast<signed char>(data[i + 3])));
+    }
+    for (; i < len; i++) {
+        h = 31 * h + static_cast<uint32_t>(static_cast<int>(static_cast<signed char>(data[i])));
+    }
+    return static_cast<int>(h & 0x7FFFFFFF);
+}
+
+void Partitioner::CalcBatch(const std::vector<std::string>& lines,
+                            std::vector<int>* partitions,
+                            std::vector<std::string>* keys) const {
+    assert(partitions && keys);
+    partitions->resize(lines.size());
+    keys->resize(lines.size());
+    for (size_t i = 0; i < lines.size(); i++) {
+        (*partitions)[i] = Calc(lines[i], &(*keys)[i]);
     }
-    return h & 0x7FFFFFFF;
 }
 
 KeyFieldBasedPartitioner::KeyFieldBasedPartitioner(const TaskInfo& task) 
   : num_key_fields_(0),
     num_partition_fields_(0), 
-    reduce_total_(0) {
+    reduce_total_(0),
+    separator_(task.job().key_separator().empty() ? "\t" : task.job().key_separator()),
+    splitter_(separator_) {
     num_key_fields_ = task.job().key_fields_num();
     num_partition_fields_ = task.job().partition_fields_num();
-    reduce_total_ = task.job().reduce_total();
-    separator_ = task.job().key_separator();
+    reduce_total_ = task.job().partition_total() > 0 ?
+                    task.job().partition_total() : task.job().reduce_total();
     if (num_key_fields_ == 0) {
         num_key_fields_ = 1;
     }
     if (num_partition_fields_ == 0) {
         num_partition_fields_ = 1;
     }
-    if (separator_.empty()) {
-        separator_ = "\t";
-    }
 }
 
 KeyFieldBasedPartitioner::KeyFieldBasedPartitioner(int num_key_fields,
                                                    int num_partition_fields,
                                                    int reduce_total,
-                                                   const std::string& separator) {
+                                                   const std::string& separator)
+  : separator_(separator.empty() ? "\t" : separator),
+    splitter_(separator_) {
     num_key_fields_ = num_key_fields;
     num_partition_fields_ = num_partition_fields;
     reduce_total_ = reduce_total;
-    separator_ = separator;
     if (num_key_fields_ == 0) {
         num_key_fields_ = 1;
     }
     if (num_partition_fields_ == 0) {
         num_partition_fields_ = 1;
     }
-    if (separator_.empty()) {
-        separator_ = "\t";
-    }
 }
 
 int KeyFieldBasedPartitioner::Calc(const std::string& line, std::string* key) const {
     assert(key);
-    const char* head = line.data();
-    const char *p1 = head;
-    const char *p2 = head;
-    const char* end = head + line.size();
-    int N = std::max(num_key_fields_, num_partition_fields_);
-    for (int i = 0; i < N; i++) {
-        if (i < num_key_fields_) {
-            if (p1 >= end) {
-                break;
-            }
-            p1 += (strcspn(p1, separator_.c_str()) + 1);
-        }
-        if (i < num_partition_fields_) {
-            if (p2 >= end) {
-                break;
-            }
-            p2 += (strcspn(p2, separator_.c_str()) + 1);
-        }
+    size_t key_len = 0;
+    size_t partition_len = 0;
+    KeyLengths(line, &key_len, &partition_len);
+    key->assign(line.data(), key_len);
+    return HashCode(line.data(), partition_len) % reduce_total_;
+}
+
+void KeyFieldBasedPartitioner::CalcBatch(const std::vector<std::string>& lines,
+                                         std::vector<int>* partitions,
+                                         std::vector<std::string>* keys) const {
+    assert(partitions && keys);
+    partitions->resize(lines.size());
+    keys->resize(lines.size());
+    for (size_t i = 0; i < lines.size(); i++) {
+        const std::string& line = lines[i];
+        size_t key_len = 0;
+        size_t partition_len = 0;
+        KeyLengths(line, &key_len, &partition_len);
+        (*keys)[i].assign(line.data(), key_len);
+        (*partitions)[i] = HashCode(line.data(), partition_len) % reduce_total_;
     }
-    if (p1 == head) {
-        p1 = head + 1;
+}
+
+void KeyFieldBasedPartitioner::KeyLengths(const std::string& line, size_t* key_len,
+                                          size_t* partition_len) const {
+    // The shorter prefix is a part of the longer one, so only the extra fields are scanned
+    if (num_key_fields_ == num_partition_fields_) {
+        *key_len = splitter_.PrefixLength(line.data(), line.size(), num_key_fields_);
+        *partition_len = *key_len;
+        return;
     }
-    if (p2 == head) {
-        p2 = head + 1;
+    bool key_shorter = num_key_fields_ < num_partition_fields_;
+    size_t* shorter = key_shorter ? key_len : partition_len;
+    size_t* longer = key_shorter ? partition_len : key_len;
+    int shorter_fields = key_shorter ? num_key_fields_ : num_partition_fields_;
+    int longer_fields = key_shorter ? num_partition_fields_ : num_key_fields_;
+    *shorter = splitter_.PrefixLength(line.data(), line.size(), shorter_fields);
+    if (*shorter + 1 >= line.size()) {
+        *longer = *shorter;
+        return;
     }
-    key->assign(head, p1 - 1);
-    std::string partition_key(head, p2 - 1);
-    return HashCode(partition_key) % reduce_total_; 
+    size_t rest = splitter_.PrefixLength(line.data() + *shorter + 1,
+                                         line.size() - *shorter - 1,
+                                         longer_fields - shorter_fields);
+    *longer = *shorter + 1 + rest;
+}
+
+void KeyFieldBasedPartitioner::ExtractKeys(const std::string& line, std::string* key,
+                                           std::string* partition_key) const {
+    size_t key_len = 0;
+    size_t partition_len = 0;
+    KeyLengths(line, &key_len, &partition_len);
+    key->assign(line.data(), key_len);
+    partition_key->assign(line.data(), partition_len);
 }
 
 int KeyFieldBasedPartitioner::Calc(const std::string& key) const {
@@ -90,21 +285,18 @@ int KeyFieldBasedPartitioner::Calc(const std::string& key) const {
 }
 
 IntHashPartitioner::IntHashPartitioner(const TaskInfo& task)
-  : reduce_total_(0) {
-    reduce_total_ = task.job().reduce_total();
-    separator_ = task.job().key_separator();
-    if (separator_.empty()) {
-        separator_ = "\t";
-    }
+  : reduce_total_(0),
+    separator_(task.job().key_separator().empty() ? "\t" : task.job().key_separator()),
+    splitter_(separator_) {
+    reduce_total_ = task.job().partition_total() > 0 ?
+                    task.job().partition_total() : task.job().reduce_total();
 }
 
 IntHashPartitioner::IntHashPartitioner(int reduce_total,
-                                       const std::string& separator) {
-    reduce_total_ = reduce_total;
-    separator_ = separator;
-    if (separator_.empty()) {
-        separator_ = "\t";
-    }
+                                       const std::string& separator)
+  : reduce_total_(reduce_total),
+    separator_(separator.empty() ? "\t" : separator),
+    splitter_(separator_) {
 }
 
 int IntHashPartitioner::Calc(const std::string& line, std::string* key) const{
@@ -113,13 +305,14 @@ int IntHashPartitioner::Calc(const std::string& line, std::string* key) const{
     if (space_pos != std::string::npos) {
         hash_code = atoi(line.substr(0, space_pos).c_str());
         const char *p = line.data() + space_pos + 1;
-        int key_span = strcspn(p, separator_.c_str());
-        key->assign(p, key_span);
+        const char* end = line.data() + line.size();
+        key->assign(p, splitter_.FindFieldEnd(p, end));
     } else { // no white space found
         const char *p = line.data();
-        int key_span = strcspn(p, separator_.c_str());
-        key->assign(p, key_span);
-        hash_code = HashCode(*key);
+        const char* end = p + line.size();
+        const char* key_end = splitter_.FindFieldEnd(p, end);
+        key->assign(p, key_end);
+        hash_code = HashCode(p, key_end - p);
     }
     return hash_code % reduce_total_;
 }
@@ -135,5 +328,62 @@ int IntHashPartitioner::Calc(const std::string& key) const{
     return hash_code % reduce_total_;
 }
 
+RangePartitioner::RangePartitioner(const TaskInfo& task)
+  : KeyFieldBasedPartitioner(task),
+    split_points_(task.job().range_split_points().begin(),
+                  task.job().range_split_points().end()),
+    normalizer_(task.job()) {
+}
+
+RangePartitioner::RangePartitioner(int num_key_fields,
+                                   int num_partition_fields,
+                                   const std::vector<std::string>& split_points,
+                                   const std::string& separator)
+  : KeyFieldBasedPartitioner(num_key_fields, num_partition_fields,
+                             split_points.size() + 1, separator),
+    split_points_(split_points),
+    normalizer_(JobDescriptor()) {
+}
+
+int RangePartitioner::Calc(const std::string& line, std::string* key) const {
+    assert(key);
+    std::string partition_key;
+    ExtractKeys(line, key, &partition_key);
+    // Ranges are of sort keys, so reduce outputs are ordered as a whole
+    return Calc(*key);
+}
+
+void RangePartitioner::CalcBatch(const std::vector<std::string>& lines,
+                                 std::vector<int>* partitions,
+                                 std::vector<std::string>* keys) const {
+    Partitioner::CalcBatch(lines, partitions, keys);
+}
+
+int RangePartitioner::Calc(const std::string& key) const {
+    if (normalizer_.Enabled()) {
+        std::string normalized;
+        normalizer_.Normalize(key, &normalized);
+        return std::upper_bound(split_points_.begin(), split_points_.end(), normalized)
+               - split_points_.begin();
+    }
+    // Partition i holds keys in [split_points_[i - 1], split_points_[i])
+    return std::upper_bound(split_points_.begin(), split_points_.end(), key)
+           - split_points_.begin();
+}
+
+void RangePartitioner::ComputeSplitPoints(std::vector<std::string>* samples, int partitions,
+                                          std::vector<std::string>* split_points) {
+    assert(samples && split_points);
+    split_points->clear();
+    if (samples->empty() || partitions <= 1) {
+        return;
+    }
+    std::sort(samples->begin(), samples->end());
+    for (int i = 1; i < partitions; i++) {
+        size_t idx = static_cast<size_t>(static_cast<int64_t>(i) * samples->size() / partitions);
+        split_points->push_back((*samples)[idx]);
+    }
+}
+
 } //namespace shuttle
 } //namespace baidu
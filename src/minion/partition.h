@@ -2,16 +2,63 @@
 #define _BAIDU_SHUTTLE_MINION_PARTITION_H_
 
 #include <string>
+#include <vector>
 #include "proto/shuttle.pb.h"
 
 namespace baidu {
 namespace shuttle {
 
+// Locates field boundaries of a record without copying it.
+// A separator of one byte is searched with memchr, longer ones are treated
+// as a set of bytes like strcspn does. NUL always ends a field as well,
+// since the partitioners used to scan with strcspn
+class FieldSplitter {
+public:
+    explicit FieldSplitter(const std::string& separator);
+    // Returns the end of the field starting at begin, or end if no separator follows
+    const char* FindFieldEnd(const char* begin, const char* end) const;
+    // Length of the prefix made of the first num_fields fields, trailing separator excluded
+    size_t PrefixLength(const char* head, size_t size, int num_fields) const;
+    // Fills offsets with the end of each field, up to max_fields of them
+    void Split(const char* head, size_t size, int max_fields,
+               std::vector<size_t>* offsets) const;
+private:
+    bool single_byte_;
+    char separator_;
+    bool is_separator_[256];
+};
+
+// Encodes a key by typed key orders into a binary key, so that
+// byte-wise comparison of encoded keys follows the orders.
+// Sorting and merging of map outputs stay plain memcmp
+class KeyNormalizer {
+public:
+    explicit KeyNormalizer(const JobDescriptor& job);
+    bool Enabled() const {
+        return !orders_.empty();
+    }
+    void Normalize(const std::string& key, std::string* normalized) const;
+private:
+    static void AppendString(const char* data, size_t len, bool ignore_case,
+                             std::string* normalized);
+    static void AppendNumber(const char* data, size_t len, std::string* normalized);
+private:
+    std::vector<KeyFieldOrder> orders_;
+    FieldSplitter splitter_;
+    int max_fields_;
+};
+
 class Partitioner {
 public:
+    virtual ~Partitioner() {}
     virtual int Calc(const std::string& line, std::string* key) const = 0;
     virtual int Calc(const std::string& key) const = 0;
+    // Partitions lines in a batch, partitions and keys are resized to lines.size()
+    virtual void CalcBatch(const std::vector<std::string>& lines,
+                           std::vector<int>* partitions,
+                           std::vector<std::string>* keys) const;
     int HashCode(const std::string& str) const;
+    static int HashCode(const char* data, size_t len);
 };
 
 class KeyFieldBasedPartitioner : public Partitioner {
@@ -25,11 +72,21 @@ public:
     virtual ~KeyFieldBasedPartitioner(){};
     int Calc(const std::string& line, std::string* key) const;
     int Calc(const std::string& key) const;
+    void CalcBatch(const std::vector<std::string>& lines,
+                   std::vector<int>* partitions,
+                   std::vector<std::string>* keys) const;
+    void ExtractKeys(const std::string& line, std::string* key,
+                     std::string* partition_key) const;
+protected:
+    // Lengths of the sort key and the partition key prefixes of a line
+    void KeyLengths(const std::string& line, size_t* key_len,
+                    size_t* partition_len) const;
 private:
     int num_key_fields_;
     int num_partition_fields_;
     int reduce_total_;
     std::string separator_;
+    FieldSplitter splitter_;
 };
 
 class IntHashPartitioner : public Partitioner {
@@ -43,6 +100,31 @@ public:
 private:
     int reduce_total_;
     std::string separator_;
+    FieldSplitter splitter_;
+};
+
+// Routes records to partitions holding ordered key ranges,
+// so outputs of reduces are sorted as a whole
+class RangePartitioner : public KeyFieldBasedPartitioner {
+public:
+    RangePartitioner(const TaskInfo& task);
+    RangePartitioner(int num_key_fields,
+                     int num_partition_fields,
+                     const std::vector<std::string>& split_points,
+                     const std::string& separator);
+    virtual ~RangePartitioner(){};
+    int Calc(const std::string& line, std::string* key) const;
+    int Calc(const std::string& key) const;
+    void CalcBatch(const std::vector<std::string>& lines,
+                   std::vector<int>* partitions,
+                   std::vector<std::string>* keys) const;
+    // Picks (partitions - 1) evenly spaced split points from sampled sort keys
+    static void ComputeSplitPoints(std::vector<std::string>* samples, int partitions,
+                                   std::vector<std::string>* split_points);
+private:
+    std::vector<std::string> split_points_;
+    // Split points are normalized keys when the job has key orders
+    KeyNormalizer normalizer_;
 };
 
 } //namespace shuttle
@@ -0,0 +1,60 @@
+#include <string>
+#include <vector>
+#include "common/benchmark.h"
+#include "partition.h"
+
+using namespace baidu::shuttle;
+using namespace baidu::shuttle::bench;
+
+const static int sLines = 4096;
+
+// Lines of two key fields and a value, partitioned by the first field
+static void KeyedLines(int value_size, std::vector<std::string>* lines) {
+    RecordGenerator gen(16, value_size, 1 << 20, 0, 1);
+    std::string line;
+    std::string field;
+    std::string value;
+    for (int i = 0; i < sLines; i++) {
+        gen.Next(&field, &value);
+        gen.NextLine(&line);
+        lines->push_back(field + "\t" + line);
+    }
+}
+
+static void BM_KeyFieldPartitionerCalc(State& state) {
+    std::vector<std::string> lines;
+    KeyedLines(state.range(0), &lines);
+    KeyFieldBasedPartitioner partitioner(2, 1, 1000, "\t");
+    std::string key;
+    int64_t bytes = 0;
+    size_t i = 0;
+    while (state.KeepRunning()) {
+        partitioner.Calc(lines[i], &key);
+        bytes += lines[i].size();
+        if (++i == lines.size()) {
+            i = 0;
+        }
+    }
+    state.SetBytesProcessed(bytes);
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_KeyFieldPartitionerCalc)->Arg(16)->Arg(100)->Arg(1024);
+
+// Batches of sLines lines, as maps partition the outputs of their apps
+static void BM_KeyFieldPartitionerCalcBatch(State& state) {
+    std::vector<std::string> lines;
+    KeyedLines(state.range(0), &lines);
+    int64_t bytes = 0;
+    for (size_t i = 0; i < lines.size(); i++) {
+        bytes += lines[i].size();
+    }
+    KeyFieldBasedPartitioner partitioner(2, 1, 1000, "\t");
+    std::vector<int> partitions;
+    std::vector<std::string> keys;
+    while (state.KeepRunning()) {
+        partitioner.CalcBatch(lines, &partitions, &keys);
+    }
+    state.SetBytesProcessed(state.iterations() * bytes);
+    state.SetItemsProcessed(state.iterations() * sLines);
+}
+BENCHMARK(BM_KeyFieldPartitionerCalcBatch)->Arg(16)->Arg(100)->Arg(1024);
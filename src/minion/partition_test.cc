@@ -1,7 +1,10 @@
 #include <gtest/gtest.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <algorithm>
 #include <string>
+#include <vector>
 #include "partition.h"
 
 using namespace baidu::shuttle;
@@ -49,6 +52,21 @@ TEST(Partitioner, KeyDefault) {
     EXPECT_EQ(reduce_no, kf_parti.HashCode("k1") % 100);
 }
 
+TEST(Partitioner, FineGrained) {
+    TaskInfo task;
+    task.mutable_job()->set_reduce_total(10);
+    task.mutable_job()->set_partition_total(1000);
+    KeyFieldBasedPartitioner kf_parti(task);
+    std::string key;
+    int reduce_no = kf_parti.Calc("k1\tk2", &key);
+    EXPECT_EQ(key, "k1");
+    EXPECT_EQ(reduce_no, kf_parti.HashCode("k1") % 1000);
+    IntHashPartitioner ih_parti(task);
+    reduce_no = ih_parti.Calc("517 key_123\tvalue456", &key);
+    EXPECT_EQ(key, "key_123");
+    EXPECT_EQ(reduce_no, 517);
+}
+
 TEST(Partitioner, IntHash) {
     TaskInfo task;
     task.mutable_job()->set_reduce_total(100);
@@ -80,6 +98,207 @@ TEST(Partitioner, IntHashInValid) {
     EXPECT_EQ(key, "aaaaaaaaaaaaazzzzzzzz");
 }
 
+TEST(Partitioner, Range) {
+    std::vector<std::string> split_points;
+    split_points.push_back("d");
+    split_points.push_back("m");
+    split_points.push_back("m");
+    split_points.push_back("t");
+    RangePartitioner range_parti(2, 1, split_points, "\t");
+    std::string key;
+    int reduce_no = range_parti.Calc("apple\t1\tx", &key);
+    EXPECT_EQ(key, "apple\t1");
+    EXPECT_EQ(reduce_no, 0);
+    reduce_no = range_parti.Calc("d\t2\tx", &key);
+    EXPECT_EQ(reduce_no, 1);
+    reduce_no = range_parti.Calc("m\t3", &key);
+    EXPECT_EQ(reduce_no, 3);
+    reduce_no = range_parti.Calc("zoo", &key);
+    EXPECT_EQ(key, "zoo");
+    EXPECT_EQ(reduce_no, 4);
+}
+
+TEST(Partitioner, RangeBySortKey) {
+    // A split point inside the records of one partition field
+    std::vector<std::string> split_points;
+    split_points.push_back("m\t5");
+    RangePartitioner range_parti(2, 1, split_points, "\t");
+    std::string key;
+    EXPECT_EQ(range_parti.Calc("m\t3\tx", &key), 0);
+    EXPECT_EQ(range_parti.Calc("m\t7\tx", &key), 1);
+    EXPECT_EQ(key, "m\t7");
+}
+
+TEST(Partitioner, RangeSplitPoints) {
+    std::vector<std::string> samples;
+    for (char c = 'z'; c >= 'a'; c--) {
+        samples.push_back(std::string(1, c));
+    }
+    std::vector<std::string> split_points;
+    RangePartitioner::ComputeSplitPoints(&samples, 4, &split_points);
+    ASSERT_EQ(split_points.size(), 3u);
+    EXPECT_EQ(split_points[0], "g");
+    EXPECT_EQ(split_points[1], "n");
+    EXPECT_EQ(split_points[2], "t");
+    RangePartitioner::ComputeSplitPoints(&samples, 1, &split_points);
+    EXPECT_TRUE(split_points.empty());
+}
+
+// Field extraction and hash as they were before FieldSplitter
+static int LegacyCalc(const std::string& line, int key_fields, int partition_fields,
+                      int reduce_total, const std::string& separator, std::string* key) {
+    const char* head = line.data();
+    const char* p1 = head;
+    const char* p2 = head;
+    const char* end = head + line.size();
+    int N = std::max(key_fields, partition_fields);
+    for (int i = 0; i < N; i++) {
+        if (i < key_fields) {
+            if (p1 >= end) {
+                break;
+            }
+            p1 += (strcspn(p1, separator.c_str()) + 1);
+        }
+        if (i < partition_fields) {
+            if (p2 >= end) {
+                break;
+            }
+            p2 += (strcspn(p2, separator.c_str()) + 1);
+        }
+    }
+    if (p1 == head) {
+        p1 = head + 1;
+    }
+    if (p2 == head) {
+        p2 = head + 1;
+    }
+    key->assign(head, p1 - 1);
+    std::string partition_key(head, p2 - 1);
+    if (partition_key.empty()) {
+        return 0;
+    }
+    unsigned int h = 1;
+    for (size_t i = 0; i < partition_key.size(); i++) {
+        h = 31 * h + static_cast<int>(partition_key[i]);
+    }
+    return static_cast<int>(h & 0x7FFFFFFF) % reduce_total;
+}
+
+TEST(Partitioner, SameAsLegacy) {
+    const char alphabet[] = {'a', 'b', '\t', ':', ',', '\0', '\xe4', '\xff'};
+    const char* separators[] = {"\t", ":", ":,"};
+    srand(17);
+    for (size_t s = 0; s < sizeof(separators) / sizeof(separators[0]); s++) {
+        for (int key_fields = 1; key_fields <= 4; key_fields++) {
+            for (int partition_fields = 1; partition_fields <= 4; partition_fields++) {
+                KeyFieldBasedPartitioner parti(key_fields, partition_fields, 97, separators[s]);
+                std::vector<std::string> lines;
+                for (int n = 0; n < 200; n++) {
+                    std::string line;
+                    int len = rand() % 24;
+                    for (int i = 0; i < len; i++) {
+                        line.push_back(alphabet[rand() % sizeof(alphabet)]);
+                    }
+                    lines.push_back(line);
+                }
+                std::vector<int> partitions;
+                std::vector<std::string> keys;
+                parti.CalcBatch(lines, &partitions, &keys);
+                ASSERT_EQ(partitions.size(), lines.size());
+                for (size_t i = 0; i < lines.size(); i++) {
+                    std::string legacy_key;
+                    int legacy = LegacyCalc(lines[i], key_fields, partition_fields, 97,
+                                            separators[s], &legacy_key);
+                    std::string key;
+                    EXPECT_EQ(parti.Calc(lines[i], &key), legacy);
+                    EXPECT_EQ(key, legacy_key);
+                    EXPECT_EQ(partitions[i], legacy);
+                    EXPECT_EQ(keys[i], legacy_key);
+                }
+            }
+        }
+    }
+}
+
+TEST(FieldSplitter, Split) {
+    FieldSplitter splitter("\t");
+    std::string line("a\tbb\t\tccc");
+    std::vector<size_t> offsets;
+    splitter.Split(line.data(), line.size(), 10, &offsets);
+    ASSERT_EQ(offsets.size(), 4u);
+    EXPECT_EQ(offsets[0], 1u);
+    EXPECT_EQ(offsets[1], 4u);
+    EXPECT_EQ(offsets[2], 5u);
+    EXPECT_EQ(offsets[3], 9u);
+    splitter.Split(line.data(), line.size(), 2, &offsets);
+    EXPECT_EQ(offsets.size(), 2u);
+    EXPECT_EQ(splitter.PrefixLength(line.data(), line.size(), 2), 4u);
+    EXPECT_EQ(splitter.PrefixLength(line.data(), line.size(), 9), line.size());
+}
+
+static std::vector<std::string> SortByNormalizedKey(const JobDescriptor& job,
+                                                    const std::vector<std::string>& keys) {
+    KeyNormalizer normalizer(job);
+    std::vector<std::pair<std::string, std::string> > encoded;
+    for (size_t i = 0; i < keys.size(); i++) {
+        std::string normalized;
+        normalizer.Normalize(keys[i], &normalized);
+        encoded.push_back(std::make_pair(normalized, keys[i]));
+    }
+    std::stable_sort(encoded.begin(), encoded.end());
+    std::vector<std::string> sorted;
+    for (size_t i = 0; i < encoded.size(); i++) {
+        sorted.push_back(encoded[i].second);
+    }
+    return sorted;
+}
+
+TEST(KeyNormalizer, NumericReverse) {
+    JobDescriptor job;
+    KeyFieldOrder* order = job.add_key_orders();
+    order->set_field_begin(2);
+    order->set_field_end(2);
+    order->set_numeric(true);
+    order->set_reverse(true);
+    order = job.add_key_orders();
+    order->set_field_begin(1);
+    order->set_field_end(1);
+    std::vector<std::string> keys;
+    keys.push_back("b\t9");
+    keys.push_back("a\t10");
+    keys.push_back("c\t-3.5");
+    keys.push_back("a\t9");
+    keys.push_back("d");
+    std::vector<std::string> sorted = SortByNormalizedKey(job, keys);
+    ASSERT_EQ(sorted.size(), 5u);
+    EXPECT_EQ(sorted[0], "a\t10");
+    EXPECT_EQ(sorted[1], "a\t9");
+    EXPECT_EQ(sorted[2], "b\t9");
+    EXPECT_EQ(sorted[3], "d");
+    EXPECT_EQ(sorted[4], "c\t-3.5");
+}
+
+TEST(KeyNormalizer, IgnoreCaseAndPrefix) {
+    JobDescriptor job;
+    job.set_key_separator(":");
+    KeyFieldOrder* order = job.add_key_orders();
+    order->set_ignore_case(true);
+    std::vector<std::string> keys;
+    keys.push_back("b:x");
+    keys.push_back("Ab");
+    keys.push_back("a");
+    keys.push_back(std::string("a\0", 2));
+    keys.push_back("B");
+    std::vector<std::string> sorted = SortByNormalizedKey(job, keys);
+    EXPECT_EQ(sorted[0], "a");
+    EXPECT_EQ(sorted[1], std::string("a\0", 2));
+    EXPECT_EQ(sorted[2], "Ab");
+    EXPECT_EQ(sorted[3], "B");
+    EXPECT_EQ(sorted[4], "b:x");
+    KeyNormalizer disabled((JobDescriptor()));
+    EXPECT_FALSE(disabled.Enabled());
+}
+
 int main(int argc, char* argv[]) {
     testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
@@ -0,0 +1,53 @@
+#include "phase_timer.h"
+
+#include <time.h>
+
+namespace baidu {
+namespace shuttle {
+
+const static char* sPhaseNames[kPhaseNum] = {
+    "setup", "first_input", "compute", "pipe_wait", "sort",
+    "spill", "merge", "output", "commit"
+};
+
+PhaseTimer::PhaseTimer() {
+    Reset();
+}
+
+void PhaseTimer::Reset() {
+    for (int i = 0; i < kPhaseNum; i++) {
+        us_[i] = 0;
+        count_[i] = 0;
+    }
+}
+
+void PhaseTimer::Add(TaskPhase phase, int64_t us) {
+    __sync_fetch_and_add(&us_[phase], us);
+    __sync_fetch_and_add(&count_[phase], 1);
+}
+
+void PhaseTimer::Fill(TaskUsage* usage) const {
+    usage->clear_phases();
+    for (int i = 0; i < kPhaseNum; i++) {
+        if (count_[i] == 0) {
+            continue;
+        }
+        PhaseTime* phase = usage->add_phases();
+        phase->set_phase(sPhaseNames[i]);
+        phase->set_ms(us_[i] / 1000);
+        phase->set_count(count_[i]);
+    }
+}
+
+int64_t PhaseTimer::NowUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+const char* PhaseTimer::Name(TaskPhase phase) {
+    return sPhaseNames[phase];
+}
+
+} //namespace shuttle
+} //namespace baidu
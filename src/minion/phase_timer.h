@@ -0,0 +1,70 @@
+#ifndef _BAIDU_SHUTTLE_MINION_PHASE_TIMER_H_
+#define _BAIDU_SHUTTLE_MINION_PHASE_TIMER_H_
+
+#include <stdint.h>
+#include "proto/shuttle.pb.h"
+
+namespace baidu {
+namespace shuttle {
+
+enum TaskPhase {
+    // Env, cgroup, plugin loading and the start of the user app
+    kPhaseSetup = 0,
+    // From the start of Exec to the first data coming from the user app or
+    // the input split
+    kPhaseFirstInput,
+    // Lifetime of the user app, or the plugin run
+    kPhaseCompute,
+    // Minion blocked on the user app, on its output or a full input queue
+    kPhasePipeWait,
+    kPhaseSort,
+    // Once for each sorted file written by a map
+    kPhaseSpill,
+    // Shuffle of reduces run in minion
+    kPhaseMerge,
+    // Writing the output, without the time waiting for the app
+    kPhaseOutput,
+    // Renames of the temporary output
+    kPhaseCommit,
+    kPhaseNum
+};
+
+// Wall time spent in each phase of a task, taken from the monotonic clock.
+// Phases may overlap, e.g. a map spills while its app computes. Threads
+// working for the task may add at the same time
+class PhaseTimer {
+public:
+    PhaseTimer();
+    void Reset();
+    void Add(TaskPhase phase, int64_t us);
+    // Phases not entered are left out
+    void Fill(TaskUsage* usage) const;
+
+    static int64_t NowUs();
+    static const char* Name(TaskPhase phase);
+private:
+    int64_t us_[kPhaseNum];
+    int32_t count_[kPhaseNum];
+};
+
+// Adds the time from construction to destruction, timer may be NULL
+class PhaseScope {
+public:
+    PhaseScope(PhaseTimer* timer, TaskPhase phase)
+        : timer_(timer), phase_(phase), begin_(PhaseTimer::NowUs()) {
+    }
+    ~PhaseScope() {
+        if (timer_ != NULL) {
+            timer_->Add(phase_, PhaseTimer::NowUs() - begin_);
+        }
+    }
+private:
+    PhaseTimer* timer_;
+    TaskPhase phase_;
+    int64_t begin_;
+};
+
+} //namespace shuttle
+} //namespace baidu
+
+#endif
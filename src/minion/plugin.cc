@@ -0,0 +1,490 @@
+#include "plugin.h"
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <sstream>
+#include <boost/bind.hpp>
+#include <boost/scoped_ptr.hpp>
+#include "common/filesystem.h"
+#include "common/shm_ring.h"
+#include "logging.h"
+#include "mutex.h"
+#include "thread.h"
+
+using baidu::common::Log;
+using baidu::common::INFO;
+using baidu::common::WARNING;
+
+namespace baidu {
+namespace shuttle {
+
+const static size_t sOutputBufferSize = 1 << 20;
+const static size_t sWorkerRingSize = 8 << 20;
+
+template <typename Func>
+static Func LoadSymbol(void* handle, const char* name) {
+    return reinterpret_cast<Func>(dlsym(handle, name));
+}
+
+Plugin::Plugin(const std::string& path, void* handle)
+    : path_(path), handle_(handle) {
+    create_ = LoadSymbol<CreateFunc>(handle, "shuttle_plugin_create");
+    destroy_ = LoadSymbol<DestroyFunc>(handle, "shuttle_plugin_destroy");
+    map_ = LoadSymbol<MapFunc>(handle, "shuttle_plugin_map");
+    reduce_begin_ = LoadSymbol<BeginFunc>(handle, "shuttle_plugin_reduce_begin");
+    reduce_value_ = LoadSymbol<ValueFunc>(handle, "shuttle_plugin_reduce_value");
+    reduce_end_ = LoadSymbol<EndFunc>(handle, "shuttle_plugin_reduce_end");
+    combine_begin_ = LoadSymbol<BeginFunc>(handle, "shuttle_plugin_combine_begin");
+    combine_value_ = LoadSymbol<ValueFunc>(handle, "shuttle_plugin_combine_value");
+    combine_end_ = LoadSymbol<EndFunc>(handle, "shuttle_plugin_combine_end");
+    finish_ = LoadSymbol<EndFunc>(handle, "shuttle_plugin_finish");
+}
+
+Plugin::~Plugin() {
+    dlclose(handle_);
+}
+
+Plugin* Plugin::Load(const std::string& path) {
+    void* handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (handle == NULL) {
+        LOG(WARNING, "fail to load plugin %s: %s", path.c_str(), dlerror());
+        return NULL;
+    }
+    typedef int (*VersionFunc)();
+    VersionFunc version = LoadSymbol<VersionFunc>(handle, "shuttle_plugin_abi_version");
+    if (version == NULL || version() != SHUTTLE_PLUGIN_ABI_VERSION) {
+        LOG(WARNING, "plugin %s is not built for ABI version %d",
+            path.c_str(), SHUTTLE_PLUGIN_ABI_VERSION);
+        dlclose(handle);
+        return NULL;
+    }
+    LOG(INFO, "load plugin: %s", path.c_str());
+    return new Plugin(path, handle);
+}
+
+bool Plugin::Provides(PluginPhase phase) const {
+    switch (phase) {
+    case kPluginMap:
+        return map_ != NULL;
+    case kPluginReduce:
+        return reduce_begin_ != NULL && reduce_value_ != NULL && reduce_end_ != NULL;
+    case kPluginCombine:
+        return combine_begin_ != NULL && combine_value_ != NULL && combine_end_ != NULL;
+    }
+    return false;
+}
+
+// Calls the plugin in the current process
+class PluginTask : public PluginRunner {
+public:
+    PluginTask(const Plugin* plugin, PluginPhase phase,
+               const std::map<std::string, std::string>& envs, const PluginSink& sink)
+        : plugin_(plugin), phase_(phase), envs_(envs), sink_(sink), state_(NULL),
+          started_(false), in_group_(false) {
+        output_.ctx = this;
+        output_.emit = &PluginTask::Emit;
+    }
+    virtual ~PluginTask() {
+        if (started_ && plugin_->destroy_ != NULL) {
+            plugin_->destroy_(state_);
+        }
+    }
+    virtual bool Start() {
+        // Only one task runs in a minion running plugins in process
+        std::map<std::string, std::string>::const_iterator it;
+        for (it = envs_.begin(); it != envs_.end(); ++it) {
+            ::setenv(it->first.c_str(), it->second.c_str(), 1);
+        }
+        state_ = plugin_->create_ != NULL ? plugin_->create_() : NULL;
+        started_ = true;
+        return true;
+    }
+    virtual bool Feed(const shuttle_slice_t& key, const shuttle_slice_t& value) {
+        if (phase_ == kPluginMap) {
+            return plugin_->map_(state_, key, value, &output_) == 0;
+        }
+        Plugin::BeginFunc begin = plugin_->reduce_begin_;
+        Plugin::ValueFunc on_value = plugin_->reduce_value_;
+        if (phase_ == kPluginCombine) {
+            begin = plugin_->combine_begin_;
+            on_value = plugin_->combine_value_;
+        }
+        if (!in_group_ || key.size != group_key_.size()
+                || memcmp(key.data, group_key_.data(), key.size) != 0) {
+            if (in_group_ && !EndGroup()) {
+                return false;
+            }
+            group_key_.assign(key.data, key.size);
+            in_group_ = true;
+            if (begin(state_, key, &output_) != 0) {
+                return false;
+            }
+        }
+        return on_value(state_, value, &output_) == 0;
+    }
+    virtual bool Finish() {
+        if (in_group_ && !EndGroup()) {
+            return false;
+        }
+        if (plugin_->finish_ != NULL && plugin_->finish_(state_, &output_) != 0) {
+            return false;
+        }
+        return true;
+    }
+private:
+    bool EndGroup() {
+        in_group_ = false;
+        Plugin::EndFunc end = phase_ == kPluginCombine ?
+                              plugin_->combine_end_ : plugin_->reduce_end_;
+        return end(state_, &output_) == 0;
+    }
+    static int Emit(void* ctx, shuttle_slice_t key, shuttle_slice_t value) {
+        PluginTask* task = static_cast<PluginTask*>(ctx);
+        return task->sink_(key, value) ? 0 : -1;
+    }
+private:
+    const Plugin* plugin_;
+    PluginPhase phase_;
+    std::map<std::string, std::string> envs_;
+    PluginSink sink_;
+    shuttle_output_t output_;
+    void* state_;
+    bool started_;
+    bool in_group_;
+    std::string group_key_;
+};
+
+// Records cross the rings as two 32-bit lengths, the key and the value
+static bool WriteFrame(ShmRing* ring, const shuttle_slice_t& key,
+                       const shuttle_slice_t& value) {
+    size_t size = sizeof(uint32_t) * 2 + key.size + value.size;
+    char* buf = ring->Reserve(size);
+    if (buf == NULL) {
+        return false;
+    }
+    uint32_t lens[2] = {static_cast<uint32_t>(key.size), static_cast<uint32_t>(value.size)};
+    memcpy(buf, lens, sizeof(lens));
+    memcpy(buf + sizeof(lens), key.data, key.size);
+    memcpy(buf + sizeof(lens) + key.size, value.data, value.size);
+    ring->Commit(size);
+    return true;
+}
+
+// Returns 1 and the size of the frame to consume, 0 at the end of the
+// ring and -1 for a frame cut short
+static int ReadFrame(ShmRing* ring, shuttle_slice_t* key,
+                     shuttle_slice_t* value, size_t* size) {
+    uint32_t lens[2];
+    const char* data = NULL;
+    size_t n = ring->Peek(&data, sizeof(lens));
+    if (n == 0) {
+        return 0;
+    }
+    if (n < sizeof(lens)) {
+        return -1;
+    }
+    memcpy(lens, data, sizeof(lens));
+    *size = sizeof(lens) + lens[0] + lens[1];
+    if (ring->Peek(&data, *size) < *size) {
+        return -1;
+    }
+    key->data = data + sizeof(lens);
+    key->size = lens[0];
+    value->data = key->data + key->size;
+    value->size = lens[1];
+    return 1;
+}
+
+// Calls the plugin in a forked worker. Input goes through one ring and
+// output comes back through another, drained by a thread into the sink
+class IsolatedRunner : public PluginRunner {
+public:
+    IsolatedRunner(const Plugin* plugin, PluginPhase phase,
+                   const std::map<std::string, std::string>& envs, const PluginSink& sink)
+        : plugin_(plugin), phase_(phase), envs_(envs), sink_(sink), worker_(-1),
+          drain_ok_(true), finished_(false), counters_(NULL) {
+    }
+    virtual ~IsolatedRunner() {
+        if (worker_ > 0 && !finished_) {
+            kill(worker_, SIGKILL);
+            output_ring_->CloseRead();
+            drain_thread_.Join();
+            waitpid(worker_, NULL, 0);
+        }
+    }
+    virtual bool Start() {
+        static int seq = 0;
+        std::stringstream prefix;
+        prefix << "/shuttle_" << getpid() << "_plugin_" << __sync_fetch_and_add(&seq, 1);
+        input_name_ = prefix.str() + "_in";
+        output_name_ = prefix.str() + "_out";
+        input_ring_.reset(ShmRing::Create(input_name_, sWorkerRingSize, ShmRing::kWriter));
+        output_ring_.reset(ShmRing::Create(output_name_, sWorkerRingSize, ShmRing::kReader));
+        if (!input_ring_ || !output_ring_) {
+            LOG(WARNING, "fail to create rings of plugin worker: %s", strerror(errno));
+            return false;
+        }
+        worker_ = fork();
+        if (worker_ < 0) {
+            LOG(WARNING, "fail to fork plugin worker: %s", strerror(errno));
+            return false;
+        }
+        if (worker_ == 0) {
+            _exit(RunWorker());
+        }
+        // An exited worker stays a zombie until it is waited, which the
+        // rings would take as alive
+        boost::function<bool ()> exited = boost::bind(&IsolatedRunner::WorkerExited, this);
+        input_ring_->SetGiveUpChecker(exited);
+        output_ring_->SetGiveUpChecker(exited);
+        counters_ = FileSystem::BoundCounters();
+        drain_thread_.Start(boost::bind(&IsolatedRunner::Drain, this));
+        return true;
+    }
+    virtual bool Feed(const shuttle_slice_t& key, const shuttle_slice_t& value) {
+        if (sizeof(uint32_t) * 2 + key.size + value.size > input_ring_->Capacity()) {
+            LOG(WARNING, "record too large for plugin worker");
+            return false;
+        }
+        return WriteFrame(input_ring_.get(), key, value);
+    }
+    virtual bool Finish() {
+        input_ring_->CloseWrite();
+        drain_thread_.Join();
+        int status = 0;
+        waitpid(worker_, &status, 0);
+        finished_ = true;
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            LOG(WARNING, "plugin worker fails, status: %d", status);
+            return false;
+        }
+        MutexLock lock(&mu_);
+        return drain_ok_;
+    }
+private:
+    bool WorkerExited() {
+        siginfo_t info;
+        info.si_pid = 0;
+        return waitid(P_PID, worker_, &info, WEXITED | WNOHANG | WNOWAIT) != 0
+               || info.si_pid == worker_;
+    }
+    // Runs in the worker, which only touches the rings and the plugin
+    int RunWorker() {
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        clearenv();
+        std::map<std::string, std::string>::const_iterator it;
+        for (it = envs_.begin(); it != envs_.end(); ++it) {
+            setenv(it->first.c_str(), it->second.c_str(), 1);
+        }
+        ShmRing* input = ShmRing::Attach(input_name_, ShmRing::kReader);
+        ShmRing* output = ShmRing::Attach(output_name_, ShmRing::kWriter);
+        if (input == NULL || output == NULL) {
+            return 1;
+        }
+        PluginTask task(plugin_, phase_, envs_, boost::bind(&WriteFrame, output, _1, _2));
+        task.Start();
+        shuttle_slice_t key;
+        shuttle_slice_t value;
+        size_t size = 0;
+        int ret = 0;
+        while ((ret = ReadFrame(input, &key, &value, &size)) > 0) {
+            if (!task.Feed(key, value)) {
+                return 2;
+            }
+            input->Consume(size);
+        }
+        if (ret < 0 || !task.Finish()) {
+            return 2;
+        }
+        output->CloseWrite();
+        return 0;
+    }
+    void Drain() {
+        // The sink writes the output of the task
+        FileSystem::BindCounters(counters_);
+        shuttle_slice_t key;
+        shuttle_slice_t value;
+        size_t size = 0;
+        int ret = 0;
+        bool ok = true;
+        while ((ret = ReadFrame(output_ring_.get(), &key, &value, &size)) > 0) {
+            if (ok && !sink_(key, value)) {
+                // Keeps draining, so the worker is not blocked on a full ring
+                ok = false;
+            }
+            output_ring_->Consume(size);
+        }
+        MutexLock lock(&mu_);
+        drain_ok_ = ok && ret == 0;
+    }
+private:
+    const Plugin* plugin_;
+    PluginPhase phase_;
+    std::map<std::string, std::string> envs_;
+    PluginSink sink_;
+    std::string input_name_;
+    std::string output_name_;
+    boost::scoped_ptr<ShmRing> input_ring_;
+    boost::scoped_ptr<ShmRing> output_ring_;
+    pid_t worker_;
+    common::Thread drain_thread_;
+    Mutex mu_;
+    bool drain_ok_;
+    bool finished_;
+    // Of the task the runner works for
+    DfsCounters* counters_;
+};
+
+PluginRunner* PluginRunner::Create(const Plugin* plugin, PluginPhase phase,
+                                   bool isolated, const std::map<std::string, std::string>& envs,
+                                   const PluginSink& sink) {
+    if (isolated) {
+        return new IsolatedRunner(plugin, phase, envs, sink);
+    }
+    return new PluginTask(plugin, phase, envs, sink);
+}
+
+PluginRecordFormat::PluginRecordFormat(const JobDescriptor& job)
+    : streaming_(job.pipe_style() == kStreaming),
+      key_fields_(std::max(job.key_fields_num(), 1)),
+      splitter_(job.key_separator().empty() ? "\t" : job.key_separator()) {
+}
+
+void PluginRecordFormat::Compose(const shuttle_slice_t& key, const shuttle_slice_t& value,
+                                 std::string* record) const {
+    record->clear();
+    if (streaming_) {
+        record->reserve(key.size + value.size + 1);
+        record->append(key.data, key.size);
+        if (value.size > 0) {
+            record->push_back('\t');
+            record->append(value.data, value.size);
+        }
+        return;
+    }
+    int32_t key_len = key.size;
+    int32_t value_len = value.size;
+    record->reserve(sizeof(key_len) + key.size + sizeof(value_len) + value.size);
+    record->append((const char*)(&key_len), sizeof(key_len));
+    record->append(key.data, key.size);
+    record->append((const char*)(&value_len), sizeof(value_len));
+    record->append(value.data, value.size);
+}
+
+bool PluginRecordFormat::Split(const char* record, size_t size,
+                               shuttle_slice_t* key, shuttle_slice_t* value) const {
+    if (streaming_) {
+        key->data = record;
+        key->size = splitter_.PrefixLength(record, size, key_fields_);
+        value->data = record;
+        value->size = size;
+        return true;
+    }
+    return SplitPair(record, size, key, value);
+}
+
+bool PluginRecordFormat::SplitPair(const char* record, size_t size,
+                                   shuttle_slice_t* key, shuttle_slice_t* value) {
+    int32_t key_len = 0;
+    int32_t value_len = 0;
+    if (size < sizeof(key_len)) {
+        return false;
+    }
+    memcpy(&key_len, record, sizeof(key_len));
+    if (key_len < 0 || size < sizeof(key_len) + key_len + sizeof(value_len)) {
+        return false;
+    }
+    memcpy(&value_len, record + sizeof(key_len) + key_len, sizeof(value_len));
+    if (value_len < 0 || size != sizeof(key_len) + key_len + sizeof(value_len) + value_len) {
+        return false;
+    }
+    key->data = record + sizeof(key_len);
+    key->size = key_len;
+    value->data = key->data + key_len + sizeof(value_len);
+    value->size = value_len;
+    return true;
+}
+
+size_t PluginRecordFormat::NextLength(const char* data, size_t size) const {
+    if (streaming_) {
+        const char* eol = static_cast<const char*>(memchr(data, '\n', size));
+        return eol == NULL ? 0 : eol - data + 1;
+    }
+    int32_t key_len = 0;
+    int32_t value_len = 0;
+    if (size < sizeof(key_len)) {
+        return 0;
+    }
+    memcpy(&key_len, data, sizeof(key_len));
+    size_t value_at = sizeof(key_len) + key_len;
+    if (size < value_at + sizeof(value_len)) {
+        return 0;
+    }
+    memcpy(&value_len, data + value_at, sizeof(value_len));
+    size_t total = value_at + sizeof(value_len) + value_len;
+    return size < total ? 0 : total;
+}
+
+PluginOutput::PluginOutput(const TaskInfo& task)
+    : binary_(task.job().output_format() == kBinaryOutput), fs_(NULL) {
+}
+
+PluginOutput::~PluginOutput() {
+    delete fs_;
+}
+
+bool PluginOutput::Supports(const TaskInfo& task) {
+    const JobDescriptor& job = task.job();
+    if (job.output_format() == kBinaryOutput) {
+        return true;
+    }
+    // Compression is done by gzip behind commands in app_wrapper.sh
+    return job.output_format() == kTextOutput && !job.compress_output();
+}
+
+bool PluginOutput::Open(const std::string& file_name, FileSystem::Param& param) {
+    if (binary_) {
+        return seqfile_.Open(file_name, param, kWriteFile);
+    }
+    fs_ = FileSystem::CreateInfHdfs();
+    buffer_.reserve(sOutputBufferSize);
+    return fs_->Open(file_name, param, kWriteFile);
+}
+
+bool PluginOutput::Write(const shuttle_slice_t& key, const shuttle_slice_t& value) {
+    if (binary_) {
+        return seqfile_.WriteNextRecord(std::string(key.data, key.size),
+                                        std::string(value.data, value.size));
+    }
+    buffer_.append(key.data, key.size);
+    if (value.size > 0) {
+        buffer_.push_back('\t');
+        buffer_.append(value.data, value.size);
+    }
+    buffer_.push_back('\n');
+    if (buffer_.size() < sOutputBufferSize) {
+        return true;
+    }
+    bool ok = fs_->WriteAll((void*)buffer_.data(), buffer_.size());
+    buffer_.clear();
+    return ok;
+}
+
+bool PluginOutput::Close() {
+    if (binary_) {
+        return seqfile_.Close();
+    }
+    bool ok = buffer_.empty() || fs_->WriteAll((void*)buffer_.data(), buffer_.size());
+    buffer_.clear();
+    return fs_->Close() && ok;
+}
+
+} //namespace shuttle
+} //namespace baidu
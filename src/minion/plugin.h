@@ -0,0 +1,123 @@
+#ifndef _BAIDU_SHUTTLE_MINION_PLUGIN_H_
+#define _BAIDU_SHUTTLE_MINION_PLUGIN_H_
+
+#include <map>
+#include <string>
+#include <boost/function.hpp>
+#include "proto/shuttle.pb.h"
+#include "common/filesystem.h"
+#include "sdk/shuttle_plugin.h"
+#include "partition.h"
+
+namespace baidu {
+namespace shuttle {
+
+enum PluginPhase {
+    kPluginMap = 0,
+    kPluginReduce = 1,
+    kPluginCombine = 2
+};
+
+// Entry points of a native plugin, see sdk/shuttle_plugin.h
+class Plugin {
+public:
+    // Returns NULL if the object can not be loaded or has a different ABI
+    static Plugin* Load(const std::string& path);
+    ~Plugin();
+    const std::string& Path() const {
+        return path_;
+    }
+    bool Provides(PluginPhase phase) const;
+private:
+    Plugin(const std::string& path, void* handle);
+    friend class PluginTask;
+    typedef void* (*CreateFunc)();
+    typedef void (*DestroyFunc)(void*);
+    typedef int (*MapFunc)(void*, shuttle_slice_t, shuttle_slice_t, shuttle_output_t*);
+    typedef int (*BeginFunc)(void*, shuttle_slice_t, shuttle_output_t*);
+    typedef int (*ValueFunc)(void*, shuttle_slice_t, shuttle_output_t*);
+    typedef int (*EndFunc)(void*, shuttle_output_t*);
+    std::string path_;
+    void* handle_;
+    CreateFunc create_;
+    DestroyFunc destroy_;
+    MapFunc map_;
+    BeginFunc reduce_begin_;
+    ValueFunc reduce_value_;
+    EndFunc reduce_end_;
+    BeginFunc combine_begin_;
+    ValueFunc combine_value_;
+    EndFunc combine_end_;
+    EndFunc finish_;
+};
+
+// Takes records a plugin emits, false fails the task
+typedef boost::function<bool (const shuttle_slice_t&, const shuttle_slice_t&)> PluginSink;
+
+// Runs one phase of a plugin over the records of a task
+class PluginRunner {
+public:
+    // A worker forked by an isolated runner runs the plugin, so a crash
+    // of the plugin only fails the task. The worker takes envs as its
+    // environment, a plugin run in process has them set in the one of
+    // minion when it starts
+    static PluginRunner* Create(const Plugin* plugin, PluginPhase phase,
+                                bool isolated, const std::map<std::string, std::string>& envs,
+                                const PluginSink& sink);
+    virtual ~PluginRunner() { }
+    virtual bool Start() = 0;
+    // Map takes records one by one, reduce and combine take runs of
+    // records with equal keys
+    virtual bool Feed(const shuttle_slice_t& key, const shuttle_slice_t& value) = 0;
+    // Ends the input, the sink has taken all output once it returns
+    virtual bool Finish() = 0;
+};
+
+// Converts between records as commands read and write them and the key
+// and value views plugins take
+class PluginRecordFormat {
+public:
+    explicit PluginRecordFormat(const JobDescriptor& job);
+    // Line of key and value for streaming, length prefixed pair otherwise
+    void Compose(const shuttle_slice_t& key, const shuttle_slice_t& value,
+                 std::string* record) const;
+    // Key and value of a record as reduce and combine take them: the key
+    // fields and the whole line for streaming, without the newline
+    bool Split(const char* record, size_t size,
+               shuttle_slice_t* key, shuttle_slice_t* value) const;
+    // Length of the complete record at the head of a stream of records,
+    // newline included, or 0 if more data is needed
+    size_t NextLength(const char* data, size_t size) const;
+    // Key and value of a length prefixed pair, as of sequence files
+    static bool SplitPair(const char* record, size_t size,
+                          shuttle_slice_t* key, shuttle_slice_t* value);
+    bool Streaming() const {
+        return streaming_;
+    }
+private:
+    bool streaming_;
+    int key_fields_;
+    FieldSplitter splitter_;
+};
+
+// Writes records a plugin emits to the output file of a task
+class PluginOutput {
+public:
+    explicit PluginOutput(const TaskInfo& task);
+    ~PluginOutput();
+    // Only text and binary outputs are written by plugins
+    static bool Supports(const TaskInfo& task);
+    bool Open(const std::string& file_name, FileSystem::Param& param);
+    bool Write(const shuttle_slice_t& key, const shuttle_slice_t& value);
+    bool Close();
+private:
+    bool binary_;
+    FileSystem* fs_;
+    InfSeqFile seqfile_;
+    std::string buffer_;
+};
+
+} //namespace shuttle
+} //namespace baidu
+
+#endif
@@ -46,6 +46,17 @@ int main(int argc, char** argv) {
     std::cout << "task id: " << response.task_id() << std::endl;
     std::cout << "attempt id: " << response.attempt_id() << std::endl;
     std::cout << "status: " << task_state[response.attempt_id()] << std::endl;
+    if (response.slots_size() > 1) {
+        for (int i = 0; i < response.slots_size(); i++) {
+            const baidu::shuttle::SlotStatus& slot = response.slots(i);
+            std::cout << "slot " << slot.slot() << ": task " << slot.task_id()
+                      << ", attempt " << slot.attempt_id() << ", "
+                      << baidu::shuttle::TaskState_Name(slot.task_state())
+                      << ", last task used " << slot.usage().user_time_ms() << "ms user, "
+                      << slot.usage().sys_time_ms() << "ms sys, "
+                      << slot.usage().max_rss_kb() << "KB rss" << std::endl;
+        }
+    }
     if (FLAGS_a && response.has_log_msg()) {
         std::cout << "log file:" << std::endl;
         std::cout << response.log_msg() << std::endl;
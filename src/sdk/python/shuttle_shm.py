@@ -0,0 +1,137 @@
+#!/bin/env python
+"""Shared-memory record transport for Python mappers and reducers.
+
+Loads libshuttle_shm.so, which is looked up beside this module and in the
+working directory of the task, so both can be shipped with -file. Without
+the rings of the shared-memory transport, streams fall back to stdin and
+stdout, so the same program runs in jobs that use pipes.
+
+    import shuttle_shm
+    out = shuttle_shm.open_output()
+    for line in shuttle_shm.open_input().lines():
+        out.write(line.upper() + b'\\n')
+    out.close()
+"""
+import ctypes
+import os
+
+_LIB_NAME = 'libshuttle_shm.so'
+
+
+def _load():
+    dirs = [os.path.dirname(os.path.abspath(__file__)), os.getcwd()]
+    for d in dirs:
+        path = os.path.join(d, _LIB_NAME)
+        if os.path.exists(path):
+            return ctypes.CDLL(path)
+    return ctypes.CDLL(_LIB_NAME)
+
+_lib = _load()
+_lib.shuttle_shm_open_input.restype = ctypes.c_void_p
+_lib.shuttle_shm_open_output.restype = ctypes.c_void_p
+_lib.shuttle_shm_is_ring.argtypes = [ctypes.c_void_p]
+_lib.shuttle_shm_read.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_void_p)]
+_lib.shuttle_shm_read.restype = ctypes.c_ssize_t
+_lib.shuttle_shm_read_line.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_void_p)]
+_lib.shuttle_shm_read_line.restype = ctypes.c_ssize_t
+_lib.shuttle_shm_consume.argtypes = [ctypes.c_void_p, ctypes.c_size_t]
+_lib.shuttle_shm_reserve.argtypes = [ctypes.c_void_p, ctypes.c_size_t]
+_lib.shuttle_shm_reserve.restype = ctypes.c_void_p
+_lib.shuttle_shm_commit.argtypes = [ctypes.c_void_p, ctypes.c_size_t]
+_lib.shuttle_shm_write.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_size_t]
+_lib.shuttle_shm_close.argtypes = [ctypes.c_void_p]
+
+
+def _view(address, size):
+    view = memoryview((ctypes.c_ubyte * size).from_address(address))
+    # Plain bytes format, so slices take and compare bytes on python 3
+    if hasattr(view, 'cast'):
+        view = view.cast('B')
+    return view
+
+
+class Input(object):
+    """Input of the task, read in batches or in lines"""
+
+    def __init__(self):
+        self._stream = _lib.shuttle_shm_open_input()
+        if not self._stream:
+            raise IOError('fail to open task input')
+
+    def is_ring(self):
+        return _lib.shuttle_shm_is_ring(self._stream) != 0
+
+    def _span(self, ptr, size):
+        if size < 0:
+            raise IOError('fail to read task input')
+        return _view(ptr.value, size)
+
+    def read(self):
+        """Returns the next batch as a memoryview of the ring, None at the
+        end. The view is only valid until consume or the next read"""
+        ptr = ctypes.c_void_p()
+        size = _lib.shuttle_shm_read(self._stream, ctypes.byref(ptr))
+        if size == 0:
+            return None
+        return self._span(ptr, size)
+
+    def consume(self, size):
+        _lib.shuttle_shm_consume(self._stream, size)
+
+    def lines(self):
+        """Yields lines as bytes without newlines, copied out of the ring"""
+        ptr = ctypes.c_void_p()
+        while True:
+            size = _lib.shuttle_shm_read_line(self._stream, ctypes.byref(ptr))
+            if size == 0:
+                return
+            if size < 0:
+                raise IOError('fail to read task input')
+            yield ctypes.string_at(ptr.value, size)
+
+    def close(self):
+        if self._stream:
+            _lib.shuttle_shm_close(self._stream)
+            self._stream = None
+
+
+class Output(object):
+    """Output of the task, must be closed so the minion sees its end"""
+
+    def __init__(self):
+        self._stream = _lib.shuttle_shm_open_output()
+        if not self._stream:
+            raise IOError('fail to open task output')
+
+    def is_ring(self):
+        return _lib.shuttle_shm_is_ring(self._stream) != 0
+
+    def write(self, data):
+        if _lib.shuttle_shm_write(self._stream, data, len(data)) != 0:
+            raise IOError('fail to write task output')
+
+    def reserve(self, size):
+        """Returns a writable memoryview of size bytes in the ring, which
+        is sent with commit"""
+        ptr = _lib.shuttle_shm_reserve(self._stream, size)
+        if not ptr:
+            raise IOError('fail to write task output')
+        return _view(ptr, size)
+
+    def commit(self, size):
+        _lib.shuttle_shm_commit(self._stream, size)
+
+    def close(self):
+        if self._stream:
+            ret = _lib.shuttle_shm_close(self._stream)
+            self._stream = None
+            if ret != 0:
+                raise IOError('fail to flush task output')
+
+
+def open_input():
+    return Input()
+
+
+def open_output():
+    return Output()
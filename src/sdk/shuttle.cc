@@ -3,8 +3,10 @@
 #include <iterator>
 #include <algorithm>
 #include <limits>
+#include <boost/scoped_ptr.hpp>
 
 #include "proto/app_master.pb.h"
+#include "proto/minion.pb.h"
 #include "common/rpc_client.h"
 #include "logging.h"
 
@@ -32,8 +34,24 @@ public:
                  bool show_detail,
                  std::string& error_msg,
                  std::map<std::string, int64_t>& counters);
+    bool ShowJob(const std::string& job_id,
+                 const sdk::TaskFilter& filter,
+                 bool display_all,
+                 bool show_detail,
+                 sdk::JobInstance& job,
+                 std::vector<sdk::TaskInstance>& tasks,
+                 std::string& error_msg,
+                 std::map<std::string, int64_t>& counters,
+                 int32_t& next_offset,
+                 int64_t& version,
+                 int64_t& epoch);
     bool ListJobs(std::vector<sdk::JobInstance>& jobs,
-                  bool display_all);
+                  bool display_all,
+                  bool summary);
+    bool TraceJob(const std::string& job_id, std::string& trace);
+    bool GetMetrics(const std::string& minion_addr,
+                    const std::string& prefix,
+                    std::vector<sdk::Metric>& metrics);
     void SetRpcTimeout(int second);
 private:
     std::string master_addr_;
@@ -117,6 +135,22 @@ bool ShuttleImpl::SubmitJob(const sdk::JobDescription& job_desc, std::string& jo
     for (size_t i = 0; i < job_desc.cmdenvs.size(); i++) {
         job->add_cmdenvs(job_desc.cmdenvs[i]);   
     }
+    job->set_partition_total(job_desc.partition_total);
+    job->set_reduce_target_size(job_desc.reduce_target_size);
+    job->set_reduce_associative(job_desc.reduce_associative);
+    job->set_hash_aggregation(job_desc.hash_aggregation);
+    job->set_shm_transport(job_desc.shm_transport);
+    job->set_plugin(job_desc.plugin);
+    job->set_plugin_isolation(job_desc.plugin_isolation);
+    for (size_t i = 0; i < job_desc.key_orders.size(); i++) {
+        const sdk::KeyFieldOrder& order = job_desc.key_orders[i];
+        ::baidu::shuttle::KeyFieldOrder* key_order = job->add_key_orders();
+        key_order->set_field_begin(order.field_begin);
+        key_order->set_field_end(order.field_end);
+        key_order->set_numeric(order.numeric);
+        key_order->set_reverse(order.reverse);
+        key_order->set_ignore_case(order.ignore_case);
+    }
     bool ok = rpc_client_.SendRequest(master_stub_, &Master_Stub::SubmitJob,
                                       &request, &response, rpc_timeout_, 1);
     if (!ok) {
@@ -196,30 +230,23 @@ bool ShuttleImpl::KillTask(const std::string& job_id, sdk::TaskType mode,
     return response.status() == kOk;
 }
 
-bool ShuttleImpl::ShowJob(const std::string& job_id, 
-                          sdk::JobInstance& job,
-                          std::vector<sdk::TaskInstance>& tasks,
-                          bool display_all,
-                          bool show_detail,
-                          std::string& error_msg,
-                          std::map<std::string, int64_t>& counters) {
-    ::baidu::shuttle::ShowJobRequest request;
-    ::baidu::shuttle::ShowJobResponse response;
-    request.set_jobid(job_id);
-    request.set_all(display_all);
-    request.set_show_detail(show_detail);
-
-    bool ok = rpc_client_.SendRequest(master_stub_, &Master_Stub::ShowJob,
-                                      &request, &response, rpc_timeout_, 1);
-    if (!ok) {
-        LOG(WARNING, "failed to rpc: %s", master_addr_.c_str());
-        return false;
-    }
-    if (response.status() != kOk) {
-        return false;
-    }
+static void FillTaskUsage(const UsageSummary& summary, sdk::TaskUsage& usage) {
+    const TaskUsage& total = summary.total();
+    usage.attempts = summary.attempts();
+    usage.user_time_ms = total.user_time_ms();
+    usage.sys_time_ms = total.sys_time_ms();
+    usage.max_rss_kb = total.max_rss_kb();
+    usage.dfs_read_bytes = total.dfs_read_bytes();
+    usage.dfs_write_bytes = total.dfs_write_bytes();
+    usage.local_read_bytes = total.local_read_bytes();
+    usage.local_write_bytes = total.local_write_bytes();
+    usage.pipe_in_bytes = total.pipe_in_bytes();
+    usage.pipe_out_bytes = total.pipe_out_bytes();
+    usage.pipe_in_wait_ms = total.pipe_in_wait_ms();
+    usage.pipe_out_wait_ms = total.pipe_out_wait_ms();
+}
 
-    const JobOverview& joboverview = response.job();
+static void FillJobInstance(const JobOverview& joboverview, sdk::JobInstance& job) {
     const JobDescriptor& desc = joboverview.desc();
     job.desc.name = desc.name();
     job.desc.user = desc.user();
@@ -259,6 +286,23 @@ bool ShuttleImpl::ShowJob(const std::string& job_id,
     job.desc.map_retry = desc.map_retry();
     job.desc.reduce_retry = desc.reduce_retry();
     job.desc.split_size = desc.split_size();
+    job.desc.partition_total = desc.partition_total();
+    job.desc.reduce_target_size = desc.reduce_target_size();
+    job.desc.reduce_associative = desc.reduce_associative();
+    job.desc.hash_aggregation = desc.hash_aggregation();
+    job.desc.shm_transport = desc.shm_transport();
+    job.desc.plugin = desc.plugin();
+    job.desc.plugin_isolation = desc.plugin_isolation();
+    job.desc.key_orders.clear();
+    for (int i = 0; i < desc.key_orders_size(); i++) {
+        sdk::KeyFieldOrder order;
+        order.field_begin = desc.key_orders(i).field_begin();
+        order.field_end = desc.key_orders(i).field_end();
+        order.numeric = desc.key_orders(i).numeric();
+        order.reverse = desc.key_orders(i).reverse();
+        order.ignore_case = desc.key_orders(i).ignore_case();
+        job.desc.key_orders.push_back(order);
+    }
 
     job.jobid = joboverview.jobid();
     job.state = (sdk::JobState)joboverview.state();
@@ -279,14 +323,20 @@ bool ShuttleImpl::ShowJob(const std::string& job_id,
     job.reduce_stat.killed = reduce_stat.killed();
     job.reduce_stat.completed = reduce_stat.completed();
 
+    FillTaskUsage(joboverview.map_usage(), job.map_usage);
+    FillTaskUsage(joboverview.reduce_usage(), job.reduce_usage);
+
     job.start_time = joboverview.start_time();
     job.finish_time = joboverview.finish_time();
+}
 
+static void FillTaskInstances(const ShowJobResponse& response, const std::string& job_id,
+                              std::vector<sdk::TaskInstance>& tasks) {
     ::google::protobuf::RepeatedPtrField<TaskOverview>::const_iterator it;
     for (it = response.tasks().begin(); it != response.tasks().end(); ++it) {
         sdk::TaskInstance task;
         const TaskInfo& info = it->info();
-        task.job_id = job.jobid;
+        task.job_id = job_id;
         task.task_id = info.task_id();
         task.attempt_id = info.attempt_id();
         task.input_file = info.input().input_file();
@@ -296,8 +346,38 @@ bool ShuttleImpl::ShowJob(const std::string& job_id,
         task.progress = it->progress();
         task.start_time = it->start_time();
         task.end_time = it->end_time();
+        for (int i = 0; i < it->phases_size(); ++i) {
+            task.phase_ms[it->phases(i).phase()] = it->phases(i).ms();
+        }
         tasks.push_back(task);
     }
+}
+
+bool ShuttleImpl::ShowJob(const std::string& job_id, 
+                          sdk::JobInstance& job,
+                          std::vector<sdk::TaskInstance>& tasks,
+                          bool display_all,
+                          bool show_detail,
+                          std::string& error_msg,
+                          std::map<std::string, int64_t>& counters) {
+    ::baidu::shuttle::ShowJobRequest request;
+    ::baidu::shuttle::ShowJobResponse response;
+    request.set_jobid(job_id);
+    request.set_all(display_all);
+    request.set_show_detail(show_detail);
+
+    bool ok = rpc_client_.SendRequest(master_stub_, &Master_Stub::ShowJob,
+                                      &request, &response, rpc_timeout_, 1);
+    if (!ok) {
+        LOG(WARNING, "failed to rpc: %s", master_addr_.c_str());
+        return false;
+    }
+    if (response.status() != kOk) {
+        return false;
+    }
+
+    FillJobInstance(response.job(), job);
+    FillTaskInstances(response, job.jobid, tasks);
     error_msg = response.error_msg();
     ::google::protobuf::RepeatedPtrField<TaskCounter>::const_iterator jt;
     for (jt = response.counters().begin(); jt != response.counters().end(); jt++) {
@@ -306,11 +386,60 @@ bool ShuttleImpl::ShowJob(const std::string& job_id,
     return true;
 }
 
+bool ShuttleImpl::ShowJob(const std::string& job_id,
+                          const sdk::TaskFilter& filter,
+                          bool display_all,
+                          bool show_detail,
+                          sdk::JobInstance& job,
+                          std::vector<sdk::TaskInstance>& tasks,
+                          std::string& error_msg,
+                          std::map<std::string, int64_t>& counters,
+                          int32_t& next_offset,
+                          int64_t& version,
+                          int64_t& epoch) {
+    ::baidu::shuttle::ShowJobRequest request;
+    ::baidu::shuttle::ShowJobResponse response;
+    request.set_jobid(job_id);
+    request.set_all(display_all);
+    request.set_show_detail(show_detail);
+    for (std::vector<sdk::TaskState>::const_iterator it = filter.states.begin();
+            it != filter.states.end(); ++it) {
+        request.add_task_states((TaskState)*it);
+    }
+    request.set_since_version(filter.since_version);
+    request.set_since_epoch(filter.since_epoch);
+    request.set_offset(filter.offset);
+    request.set_limit(filter.limit);
+
+    bool ok = rpc_client_.SendRequest(master_stub_, &Master_Stub::ShowJob,
+                                      &request, &response, rpc_timeout_, 1);
+    if (!ok) {
+        LOG(WARNING, "failed to rpc: %s", master_addr_.c_str());
+        return false;
+    }
+    if (response.status() != kOk) {
+        return false;
+    }
+    FillJobInstance(response.job(), job);
+    FillTaskInstances(response, job.jobid, tasks);
+    error_msg = response.error_msg();
+    ::google::protobuf::RepeatedPtrField<TaskCounter>::const_iterator jt;
+    for (jt = response.counters().begin(); jt != response.counters().end(); jt++) {
+        counters[jt->key()] = jt->value();
+    }
+    next_offset = response.has_next_offset() ? response.next_offset() : -1;
+    version = response.version();
+    epoch = response.epoch();
+    return true;
+}
+
 bool ShuttleImpl::ListJobs(std::vector<sdk::JobInstance>& jobs,
-                           bool display_all) {
+                           bool display_all,
+                           bool summary) {
     ::baidu::shuttle::ListJobsRequest request;
     ::baidu::shuttle::ListJobsResponse response;
     request.set_all(display_all);
+    request.set_summary(summary);
 
     bool ok = rpc_client_.SendRequest(master_stub_, &Master_Stub::ListJobs,
                                       &request, &response, rpc_timeout_, 1);
@@ -324,68 +453,70 @@ bool ShuttleImpl::ListJobs(std::vector<sdk::JobInstance>& jobs,
     ::google::protobuf::RepeatedPtrField<JobOverview>::const_iterator it;
     for (it = response.jobs().begin(); it != response.jobs().end(); ++it) {
         sdk::JobInstance job;
-        const JobDescriptor& desc = it->desc();
-        job.desc.name = desc.name();
-        job.desc.user = desc.user();
-        job.desc.priority = (sdk::JobPriority)desc.priority();
-        job.desc.map_capacity = desc.map_capacity();
-        job.desc.reduce_capacity = desc.reduce_capacity();
-        job.desc.millicores = desc.millicores();
-        job.desc.memory = desc.memory();
-        std::copy(desc.inputs().begin(), desc.inputs().end(),
-                  std::back_inserter(job.desc.inputs));
-        job.desc.output = desc.output();
-        std::copy(desc.files().begin(), desc.files().end(),
-                  std::back_inserter(job.desc.files));
-        job.desc.map_command = desc.map_command();
-        job.desc.reduce_command = desc.reduce_command();
-        job.desc.combine_command = desc.combine_command();
-        job.desc.partition = (sdk::PartitionMethod)desc.partition();
-        job.desc.map_total = desc.map_total();
-        job.desc.reduce_total = desc.reduce_total();
-        job.desc.key_separator = desc.key_separator();
-        job.desc.key_fields_num = desc.key_fields_num();
-        job.desc.partition_fields_num = desc.partition_fields_num();
-        job.desc.input_dfs.host = desc.input_dfs().host();
-        job.desc.input_dfs.port = desc.input_dfs().port();
-        job.desc.input_dfs.user = desc.input_dfs().user();
-        job.desc.input_dfs.password = desc.input_dfs().password();
-        job.desc.output_dfs.host = desc.output_dfs().host();
-        job.desc.output_dfs.port = desc.output_dfs().port();
-        job.desc.output_dfs.user = desc.output_dfs().user();
-        job.desc.output_dfs.password = desc.output_dfs().password();
-        job.desc.input_format = (sdk::InputFormat)desc.input_format();
-        job.desc.output_format = (sdk::OutputFormat)desc.output_format();
-        job.desc.pipe_style = (sdk::PipeStyle)desc.pipe_style();
-        job.desc.map_allow_duplicates = desc.map_allow_duplicates();
-        job.desc.reduce_allow_duplicates = desc.reduce_allow_duplicates();
-        job.desc.map_retry = desc.map_retry();
-        job.desc.reduce_retry = desc.reduce_retry();
-        job.desc.split_size = desc.split_size();
-
-        job.jobid = it->jobid();
-        job.state = (sdk::JobState)it->state();
-
-        const TaskStatistics& map_stat = it->map_stat();
-        job.map_stat.total = map_stat.total();
-        job.map_stat.pending = map_stat.pending();
-        job.map_stat.running = map_stat.running();
-        job.map_stat.failed = map_stat.failed();
-        job.map_stat.killed = map_stat.killed();
-        job.map_stat.completed = map_stat.completed();
-
-        const TaskStatistics& reduce_stat = it->reduce_stat();
-        job.reduce_stat.total = reduce_stat.total();
-        job.reduce_stat.pending = reduce_stat.pending();
-        job.reduce_stat.running = reduce_stat.running();
-        job.reduce_stat.failed = reduce_stat.failed();
-        job.reduce_stat.killed = reduce_stat.killed();
-        job.reduce_stat.completed = reduce_stat.completed();
+        FillJobInstance(*it, job);
         jobs.push_back(job);
     }
     return true;
 }
 
+bool ShuttleImpl::TraceJob(const std::string& job_id, std::string& trace) {
+    ::baidu::shuttle::TraceJobRequest request;
+    ::baidu::shuttle::TraceJobResponse response;
+    request.set_jobid(job_id);
+    bool ok = rpc_client_.SendRequest(master_stub_, &Master_Stub::TraceJob,
+                                      &request, &response, rpc_timeout_, 1);
+    if (!ok) {
+        LOG(WARNING, "failed to rpc: %s", master_addr_.c_str());
+        return false;
+    }
+    if (response.status() != kOk) {
+        return false;
+    }
+    trace = response.trace();
+    return true;
+}
+
+bool ShuttleImpl::GetMetrics(const std::string& minion_addr,
+                             const std::string& prefix,
+                             std::vector<sdk::Metric>& metrics) {
+    ::baidu::shuttle::GetMetricsRequest request;
+    ::baidu::shuttle::GetMetricsResponse response;
+    request.set_prefix(prefix);
+    bool ok = false;
+    if (minion_addr.empty()) {
+        ok = rpc_client_.SendRequest(master_stub_, &Master_Stub::GetMetrics,
+                                     &request, &response, rpc_timeout_, 1);
+    } else {
+        Minion_Stub* minion_stub = NULL;
+        rpc_client_.GetStub(minion_addr, &minion_stub);
+        boost::scoped_ptr<Minion_Stub> stub_guard(minion_stub);
+        ok = rpc_client_.SendRequest(minion_stub, &Minion_Stub::GetMetrics,
+                                     &request, &response, rpc_timeout_, 1);
+    }
+    if (!ok) {
+        LOG(WARNING, "failed to rpc: %s",
+            minion_addr.empty() ? master_addr_.c_str() : minion_addr.c_str());
+        return false;
+    }
+    ::google::protobuf::RepeatedPtrField<Metric>::const_iterator it;
+    for (it = response.metrics().begin(); it != response.metrics().end(); ++it) {
+        sdk::Metric metric;
+        metric.name = it->name();
+        metric.help = it->help();
+        metric.type = static_cast<sdk::MetricType>(it->type());
+        metric.labels = it->labels();
+        metric.value = it->value();
+        metric.count = it->count();
+        metric.sum = it->sum();
+        metric.max = it->max();
+        metric.p50 = it->p50();
+        metric.p90 = it->p90();
+        metric.p99 = it->p99();
+        metric.p999 = it->p999();
+        metrics.push_back(metric);
+    }
+    return true;
+}
+
 } //namespace shuttle
 } //namespace baidu
-
@@ -43,7 +43,8 @@ enum TaskState {
 
 enum PartitionMethod {
     kKeyFieldBased = 0,
-    kIntHash = 1
+    kIntHash = 1,
+    kRange = 2
 };
 
 enum InputFormat {
@@ -69,6 +70,12 @@ enum PipeStyle {
     kBiStreaming = 1
 };
 
+enum MetricType {
+    kCounterMetric = 0,
+    kGaugeMetric = 1,
+    kHistogramMetric = 2
+};
+
 struct TaskStatistics {
     int32_t total;
     int32_t pending;
@@ -78,6 +85,22 @@ struct TaskStatistics {
     int32_t completed;
 };
 
+// Summed over the reported attempts of a phase, max_rss_kb is the largest
+struct TaskUsage {
+    int32_t attempts;
+    int64_t user_time_ms;
+    int64_t sys_time_ms;
+    int64_t max_rss_kb;
+    int64_t dfs_read_bytes;
+    int64_t dfs_write_bytes;
+    int64_t local_read_bytes;
+    int64_t local_write_bytes;
+    int64_t pipe_in_bytes;
+    int64_t pipe_out_bytes;
+    int64_t pipe_in_wait_ms;
+    int64_t pipe_out_wait_ms;
+};
+
 struct DfsInfo {
     std::string host;
     std::string port;
@@ -85,6 +108,18 @@ struct DfsInfo {
     std::string password;
 };
 
+// Ordering of key fields like -k of KeyFieldBasedComparator,
+// fields are 1-based and field_end 0 means the end of key
+struct KeyFieldOrder {
+    int32_t field_begin;
+    int32_t field_end;
+    bool numeric;
+    bool reverse;
+    bool ignore_case;
+    KeyFieldOrder() : field_begin(1), field_end(0), numeric(false),
+                      reverse(false), ignore_case(false) { }
+};
+
 struct JobDescription {
     std::string name;
     std::string user;
@@ -121,6 +156,21 @@ struct JobDescription {
     std::string combine_command;
     bool compress_output;
     std::vector<std::string> cmdenvs;
+    // Maps write partition_total partitions when positive, and reducers,
+    // no more than reduce_total, each take about reduce_target_size bytes
+    int32_t partition_total;
+    int64_t reduce_target_size;
+    // Reducer output may be fed to the reducer again, e.g. sums and counts
+    bool reduce_associative;
+    // Map output keys sort by these orders, or by bytes when empty
+    std::vector<KeyFieldOrder> key_orders;
+    // Reducer gets records grouped but not sorted by key, sorting is skipped
+    bool hash_aggregation;
+    // Mappers and reducers use the rings of shuttle_shm.h, not pipes
+    bool shm_transport;
+    // Shared object of native entry points, see shuttle_plugin.h
+    std::string plugin;
+    bool plugin_isolation;
 };
 
 struct TaskInstance {
@@ -134,6 +184,21 @@ struct TaskInstance {
     float progress;    
     time_t start_time;
     time_t end_time;
+    // Wall time of each phase in ms, once the attempt is finished
+    std::map<std::string, int64_t> phase_ms;
+};
+
+struct TaskFilter {
+    // Empty for tasks in any state
+    std::vector<TaskState> states;
+    // Only tasks changed after this version of this epoch are returned,
+    // all of them if the epoch is no longer the one of the job
+    int64_t since_version;
+    int64_t since_epoch;
+    // Position to start from and max tasks in one page, 0 for no limit
+    int32_t offset;
+    int32_t limit;
+    TaskFilter() : since_version(0), since_epoch(0), offset(0), limit(0) { }
 };
 
 struct JobInstance {
@@ -142,10 +207,31 @@ struct JobInstance {
     JobState state;
     TaskStatistics map_stat;
     TaskStatistics reduce_stat;
+    TaskUsage map_usage;
+    TaskUsage reduce_usage;
     int32_t start_time;
     int32_t finish_time;
 };
 
+// A counter, gauge or histogram of master or minion
+struct Metric {
+    std::string name;
+    std::string help;
+    MetricType type;
+    // In the text format of Prometheus, e.g. job="job_x",phase="map"
+    std::string labels;
+    // of counters and gauges
+    int64_t value;
+    // of histograms, percentiles are upper bounds of their buckets
+    int64_t count;
+    int64_t sum;
+    int64_t max;
+    int64_t p50;
+    int64_t p90;
+    int64_t p99;
+    int64_t p999;
+};
+
 } //namspace sdk
 
 class Shuttle {
@@ -168,8 +254,32 @@ public:
                          bool show_detail,
                          std::string& error_msg,
                          std::map<std::string, int64_t>& counters) = 0;
+    // Tasks are returned page by page and next_offset is -1 on the last page,
+    // the version and epoch can be used as since_version and since_epoch
+    // later to get changes only. Without show_detail only the job is filled
+    virtual bool ShowJob(const std::string& job_id,
+                         const sdk::TaskFilter& filter,
+                         bool display_all,
+                         bool show_detail,
+                         sdk::JobInstance& job,
+                         std::vector<sdk::TaskInstance>& tasks,
+                         std::string& error_msg,
+                         std::map<std::string, int64_t>& counters,
+                         int32_t& next_offset,
+                         int64_t& version,
+                         int64_t& epoch) = 0;
+    // Only names in job descriptions are filled in summary
     virtual bool ListJobs(std::vector<sdk::JobInstance>& jobs,
-                          bool display_all = true) = 0;
+                          bool display_all = true,
+                          bool summary = false) = 0;
+    // Attempts of the job as JSON for chrome://tracing or Perfetto, one
+    // process for each minion, dead jobs included
+    virtual bool TraceJob(const std::string& job_id, std::string& trace) = 0;
+    // Metrics of master, or of the minion at minion_addr unless it is empty,
+    // with names starting with prefix
+    virtual bool GetMetrics(const std::string& minion_addr,
+                            const std::string& prefix,
+                            std::vector<sdk::Metric>& metrics) = 0;
     virtual void SetRpcTimeout(int timeout) = 0;
 
     virtual ~Shuttle() { }
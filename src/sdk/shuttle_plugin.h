@@ -0,0 +1,94 @@
+#ifndef _BAIDU_SHUTTLE_SDK_SHUTTLE_PLUGIN_H_
+#define _BAIDU_SHUTTLE_SDK_SHUTTLE_PLUGIN_H_
+
+/*
+ * Native mappers, reducers and combiners, loaded by minion with dlopen.
+ *
+ * A job names a shared object shipped with its files, e.g.
+ *   -file libwc.so -jobconf mapred.native.plugin=libwc.so
+ * Minion calls the entry points below in its own process, or in a forked
+ * worker when mapred.native.plugin.isolation=true, instead of running the
+ * mapper or reducer command. A phase without entry points still runs its
+ * command, so a plugin may provide only a reducer.
+ *
+ * Records are handed over as views into buffers of minion. They are only
+ * valid during the call, and emitted records are copied before it returns.
+ * All entry points return 0 on success, anything else fails the task.
+ */
+
+#include <stddef.h>
+
+#define SHUTTLE_PLUGIN_ABI_VERSION 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct shuttle_slice {
+    const char* data;
+    size_t size;
+} shuttle_slice_t;
+
+/*
+ * Passed to entry points to take their output records. Where records are
+ * written as text, as by streaming jobs, a record becomes a line of the
+ * key, a tab and the value, or of the key alone when the value is empty.
+ */
+typedef struct shuttle_output {
+    void* ctx;
+    int (*emit)(void* ctx, shuttle_slice_t key, shuttle_slice_t value);
+} shuttle_output_t;
+
+/*
+ * Required. Returns SHUTTLE_PLUGIN_ABI_VERSION the plugin is built with.
+ */
+int shuttle_plugin_abi_version(void);
+
+/*
+ * Optional. Creates the state of a task, which is passed to all other
+ * calls. Job configuration is found in the environment as for commands,
+ * e.g. mapred_task_partition and the -cmdenv variables.
+ */
+void* shuttle_plugin_create(void);
+void shuttle_plugin_destroy(void* state);
+
+/*
+ * Map: called once per input record. Text input gives an empty key and
+ * the line as value, NLine input the line number as key, and sequence
+ * files give their keys and values.
+ */
+int shuttle_plugin_map(void* state, shuttle_slice_t key, shuttle_slice_t value,
+                       shuttle_output_t* output);
+
+/*
+ * Reduce: records come grouped by key, as a begin call, a value call for
+ * each record of the key and an end call. With streaming the key is made
+ * of the key fields of the job, and the value is the whole line.
+ */
+int shuttle_plugin_reduce_begin(void* state, shuttle_slice_t key,
+                                shuttle_output_t* output);
+int shuttle_plugin_reduce_value(void* state, shuttle_slice_t value,
+                                shuttle_output_t* output);
+int shuttle_plugin_reduce_end(void* state, shuttle_output_t* output);
+
+/*
+ * Combine: optional, same as reduce but run by maps on their sorted
+ * output before it is written. Emitted records must keep the key.
+ */
+int shuttle_plugin_combine_begin(void* state, shuttle_slice_t key,
+                                 shuttle_output_t* output);
+int shuttle_plugin_combine_value(void* state, shuttle_slice_t value,
+                                 shuttle_output_t* output);
+int shuttle_plugin_combine_end(void* state, shuttle_output_t* output);
+
+/*
+ * Optional. Called after the last record of a task, to emit what is
+ * still held in the state.
+ */
+int shuttle_plugin_finish(void* state, shuttle_output_t* output);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,205 @@
+#include "shuttle_shm.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+
+#include "common/shm_ring.h"
+
+using baidu::shuttle::ShmRing;
+
+const static size_t sPipeBufferSize = 1 << 20;
+
+// Either a ring, or a buffer over stdin or stdout when the task has no
+// ring, so that both look the same to the user program
+struct shuttle_shm {
+    ShmRing* ring;
+    int fd;
+    // Bytes of the last line, consumed by the next read
+    size_t pending;
+    // Pipe buffer, data lies in [begin, end)
+    std::vector<char> buffer;
+    size_t begin;
+    size_t end;
+    bool eof;
+    shuttle_shm() : ring(NULL), fd(-1), pending(0), begin(0), end(0), eof(false) { }
+};
+
+static shuttle_shm_t* Open(const char* env_name, ShmRing::Role role, int fd) {
+    shuttle_shm_t* stream = new shuttle_shm_t();
+    const char* ring_name = getenv(env_name);
+    if (ring_name != NULL && ring_name[0] != '\0') {
+        stream->ring = ShmRing::Attach(ring_name, role);
+        if (stream->ring == NULL) {
+            delete stream;
+            return NULL;
+        }
+    } else {
+        stream->fd = fd;
+        stream->buffer.resize(sPipeBufferSize);
+    }
+    return stream;
+}
+
+shuttle_shm_t* shuttle_shm_open_input(void) {
+    return Open("mapred_shm_input", ShmRing::kReader, STDIN_FILENO);
+}
+
+shuttle_shm_t* shuttle_shm_open_output(void) {
+    return Open("mapred_shm_output", ShmRing::kWriter, STDOUT_FILENO);
+}
+
+int shuttle_shm_is_ring(const shuttle_shm_t* stream) {
+    return stream->ring != NULL;
+}
+
+// Waits until at least min_len bytes are buffered, or input ends
+static ssize_t Fill(shuttle_shm_t* stream, size_t min_len, const char** data) {
+    if (stream->ring != NULL) {
+        return stream->ring->Peek(data, min_len);
+    }
+    while (stream->end - stream->begin < min_len && !stream->eof) {
+        if (stream->begin > 0) {
+            std::copy(stream->buffer.begin() + stream->begin,
+                      stream->buffer.begin() + stream->end, stream->buffer.begin());
+            stream->end -= stream->begin;
+            stream->begin = 0;
+        }
+        if (stream->end == stream->buffer.size()) {
+            stream->buffer.resize(stream->buffer.size() * 2);
+        }
+        ssize_t n = read(stream->fd, &stream->buffer[stream->end],
+                         stream->buffer.size() - stream->end);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (n == 0) {
+            stream->eof = true;
+        }
+        stream->end += n;
+    }
+    *data = &stream->buffer[0] + stream->begin;
+    return stream->end - stream->begin;
+}
+
+ssize_t shuttle_shm_read(shuttle_shm_t* stream, const char** data) {
+    if (stream->pending > 0) {
+        shuttle_shm_consume(stream, stream->pending);
+    }
+    return Fill(stream, 1, data);
+}
+
+void shuttle_shm_consume(shuttle_shm_t* stream, size_t len) {
+    stream->pending = 0;
+    if (stream->ring != NULL) {
+        stream->ring->Consume(len);
+    } else {
+        stream->begin += std::min(len, stream->end - stream->begin);
+    }
+}
+
+ssize_t shuttle_shm_read_line(shuttle_shm_t* stream, const char** line) {
+    if (stream->pending > 0) {
+        shuttle_shm_consume(stream, stream->pending);
+    }
+    size_t searched = 0;
+    while (true) {
+        const char* data = NULL;
+        ssize_t n = Fill(stream, searched + 1, &data);
+        if (n <= 0) {
+            return n;
+        }
+        const char* eol = static_cast<const char*>(
+            memchr(data + searched, '\n', n - searched));
+        if (eol != NULL) {
+            *line = data;
+            stream->pending = eol - data + 1;
+            return eol - data;
+        }
+        if ((size_t)n == searched) {
+            // The end of input, or a line longer than the whole ring
+            if (stream->ring != NULL && (size_t)n == stream->ring->Capacity()) {
+                return -1;
+            }
+            *line = data;
+            stream->pending = n;
+            return n;
+        }
+        searched = n;
+    }
+}
+
+static bool FlushPipe(shuttle_shm_t* stream) {
+    while (stream->begin < stream->end) {
+        ssize_t n = write(stream->fd, &stream->buffer[stream->begin],
+                          stream->end - stream->begin);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        stream->begin += n;
+    }
+    stream->begin = 0;
+    stream->end = 0;
+    return true;
+}
+
+char* shuttle_shm_reserve(shuttle_shm_t* stream, size_t len) {
+    if (stream->ring != NULL) {
+        return stream->ring->Reserve(len);
+    }
+    if (stream->buffer.size() - stream->end < len) {
+        if (!FlushPipe(stream)) {
+            return NULL;
+        }
+        if (stream->buffer.size() < len) {
+            stream->buffer.resize(len);
+        }
+    }
+    return &stream->buffer[stream->end];
+}
+
+int shuttle_shm_commit(shuttle_shm_t* stream, size_t len) {
+    if (stream->ring != NULL) {
+        stream->ring->Commit(len);
+        return 0;
+    }
+    stream->end += len;
+    return 0;
+}
+
+int shuttle_shm_write(shuttle_shm_t* stream, const char* data, size_t len) {
+    if (stream->ring != NULL) {
+        return stream->ring->Write(data, len) ? 0 : -1;
+    }
+    char* buf = shuttle_shm_reserve(stream, len);
+    if (buf == NULL) {
+        return -1;
+    }
+    memcpy(buf, data, len);
+    return shuttle_shm_commit(stream, len);
+}
+
+int shuttle_shm_close(shuttle_shm_t* stream) {
+    bool ok = true;
+    if (stream->ring != NULL) {
+        if (stream->ring->GetRole() == ShmRing::kWriter) {
+            stream->ring->CloseWrite();
+        } else {
+            stream->ring->CloseRead();
+        }
+        delete stream->ring;
+    } else if (stream->fd == STDOUT_FILENO) {
+        ok = FlushPipe(stream);
+    }
+    delete stream;
+    return ok ? 0 : -1;
+}
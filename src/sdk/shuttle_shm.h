@@ -0,0 +1,66 @@
+#ifndef _BAIDU_SHUTTLE_SDK_SHUTTLE_SHM_H_
+#define _BAIDU_SHUTTLE_SDK_SHUTTLE_SHM_H_
+
+/*
+ * Record transport of mappers and reducers through shared memory.
+ *
+ * When a job is submitted with the shared-memory transport, the minion
+ * names two rings in the environment of the user program. Input is read
+ * from one and output is written to the other, instead of stdin and
+ * stdout. Without the rings, as in jobs that don't ask for them, the
+ * same calls fall back to stdin and stdout, so a program linked with
+ * this library runs either way.
+ *
+ * Data has the usual format of the job, e.g. text lines or the length
+ * prefixed records of bistreaming. Spans returned by the read calls
+ * point into the ring and are only valid until the next call.
+ */
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct shuttle_shm shuttle_shm_t;
+
+/* Opens the input and the output of the task, NULL on failures */
+shuttle_shm_t* shuttle_shm_open_input(void);
+shuttle_shm_t* shuttle_shm_open_output(void);
+
+/* Non-zero when the stream goes through a ring rather than a pipe */
+int shuttle_shm_is_ring(const shuttle_shm_t* stream);
+
+/*
+ * Returns the size of the next batch of input and points data to it,
+ * 0 at the end of input and -1 on errors. The batch is kept until
+ * shuttle_shm_consume, which may take any part of it.
+ */
+ssize_t shuttle_shm_read(shuttle_shm_t* stream, const char** data);
+void shuttle_shm_consume(shuttle_shm_t* stream, size_t len);
+
+/*
+ * Returns the next line without its newline, with the same results
+ * as shuttle_shm_read. The last line may come without a newline.
+ */
+ssize_t shuttle_shm_read_line(shuttle_shm_t* stream, const char** line);
+
+/*
+ * Returns len bytes of output space to be filled in place, NULL when
+ * the reader has gone. Nothing is sent before shuttle_shm_commit.
+ */
+char* shuttle_shm_reserve(shuttle_shm_t* stream, size_t len);
+int shuttle_shm_commit(shuttle_shm_t* stream, size_t len);
+
+/* Copies len bytes to output, returns 0 on success and -1 on errors */
+int shuttle_shm_write(shuttle_shm_t* stream, const char* data, size_t len);
+
+/* Ends the stream and releases it, returns 0 on success */
+int shuttle_shm_close(shuttle_shm_t* stream);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -4,6 +4,7 @@
 #include <algorithm>
 #include <string>
 #include "logging.h"
+#include "line_buffer.h"
 
 using baidu::common::INFO;
 using baidu::common::WARNING;
@@ -11,44 +12,6 @@ using baidu::common::WARNING;
 namespace baidu {
 namespace shuttle {
 
-class LineBuffer {
-public:
-    LineBuffer() : head_(0) {}
-    void Reset() {
-        data_.erase();
-        head_ = 0;
-    }
-    void Append(char* new_data, size_t len) {
-        data_.append(new_data, len);
-    }
-    void FillRemain(std::string* line) {
-        line->assign(data_, head_, data_.size() - head_);
-    }
-    bool ReadLine(std::string* line) {
-        if (head_ == data_.size()) {
-            return false;
-        }
-        for (size_t i = head_; i < data_.size(); i++) {
-            if (data_[i] == '\n') {
-                line->assign(data_, head_, i - head_);
-                head_ = i + 1;
-                return true;
-            }
-        }
-        if (head_ > 0) {
-            data_.erase(0, head_);
-            head_ = 0;
-        }
-        return false;
-    }
-    size_t Size() {
-        return data_.size() - head_;
-    }
-private:
-    std::string data_;
-    size_t head_;
-};
-
 class TextReader : public InputReader {
 public:
     class IteratorImpl : public InputReader::Iterator {
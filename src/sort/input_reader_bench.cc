@@ -0,0 +1,36 @@
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "common/benchmark.h"
+#include "line_buffer.h"
+
+using namespace baidu::shuttle;
+using namespace baidu::shuttle::bench;
+
+const static size_t sChunkSize = 64 << 10;
+
+// Lines split out of the chunks of a text split, as map inputs are read
+static void BM_LineBufferReadLine(State& state) {
+    RecordGenerator gen(16, state.range(0), 1 << 20, 0, 1);
+    std::string text;
+    std::string line;
+    while (text.size() < (4 << 20)) {
+        gen.NextLine(&line);
+        text.append(line);
+        text.push_back('\n');
+    }
+    int64_t lines = 0;
+    while (state.KeepRunning()) {
+        LineBuffer buffer;
+        for (size_t offset = 0; offset < text.size(); offset += sChunkSize) {
+            size_t len = std::min(sChunkSize, text.size() - offset);
+            buffer.Append(&text[offset], len);
+            while (buffer.ReadLine(&line)) {
+                ++lines;
+            }
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * text.size());
+    state.SetItemsProcessed(lines);
+}
+BENCHMARK(BM_LineBufferReadLine)->Arg(16)->Arg(100)->Arg(1024)->Arg(16 << 10);
@@ -9,7 +9,9 @@
 #include <gflags/gflags.h>
 #include "input_reader.h"
 #include "logging.h"
+#include "common/filesystem.h"
 #include "common/tools_util.h"
+#include "common/shm_ring.h"
 
 using baidu::common::INFO;
 using baidu::common::WARNING;
@@ -29,6 +31,7 @@ DEFINE_string(format, "text", "input format: text/binary");
 DEFINE_string(pipe, "streaming", "pipe style: streaming/bistreaming");
 DEFINE_bool(is_nline, false, "whether NlineInputformat");
 DEFINE_bool(decompress_input, false, "whether decompreess input file");
+DEFINE_string(shm_output, "", "write records to this shared-memory ring instead of stdout");
 
 void FillParam(FileSystem::Param& param) {
     if (boost::ends_with(FLAGS_file, ".gz")) {
@@ -55,7 +58,7 @@ void FillParam(FileSystem::Param& param) {
     }
 }
 
-void DoRead() {
+void DoRead(std::ostream& out) {
     InputReader * reader = NULL;
     if (FLAGS_fs == "hdfs") {
         if (FLAGS_format == "text") {
@@ -106,13 +109,13 @@ void DoRead() {
     while (!it->Done()) {
         if (should_print_eol) {
             if (FLAGS_is_nline) {
-                std::cout << record_no << "\t" << it->Record() << std::endl;
+                out << record_no << "\t" << it->Record() << std::endl;
             } else {
-                std::cout << it->Record() << std::endl;
+                out << it->Record() << std::endl;
             }
         } else {
             if (!should_emit_kv) {
-                std::cout << it->Record();// no new line
+                out << it->Record();// no new line
             } else {
                 const std::string& value = it->Record();
                 std::string record;
@@ -122,7 +125,7 @@ void DoRead() {
                 record.append(s_offset);
                 record.append((const char*)(&value_len), sizeof(value_len));
                 record.append(value);
-                std::cout << record;
+                out << record;
             }
         }
         it->Next();
@@ -132,6 +135,10 @@ void DoRead() {
         std::cerr << "errors in reading: " << FLAGS_file << std::endl;
         exit(-1);
     }
+    if (!out.flush()) {
+        std::cerr << "fail to write records" << std::endl;
+        exit(-1);
+    }
     delete it;
     reader->Close();
     delete reader;
@@ -142,6 +149,7 @@ int main(int argc, char* argv[]) {
     baidu::common::SetLogFile("./input_tool.log");
     baidu::common::SetWarningFile("./input_tool.log.wf");
     google::ParseCommandLineFlags(&argc, &argv, true);
+    FileSystem::ReportCountersAtExit();
     if (FLAGS_file.empty()) {
         std::cerr << "./input_tool -file=[file path] -offset=(offset) -len=(max read)"
                   << std::endl;
@@ -156,6 +164,21 @@ int main(int argc, char* argv[]) {
         //FLAGS_dfs_user = "";
         //FLAGS_dfs_password = "";
     }
-    DoRead();
+    if (FLAGS_shm_output.empty()) {
+        DoRead(std::cout);
+        return 0;
+    }
+    ShmRing* ring = ShmRing::Attach(FLAGS_shm_output, ShmRing::kWriter);
+    if (ring == NULL) {
+        std::cerr << "fail to attach ring: " << FLAGS_shm_output << std::endl;
+        return -1;
+    }
+    {
+        ShmRingStreamBuf ring_buf(ring);
+        std::ostream out(&ring_buf);
+        DoRead(out);
+    }
+    ring->CloseWrite();
+    delete ring;
     return 0;
 }
@@ -0,0 +1,50 @@
+#ifndef _BAIDU_SHUTTLE_SORT_LINE_BUFFER_H_
+#define _BAIDU_SHUTTLE_SORT_LINE_BUFFER_H_
+#include <string>
+
+namespace baidu {
+namespace shuttle {
+
+// Splits lines out of the chunks read from text input
+class LineBuffer {
+public:
+    LineBuffer() : head_(0) {}
+    void Reset() {
+        data_.erase();
+        head_ = 0;
+    }
+    void Append(char* new_data, size_t len) {
+        data_.append(new_data, len);
+    }
+    void FillRemain(std::string* line) {
+        line->assign(data_, head_, data_.size() - head_);
+    }
+    bool ReadLine(std::string* line) {
+        if (head_ == data_.size()) {
+            return false;
+        }
+        for (size_t i = head_; i < data_.size(); i++) {
+            if (data_[i] == '\n') {
+                line->assign(data_, head_, i - head_);
+                head_ = i + 1;
+                return true;
+            }
+        }
+        if (head_ > 0) {
+            data_.erase(0, head_);
+            head_ = 0;
+        }
+        return false;
+    }
+    size_t Size() {
+        return data_.size() - head_;
+    }
+private:
+    std::string data_;
+    size_t head_;
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,71 @@
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <boost/scoped_ptr.hpp>
+#include "common/benchmark.h"
+#include "sort_file.h"
+
+using namespace baidu::shuttle;
+using namespace baidu::shuttle::bench;
+
+const static int sRecords = 200000;
+
+// Merges of the map outputs a reduce shuffles, records of a sorted set are
+// dealt round-robin to the inputs
+static void BM_MergeFileReader(State& state) {
+    const int inputs = state.range(0);
+    std::vector<std::pair<std::string, std::string> > records;
+    RecordGenerator gen(16, state.range(1), 1 << 20, 0, 1);
+    gen.Sorted(sRecords, &records);
+    TempDir dir("bench_merge_file");
+    std::vector<std::string> files;
+    std::vector<SortFileWriter*> writers;
+    Status status = kOk;
+    for (int i = 0; i < inputs && status == kOk; i++) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%d.sort", dir.Path().c_str(), i);
+        files.push_back(path);
+        writers.push_back(SortFileWriter::Create(kLocalFile, &status));
+        if (status == kOk) {
+            status = writers.back()->Open(path, FileSystem::Param());
+        }
+    }
+    int64_t bytes = 0;
+    for (size_t i = 0; i < records.size() && status == kOk; i++) {
+        status = writers[i % inputs]->Put(records[i].first, records[i].second);
+        bytes += records[i].first.size() + records[i].second.size();
+    }
+    for (size_t i = 0; i < writers.size(); i++) {
+        if (status == kOk) {
+            status = writers[i]->Close();
+        }
+        delete writers[i];
+    }
+    if (status != kOk) {
+        state.SkipWithError("fail to write inputs");
+        return;
+    }
+    while (state.KeepRunning()) {
+        MergeFileReader reader;
+        if (reader.Open(files, FileSystem::Param(), kLocalFile) != kOk) {
+            state.SkipWithError("fail to open " + reader.GetErrorFile());
+            break;
+        }
+        boost::scoped_ptr<SortFileReader::Iterator> it(reader.Scan("", ""));
+        int merged = 0;
+        while (!it->Done()) {
+            ++merged;
+            it->Next();
+        }
+        it.reset();
+        reader.Close();
+        if (merged != sRecords) {
+            state.SkipWithError("records lost in merge");
+            break;
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * bytes);
+    state.SetItemsProcessed(state.iterations() * sRecords);
+}
+BENCHMARK(BM_MergeFileReader)->ArgPair(2, 100)->ArgPair(8, 100)->ArgPair(64, 100)
+    ->ArgPair(256, 100)->ArgPair(1000, 100)->ArgPair(64, 1024);
@@ -24,6 +24,7 @@ void MergeFileReader::AddReader(const std::string& file_name, FileSystem::Param
     Status st;
     SortFileReader* reader = SortFileReader::Create(file_type, &st);
     if (st == kOk) {
+        reader->SetReadThrottle(throttle_);
         st = reader->Open(file_name, param);
     }
     if (st != kOk) {
@@ -94,7 +95,10 @@ void MergeFileReader::AddIter(std::vector<SortFileReader::Iterator*>* iters,
                               SortFileReader* reader,
                               const std::string& start_key,
                               const std::string& end_key,
-                              bool* has_error) {
+                              bool* has_error,
+                              DfsCounters* counters) {
+    // The first blocks are read here for the thread scanning the files
+    FileSystem::BindCounters(counters);
     {
         MutexLock lock(&mu_);
         if (*has_error) {
@@ -123,7 +127,7 @@ SortFileReader::Iterator* MergeFileReader::Scan(const std::string& start_key, co
         SortFileReader * const& reader = *it;
         pool.AddTask(boost::bind(
                     &MergeFileReader::AddIter, this, iters, reader, 
-                    start_key, end_key, has_error
+                    start_key, end_key, has_error, FileSystem::BoundCounters()
         ));
     }
     pool.Stop(true);
@@ -0,0 +1,802 @@
+#include "shuffle.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <algorithm>
+#include <set>
+#include <sstream>
+#include <boost/bind.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/unordered_map.hpp>
+#include "sort_file.h"
+#include "logging.h"
+#include "common/shm_ring.h"
+#include "common/tools_util.h"
+#include "common/token_bucket.h"
+#include "minion/partition.h"
+
+using baidu::common::Log;
+using baidu::common::INFO;
+using baidu::common::WARNING;
+
+namespace baidu {
+namespace shuttle {
+
+const static size_t sBatchBufferSize = 1 << 20;
+
+BatchWriter::BatchWriter(int fd) : fd_(fd), ring_(NULL), ring_buffer_(NULL),
+                                   ring_space_(0), use_vmsplice_(false),
+                                   cur_buffer_(0), cur_size_(0) {
+    size_t n_buffers = 1;
+    struct stat st;
+    if (fstat(fd_, &st) == 0 && S_ISFIFO(st.st_mode)) {
+#ifdef F_SETPIPE_SZ
+        fcntl(fd_, F_SETPIPE_SZ, static_cast<int>(sBatchBufferSize));
+        int pipe_size = fcntl(fd_, F_GETPIPE_SZ);
+        // A spliced buffer is reused only after more bytes than the pipe
+        // holds are written behind it, by then the reader has consumed it
+        if (pipe_size > 0) {
+            use_vmsplice_ = true;
+            n_buffers = pipe_size / sBatchBufferSize + 2;
+        }
+#endif
+    }
+    for (size_t i = 0; i < n_buffers; i++) {
+        void* buf = NULL;
+        if (posix_memalign(&buf, 4096, sBatchBufferSize) != 0) {
+            LOG(WARNING, "fail to allocate write buffer");
+            abort();
+        }
+        buffers_.push_back(static_cast<char*>(buf));
+    }
+}
+
+BatchWriter::BatchWriter(ShmRing* ring) : fd_(-1), ring_(ring), ring_buffer_(NULL),
+                                          ring_space_(0), use_vmsplice_(false),
+                                          cur_buffer_(0), cur_size_(0) {
+}
+
+BatchWriter::BatchWriter(const boost::function<bool (const char*, size_t)>& consumer)
+    : fd_(-1), ring_(NULL), ring_buffer_(NULL), ring_space_(0), consumer_(consumer),
+      use_vmsplice_(false), cur_buffer_(0), cur_size_(0) {
+    buffers_.push_back(static_cast<char*>(malloc(sBatchBufferSize)));
+}
+
+BatchWriter::~BatchWriter() {
+    Close();
+    for (size_t i = 0; i < buffers_.size(); i++) {
+        free(buffers_[i]);
+    }
+}
+
+bool BatchWriter::Append(const char* data, size_t len) {
+    if (ring_ != NULL) {
+        return AppendToRing(data, len);
+    }
+    if (fd_ < 0 && consumer_.empty()) {
+        return false;
+    }
+    if (cur_size_ + len > sBatchBufferSize && !Flush()) {
+        return false;
+    }
+    if (len > sBatchBufferSize) {
+        if (!consumer_.empty()) {
+            return consumer_(data, len);
+        }
+        // Memory of the caller can not be spliced, it may change right after
+        return WriteFully(data, len);
+    }
+    memcpy(buffers_[cur_buffer_] + cur_size_, data, len);
+    cur_size_ += len;
+    return true;
+}
+
+bool BatchWriter::AppendToRing(const char* data, size_t len) {
+    if (cur_size_ + len > ring_space_) {
+        Flush();
+        const size_t chunk = std::min(sBatchBufferSize, ring_->Capacity() / 4);
+        if (len > chunk) {
+            // Moves the head, so the space reserved so far is given up
+            ring_buffer_ = NULL;
+            ring_space_ = 0;
+            return ring_->Write(data, len);
+        }
+        ring_buffer_ = ring_->Reserve(chunk);
+        ring_space_ = ring_buffer_ == NULL ? 0 : chunk;
+        if (ring_buffer_ == NULL) {
+            return false;
+        }
+    }
+    memcpy(ring_buffer_ + cur_size_, data, len);
+    cur_size_ += len;
+    return true;
+}
+
+bool BatchWriter::Flush() {
+    if (ring_ != NULL) {
+        // What is left of the reserved space is still free to fill
+        if (cur_size_ > 0) {
+            ring_->Commit(cur_size_);
+            ring_buffer_ += cur_size_;
+            ring_space_ -= cur_size_;
+            cur_size_ = 0;
+        }
+        return true;
+    }
+    if (fd_ < 0 && consumer_.empty()) {
+        return false;
+    }
+    if (cur_size_ == 0) {
+        return true;
+    }
+    const char* data = buffers_[cur_buffer_];
+    bool ok = false;
+    if (!consumer_.empty()) {
+        ok = consumer_(data, cur_size_);
+    } else {
+        ok = use_vmsplice_ ? SpliceFully(data, cur_size_) : WriteFully(data, cur_size_);
+    }
+    cur_buffer_ = (cur_buffer_ + 1) % buffers_.size();
+    cur_size_ = 0;
+    return ok;
+}
+
+bool BatchWriter::Close() {
+    if (ring_ != NULL) {
+        Flush();
+        ring_->CloseWrite();
+        ring_ = NULL;
+        return true;
+    }
+    if (!consumer_.empty()) {
+        bool ok = Flush();
+        consumer_.clear();
+        return ok;
+    }
+    if (fd_ < 0) {
+        return true;
+    }
+    bool ok = Flush();
+    if (close(fd_) != 0) {
+        ok = false;
+    }
+    fd_ = -1;
+    return ok;
+}
+
+void BatchWriter::SetStopChecker(const boost::function<bool ()>& should_stop) {
+    should_stop_ = should_stop;
+    if (ring_ != NULL) {
+        ring_->SetGiveUpChecker(should_stop);
+        return;
+    }
+    if (!consumer_.empty()) {
+        return;
+    }
+    int flags = fcntl(fd_, F_GETFL);
+    if (flags >= 0) {
+        fcntl(fd_, F_SETFL, flags | O_NONBLOCK);
+    }
+}
+
+bool BatchWriter::WaitWritable() {
+    while (should_stop_.empty() || !should_stop_()) {
+        struct pollfd pfd;
+        pfd.fd = fd_;
+        pfd.events = POLLOUT;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, 100) != 0) {
+            return true;
+        }
+    }
+    LOG(INFO, "stop writing records");
+    return false;
+}
+
+bool BatchWriter::WriteFully(const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd_, data, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN && WaitWritable()) {
+                continue;
+            }
+            LOG(WARNING, "fail to write records, %s", strerror(errno));
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool BatchWriter::SpliceFully(const char* data, size_t len) {
+    while (len > 0) {
+        struct iovec iov;
+        iov.iov_base = const_cast<char*>(data);
+        iov.iov_len = len;
+        ssize_t n = vmsplice(fd_, &iov, 1, should_stop_.empty() ? 0 : SPLICE_F_NONBLOCK);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN && WaitWritable()) {
+                continue;
+            }
+            if (errno == EINVAL || errno == ENOSYS) {
+                LOG(INFO, "vmsplice is not supported, fall back to write");
+                use_vmsplice_ = false;
+                return WriteFully(data, len);
+            }
+            LOG(WARNING, "fail to splice records, %s", strerror(errno));
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+ShuffleOptions::ShuffleOptions()
+  : total(0), reduce_no(0), attempt_id(0), work_dir("/tmp"),
+    streaming(true), tuo_size(0), slow_start_no(200),
+    partition_begin(-1), partition_end(-1),
+    split_no(0), split_total(0), partial_begin(0), partial_end(0), partial_timeout(3600),
+    hash_aggregation(false), key_fields(1), separator("\t"),
+    hash_memory_limit(512L << 20), hash_spill_fanout(16), hash_max_depth(3),
+    spill_prefix("./hash_spill_"), read_bytes_per_second(0), read_limiter(NULL),
+    tuo_merger("./tuo_merger") {
+}
+
+// Groups records by key without sorting them. When the table exceeds
+// memory, it and the records after are spilled by a hash of key into local
+// sub-partition files, each of which is grouped by a table of its own
+class HashAggregator {
+public:
+    HashAggregator(const ShuffleOptions& options, const FieldSplitter* splitter,
+                   BatchWriter* writer, int depth)
+        : options_(options), splitter_(splitter), writer_(writer),
+          depth_(depth), mem_size_(0) { }
+    ~HashAggregator() {
+        for (size_t i = 0; i < spills_.size(); i++) {
+            fclose(spills_[i]);
+        }
+    }
+    Status Add(const std::string& record) {
+        std::string key;
+        ExtractKey(record, &key);
+        return Add(key, record);
+    }
+    Status Add(const std::string& key, const std::string& record);
+    // Writes groups, then sub-partitions one by one, and clears the table
+    Status Flush();
+private:
+    void ExtractKey(const std::string& record, std::string* key) const;
+    Status Spill();
+    Status SpillRecord(const std::string& key, const std::string& record);
+    std::string SpillFileName(int no) const;
+private:
+    typedef boost::unordered_map<std::string, std::vector<std::string> > Table;
+    const ShuffleOptions& options_;
+    const FieldSplitter* splitter_;
+    BatchWriter* writer_;
+    int depth_;
+    int64_t mem_size_;
+    Table table_;
+    std::vector<FILE*> spills_;
+};
+
+void HashAggregator::ExtractKey(const std::string& record, std::string* key) const {
+    const char* data = record.data();
+    size_t size = record.size();
+    if (!options_.streaming) {
+        // Records of bistreaming are <key_len, key, value_len, value>
+        int32_t key_len = 0;
+        if (size >= sizeof(key_len)) {
+            memcpy(&key_len, data, sizeof(key_len));
+            data += sizeof(key_len);
+            size = std::min(size - sizeof(key_len), static_cast<size_t>(key_len));
+        } else {
+            size = 0;
+        }
+    }
+    key->assign(data, splitter_->PrefixLength(data, size, options_.key_fields));
+}
+
+Status HashAggregator::Add(const std::string& key, const std::string& record) {
+    if (!spills_.empty()) {
+        return SpillRecord(key, record);
+    }
+    Table::iterator it = table_.find(key);
+    if (it == table_.end()) {
+        it = table_.insert(std::make_pair(key, std::vector<std::string>())).first;
+        mem_size_ += key.size() + sizeof(Table::value_type) + sizeof(void*) * 2;
+    }
+    it->second.push_back(record);
+    mem_size_ += record.size() + sizeof(std::string);
+    if (mem_size_ > options_.hash_memory_limit && depth_ < options_.hash_max_depth) {
+        return Spill();
+    }
+    return kOk;
+}
+
+std::string HashAggregator::SpillFileName(int no) const {
+    std::stringstream ss;
+    ss << options_.spill_prefix << depth_ << "_" << no;
+    return ss.str();
+}
+
+Status HashAggregator::Spill() {
+    LOG(INFO, "spill %ld bytes of %d keys at depth %d",
+        mem_size_, table_.size(), depth_);
+    for (int i = 0; i < std::max(options_.hash_spill_fanout, 2); i++) {
+        FILE* fp = fopen(SpillFileName(i).c_str(), "w+");
+        if (fp == NULL) {
+            LOG(WARNING, "fail to create spill file: %s", SpillFileName(i).c_str());
+            return kOpenFileFail;
+        }
+        spills_.push_back(fp);
+    }
+    for (Table::iterator it = table_.begin(); it != table_.end(); ++it) {
+        for (size_t i = 0; i < it->second.size(); i++) {
+            Status status = SpillRecord(it->first, it->second[i]);
+            if (status != kOk) {
+                return status;
+            }
+        }
+    }
+    Table().swap(table_);
+    mem_size_ = 0;
+    return kOk;
+}
+
+Status HashAggregator::SpillRecord(const std::string& key, const std::string& record) {
+    // Seeded by depth, so keys of a sub-partition spread out again one level down
+    size_t seed = depth_ + 1;
+    boost::hash_combine(seed, key);
+    FILE* fp = spills_[seed % spills_.size()];
+    int32_t key_len = key.size();
+    int32_t record_len = record.size();
+    if (fwrite(&key_len, sizeof(key_len), 1, fp) != 1
+            || fwrite(key.data(), 1, key.size(), fp) != key.size()
+            || fwrite(&record_len, sizeof(record_len), 1, fp) != 1
+            || fwrite(record.data(), 1, record.size(), fp) != record.size()) {
+        LOG(WARNING, "fail to write spill file, %s", strerror(errno));
+        return kWriteFileFail;
+    }
+    return kOk;
+}
+
+Status HashAggregator::Flush() {
+    for (Table::iterator it = table_.begin(); it != table_.end(); ++it) {
+        const std::vector<std::string>& records = it->second;
+        for (size_t i = 0; i < records.size(); i++) {
+            if (!writer_->Append(records[i])
+                    || (options_.streaming && !writer_->Append("\n", 1))) {
+                return kWriteFileFail;
+            }
+        }
+    }
+    Table().swap(table_);
+    mem_size_ = 0;
+    std::vector<FILE*> spills;
+    spills.swap(spills_);
+    Status status = kOk;
+    std::string key;
+    std::string record;
+    for (size_t i = 0; i < spills.size(); i++) {
+        FILE* fp = spills[i];
+        rewind(fp);
+        HashAggregator sub(options_, splitter_, writer_, depth_ + 1);
+        int32_t key_len = 0;
+        int32_t record_len = 0;
+        while (status == kOk && fread(&key_len, sizeof(key_len), 1, fp) == 1) {
+            key.resize(key_len);
+            bool ok = key_len == 0 || fread(&key[0], 1, key_len, fp) == key.size();
+            ok = ok && fread(&record_len, sizeof(record_len), 1, fp) == 1;
+            record.resize(record_len);
+            ok = ok && (record_len == 0 || fread(&record[0], 1, record_len, fp) == record.size());
+            if (!ok) {
+                LOG(WARNING, "fail to read spill file: %s", SpillFileName(i).c_str());
+                status = kReadFileFail;
+                break;
+            }
+            status = sub.Add(key, record);
+        }
+        fclose(fp);
+        remove(SpillFileName(i).c_str());
+        if (status == kOk) {
+            status = sub.Flush();
+        }
+    }
+    return status;
+}
+
+Shuffler::Shuffler(const ShuffleOptions& options)
+    : options_(options), read_limiter_(options.read_limiter), own_limiter_(false) {
+    FileSystem::Param param;
+    FillParam(&param);
+    fs_ = FileSystem::CreateInfHdfs(param);
+    if (read_limiter_ == NULL && options_.read_bytes_per_second > 0) {
+        own_limiter_ = true;
+        // A burst of a second, blocks of sort files are far smaller
+        read_limiter_ = new TokenBucket(options_.read_bytes_per_second,
+                                        options_.read_bytes_per_second);
+    }
+}
+
+Shuffler::~Shuffler() {
+    delete fs_;
+    if (own_limiter_) {
+        delete read_limiter_;
+    }
+}
+
+void Shuffler::SetReadThrottle(MergeFileReader* reader) {
+    if (read_limiter_ != NULL) {
+        reader->SetReadThrottle(boost::bind(&TokenBucket::Take, read_limiter_, _1));
+    }
+}
+
+void Shuffler::FillParam(FileSystem::Param* param) const {
+    if (!options_.dfs_user.empty()) {
+        (*param)["user"] = options_.dfs_user;
+    }
+    if (!options_.dfs_password.empty()) {
+        (*param)["password"] = options_.dfs_password;
+    }
+    if (!options_.dfs_host.empty()) {
+        (*param)["host"] = options_.dfs_host;
+    }
+    if (!options_.dfs_port.empty()) {
+        (*param)["port"] = options_.dfs_port;
+    }
+}
+
+Status Shuffler::Run(BatchWriter* writer) {
+    if (options_.total == 0) {
+        LOG(WARNING, "invalid map task total");
+        return kInvalidArg;
+    }
+    if (options_.partial_end > options_.partial_begin) {
+        // Outputs of partial reduces of a hot key are reduced once more
+        return GatherPartials(writer);
+    }
+    if (options_.tuo_size == 0) {
+        options_.tuo_size = DefaultTuoSize(options_.total);
+    }
+    LOG(INFO, "tuo_size: %d", options_.tuo_size);
+    int n_tuo = 0;
+    Status status = MergeTuo(&n_tuo);
+    if (status != kOk) {
+        return status;
+    }
+    std::vector<std::string>  tuo_file_names;
+    for (int i = 0;  i< n_tuo; i++) {
+        if (options_.split_total > 0 && i % options_.split_total != options_.split_no) {
+            continue;
+        }
+        std::stringstream ss;
+        ss << options_.work_dir + "/" << i << ".tuo";
+        tuo_file_names.push_back(ss.str());
+    }
+    if (options_.reduce_no > options_.slow_start_no) {
+        double rn = rand() / (RAND_MAX+0.0);
+        int random_period = static_cast<int>(rn * 90);
+        LOG(INFO, "sleep a random time: %d", random_period);
+        sleep(random_period);
+    }
+    if (tuo_file_names.empty()) {
+        LOG(INFO, "no map outputs in split %d/%d", options_.split_no, options_.split_total);
+        return kOk;
+    }
+    if (options_.hash_aggregation) {
+        return HashAggregateAndPrint(tuo_file_names, writer);
+    }
+    return MergeAndPrint(tuo_file_names, writer);
+}
+
+Status Shuffler::MergeAndPrint(const std::vector<std::string>& file_names,
+                               BatchWriter* writer) {
+    MergeFileReader reader;
+    FileSystem::Param param;
+    FillParam(&param);
+    SetReadThrottle(&reader);
+    Status status = reader.Open(file_names, param, kHdfsFile);
+    if (status != kOk) {
+        LOG(WARNING, "fail to open: %s", reader.GetErrorFile().c_str());
+        return status;
+    }
+    int partition_begin = options_.reduce_no;
+    int partition_end = options_.reduce_no + 1;
+    if (options_.partition_begin >= 0 && options_.partition_end > options_.partition_begin) {
+        partition_begin = options_.partition_begin;
+        partition_end = options_.partition_end;
+    }
+    LOG(INFO, "scan partitions [%d, %d)", partition_begin, partition_end);
+    // Partitions are prefixed in sort files, so a range of them is one scan
+    char s_begin[256];
+    char s_last[256];
+    snprintf(s_begin, sizeof(s_begin), "%05d", partition_begin);
+    snprintf(s_last, sizeof(s_last), "%05d", partition_end - 1);
+    std::string start_key = s_begin;
+    std::string end_key = std::string(s_last) + "\xff";
+    if (!options_.key_begin.empty()) {
+        start_key += "\t" + options_.key_begin;
+    }
+    if (!options_.key_end.empty()) {
+        end_key = std::string(s_last) + "\t" + options_.key_end;
+    }
+    SortFileReader::Iterator* scan_it = reader.Scan(start_key, end_key);
+    if (scan_it->Error() != kOk && scan_it->Error() != kNoMore) {
+        LOG(WARNING, "fail to scan: %s", reader.GetErrorFile().c_str());
+        delete scan_it;
+        return kReadFileFail;
+    }
+    status = kOk;
+    while (!scan_it->Done()) {
+        if (Stopped()) {
+            status = kSuspend;
+            break;
+        }
+        const std::string& line = scan_it->Value();
+        if (options_.streaming) {
+            if (!line.empty() && (!writer->Append(line) || !writer->Append("\n", 1))) {
+                status = kWriteFileFail;
+                break;
+            }
+        } else if (!writer->Append(line)) {
+            status = kWriteFileFail;
+            break;
+        }
+        scan_it->Next();
+    }
+    if (status == kOk && scan_it->Error() != kOk && scan_it->Error() != kNoMore) {
+        LOG(WARNING, "fail to scan: %s", reader.GetErrorFile().c_str());
+        status = kReadFileFail;
+    }
+    if (status == kOk && !writer->Flush()) {
+        status = kWriteFileFail;
+    }
+    reader.Close();
+    delete scan_it;
+    return status;
+}
+
+Status Shuffler::HashAggregateAndPrint(const std::vector<std::string>& file_names,
+                                       BatchWriter* writer) {
+    MergeFileReader reader;
+    FileSystem::Param param;
+    FillParam(&param);
+    SetReadThrottle(&reader);
+    Status status = reader.Open(file_names, param, kHdfsFile);
+    if (status != kOk) {
+        LOG(WARNING, "fail to open: %s", reader.GetErrorFile().c_str());
+        return status;
+    }
+    int partition_begin = options_.reduce_no;
+    int partition_end = options_.reduce_no + 1;
+    if (options_.partition_begin >= 0 && options_.partition_end > options_.partition_begin) {
+        partition_begin = options_.partition_begin;
+        partition_end = options_.partition_end;
+    }
+    LOG(INFO, "aggregate partitions [%d, %d) by hash", partition_begin, partition_end);
+    FieldSplitter splitter(options_.separator.empty() ? "\t" : options_.separator);
+    // Map outputs are keyed by partition alone, so the merged scan brings
+    // partitions one after another and a table holds only one of them
+    char s_begin[256];
+    char s_last[256];
+    snprintf(s_begin, sizeof(s_begin), "%05d", partition_begin);
+    snprintf(s_last, sizeof(s_last), "%05d", partition_end - 1);
+    SortFileReader::Iterator* scan_it = reader.Scan(s_begin, std::string(s_last) + "\xff");
+    if (scan_it->Error() != kOk && scan_it->Error() != kNoMore) {
+        LOG(WARNING, "fail to scan: %s", reader.GetErrorFile().c_str());
+        delete scan_it;
+        return kReadFileFail;
+    }
+    HashAggregator aggregator(options_, &splitter, writer, 0);
+    std::string partition;
+    while (status == kOk && !scan_it->Done()) {
+        if (Stopped()) {
+            status = kSuspend;
+            break;
+        }
+        if (scan_it->Key() != partition) {
+            status = aggregator.Flush();
+            partition = scan_it->Key();
+        }
+        const std::string& record = scan_it->Value();
+        if (status == kOk && (!options_.streaming || !record.empty())) {
+            status = aggregator.Add(record);
+        }
+        scan_it->Next();
+    }
+    if (status == kOk && scan_it->Error() != kOk && scan_it->Error() != kNoMore) {
+        LOG(WARNING, "fail to scan: %s", reader.GetErrorFile().c_str());
+        status = kReadFileFail;
+    }
+    if (status == kOk) {
+        status = aggregator.Flush();
+    }
+    if (status == kOk && !writer->Flush()) {
+        status = kWriteFileFail;
+    }
+    reader.Close();
+    delete scan_it;
+    return status;
+}
+
+bool Shuffler::MergeOneTuo(int map_from, int map_to, int tuo_now) {
+    std::stringstream cmd_ss;
+    cmd_ss << options_.tuo_merger << " --reduce_no=" << options_.reduce_no
+           << " --work_dir=" << options_.work_dir
+           << " --attempt_id=" << options_.attempt_id
+           << " --dfs_host=" << options_.dfs_host
+           << " --dfs_port=" << options_.dfs_port
+           << " --dfs_user=" << options_.dfs_user
+           << " --dfs_password=" << options_.dfs_password
+           << " --from_no=" << map_from
+           << " --to_no=" << map_to
+           << " --tuo_no=" << tuo_now
+           << " --read_bytes_per_second="
+           << (read_limiter_ != NULL ? read_limiter_->Rate() : 0);
+    FILE* tuo_merger = popen(cmd_ss.str().c_str(), "r");
+    if (tuo_merger == NULL) {
+        LOG(WARNING, "fail to start tuo_merger, %s", strerror(errno));
+        return false;
+    }
+    int exit_code = pclose(tuo_merger);
+    return exit_code == 0;
+}
+
+Status Shuffler::MergeTuo(int* n_tuo_out) {
+    srand(time(0));
+    const int n_tuo = (int)ceil((float)options_.total / options_.tuo_size) ;
+    LOG(INFO, "will merge %d tuo", n_tuo);
+    std::vector<int> tuo_list;
+    for (int i = 0; i < n_tuo; i++) {
+        tuo_list.push_back(i);
+    }
+    std::random_shuffle(tuo_list.begin(), tuo_list.end());
+    std::set<int> ready_tuo_set;
+    if (options_.reduce_no < n_tuo) {
+        while (ready_tuo_set.empty()) { //at first, merge tuo belongs to me!
+            if (Stopped()) {
+                return kSuspend;
+            }
+            int tuo_now = options_.reduce_no;
+            std::stringstream ss;
+            ss << options_.work_dir << "/" << tuo_now << ".tuo";
+            const std::string& tuo_file_name = ss.str();
+            if (fs_->Exist(tuo_file_name)) {
+                ready_tuo_set.insert(tuo_now);
+                LOG(INFO, "lucky, my tuo ready, total #%d/%d tuo ready",
+                    ready_tuo_set.size(), n_tuo);
+                continue;
+            }
+            int map_from = tuo_now * options_.tuo_size;
+            int map_to = std::min( (tuo_now + 1) * options_.tuo_size - 1, options_.total - 1);
+            LOG(INFO, "merge tuo from %d to %d", map_from, map_to);
+            if (MergeOneTuo(map_from, map_to, tuo_now)) {
+                ready_tuo_set.insert(tuo_now);
+                LOG(INFO, "my tuo done. total #%d/%d tuo ready", ready_tuo_set.size(), n_tuo);
+            }
+            sleep(5);
+        }
+    }
+
+    while (ready_tuo_set.size() < (size_t)n_tuo) {
+        std::vector<int>::iterator it;
+        for (it = tuo_list.begin(); it != tuo_list.end(); it++) {
+            if (Stopped()) {
+                return kSuspend;
+            }
+            int tuo_now = *it;
+            if (ready_tuo_set.find(tuo_now) != ready_tuo_set.end()) {
+                continue;
+            }
+            std::stringstream ss;
+            ss << options_.work_dir << "/" << tuo_now << ".tuo";
+            const std::string& tuo_file_name = ss.str();
+            if (fs_->Exist(tuo_file_name)) {
+                ready_tuo_set.insert(tuo_now);
+                LOG(INFO, "lucky, total #%d/%d tuo ready", ready_tuo_set.size(), n_tuo);
+                continue;
+            }
+            if (options_.reduce_no > n_tuo * 2) {
+                continue;
+            }
+            std::stringstream ss_lock;
+            std::stringstream my_lock_flag;
+            ss_lock << options_.work_dir << "/tuo_lock_" << tuo_now << "/";
+            std::vector<baidu::shuttle::FileInfo> lockers;
+            fs_->List(ss_lock.str(), &lockers);
+            my_lock_flag << ss_lock.str() << options_.reduce_no;
+            if (lockers.size() > 2 && !fs_->Exist(my_lock_flag.str())) {
+                LOG(WARNING, "two many workers on this tuo!: %d", tuo_now);
+                double rn = rand() / (RAND_MAX+0.0);
+                if (rn < 0.99) {
+                    sleep(1);
+                    continue;
+                }
+            }
+            if (!fs_->Exist(my_lock_flag.str()) &&
+                fs_->Exist(options_.work_dir)) {
+                fs_->Open(my_lock_flag.str(), kWriteFile);
+                fs_->Close(); //create my lock
+            }
+            int map_from = tuo_now * options_.tuo_size;
+            int map_to = std::min( (tuo_now + 1) * options_.tuo_size - 1, options_.total - 1);
+            LOG(INFO, "merge tuo from %d to %d", map_from, map_to);
+            if (MergeOneTuo(map_from, map_to, tuo_now)) {
+                ready_tuo_set.insert(tuo_now);
+                LOG(INFO, "total #%d/%d tuo ready", ready_tuo_set.size(), n_tuo);
+                fs_->Remove(ss_lock.str());
+            } else {
+                fs_->Remove(my_lock_flag.str());
+            }
+            sleep(3);
+        } // end of for
+        sleep(5);
+    }// end of while
+    *n_tuo_out = n_tuo;
+    return kOk;
+}
+
+Status Shuffler::GatherPartials(BatchWriter* writer) {
+    char buf[4096];
+    for (int i = options_.partial_begin; i < options_.partial_end; i++) {
+        std::stringstream ss;
+        ss << options_.work_dir << "/partial_" << i;
+        const std::string& partial_file = ss.str();
+        const time_t wait_begin = time(NULL);
+        while (!fs_->Exist(partial_file)) {
+            if (Stopped()) {
+                return kSuspend;
+            }
+            // A partial failed for good never shows up, fail the task to
+            // give the slot back and let master schedule it again
+            if (options_.partial_timeout > 0
+                    && time(NULL) - wait_begin >= options_.partial_timeout) {
+                LOG(WARNING, "partial reduce missing for %d seconds: %s",
+                        options_.partial_timeout, partial_file.c_str());
+                return kReadFileFail;
+            }
+            LOG(INFO, "wait for partial reduce: %s", partial_file.c_str());
+            sleep(5);
+        }
+        if (!fs_->Open(partial_file, kReadFile)) {
+            LOG(WARNING, "fail to open: %s", partial_file.c_str());
+            return kOpenFileFail;
+        }
+        int32_t len = 0;
+        while ((len = fs_->Read(buf, sizeof(buf))) > 0) {
+            if (read_limiter_ != NULL) {
+                read_limiter_->Take(len);
+            }
+            if (!writer->Append(buf, len)) {
+                fs_->Close();
+                return kWriteFileFail;
+            }
+        }
+        fs_->Close();
+        if (len < 0) {
+            LOG(WARNING, "fail to read: %s", partial_file.c_str());
+            return kReadFileFail;
+        }
+    }
+    return writer->Flush() ? kOk : kWriteFileFail;
+}
+
+} //namespace shuttle
+} //namespace baidu
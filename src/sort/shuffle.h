@@ -0,0 +1,133 @@
+#ifndef _BAIDU_SHUTTLE_SHUFFLE_H_
+#define _BAIDU_SHUTTLE_SHUFFLE_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <boost/function.hpp>
+#include "proto/shuttle.pb.h"
+#include "common/filesystem.h"
+
+namespace baidu {
+namespace shuttle {
+
+class ShmRing;
+class TokenBucket;
+class MergeFileReader;
+
+// Writes records to a file descriptor in large buffers. Full buffers are
+// moved into pipes with vmsplice, so the writer must outlive the reader
+// of the pipe, or at least the data it has written
+class BatchWriter {
+public:
+    explicit BatchWriter(int fd);
+    // Fills the ring in place, the writer side of it is closed by Close
+    explicit BatchWriter(ShmRing* ring);
+    // Hands full buffers to consumer in the writing thread, which takes
+    // whole buffers, so records may be cut between two calls
+    explicit BatchWriter(const boost::function<bool (const char*, size_t)>& consumer);
+    ~BatchWriter();
+    bool Append(const char* data, size_t len);
+    bool Append(const std::string& data) {
+        return Append(data.data(), data.size());
+    }
+    bool Flush();
+    // Flushes and closes the descriptor, buffers are kept until destruction
+    bool Close();
+    // Makes writes non-blocking, so a stalled reader is given up when stopped
+    void SetStopChecker(const boost::function<bool ()>& should_stop);
+private:
+    bool WaitWritable();
+    bool WriteFully(const char* data, size_t len);
+    bool SpliceFully(const char* data, size_t len);
+    bool AppendToRing(const char* data, size_t len);
+private:
+    int fd_;
+    ShmRing* ring_;
+    // Reserved and not yet committed space of the ring
+    char* ring_buffer_;
+    size_t ring_space_;
+    boost::function<bool (const char*, size_t)> consumer_;
+    bool use_vmsplice_;
+    std::vector<char*> buffers_;
+    size_t cur_buffer_;
+    size_t cur_size_;
+    boost::function<bool ()> should_stop_;
+};
+
+struct ShuffleOptions {
+    int32_t total;
+    int32_t reduce_no;
+    int32_t attempt_id;
+    std::string work_dir;
+    std::string dfs_host;
+    std::string dfs_port;
+    std::string dfs_user;
+    std::string dfs_password;
+    bool streaming;
+    int32_t tuo_size;
+    int32_t slow_start_no;
+    // Mirrors ReduceRange, keys are raw bytes
+    int32_t partition_begin;
+    int32_t partition_end;
+    std::string key_begin;
+    std::string key_end;
+    int32_t split_no;
+    int32_t split_total;
+    int32_t partial_begin;
+    int32_t partial_end;
+    // Seconds a final reduce waits for each partial, 0 for ever
+    int32_t partial_timeout;
+    bool hash_aggregation;
+    int32_t key_fields;
+    std::string separator;
+    int64_t hash_memory_limit;
+    int32_t hash_spill_fanout;
+    int32_t hash_max_depth;
+    // Local path prefix of spill files of hash aggregation
+    std::string spill_prefix;
+    // Rate map outputs are read at, tuo_merger included. 0 for no limit
+    int64_t read_bytes_per_second;
+    // Shared with the caller, who may change the rate meanwhile. Used
+    // instead of read_bytes_per_second when set
+    TokenBucket* read_limiter;
+    // Run to merge map outputs into a tuo
+    std::string tuo_merger;
+    ShuffleOptions();
+};
+
+// Merges map outputs of a reduce and writes records in the order the
+// reducer reads them, used by shuffle_tool and by reduces in process
+class Shuffler {
+public:
+    explicit Shuffler(const ShuffleOptions& options);
+    ~Shuffler();
+    // Checked between records, a stopped shuffle returns kSuspend
+    void SetStopChecker(const boost::function<bool ()>& should_stop) {
+        should_stop_ = should_stop;
+    }
+    Status Run(BatchWriter* writer);
+private:
+    void FillParam(FileSystem::Param* param) const;
+    bool MergeOneTuo(int map_from, int map_to, int tuo_now);
+    Status MergeTuo(int* n_tuo);
+    Status GatherPartials(BatchWriter* writer);
+    Status MergeAndPrint(const std::vector<std::string>& file_names, BatchWriter* writer);
+    Status HashAggregateAndPrint(const std::vector<std::string>& file_names,
+                                 BatchWriter* writer);
+    bool Stopped() const {
+        return !should_stop_.empty() && should_stop_();
+    }
+    void SetReadThrottle(MergeFileReader* reader);
+private:
+    ShuffleOptions options_;
+    FileSystem* fs_;
+    TokenBucket* read_limiter_;
+    bool own_limiter_;
+    boost::function<bool ()> should_stop_;
+};
+
+} //namespace shuttle
+} //namespace baidu
+
+#endif
@@ -0,0 +1,339 @@
+// Load generator of the shuffle. It writes M synthetic map outputs as sort
+// files, the way maps commit them, then runs R reduces through the merges of
+// shuffle_tool and tuo_merger against the directory, and reports the calls
+// made to the file system, the bytes moved, their latencies and the wall
+// time, so merge strategies and fan-in settings can be compared at scale:
+//
+//   ./shuffle_load --maps=2000 --reduces=500 --tuo_size=50 --work_dir=/mnt/nfs/load
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <gflags/gflags.h>
+#include "shuffle.h"
+#include "sort_file.h"
+#include "logging.h"
+#include "thread_pool.h"
+#include "common/filesystem.h"
+#include "common/record_generator.h"
+#include "common/table_printer.h"
+#include "minion/partition.h"
+
+DEFINE_string(work_dir, "/tmp/shuffle_load", "directory map outputs are written to and "
+              "shuffled in, local or on NFS, or on dfs when dfs_host is set");
+DEFINE_int32(maps, 100, "number of map outputs");
+DEFINE_int32(reduces, 10, "number of reduces, each reads a partition");
+DEFINE_int32(map_spills, 1, "sort files each map output is made of");
+DEFINE_int64(map_output_bytes, 8L << 20, "bytes of records in each map output");
+DEFINE_int32(key_size, 16, "bytes of each key");
+DEFINE_int32(value_size, 100, "bytes of each value");
+DEFINE_int32(distinct_keys, 1 << 20, "number of distinct keys");
+DEFINE_double(key_skew, 0, "Zipf skew of keys, 0 for uniform ones, hot keys make hot partitions");
+DEFINE_int32(generate_threads, 8, "threads writing map outputs");
+DEFINE_int32(parallel_reduces, 0, "reduces shuffling at the same time, 0 for all of them");
+DEFINE_int32(tuo_size, 0, "map outputs merged into one tuo, 0 for the default of shuffle_tool");
+DEFINE_int32(slow_start_no, 200, "reduces after this one sleep a random time, as in shuffle_tool");
+DEFINE_bool(hash_aggregation, false, "map outputs are ordered by partition only, "
+            "and reduces group records in hash tables");
+DEFINE_int64(read_bytes_per_second, 0, "rate each reduce reads map outputs at, 0 for no limit");
+DEFINE_string(tuo_merger, "./tuo_merger", "path of tuo_merger");
+DEFINE_string(dfs_host, "", "host name of dfs master, the work dir is local when empty");
+DEFINE_string(dfs_port, "", "port of dfs master");
+DEFINE_string(dfs_user, "", "user name of dfs master");
+DEFINE_string(dfs_password, "", "password of dfs master");
+DEFINE_bool(keep_files, false, "keep the work dir after the run");
+
+using baidu::common::Log;
+using baidu::common::INFO;
+using baidu::common::WARNING;
+using baidu::common::ThreadPool;
+using namespace baidu::shuttle;
+
+struct ReduceResult {
+    Status status;
+    int64_t wall_ms;
+    int64_t records;
+    int64_t bytes;
+    ReduceResult() : status(kUnKnown), wall_ms(0), records(0), bytes(0) { }
+};
+
+static int64_t NowMs() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000L + tv.tv_usec / 1000;
+}
+
+static std::string ToString(int64_t value) {
+    return boost::lexical_cast<std::string>(value);
+}
+
+static std::string FormatBytes(int64_t bytes) {
+    const char* units[] = {"B", "K", "M", "G", "T"};
+    double size = bytes;
+    size_t unit = 0;
+    while (size >= 1024 && unit + 1 < sizeof(units) / sizeof(units[0])) {
+        size /= 1024;
+        unit++;
+    }
+    char buf[32];
+    snprintf(buf, sizeof(buf), unit == 0 ? "%.0f%s" : "%.1f%s", size, units[unit]);
+    return buf;
+}
+
+static void FillParam(FileSystem::Param* param) {
+    if (!FLAGS_dfs_user.empty()) {
+        (*param)["user"] = FLAGS_dfs_user;
+        (*param)["password"] = FLAGS_dfs_password;
+    }
+    if (!FLAGS_dfs_host.empty()) {
+        (*param)["host"] = FLAGS_dfs_host;
+        (*param)["port"] = FLAGS_dfs_port;
+    }
+}
+
+static std::string MapDir(int map_no) {
+    return FLAGS_work_dir + "/map_" + ToString(map_no);
+}
+
+// Writes the spills of a map to a temporary dir, renamed to the map dir
+// once all are closed, as maps commit their outputs
+static void GenerateMap(int map_no, const Partitioner* partitioner, Status* status) {
+    *status = kOk;
+    FileSystem::Param param;
+    FillParam(&param);
+    const std::string tmp_dir = MapDir(map_no) + ".tmp";
+    const int64_t record_size = FLAGS_key_size + FLAGS_value_size + 1;
+    const int64_t records = std::max(FLAGS_map_output_bytes / FLAGS_map_spills / record_size, 1L);
+    RecordGenerator gen(FLAGS_key_size, FLAGS_value_size, FLAGS_distinct_keys,
+                        FLAGS_key_skew, map_no * 1000 + 1);
+    std::vector<std::pair<std::string, std::string> > spill;
+    std::string line;
+    std::string key;
+    char partition[16];
+    for (int s = 0; s < FLAGS_map_spills && *status == kOk; s++) {
+        spill.resize(records);
+        for (int64_t i = 0; i < records; i++) {
+            gen.NextLine(&line);
+            int reduce_no = partitioner->Calc(line, &key);
+            snprintf(partition, sizeof(partition), "%05d", reduce_no);
+            spill[i].first = partition;
+            if (!FLAGS_hash_aggregation) {
+                spill[i].first += "\t" + key;
+            }
+            spill[i].second.swap(line);
+        }
+        std::sort(spill.begin(), spill.end());
+        SortFileWriter* writer = SortFileWriter::Create(kHdfsFile, status);
+        if (*status != kOk) {
+            break;
+        }
+        *status = writer->Open(tmp_dir + "/" + ToString(s) + ".sort", param);
+        for (size_t i = 0; i < spill.size() && *status == kOk; i++) {
+            *status = writer->Put(spill[i].first, spill[i].second);
+        }
+        if (*status == kOk) {
+            *status = writer->Close();
+        }
+        delete writer;
+    }
+    FileSystem* fs = FileSystem::CreateInfHdfs(param);
+    if (*status == kOk && !fs->Rename(tmp_dir, MapDir(map_no))) {
+        *status = kWriteFileFail;
+    }
+    delete fs;
+    if (*status != kOk) {
+        LOG(WARNING, "fail to write map output %d: %s", map_no, Status_Name(*status).c_str());
+    }
+}
+
+static bool CountOutput(ReduceResult* result, const char* data, size_t len) {
+    result->bytes += len;
+    result->records += std::count(data, data + len, '\n');
+    return true;
+}
+
+static void RunReduce(int reduce_no, ReduceResult* result) {
+    ShuffleOptions options;
+    options.total = FLAGS_maps;
+    options.reduce_no = reduce_no;
+    options.work_dir = FLAGS_work_dir;
+    options.dfs_host = FLAGS_dfs_host;
+    options.dfs_port = FLAGS_dfs_port;
+    options.dfs_user = FLAGS_dfs_user;
+    options.dfs_password = FLAGS_dfs_password;
+    options.tuo_size = FLAGS_tuo_size;
+    options.slow_start_no = FLAGS_slow_start_no;
+    options.hash_aggregation = FLAGS_hash_aggregation;
+    options.spill_prefix = "/tmp/shuffle_load_" + ToString(getpid()) + "_"
+        + ToString(reduce_no) + "_";
+    options.read_bytes_per_second = FLAGS_read_bytes_per_second;
+    options.tuo_merger = FLAGS_tuo_merger;
+    const int64_t begin = NowMs();
+    BatchWriter writer(boost::bind(&CountOutput, result, _1, _2));
+    Shuffler shuffler(options);
+    result->status = shuffler.Run(&writer);
+    if (result->status == kOk && !writer.Close()) {
+        result->status = kWriteFileFail;
+    }
+    result->wall_ms = NowMs() - begin;
+    LOG(INFO, "reduce %d done in %ld ms: %s", reduce_no, result->wall_ms,
+        Status_Name(result->status).c_str());
+}
+
+static int64_t Percentile(const std::vector<int64_t>& sorted, int percent) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    return sorted[std::min(sorted.size() - 1, sorted.size() * percent / 100)];
+}
+
+static void PrintOpStats(const char* title, const std::vector<FsOpStats>& stats) {
+    TPrinter tp(8);
+    tp.AddRow(8, title, "calls", "errors", "bytes", "avg(us)", "p50(us)", "p99(us)", "total(ms)");
+    for (size_t op = 0; op < stats.size(); op++) {
+        const FsOpStats& s = stats[op];
+        if (s.calls == 0) {
+            continue;
+        }
+        std::vector<std::string> row;
+        row.push_back(FileSystem::OpName(static_cast<FsOp>(op)));
+        row.push_back(ToString(s.calls));
+        row.push_back(ToString(s.errors));
+        row.push_back(FormatBytes(s.bytes));
+        row.push_back(ToString(s.total_us / s.calls));
+        // Bounds of power-of-2 buckets
+        row.push_back("<" + ToString(s.PercentileUs(50)));
+        row.push_back("<" + ToString(s.PercentileUs(99)));
+        row.push_back(ToString(s.total_us / 1000));
+        tp.AddRow(row);
+    }
+    printf("%s\n", tp.ToString().c_str());
+}
+
+static void Subtract(const std::vector<FsOpStats>& base, std::vector<FsOpStats>* stats) {
+    for (size_t op = 0; op < stats->size() && op < base.size(); op++) {
+        FsOpStats& s = (*stats)[op];
+        s.calls -= base[op].calls;
+        s.errors -= base[op].errors;
+        s.bytes -= base[op].bytes;
+        s.total_us -= base[op].total_us;
+        for (int i = 0; i < FsOpStats::kBuckets; i++) {
+            s.buckets[i] -= base[op].buckets[i];
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    baidu::common::SetLogFile("./shuffle_load.log");
+    baidu::common::SetWarningFile("./shuffle_load.log.wf");
+    google::ParseCommandLineFlags(&argc, &argv, true);
+    if (FLAGS_maps <= 0 || FLAGS_reduces <= 0 || FLAGS_map_spills <= 0) {
+        fprintf(stderr, "maps, reduces and map_spills must be positive\n");
+        return 1;
+    }
+    // Set before the first file system is made, tuo_merger inherits them
+    const std::string stats_file = "/tmp/shuffle_load_" + ToString(getpid()) + ".fs_stats";
+    setenv("minion_dfs_stats_file", stats_file.c_str(), 1);
+    setenv("shuttle_time_dfs_ops", "1", 1);
+    FileSystem::ReportCountersAtExit();
+    if (FLAGS_dfs_host.empty()) {
+        setenv("shuttle_local_dfs", "1", 1);
+    }
+    FileSystem::Param param;
+    FillParam(&param);
+    FileSystem* fs = FileSystem::CreateInfHdfs(param);
+    if (fs->Exist(FLAGS_work_dir)) {
+        fprintf(stderr, "work dir exists: %s\n", FLAGS_work_dir.c_str());
+        delete fs;
+        return 1;
+    }
+    fs->Mkdirs(FLAGS_work_dir);
+
+    printf("writing %d map outputs of %s, %d partitions\n", FLAGS_maps,
+           FormatBytes(FLAGS_map_output_bytes).c_str(), FLAGS_reduces);
+    KeyFieldBasedPartitioner partitioner(1, 1, FLAGS_reduces, "\t");
+    std::vector<Status> map_status(FLAGS_maps, kUnKnown);
+    int64_t begin = NowMs();
+    {
+        ThreadPool pool(std::max(FLAGS_generate_threads, 1));
+        for (int i = 0; i < FLAGS_maps; i++) {
+            pool.AddTask(boost::bind(&GenerateMap, i, &partitioner, &map_status[i]));
+        }
+        pool.Stop(true);
+    }
+    const int64_t generate_ms = NowMs() - begin;
+    if (std::count(map_status.begin(), map_status.end(), kOk) != FLAGS_maps) {
+        fprintf(stderr, "fail to write map outputs, see shuffle_load.log.wf\n");
+        delete fs;
+        return 1;
+    }
+    std::vector<FsOpStats> generate_stats;
+    FileSystem::GetOpStats(&generate_stats);
+
+    printf("shuffling with %d reduces\n", FLAGS_reduces);
+    std::vector<ReduceResult> results(FLAGS_reduces);
+    begin = NowMs();
+    {
+        int parallel = FLAGS_parallel_reduces > 0 ? FLAGS_parallel_reduces : FLAGS_reduces;
+        ThreadPool pool(std::min(parallel, FLAGS_reduces));
+        for (int i = 0; i < FLAGS_reduces; i++) {
+            pool.AddTask(boost::bind(&RunReduce, i, &results[i]));
+        }
+        pool.Stop(true);
+    }
+    const int64_t shuffle_ms = NowMs() - begin;
+    // Calls of the reduces in this process, and of tuo_merger which exited
+    std::vector<FsOpStats> shuffle_stats;
+    FileSystem::GetOpStats(&shuffle_stats);
+    Subtract(generate_stats, &shuffle_stats);
+    std::vector<FsOpStats> merger_stats;
+    FileSystem::LoadCounters(stats_file, NULL, &merger_stats);
+    for (size_t op = 0; op < merger_stats.size(); op++) {
+        shuffle_stats[op].Merge(merger_stats[op]);
+    }
+
+    int failed = 0;
+    int64_t records = 0;
+    int64_t bytes = 0;
+    std::vector<int64_t> wall;
+    for (size_t i = 0; i < results.size(); i++) {
+        if (results[i].status != kOk) {
+            ++failed;
+        }
+        records += results[i].records;
+        bytes += results[i].bytes;
+        wall.push_back(results[i].wall_ms);
+    }
+    std::sort(wall.begin(), wall.end());
+    printf("\n");
+    TPrinter tp(2);
+    tp.AddRow(2, "Shuffle", "");
+    tp.AddRow(2, "map outputs", (ToString(FLAGS_maps) + " x " + ToString(FLAGS_map_spills)
+                                 + " sort files").c_str());
+    tp.AddRow(2, "generate", (ToString(generate_ms) + " ms").c_str());
+    tp.AddRow(2, "shuffle", (ToString(shuffle_ms) + " ms").c_str());
+    tp.AddRow(2, "reduces failed", (ToString(failed) + "/" + ToString(FLAGS_reduces)).c_str());
+    tp.AddRow(2, "records", ToString(records).c_str());
+    tp.AddRow(2, "bytes", FormatBytes(bytes).c_str());
+    tp.AddRow(2, "reduce p50/p90/max", (ToString(Percentile(wall, 50)) + "/"
+              + ToString(Percentile(wall, 90)) + "/" + ToString(wall.back()) + " ms").c_str());
+    printf("%s\n", tp.ToString().c_str());
+    PrintOpStats("Generate", generate_stats);
+    PrintOpStats("Shuffle", shuffle_stats);
+
+    if (!FLAGS_keep_files) {
+        fs->Remove(FLAGS_work_dir);
+    }
+    delete fs;
+    // Stats of this process are printed already
+    unsetenv("minion_dfs_stats_file");
+    remove(stats_file.c_str());
+    return failed == 0 ? 0 : 1;
+}
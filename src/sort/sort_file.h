@@ -6,6 +6,7 @@
 #include <string>
 #include <queue>
 #include <vector>
+#include <boost/function.hpp>
 #include "proto/shuttle.pb.h"
 #include "proto/sortfile.pb.h"
 #include "common/filesystem.h"
@@ -23,6 +24,8 @@ enum FileType {
 
 class SortFileReader {
 public:
+    // Told of the bytes of each block read, and may block to slow reads down
+    typedef boost::function<void (int64_t)> ReadThrottle;
     static SortFileReader* Create(FileType file_type, Status* status);
     class Iterator {
     public:
@@ -38,6 +41,7 @@ public:
     virtual Iterator* Scan(const std::string& start_key, const std::string& end_key) = 0;
     virtual Status Close() = 0;
     virtual std::string GetFileName() = 0;
+    virtual void SetReadThrottle(const ReadThrottle& throttle) = 0;
     virtual ~SortFileReader() {}
 };
 
@@ -93,12 +97,17 @@ public:
     SortFileReader::Iterator* Scan(const std::string& start_key, const std::string& end_key);
     Status Close();
     const std::string& GetErrorFile() {return err_file_;}
+    // Shared by readers of all files, set before Open
+    void SetReadThrottle(const SortFileReader::ReadThrottle& throttle) {
+        throttle_ = throttle;
+    }
 private:
     void AddIter(std::vector<SortFileReader::Iterator*>* iters,
                  SortFileReader* reader,
                  const std::string& start_key,
                  const std::string& end_key,
-                 bool* has_error);
+                 bool* has_error,
+                 DfsCounters* counters);
     void AddReader(const std::string& file_name,
                    FileSystem::Param param,
                    FileType type,
@@ -106,6 +115,7 @@ private:
     void CloseReader(SortFileReader* reader, Status* st);
     std::vector<SortFileReader*> readers_;
     std::string err_file_;
+    SortFileReader::ReadThrottle throttle_;
     Mutex mu_;
 };
 
@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <boost/scoped_ptr.hpp>
+#include "common/benchmark.h"
+#include "sort_file.h"
+
+using namespace baidu::shuttle;
+using namespace baidu::shuttle::bench;
+
+typedef std::vector<std::pair<std::string, std::string> > Records;
+
+const static int64_t sDataSize = 16 << 20;
+const static int sKeySize = 16;
+
+static void SortedRecords(int value_size, Records* records) {
+    RecordGenerator gen(sKeySize, value_size, 1 << 20, 0, 1);
+    gen.Sorted(sDataSize / (sKeySize + value_size), records);
+}
+
+static Status WriteFile(const std::string& path, const Records& records) {
+    Status status = kOk;
+    boost::scoped_ptr<SortFileWriter> writer(SortFileWriter::Create(kLocalFile, &status));
+    if (status != kOk) {
+        return status;
+    }
+    status = writer->Open(path, FileSystem::Param());
+    for (size_t i = 0; i < records.size() && status == kOk; i++) {
+        status = writer->Put(records[i].first, records[i].second);
+    }
+    if (status == kOk) {
+        status = writer->Close();
+    }
+    return status;
+}
+
+// Puts of sorted records, which fill and compress the blocks
+static void BM_SortFileWriterPut(State& state) {
+    Records records;
+    SortedRecords(state.range(0), &records);
+    TempDir dir("bench_sort_file");
+    const std::string path = dir.Path() + "/put.sort";
+    Status status = kOk;
+    boost::scoped_ptr<SortFileWriter> writer(SortFileWriter::Create(kLocalFile, &status));
+    writer->Open(path, FileSystem::Param());
+    size_t i = 0;
+    int64_t bytes = 0;
+    while (state.KeepRunning()) {
+        if (i == records.size()) {
+            // Keys must keep increasing, so a new file starts over
+            state.PauseTiming();
+            writer->Close();
+            writer->Open(path, FileSystem::Param());
+            i = 0;
+            state.ResumeTiming();
+        }
+        if (writer->Put(records[i].first, records[i].second) != kOk) {
+            state.SkipWithError("fail to put");
+            break;
+        }
+        bytes += records[i].first.size() + records[i].second.size();
+        ++i;
+    }
+    writer->Close();
+    state.SetBytesProcessed(bytes);
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_SortFileWriterPut)->Arg(16)->Arg(100)->Arg(1024)->Arg(16 << 10);
+
+// A whole sorted file of 16MB, from Open to Close
+static void BM_SortFileWriterWrite(State& state) {
+    Records records;
+    SortedRecords(state.range(0), &records);
+    TempDir dir("bench_sort_file");
+    const std::string path = dir.Path() + "/write.sort";
+    while (state.KeepRunning()) {
+        if (WriteFile(path, records) != kOk) {
+            state.SkipWithError("fail to write");
+            break;
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * sDataSize);
+}
+BENCHMARK(BM_SortFileWriterWrite)->Arg(16)->Arg(100)->Arg(1024)->Arg(16 << 10);
+
+// Full scans of a sorted file of 16MB
+static void BM_SortFileReaderScan(State& state) {
+    Records records;
+    SortedRecords(state.range(0), &records);
+    TempDir dir("bench_sort_file");
+    const std::string path = dir.Path() + "/scan.sort";
+    if (WriteFile(path, records) != kOk) {
+        state.SkipWithError("fail to write");
+        return;
+    }
+    int64_t scanned = 0;
+    while (state.KeepRunning()) {
+        Status status = kOk;
+        boost::scoped_ptr<SortFileReader> reader(SortFileReader::Create(kLocalFile, &status));
+        if (status != kOk || reader->Open(path, FileSystem::Param()) != kOk) {
+            state.SkipWithError("fail to open");
+            break;
+        }
+        boost::scoped_ptr<SortFileReader::Iterator> it(reader->Scan("", ""));
+        while (!it->Done()) {
+            ++scanned;
+            it->Next();
+        }
+        if (it->Error() != kOk && it->Error() != kNoMore) {
+            state.SkipWithError("fail to scan");
+            break;
+        }
+        it.reset();
+        reader->Close();
+    }
+    state.SetBytesProcessed(state.iterations() * sDataSize);
+    state.SetItemsProcessed(scanned);
+}
+BENCHMARK(BM_SortFileReaderScan)->Arg(16)->Arg(100)->Arg(1024)->Arg(16 << 10);
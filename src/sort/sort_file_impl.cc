@@ -208,6 +208,9 @@ Status SortFileReaderImpl::ReadNextRecord(DataBlock& data_block) {
     if (status != kOk) {
         return status;
     }
+    if (throttle_) {
+        throttle_(sizeof(block_size) + block_raw.size());
+    }
     snappy::Uncompress(block_raw.data(), block_raw.size(), &block_uncompress);
     bool ret = data_block.ParseFromString(block_uncompress);
     if (!ret) {
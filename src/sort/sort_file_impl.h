@@ -43,6 +43,9 @@ public:
     virtual Iterator* Scan(const std::string& start_key, const std::string& end_key);
     virtual Status Close();
     std::string GetFileName() {return path_;}
+    void SetReadThrottle(const ReadThrottle& throttle) {
+        throttle_ = throttle;
+    }
 private:
     Status LoadIndexBlock(IndexBlock* idx_block);
     Status ReadFull(std::string* result_buf, int32_t len, bool is_read_data = false);
@@ -51,6 +54,7 @@ private:
     std::string path_;
     int64_t idx_offset_;
     FileSystem* fs_;
+    ReadThrottle throttle_;
 };
 
 struct IndexSampleOrder{
@@ -16,6 +16,7 @@
 #include "logging.h"
 #include "common/filesystem.h"
 #include "common/tools_util.h"
+#include "common/token_bucket.h"
 #include "thread_pool.h"
 #include "mutex.h"
 
@@ -29,6 +30,7 @@ DEFINE_string(dfs_password, "", "password of dfs master");
 DEFINE_int32(from_no, 0, "from which mapper");
 DEFINE_int32(to_no, 0, "to whichi mapper");
 DEFINE_int32(tuo_no, 0, "which tuo");
+DEFINE_int64(read_bytes_per_second, 0, "rate map outputs are read at, 0 for no limit");
 
 using baidu::common::Log;
 using baidu::common::FATAL;
@@ -39,6 +41,7 @@ using namespace baidu::shuttle;
 
 int32_t g_file_no(0);
 FileSystem* g_fs(NULL);
+TokenBucket* g_read_limiter(NULL);
 
 void FillParam(FileSystem::Param& param) {
     if (!FLAGS_dfs_user.empty()) {
@@ -78,6 +81,9 @@ bool MergeManyFilesToOne(const std::vector<std::string>& file_names,
     MergeFileReader reader;
     FileSystem::Param param;
     FillParam(param);
+    if (g_read_limiter != NULL) {
+        reader.SetReadThrottle(boost::bind(&TokenBucket::Take, g_read_limiter, _1));
+    }
     Status status = reader.Open(file_names, param, kHdfsFile);
     if (status != kOk) {
         LOG(WARNING, "fail to open: %s", reader.GetErrorFile().c_str());
@@ -181,9 +187,14 @@ int main(int argc, char* argv[]) {
     baidu::common::SetLogFile("./tuo_merger.log");
     baidu::common::SetWarningFile("./tuo_merger.log.wf");
     google::ParseCommandLineFlags(&argc, &argv, true);
+    FileSystem::ReportCountersAtExit();
     FileSystem::Param param;
     FillParam(param);
     g_fs = FileSystem::CreateInfHdfs(param);
+    if (FLAGS_read_bytes_per_second > 0) {
+        g_read_limiter = new TokenBucket(FLAGS_read_bytes_per_second,
+                                         FLAGS_read_bytes_per_second);
+    }
     bool ret = MergeOneTuo(FLAGS_from_no, FLAGS_to_no, FLAGS_tuo_no);
     if (!ret) {
         LOG(WARNING, "tuo_merge fail, [%d, %d] --> tuo(%d)",  FLAGS_from_no, FLAGS_to_no, FLAGS_tuo_no);       